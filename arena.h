@@ -0,0 +1,188 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "topology.h"
+
+// Persistent arena for benchmark working sets.
+//
+// Programs that allocate and free gigabytes per timed run pay for page
+// faults and kernel zeroing inside (or right next to) the timed region on
+// every run. An Arena instead maps its memory once per process and keeps
+// it: arena_alloc() bumps a pointer through the mapped regions and
+// arena_reset() rewinds it at the start of the next run, so after the
+// first (warmup) run every run reuses the same already-faulted pages.
+//
+// A region is mapped with explicit huge pages (MAP_HUGETLB: 2 MB, or 1 GB
+// pages when ARENA_PAGES=1g and the region is at least 1 GB) if the system
+// has them reserved, else as ordinary memory with MADV_HUGEPAGE so
+// transparent huge pages can back it, else as plain 4 KB pages
+// (ARENA_PAGES=4k forces that). A new region is pre-faulted by the arena's
+// thread team, each thread touching the static slice
+// (n * tid / nthreads) the compute loops use, so on NUMA machines pages
+// land on the node that works on them. The team is the largest thread
+// count the program will run, set at arena_init(), so smaller teams get
+// the largest team's slices; arena_place() re-faults a buffer with a
+// run's own team when that matters more than skipping the faults.
+//
+// Memory handed out is NOT zeroed after a reset; callers that need zeros
+// clear it themselves. arena_alloc() is not thread-safe: carve per-thread
+// buffers out of one allocation made before the parallel region. When a
+// region cannot be mapped it returns NULL, which callers handle like a
+// failed malloc.
+
+#define ARENA_ALIGN 64
+#define ARENA_HUGE_2M (2UL << 20)
+#define ARENA_HUGE_1G (1UL << 30)
+#define ARENA_MIN_REGION (64UL << 20)
+#define ARENA_MAX_REGIONS 32
+#define ARENA_PAGES_ENV "ARENA_PAGES"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+typedef enum { ARENA_PAGES_4K, ARENA_PAGES_THP, ARENA_PAGES_2M, ARENA_PAGES_1G } ArenaPageKind;
+
+static const char *const arena_page_names[] = {"4k", "thp", "2m", "1g"};
+
+typedef struct {
+    char *base;
+    size_t size, used;
+    ArenaPageKind pages;
+} ArenaRegion;
+
+typedef struct {
+    ArenaRegion regions[ARENA_MAX_REGIONS];
+    int num_regions;
+    int num_threads;          // pre-fault team
+    size_t peak;              // most bytes handed out between two resets
+    double prefault_time;     // seconds spent faulting regions in
+} Arena;
+
+static inline void arena_init(Arena *a, int num_threads) {
+    memset(a, 0, sizeof(*a));
+    a->num_threads = num_threads > 0 ? num_threads : 1;
+}
+
+static inline size_t arena_round(size_t bytes, size_t unit) {
+    return (bytes + unit - 1) / unit * unit;
+}
+
+// Maps one region of at least `bytes`; returns 0 or -1
+static int arena_map(Arena *a, size_t bytes) {
+    if (a->num_regions == ARENA_MAX_REGIONS) return -1;
+    const char *want = getenv(ARENA_PAGES_ENV);
+    int force_small = want && strcmp(want, "4k") == 0;
+    int allow_1g = want && strcmp(want, "1g") == 0;
+    ArenaRegion *r = &a->regions[a->num_regions];
+    void *p = MAP_FAILED;
+
+    if (!force_small && allow_1g && bytes >= ARENA_HUGE_1G) {
+        r->size = arena_round(bytes, ARENA_HUGE_1G);
+        p = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+        r->pages = ARENA_PAGES_1G;
+    }
+    if (p == MAP_FAILED && !force_small) {
+        r->size = arena_round(bytes, ARENA_HUGE_2M);
+        p = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        r->pages = ARENA_PAGES_2M;
+    }
+    if (p == MAP_FAILED) {
+        r->size = arena_round(bytes, ARENA_HUGE_2M);
+        p = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        r->pages = ARENA_PAGES_4K;
+        if (p != MAP_FAILED && !force_small && madvise(p, r->size, MADV_HUGEPAGE) == 0) r->pages = ARENA_PAGES_THP;
+    }
+    if (p == MAP_FAILED) return -1;
+
+    r->base = p;
+    r->used = 0;
+    double t0 = omp_get_wtime();
+    topo_first_touch(r->base, r->size, a->num_threads);
+    a->prefault_time += omp_get_wtime() - t0;
+    a->num_regions++;
+    return 0;
+}
+
+// `bytes` aligned to `align` (a power of two, at least ARENA_ALIGN), or
+// NULL if no region has room and a new one cannot be mapped
+static void *arena_alloc(Arena *a, size_t bytes, size_t align) {
+    if (align < ARENA_ALIGN) align = ARENA_ALIGN;
+    bytes = arena_round(bytes ? bytes : 1, ARENA_ALIGN);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (int i = 0; i < a->num_regions; i++) {
+            ArenaRegion *r = &a->regions[i];
+            size_t offset = arena_round(r->used, align);
+            if (offset + bytes <= r->size) {
+                r->used = offset + bytes;
+                size_t in_use = 0;
+                for (int j = 0; j < a->num_regions; j++) in_use += a->regions[j].used;
+                if (in_use > a->peak) a->peak = in_use;
+                return r->base + offset;
+            }
+        }
+        if (attempt == 0 && arena_map(a, bytes > ARENA_MIN_REGION ? bytes : ARENA_MIN_REGION) != 0) break;
+    }
+    return NULL;
+}
+
+// Drops the pages of [p, p + bytes) (rounded inwards to the region's page
+// size) and faults them in again with num_threads' static slices, so they
+// land where that team works on them. The contents are lost. Returns 0, or
+// -1 if p is not arena memory or the kernel cannot drop the pages (e.g.
+// hugetlb before Linux 5.18); the buffer is then touched but not moved.
+static inline int arena_place(Arena *a, void *p, size_t bytes, int num_threads) {
+    char *begin = p, *end = begin + bytes;
+    const ArenaRegion *r = NULL;
+    for (int i = 0; i < a->num_regions; i++) {
+        if (begin >= a->regions[i].base && end <= a->regions[i].base + a->regions[i].size) r = &a->regions[i];
+    }
+    if (!r) return -1;
+    size_t page = r->pages == ARENA_PAGES_1G ? ARENA_HUGE_1G : r->pages == ARENA_PAGES_2M ? ARENA_HUGE_2M : 4096;
+    char *first = r->base + arena_round((size_t)(begin - r->base), page);
+    char *last = r->base + (size_t)(end - r->base) / page * page;
+    int status = 0;
+    if (first < last && madvise(first, last - first, MADV_DONTNEED) != 0) status = -1;
+    topo_first_touch(begin, bytes, num_threads);
+    return status;
+}
+
+// Makes all memory available again; the pages stay mapped and faulted in
+static inline void arena_reset(Arena *a) {
+    for (int i = 0; i < a->num_regions; i++) a->regions[i].used = 0;
+}
+
+static inline void arena_release(Arena *a) {
+    for (int i = 0; i < a->num_regions; i++) munmap(a->regions[i].base, a->regions[i].size);
+    int num_threads = a->num_threads;
+    arena_init(a, num_threads);
+}
+
+// e.g. "3 regions, 8.0 GB (2m+thp), prefault 1.2 s"
+static void arena_describe(const Arena *a, char *buf, size_t size) {
+    size_t total = 0;
+    int kinds = 0;
+    char names[32] = "";
+    for (int i = 0; i < a->num_regions; i++) {
+        total += a->regions[i].size;
+        kinds |= 1 << a->regions[i].pages;
+    }
+    for (int k = 0; k < 4; k++) {
+        if (!(kinds & (1 << k))) continue;
+        if (names[0]) strcat(names, "+");
+        strcat(names, arena_page_names[k]);
+    }
+    snprintf(buf, size, "%d region(s), %.1f GB (%s), prefault %.2f s", a->num_regions, total / 1e9,
+             names[0] ? names : "none", a->prefault_time);
+}
+
+#endif
@@ -0,0 +1,515 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <omp.h>
+#include "topology.h"
+
+// Benchmark harness shared by q1-q5.
+//
+// bench_measure() times one configuration: it runs `warmup` discarded
+// iterations, then repeats until at least min_runs samples exist and the
+// 95% confidence interval of the mean is within target_ci of the mean, or
+// max_runs or the time budget is reached. Samples more than 3.5 robust
+// standard deviations from the median (modified z-score over the MAD) are
+// reported as outliers and left out of every statistic. A run may return
+// extra metrics (phase times), summarized over the same inlier runs. The
+// process's page faults (minor + major, from getrusage) are counted around
+// every run and reported as the "page_faults" metric.
+//
+// Each configuration is added to a BenchReport, written as CSV and JSON
+// with machine metadata. With --baseline=<csv> the report is compared
+// with an earlier CSV by Welch's t-test per (benchmark, metric, threads,
+// size). A significant change of the mean that is also larger than
+// BENCH_MIN_EFFECT counts as a regression when it goes the wrong way for the
+// metric: up for times (and extras registered as BENCH_LOWER_BETTER), down
+// for BENCH_HIGHER_BETTER extras. Page faults and BENCH_INFORMATIONAL extras
+// are compared but never count.
+//
+// Command-line options (removed from argv, so programs parse the rest):
+//   --threads=1,2,4   thread counts          --sizes=N,N   problem sizes
+//   --warmup=N        discarded runs          --min-runs=N  --max-runs=N
+//   --ci=F            target relative CI      --budget=S    seconds per config
+//   --csv=PATH        --json=PATH             --baseline=PATH
+
+#define BENCH_MAX_CONFIGS 64
+#define BENCH_MAX_RUNS 100
+#define BENCH_MAX_EXTRA 8
+#define BENCH_OUTLIER_Z 3.5
+#define BENCH_MIN_EFFECT 0.01
+
+typedef struct {
+    const char *name;                        // file prefix, e.g. "problem1"
+    int threads[BENCH_MAX_CONFIGS];
+    int num_threads;
+    int threads_given;                       // --threads was passed
+    long long sizes[BENCH_MAX_CONFIGS];
+    int num_sizes;                           // 0 unless the program takes sizes
+    int sizes_supported;
+    int warmup, min_runs, max_runs;
+    double target_ci;
+    double budget;
+    char csv_path[256], json_path[256];
+    const char *baseline_path;
+} BenchOptions;
+
+typedef struct {
+    int n;
+    double median, min, max, mean, stddev;
+    double ci95;                             // half-width of the 95% CI of the mean
+} BenchSummary;
+
+typedef struct {
+    int runs, outliers;
+    BenchSummary time;
+    BenchSummary faults;                     // page faults per run
+    BenchSummary extra[BENCH_MAX_EXTRA];
+} BenchStats;
+
+// Timed seconds of one run; extra[] receives the run's extra metrics
+typedef double (*BenchRunFn)(void *ctx, double *extra);
+
+// Which way a metric improves, for the baseline comparison
+typedef enum { BENCH_LOWER_BETTER, BENCH_HIGHER_BETTER, BENCH_INFORMATIONAL } BenchDirection;
+
+typedef struct {
+    char benchmark[64];
+    char metric[32];
+    int threads;
+    long long size;
+    int outliers;
+    BenchDirection direction;
+    BenchSummary summary;
+} BenchRecord;
+
+typedef struct {
+    int count, capacity;
+    BenchRecord *records;
+} BenchReport;
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline long long bench_page_faults(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (long long)usage.ru_minflt + usage.ru_majflt;
+}
+
+static inline void bench_options_init(BenchOptions *opts, const char *name, int sizes_supported) {
+    static const int default_threads[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
+    memset(opts, 0, sizeof(*opts));
+    opts->name = name;
+    opts->num_threads = (int)(sizeof(default_threads) / sizeof(default_threads[0]));
+    memcpy(opts->threads, default_threads, sizeof(default_threads));
+    opts->sizes_supported = sizes_supported;
+    opts->warmup = 1;
+    opts->min_runs = 3;
+    opts->max_runs = 10;
+    opts->target_ci = 0.02;
+    opts->budget = 600.0;
+    snprintf(opts->csv_path, sizeof(opts->csv_path), "%s_bench.csv", name);
+    snprintf(opts->json_path, sizeof(opts->json_path), "%s_bench.json", name);
+}
+
+// Parses "a,b,c" into values; returns the count, or -1 on a bad list
+static inline int bench_parse_list(const char *list, long long *values, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long long v = strtoll(p, &end, 10);
+        if (end == p || v <= 0 || count == max) return -1;
+        values[count++] = v;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return -1;
+    }
+    return count > 0 ? count : -1;
+}
+
+static inline void bench_usage(const BenchOptions *opts) {
+    fprintf(stderr, "Benchmark options: --threads=1,2,4%s --warmup=N --min-runs=N --max-runs=N\n"
+                    "                   --ci=F --budget=SECONDS --csv=PATH --json=PATH --baseline=PATH\n",
+            opts->sizes_supported ? " --sizes=N,N" : "");
+}
+
+// Consumes the harness options from argv (argc is updated). Returns 0, or
+// -1 after printing usage if an option is malformed.
+static int bench_parse_args(BenchOptions *opts, int *argc, char **argv) {
+    int kept = 1;
+    for (int a = 1; a < *argc; a++) {
+        const char *arg = argv[a];
+        const char *eq = strchr(arg, '=');
+        const char *value = eq ? eq + 1 : "";
+        long long list[BENCH_MAX_CONFIGS];
+        int ok = 1;
+        if (strncmp(arg, "--threads=", 10) == 0) {
+            int count = bench_parse_list(value, list, BENCH_MAX_CONFIGS);
+            ok = count > 0;
+            for (int i = 0; ok && i < count; i++) opts->threads[i] = (int)list[i];
+            if (ok) opts->num_threads = count;
+            opts->threads_given = ok;
+        } else if (strncmp(arg, "--sizes=", 8) == 0) {
+            int count = bench_parse_list(value, list, BENCH_MAX_CONFIGS);
+            ok = opts->sizes_supported && count > 0;
+            if (ok) {
+                memcpy(opts->sizes, list, count * sizeof(long long));
+                opts->num_sizes = count;
+            }
+        } else if (strncmp(arg, "--warmup=", 9) == 0) {
+            opts->warmup = atoi(value);
+            ok = opts->warmup >= 0;
+        } else if (strncmp(arg, "--min-runs=", 11) == 0) {
+            opts->min_runs = atoi(value);
+            ok = opts->min_runs >= 1;
+        } else if (strncmp(arg, "--max-runs=", 11) == 0) {
+            opts->max_runs = atoi(value);
+            ok = opts->max_runs >= 1 && opts->max_runs <= BENCH_MAX_RUNS;
+        } else if (strncmp(arg, "--ci=", 5) == 0) {
+            opts->target_ci = atof(value);
+            ok = opts->target_ci > 0;
+        } else if (strncmp(arg, "--budget=", 9) == 0) {
+            opts->budget = atof(value);
+            ok = opts->budget > 0;
+        } else if (strncmp(arg, "--csv=", 6) == 0) {
+            snprintf(opts->csv_path, sizeof(opts->csv_path), "%s", value);
+        } else if (strncmp(arg, "--json=", 7) == 0) {
+            snprintf(opts->json_path, sizeof(opts->json_path), "%s", value);
+        } else if (strncmp(arg, "--baseline=", 11) == 0) {
+            opts->baseline_path = value;
+        } else {
+            argv[kept++] = argv[a];
+            continue;
+        }
+        if (!ok) {
+            fprintf(stderr, "Bad benchmark option: %s\n", arg);
+            bench_usage(opts);
+            return -1;
+        }
+    }
+    if (opts->max_runs < opts->min_runs) opts->max_runs = opts->min_runs;
+    *argc = kept;
+    argv[kept] = NULL;
+    return 0;
+}
+
+// Two-sided 95% Student t critical value
+static inline double bench_t95(double df) {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < 1) return table[0];
+    if (df <= 30) return table[(int)df - 1];
+    return 1.960 + 2.4 / df;   // close to the table beyond 30
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline double bench_median(double *values, int n) {
+    qsort(values, n, sizeof(double), bench_compare_double);
+    return (n % 2) ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+static void bench_summarize(const double *values, int n, BenchSummary *s) {
+    double sorted[BENCH_MAX_RUNS];
+    memset(s, 0, sizeof(*s));
+    s->n = n;
+    if (n == 0) return;
+    memcpy(sorted, values, n * sizeof(double));
+    s->median = bench_median(sorted, n);
+    s->min = sorted[0];
+    s->max = sorted[n - 1];
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += values[i];
+    s->mean = sum / n;
+    double sq = 0.0;
+    for (int i = 0; i < n; i++) sq += (values[i] - s->mean) * (values[i] - s->mean);
+    s->stddev = (n > 1) ? sqrt(sq / (n - 1)) : 0.0;
+    s->ci95 = (n > 1) ? bench_t95(n - 1) * s->stddev / sqrt(n) : 0.0;
+}
+
+// Marks samples whose modified z-score exceeds BENCH_OUTLIER_Z
+static int bench_flag_outliers(const double *samples, int n, int *outlier) {
+    double tmp[BENCH_MAX_RUNS];
+    memcpy(tmp, samples, n * sizeof(double));
+    double median = bench_median(tmp, n);
+    for (int i = 0; i < n; i++) tmp[i] = fabs(samples[i] - median);
+    double mad = bench_median(tmp, n);
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        outlier[i] = n >= 4 && mad > 0 && fabs(samples[i] - median) / (1.4826 * mad) > BENCH_OUTLIER_Z;
+        count += outlier[i];
+    }
+    return count;
+}
+
+static void bench_compute(const double *samples, const double *faults, const double extra[][BENCH_MAX_EXTRA],
+                          int n, int num_extra, BenchStats *stats) {
+    int outlier[BENCH_MAX_RUNS];
+    double kept[BENCH_MAX_RUNS];
+    memset(stats, 0, sizeof(*stats));
+    stats->runs = n;
+    stats->outliers = bench_flag_outliers(samples, n, outlier);
+
+    int m = 0;
+    for (int i = 0; i < n; i++) if (!outlier[i]) kept[m++] = samples[i];
+    bench_summarize(kept, m, &stats->time);
+    m = 0;
+    for (int i = 0; i < n; i++) if (!outlier[i]) kept[m++] = faults[i];
+    bench_summarize(kept, m, &stats->faults);
+    for (int e = 0; e < num_extra; e++) {
+        m = 0;
+        for (int i = 0; i < n; i++) if (!outlier[i]) kept[m++] = extra[i][e];
+        bench_summarize(kept, m, &stats->extra[e]);
+    }
+}
+
+// Runs fn until the statistics are tight enough (see the top of the file)
+static void bench_measure(const BenchOptions *opts, BenchRunFn fn, void *ctx, int num_extra, BenchStats *stats) {
+    static double extra[BENCH_MAX_RUNS][BENCH_MAX_EXTRA];
+    double samples[BENCH_MAX_RUNS], faults[BENCH_MAX_RUNS];
+    double scratch[BENCH_MAX_EXTRA];
+
+    for (int w = 0; w < opts->warmup; w++) {
+        printf("  Warmup: ");
+        fn(ctx, scratch);
+    }
+
+    double start = bench_now();
+    int n = 0;
+    while (n < opts->max_runs) {
+        printf("  Run %d: ", n + 1);
+        memset(extra[n], 0, sizeof(extra[n]));
+        long long faults_before = bench_page_faults();
+        samples[n] = fn(ctx, extra[n]);
+        faults[n] = (double)(bench_page_faults() - faults_before);
+        n++;
+        if (n < opts->min_runs) continue;
+        bench_compute(samples, faults, (const double (*)[BENCH_MAX_EXTRA])extra, n, num_extra, stats);
+        if (stats->time.mean > 0 && stats->time.ci95 / stats->time.mean <= opts->target_ci) break;
+        if (bench_now() - start > opts->budget) break;
+    }
+    bench_compute(samples, faults, (const double (*)[BENCH_MAX_EXTRA])extra, n, num_extra, stats);
+}
+
+static inline void bench_print_stats(const BenchStats *s) {
+    printf("  Median %.4f s | min %.4f s | mean %.4f +/- %.4f s | 95%% CI [%.4f, %.4f] | %d run(s), %d outlier(s) | "
+           "%.0f page faults/run\n", s->time.median, s->time.min, s->time.mean, s->time.stddev,
+           s->time.mean - s->time.ci95, s->time.mean + s->time.ci95, s->runs, s->outliers, s->faults.median);
+}
+
+// ---- report ----
+
+static inline void bench_report_init(BenchReport *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+static inline void bench_report_free(BenchReport *r) {
+    free(r->records);
+    memset(r, 0, sizeof(*r));
+}
+
+static void bench_report_add_summary(BenchReport *r, const char *benchmark, const char *metric, int threads,
+                                     long long size, int outliers, BenchDirection direction,
+                                     const BenchSummary *summary) {
+    if (r->count == r->capacity) {
+        int capacity = r->capacity ? 2 * r->capacity : 64;
+        BenchRecord *grown = realloc(r->records, capacity * sizeof(BenchRecord));
+        if (!grown) return;
+        r->records = grown;
+        r->capacity = capacity;
+    }
+    BenchRecord *rec = &r->records[r->count++];
+    snprintf(rec->benchmark, sizeof(rec->benchmark), "%s", benchmark);
+    snprintf(rec->metric, sizeof(rec->metric), "%s", metric);
+    rec->threads = threads;
+    rec->size = size;
+    rec->outliers = outliers;
+    rec->direction = direction;
+    rec->summary = *summary;
+}
+
+// Adds the "time" and "page_faults" metrics and one metric per extra name.
+// extra_directions gives each extra's direction, or is NULL when all of
+// them are lower-is-better (phase times).
+static void bench_report_add(BenchReport *r, const char *benchmark, int threads, long long size,
+                             const BenchStats *s, const char *const *extra_names,
+                             const BenchDirection *extra_directions, int num_extra) {
+    bench_report_add_summary(r, benchmark, "time", threads, size, s->outliers, BENCH_LOWER_BETTER, &s->time);
+    bench_report_add_summary(r, benchmark, "page_faults", threads, size, s->outliers, BENCH_INFORMATIONAL,
+                             &s->faults);
+    for (int e = 0; e < num_extra; e++) {
+        bench_report_add_summary(r, benchmark, extra_names[e], threads, size, s->outliers,
+                                 extra_directions ? extra_directions[e] : BENCH_LOWER_BETTER, &s->extra[e]);
+    }
+}
+
+static void bench_metadata(char (*keys)[32], char (*values)[256], int *count) {
+    const Topology *t = topo_get();
+    int n = 0;
+    char host[256] = "unknown";
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+    time_t now = time(NULL);
+    struct tm tm_utc;
+    gmtime_r(&now, &tm_utc);
+
+    snprintf(keys[n], 32, "host");
+    snprintf(values[n++], 256, "%s", host);
+    snprintf(keys[n], 32, "cpu");
+    topo_cpu_model(values[n++], 256);
+    snprintf(keys[n], 32, "topology");
+    snprintf(values[n++], 256, "%d cpus, %d cores, %d packages, %d nodes", t->num_cpus, t->num_cores,
+             t->num_packages, t->num_nodes);
+    snprintf(keys[n], 32, "caches");
+    snprintf(values[n++], 256, "L1d %dK, L2 %dK, L3 %dK", t->l1d_kb, t->l2_kb, t->l3_kb);
+    snprintf(keys[n], 32, "placement");
+    snprintf(values[n++], 256, "%s", topo_policy_names[t->policy]);
+    snprintf(keys[n], 32, "compiler");
+    snprintf(values[n++], 256, "%s", __VERSION__);
+    snprintf(keys[n], 32, "timestamp");
+    strftime(values[n++], 256, "%Y-%m-%dT%H:%M:%SZ", &tm_utc);
+    *count = n;
+}
+
+// Writes the report as CSV ("# key: value" metadata lines, then a header
+// and one row per record) and JSON. Returns 0, or -1 if a file fails.
+static int bench_report_write(const BenchReport *r, const BenchOptions *opts) {
+    char keys[16][32], values[16][256];
+    int num_meta;
+    bench_metadata(keys, values, &num_meta);
+    int status = 0;
+
+    FILE *fp = fopen(opts->csv_path, "w");
+    if (fp) {
+        for (int i = 0; i < num_meta; i++) fprintf(fp, "# %s: %s\n", keys[i], values[i]);
+        fprintf(fp, "benchmark,metric,threads,size,runs,outliers,median,min,max,mean,stddev,ci95_low,ci95_high\n");
+        for (int i = 0; i < r->count; i++) {
+            const BenchRecord *rec = &r->records[i];
+            const BenchSummary *s = &rec->summary;
+            fprintf(fp, "%s,%s,%d,%lld,%d,%d,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", rec->benchmark, rec->metric,
+                    rec->threads, rec->size, s->n, rec->outliers, s->median, s->min, s->max, s->mean, s->stddev,
+                    s->mean - s->ci95, s->mean + s->ci95);
+        }
+        if (fclose(fp) != 0) status = -1;
+    } else {
+        status = -1;
+    }
+
+    fp = fopen(opts->json_path, "w");
+    if (fp) {
+        fprintf(fp, "{\n  \"benchmark\": \"%s\",\n  \"metadata\": {", opts->name);
+        for (int i = 0; i < num_meta; i++) {
+            fprintf(fp, "%s\n    \"%s\": \"", i ? "," : "", keys[i]);
+            for (const char *c = values[i]; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', fp);
+                fputc(*c, fp);
+            }
+            fputc('"', fp);
+        }
+        fprintf(fp, "\n  },\n  \"results\": [");
+        for (int i = 0; i < r->count; i++) {
+            const BenchRecord *rec = &r->records[i];
+            const BenchSummary *s = &rec->summary;
+            fprintf(fp, "%s\n    {\"benchmark\": \"%s\", \"metric\": \"%s\", \"threads\": %d, \"size\": %lld, "
+                        "\"runs\": %d, \"outliers\": %d, \"median\": %.6g, \"min\": %.6g, \"max\": %.6g, "
+                        "\"mean\": %.6g, \"stddev\": %.6g, \"ci95\": [%.6g, %.6g]}",
+                    i ? "," : "", rec->benchmark, rec->metric, rec->threads, rec->size, s->n, rec->outliers,
+                    s->median, s->min, s->max, s->mean, s->stddev, s->mean - s->ci95, s->mean + s->ci95);
+        }
+        fprintf(fp, "\n  ]\n}\n");
+        if (fclose(fp) != 0) status = -1;
+    } else {
+        status = -1;
+    }
+    return status;
+}
+
+// Compares the report with a CSV written by bench_report_write(). Prints
+// one line per matching record and returns the number of regressions, or
+// -1 if the baseline cannot be read.
+static int bench_compare_baseline(const BenchReport *r, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[1024];
+    int regressions = 0, matched = 0;
+
+    printf("\nBaseline comparison against %s (Welch t-test, 95%%):\n", path);
+    printf("%-24s %-10s %7s %10s | %10s %10s | %8s %7s | %s\n", "Benchmark", "Metric", "Threads", "Size",
+           "Base mean", "New mean", "Change", "t", "Verdict");
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || strncmp(line, "benchmark,", 10) == 0) continue;
+        char benchmark[64], metric[32];
+        int threads, runs, outliers;
+        long long size;
+        double median, min, max, mean, stddev, lo, hi;
+        if (sscanf(line, "%63[^,],%31[^,],%d,%lld,%d,%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf", benchmark, metric, &threads,
+                   &size, &runs, &outliers, &median, &min, &max, &mean, &stddev, &lo, &hi) != 13) {
+            continue;
+        }
+        for (int i = 0; i < r->count; i++) {
+            const BenchRecord *rec = &r->records[i];
+            if (strcmp(rec->benchmark, benchmark) != 0 || strcmp(rec->metric, metric) != 0 ||
+                rec->threads != threads || rec->size != size) {
+                continue;
+            }
+            const BenchSummary *s = &rec->summary;
+            matched++;
+            double change = (mean > 0) ? (s->mean - mean) / mean : 0.0;
+            double var0 = (runs > 0) ? stddev * stddev / runs : 0.0;
+            double var1 = (s->n > 0) ? s->stddev * s->stddev / s->n : 0.0;
+            const char *verdict = "n/a";
+            double t = 0.0;
+            if (var0 + var1 > 0 && runs > 1 && s->n > 1) {
+                t = (s->mean - mean) / sqrt(var0 + var1);
+                double df = (var0 + var1) * (var0 + var1) /
+                            (var0 * var0 / (runs - 1) + var1 * var1 / (s->n - 1));
+                int significant = fabs(t) > bench_t95(df) && fabs(change) > BENCH_MIN_EFFECT;
+                if (rec->direction == BENCH_INFORMATIONAL) {
+                    // e.g. page faults: they explain a slowdown but are not one
+                    verdict = !significant ? "same" : (t > 0 ? "more" : "fewer");
+                } else {
+                    int worse = rec->direction == BENCH_HIGHER_BETTER ? t < 0 : t > 0;
+                    verdict = !significant ? "same" : (worse ? "REGRESSION" : "improved");
+                    regressions += significant && worse;
+                }
+            }
+            printf("%-24s %-10s %7d %10lld | %10.4f %10.4f | %+7.1f%% %7.2f | %s\n", benchmark, metric, threads,
+                   size, mean, s->mean, 100.0 * change, t, verdict);
+        }
+    }
+    fclose(fp);
+    printf("%d matching record(s), %d regression(s)\n", matched, regressions);
+    return regressions;
+}
+
+// Writes the report, and compares it with the baseline if one was given.
+// Returns the number of regressions (0 without a baseline).
+static int bench_finish(const BenchReport *r, const BenchOptions *opts) {
+    if (bench_report_write(r, opts) == 0) {
+        printf("Benchmark statistics saved to %s and %s\n", opts->csv_path, opts->json_path);
+    } else {
+        fprintf(stderr, "Could not write %s / %s\n", opts->csv_path, opts->json_path);
+    }
+    if (!opts->baseline_path) return 0;
+    int regressions = bench_compare_baseline(r, opts->baseline_path);
+    if (regressions < 0) {
+        fprintf(stderr, "Could not read baseline %s\n", opts->baseline_path);
+        return 0;
+    }
+    return regressions;
+}
+
+#endif
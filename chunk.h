@@ -0,0 +1,45 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+// Chunked read access to a sequence of 64-bit keys.
+//
+// Scans written against a ChunkReader run unchanged on a plain array and on
+// an encoded representation (column.h): chunk c holds keys
+// [c * chunk, min((c + 1) * chunk, n)), and read() returns a pointer to
+// them. An array reader returns a pointer into the array; a decoding reader
+// fills the caller's buffer, which must hold CHUNK_MAX keys. Readers are
+// shared between threads, so read() must not modify the reader.
+
+#define CHUNK_MAX 4096
+#define CHUNK_ARRAY 4096   // keys per chunk of an array reader
+
+typedef const unsigned long long *(*ChunkReadFn)(const void *ctx, long long chunk, unsigned long long *buffer);
+
+typedef struct {
+    long long n;          // keys
+    long long chunk;      // keys per chunk, at most CHUNK_MAX
+    ChunkReadFn read;
+    const void *ctx;
+} ChunkReader;
+
+static const unsigned long long *chunk_array_read(const void *ctx, long long chunk, unsigned long long *buffer) {
+    (void)buffer;
+    return (const unsigned long long *)ctx + chunk * CHUNK_ARRAY;
+}
+
+static inline ChunkReader chunk_array(const unsigned long long *data, long long n) {
+    ChunkReader r = {n, CHUNK_ARRAY, chunk_array_read, data};
+    return r;
+}
+
+static inline long long chunk_count(const ChunkReader *r) {
+    return (r->n + r->chunk - 1) / r->chunk;
+}
+
+// Keys in chunk c
+static inline long long chunk_len(const ChunkReader *r, long long c) {
+    long long first = c * r->chunk;
+    return r->n - first < r->chunk ? r->n - first : r->chunk;
+}
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef COLUMN_H
+#define COLUMN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+#include "rng.h"
+#include "chunk.h"
+#include "select.h"
+
+// Compressed in-memory column of 64-bit unsigned values.
+//
+// Values are stored in blocks of COLUMN_BLOCK. Each block header keeps the
+// block's min and max (a zone map) and where its bit-packed payload starts.
+// Two encodings:
+//   FOR    frame of reference: value - min in `bits` bits, bits being the
+//          width of max - min. Problem 5's values are below 10^12 < 2^40,
+//          so a block of them takes 40 bits per value instead of 64.
+//   DELTA  for sorted columns: value - previous value in `bits` bits, the
+//          first value being the block min. 360M sorted values below 10^12
+//          are about 2800 apart (at most ~20000 within a block), so blocks take
+//          15 bits per value.
+// A block whose width would exceed COLUMN_MAX_BITS is stored unpacked.
+//
+// Value i of a block occupies bits [i * bits, (i + 1) * bits) of the
+// payload (little endian), so every group of 8 values starts on a byte
+// boundary. The unpack kernels exploit that: the index and shift vectors
+// are the same for every group of a block. AVX-512 loads a group's bytes
+// into one register and moves each lane's two candidate words into place
+// with permutes; AVX2 gathers the word at each lane's byte offset. Both
+// then shift, mask and add the base. The kernels are selected with
+// rng_isa(), so RNG_ISA caps them too. Payloads are padded so the wide
+// loads never run past the end.
+//
+// Queries work a block at a time: min and max read only the zone maps, sum
+// adds count * min to the offsets summed in registers (FOR blocks), and
+// column_select_ranks() finds exact percentiles. In a DELTA (sorted) column
+// a rank's position gives its block, so one block is decoded. Otherwise
+// select.h's histogram passes run over decoded blocks (column_reader()),
+// reading bits / 64 of the bytes a plain array needs.
+//
+// The column lives in memory the caller provides (column_size() bytes) and
+// is filled block by block, so threads encode disjoint blocks in parallel.
+
+#define COLUMN_BLOCK 1024
+#define COLUMN_MAX_BITS 56    // widest packed lane; one 64-bit load always covers a value
+#define COLUMN_PAD_WORDS 8    // readable words past the last payload
+
+typedef enum { COLUMN_FOR, COLUMN_DELTA } ColumnEncoding;
+
+typedef struct {
+    unsigned long long min, max;
+    long long offset;         // payload word where the block starts
+    int bits;                 // 0 (all values equal) to COLUMN_MAX_BITS, or 64 unpacked
+} ColumnBlock;
+
+typedef struct {
+    long long n, num_blocks;
+    ColumnEncoding encoding;
+    int slot_bits;            // payload reserved per value
+    ColumnBlock *blocks;
+    unsigned long long *payload;
+    long long payload_words;  // in use
+} Column;
+
+static inline int column_width(unsigned long long span) {
+    return span ? 64 - __builtin_clzll(span) : 0;
+}
+
+static inline int column_lane_bits(unsigned long long span) {
+    int bits = column_width(span);
+    return bits > COLUMN_MAX_BITS ? 64 : bits;
+}
+
+static inline long long column_block_words(long long count, int bits) {
+    return (count * bits + 63) / 64;
+}
+
+static inline long long column_num_blocks(long long n) {
+    return (n + COLUMN_BLOCK - 1) / COLUMN_BLOCK;
+}
+
+static inline int column_block_len(const Column *col, long long b) {
+    long long first = b * COLUMN_BLOCK;
+    return (int)(col->n - first < COLUMN_BLOCK ? col->n - first : COLUMN_BLOCK);
+}
+
+// Bytes for a column of n values whose blocks need at most slot_bits bits
+// per value (column_lane_bits() of the widest span)
+static inline size_t column_size(long long n, int slot_bits) {
+    size_t headers = (column_num_blocks(n) * sizeof(ColumnBlock) + 63) / 64 * 64;
+    return headers + (column_num_blocks(n) * column_block_words(COLUMN_BLOCK, slot_bits) + COLUMN_PAD_WORDS) * 8;
+}
+
+// Lays the column out in memory; block b gets a fixed slot of slot_bits
+// per value (DELTA encoding packs the slots tighter, see below)
+static inline void column_init(Column *col, long long n, ColumnEncoding encoding, int slot_bits, void *memory) {
+    col->n = n;
+    col->num_blocks = column_num_blocks(n);
+    col->encoding = encoding;
+    col->slot_bits = slot_bits;
+    col->blocks = memory;
+    col->payload = (unsigned long long *)((char *)memory + (col->num_blocks * sizeof(ColumnBlock) + 63) / 64 * 64);
+    col->payload_words = col->num_blocks * column_block_words(COLUMN_BLOCK, slot_bits);
+    memset(&col->payload[col->payload_words], 0, COLUMN_PAD_WORDS * 8);
+}
+
+// Bytes the column actually occupies (headers plus used payload)
+static inline size_t column_bytes(const Column *col) {
+    return col->num_blocks * sizeof(ColumnBlock) + col->payload_words * 8;
+}
+
+static inline double column_bits_per_value(const Column *col) {
+    return col->n ? column_bytes(col) * 8.0 / col->n : 0.0;
+}
+
+// ---- packing ----
+
+// Packs values[i] (each < 2^bits) into words, which must be zeroed
+static void column_pack(unsigned long long *words, const unsigned long long *values, int count, int bits) {
+    if (bits == 64) {
+        memcpy(words, values, count * sizeof(unsigned long long));
+        return;
+    }
+    if (bits == 0) return;
+    for (int i = 0; i < count; i++) {
+        long long bit = (long long)i * bits;
+        int shift = (int)(bit & 63);
+        words[bit >> 6] |= values[i] << shift;
+        if (shift + bits > 64) words[(bit >> 6) + 1] |= values[i] >> (64 - shift);
+    }
+}
+
+// ---- unpack kernels: out[i] = base + lane i, for 0 < bits <= COLUMN_MAX_BITS ----
+
+static inline unsigned long long column_lane(const unsigned char *bytes, long long i, int bits,
+                                             unsigned long long mask) {
+    long long bit = i * bits;
+    unsigned long long word;
+    memcpy(&word, bytes + (bit >> 3), sizeof(word));
+    return (word >> (bit & 7)) & mask;
+}
+
+static void column_unpack_scalar(const unsigned char *in, int bits, int count, unsigned long long base,
+                                 unsigned long long *out) {
+    unsigned long long mask = (1ULL << bits) - 1;
+    for (int i = 0; i < count; i++) out[i] = base + column_lane(in, i, bits, mask);
+}
+
+#ifdef RNG_X86
+__attribute__((target("avx2")))
+static void column_unpack_avx2(const unsigned char *in, int bits, int count, unsigned long long base,
+                               unsigned long long *out) {
+    // Lane j of a group starts at bit j * bits: byte offset and shift
+    __m256i byte_lo = _mm256_setr_epi64x(0, bits >> 3, (2 * bits) >> 3, (3 * bits) >> 3);
+    __m256i byte_hi = _mm256_setr_epi64x((4 * bits) >> 3, (5 * bits) >> 3, (6 * bits) >> 3, (7 * bits) >> 3);
+    __m256i shift_lo = _mm256_setr_epi64x(0, bits & 7, (2 * bits) & 7, (3 * bits) & 7);
+    __m256i shift_hi = _mm256_setr_epi64x((4 * bits) & 7, (5 * bits) & 7, (6 * bits) & 7, (7 * bits) & 7);
+    __m256i mask = _mm256_set1_epi64x((long long)((1ULL << bits) - 1));
+    __m256i vbase = _mm256_set1_epi64x((long long)base);
+    int groups = count / 8;
+    for (int g = 0; g < groups; g++) {
+        const long long *group = (const long long *)(in + (long)g * bits);
+        __m256i lo = _mm256_i64gather_epi64(group, byte_lo, 1);
+        __m256i hi = _mm256_i64gather_epi64(group, byte_hi, 1);
+        lo = _mm256_add_epi64(_mm256_and_si256(_mm256_srlv_epi64(lo, shift_lo), mask), vbase);
+        hi = _mm256_add_epi64(_mm256_and_si256(_mm256_srlv_epi64(hi, shift_hi), mask), vbase);
+        _mm256_storeu_si256((__m256i *)&out[g * 8], lo);
+        _mm256_storeu_si256((__m256i *)&out[g * 8 + 4], hi);
+    }
+    unsigned long long m = (1ULL << bits) - 1;
+    for (int i = groups * 8; i < count; i++) out[i] = base + column_lane(in, i, bits, m);
+}
+
+// Index and shift vectors of a group: lane j is bits [j * bits, ...) of the
+// group's 64 bytes, i.e. word lo >> shift joined with word lo + 1
+__attribute__((target("avx512f")))
+static inline void column_avx512_lanes(int bits, __m512i *lo, __m512i *hi, __m512i *right, __m512i *left) {
+    long long lo_idx[8], hi_idx[8], r[8], l[8];
+    for (int j = 0; j < 8; j++) {
+        int bit = j * bits;
+        lo_idx[j] = bit >> 6;
+        hi_idx[j] = (bit >> 6) + 1 < 8 ? (bit >> 6) + 1 : 7;
+        r[j] = bit & 63;
+        l[j] = 64 - (bit & 63);   // a shift by 64 yields 0, so aligned lanes take nothing from hi
+    }
+    *lo = _mm512_loadu_si512(lo_idx);
+    *hi = _mm512_loadu_si512(hi_idx);
+    *right = _mm512_loadu_si512(r);
+    *left = _mm512_loadu_si512(l);
+}
+
+__attribute__((target("avx512f")))
+static void column_unpack_avx512(const unsigned char *in, int bits, int count, unsigned long long base,
+                                 unsigned long long *out) {
+    __m512i lo_idx, hi_idx, right, left;
+    column_avx512_lanes(bits, &lo_idx, &hi_idx, &right, &left);
+    __m512i mask = _mm512_set1_epi64((long long)((1ULL << bits) - 1));
+    __m512i vbase = _mm512_set1_epi64((long long)base);
+    int groups = count / 8;
+    for (int g = 0; g < groups; g++) {
+        __m512i w = _mm512_loadu_si512(in + (long)g * bits);
+        __m512i v = _mm512_or_si512(_mm512_srlv_epi64(_mm512_permutexvar_epi64(lo_idx, w), right),
+                                    _mm512_sllv_epi64(_mm512_permutexvar_epi64(hi_idx, w), left));
+        _mm512_storeu_si512(&out[g * 8], _mm512_add_epi64(_mm512_and_si512(v, mask), vbase));
+    }
+    unsigned long long m = (1ULL << bits) - 1;
+    for (int i = groups * 8; i < count; i++) out[i] = base + column_lane(in, i, bits, m);
+}
+
+// Sum of the lanes, without storing them. Each 64-bit lane adds at most
+// COLUMN_BLOCK / 8 values of COLUMN_MAX_BITS, so it cannot wrap, but the
+// eight lanes together can: they are added into the 128-bit total one by one.
+__attribute__((target("avx512f")))
+static unsigned __int128 column_lane_sum_avx512(const unsigned char *in, int bits, int count) {
+    __m512i lo_idx, hi_idx, right, left;
+    column_avx512_lanes(bits, &lo_idx, &hi_idx, &right, &left);
+    __m512i mask = _mm512_set1_epi64((long long)((1ULL << bits) - 1));
+    __m512i acc = _mm512_setzero_si512();
+    int groups = count / 8;
+    for (int g = 0; g < groups; g++) {
+        __m512i w = _mm512_loadu_si512(in + (long)g * bits);
+        __m512i v = _mm512_or_si512(_mm512_srlv_epi64(_mm512_permutexvar_epi64(lo_idx, w), right),
+                                    _mm512_sllv_epi64(_mm512_permutexvar_epi64(hi_idx, w), left));
+        acc = _mm512_add_epi64(acc, _mm512_and_si512(v, mask));
+    }
+    unsigned long long lanes[8];
+    unsigned __int128 sum = 0;
+    _mm512_storeu_si512(lanes, acc);
+    for (int j = 0; j < 8; j++) sum += lanes[j];
+    unsigned long long m = (1ULL << bits) - 1;
+    for (int i = groups * 8; i < count; i++) sum += column_lane(in, i, bits, m);
+    return sum;
+}
+#endif
+
+static inline void column_unpack(const unsigned char *in, int bits, int count, unsigned long long base,
+                                 unsigned long long *out) {
+#ifdef RNG_X86
+    switch (rng_isa()) {
+    case RNG_ISA_AVX512: column_unpack_avx512(in, bits, count, base, out); return;
+    case RNG_ISA_AVX2: column_unpack_avx2(in, bits, count, base, out); return;
+    default: break;
+    }
+#endif
+    column_unpack_scalar(in, bits, count, base, out);
+}
+
+// ---- blocks ----
+
+// FOR-encodes values[0..len) as block b. Returns 0, or -1 if the block's
+// span needs more than the column's slot_bits.
+static int column_put_block(Column *col, long long b, const unsigned long long *values) {
+    int len = column_block_len(col, b);
+    ColumnBlock *block = &col->blocks[b];
+    unsigned long long min = ULLONG_MAX, max = 0;
+    for (int i = 0; i < len; i++) {
+        if (values[i] < min) min = values[i];
+        if (values[i] > max) max = values[i];
+    }
+    int bits = column_lane_bits(max - min);
+    if (bits > col->slot_bits) return -1;
+
+    unsigned long long offsets[COLUMN_BLOCK];
+    for (int i = 0; i < len; i++) offsets[i] = values[i] - min;
+    block->min = min;
+    block->max = max;
+    block->bits = bits;
+    block->offset = b * column_block_words(COLUMN_BLOCK, col->slot_bits);
+    unsigned long long *words = &col->payload[block->offset];
+    memset(words, 0, column_block_words(len, bits) * 8);
+    column_pack(words, offsets, len, bits);
+    return 0;
+}
+
+// Decodes block b into out (COLUMN_BLOCK values); returns its length
+static int column_decode_block(const Column *col, long long b, unsigned long long *out) {
+    const ColumnBlock *block = &col->blocks[b];
+    int len = column_block_len(col, b);
+    const unsigned long long *words = &col->payload[block->offset];
+    int delta = col->encoding == COLUMN_DELTA;
+    unsigned long long base = delta ? 0 : block->min;
+
+    if (block->bits == 0) {
+        for (int i = 0; i < len; i++) out[i] = block->min;
+        return len;
+    } else if (block->bits == 64) {
+        for (int i = 0; i < len; i++) out[i] = base + words[i];
+    } else {
+        column_unpack((const unsigned char *)words, block->bits, len, base, out);
+    }
+    if (delta) {
+        unsigned long long running = block->min;
+        for (int i = 0; i < len; i++) {
+            running += out[i];
+            out[i] = running;
+        }
+    }
+    return len;
+}
+
+static const unsigned long long *column_read(const void *ctx, long long chunk, unsigned long long *buffer) {
+    column_decode_block(ctx, chunk, buffer);
+    return buffer;
+}
+
+// Block-at-a-time reader for select.h and freq.h
+static inline ChunkReader column_reader(const Column *col) {
+    ChunkReader r = {col->n, COLUMN_BLOCK, column_read, col};
+    return r;
+}
+
+// Sorted data into a DELTA column in `memory` (column_size(n, slot_bits)
+// bytes, slot_bits >= column_lane_bits(max - min)). Blocks are packed back
+// to back: per-block widths first, then offsets, then the payload.
+static void column_encode_sorted(Column *col, const unsigned long long *data, long long n, int slot_bits,
+                                 void *memory, int num_threads) {
+    column_init(col, n, COLUMN_DELTA, slot_bits, memory);
+
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (long long b = 0; b < col->num_blocks; b++) {
+        const unsigned long long *values = &data[b * COLUMN_BLOCK];
+        int len = column_block_len(col, b);
+        unsigned long long widest = 0;
+        for (int i = 1; i < len; i++) {
+            unsigned long long d = values[i] - values[i - 1];
+            if (d > widest) widest = d;
+        }
+        col->blocks[b].min = values[0];
+        col->blocks[b].max = values[len - 1];
+        col->blocks[b].bits = column_lane_bits(widest);
+    }
+
+    long long words = 0;
+    for (long long b = 0; b < col->num_blocks; b++) {
+        col->blocks[b].offset = words;
+        words += column_block_words(column_block_len(col, b), col->blocks[b].bits);
+    }
+    col->payload_words = words;
+    memset(&col->payload[words], 0, COLUMN_PAD_WORDS * 8);
+
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (long long b = 0; b < col->num_blocks; b++) {
+        const unsigned long long *values = &data[b * COLUMN_BLOCK];
+        const ColumnBlock *block = &col->blocks[b];
+        int len = column_block_len(col, b);
+        unsigned long long deltas[COLUMN_BLOCK];
+        deltas[0] = 0;
+        for (int i = 1; i < len; i++) deltas[i] = values[i] - values[i - 1];
+        unsigned long long *out = &col->payload[block->offset];
+        memset(out, 0, column_block_words(len, block->bits) * 8);
+        column_pack(out, deltas, len, block->bits);
+    }
+}
+
+// ---- queries ----
+
+// From the zone maps only
+static unsigned long long column_min(const Column *col) {
+    unsigned long long min = ULLONG_MAX;
+    for (long long b = 0; b < col->num_blocks; b++) {
+        if (col->blocks[b].min < min) min = col->blocks[b].min;
+    }
+    return min;
+}
+
+static unsigned long long column_max(const Column *col) {
+    unsigned long long max = 0;
+    for (long long b = 0; b < col->num_blocks; b++) {
+        if (col->blocks[b].max > max) max = col->blocks[b].max;
+    }
+    return max;
+}
+
+// Exact sum of every value (128-bit: 360M values near 10^12 overflow 64 bits)
+static unsigned __int128 column_sum(const Column *col, int num_threads) {
+    unsigned long long hi = 0, lo = 0;   // the 128-bit total, as two reducible halves
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        unsigned __int128 local = 0;
+        unsigned long long buffer[COLUMN_BLOCK];
+
+        #pragma omp for schedule(static)
+        for (long long b = 0; b < col->num_blocks; b++) {
+            const ColumnBlock *block = &col->blocks[b];
+            int len = column_block_len(col, b);
+            unsigned __int128 offsets = 0;
+            int packed = col->encoding == COLUMN_FOR && block->bits > 0 && block->bits < 64;
+#ifdef RNG_X86
+            if (packed && rng_isa() == RNG_ISA_AVX512) {
+                offsets = column_lane_sum_avx512((const unsigned char *)&col->payload[block->offset],
+                                                 block->bits, len);
+                local += (unsigned __int128)block->min * len + offsets;
+                continue;
+            }
+#endif
+            (void)packed;
+            column_decode_block(col, b, buffer);
+            for (int i = 0; i < len; i++) local += buffer[i];
+        }
+
+        #pragma omp critical
+        {
+            unsigned __int128 total = ((unsigned __int128)hi << 64 | lo) + local;
+            hi = (unsigned long long)(total >> 64);
+            lo = (unsigned long long)total;
+        }
+    }
+    return (unsigned __int128)hi << 64 | lo;
+}
+
+// Values of rank ranks[0..k) (0-based, ascending) into out; 0 or -1
+static int column_select_ranks(const Column *col, const long long *ranks, unsigned long long *out, int k,
+                               int num_threads) {
+    if (col->encoding == COLUMN_DELTA) {
+        unsigned long long buffer[COLUMN_BLOCK];
+        for (int t = 0; t < k; t++) {
+            if (ranks[t] < 0 || ranks[t] >= col->n) return -1;
+            column_decode_block(col, ranks[t] / COLUMN_BLOCK, buffer);
+            out[t] = buffer[ranks[t] % COLUMN_BLOCK];
+        }
+        return 0;
+    }
+    ChunkReader in = column_reader(col);
+    return select_ranks_chunks(&in, column_min(col), column_max(col), ranks, out, k, num_threads);
+}
+
+#endif
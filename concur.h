@@ -0,0 +1,245 @@
+#ifndef CONCUR_H
+#define CONCUR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "topology.h"
+
+// Adaptive concurrency: picks the thread count and placement of each
+// parallel phase from short calibration runs instead of sweeping them all.
+//
+// A phase supplies a probe: a scaled-down run of the phase at a given
+// thread count that returns its throughput (work per second, any unit), or
+// 0 when it fails, so that count can only be chosen if every count fails.
+// Calibration probes the candidate counts in increasing order, each the
+// best of CONCUR_REPS runs. It stops climbing after CONCUR_PATIENCE
+// candidates in a row fail to beat the best so far by CONCUR_GAIN, which is
+// where memory bandwidth saturates or efficiency starts to fall, but always
+// probes the largest candidate too, for comparison. The choice is the
+// smallest count within CONCUR_TOLERANCE of the best throughput: threads
+// that add less than that are left idle. With more than one thread the
+// other placement policy (compact vs scatter, see topology.h) is then tried
+// at that count and kept if it is CONCUR_GAIN faster.
+//
+// The reason recorded with a choice is "scaling" (the largest count won),
+// "saturated" (more threads give about the same) or "declined" (more
+// threads are slower), and the log keeps the throughput at the largest count
+// next to the chosen one: what the choice gains or gives up.
+//
+// Re-probing: callers report the throughput of every real run with
+// concur_observe(). The first report after a calibration is a warmup (page
+// faults, cold caches) and is ignored; the second is the phase's baseline.
+// CONCUR_PATIENCE reports in a row more than CONCUR_DRIFT away
+// from it (other load arriving or leaving the machine) mark the phase
+// stale, and the next concur_apply() calibrates it again. Callers apply
+// once before each measurement and use concur_use() inside it, so a
+// re-probe only happens between measurements and all repetitions of one
+// run with the same thread count.
+
+#define CONCUR_MAX_PHASES 8
+#define CONCUR_MAX_CANDIDATES 64
+#define CONCUR_REPS 3
+#define CONCUR_GAIN 0.05       // a step must be this much faster to count as scaling
+#define CONCUR_TOLERANCE 0.05  // chosen count is within this of the best throughput
+#define CONCUR_PATIENCE 2
+#define CONCUR_DRIFT 0.25
+
+typedef double (*ConcurProbeFn)(void *ctx, int threads);
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    ConcurProbeFn probe;
+    void *ctx;
+
+    // Last calibration
+    int threads;
+    TopoPolicy policy;
+    double throughput;
+    int max_threads;
+    double max_throughput;
+    const char *reason;
+    int probe_threads[CONCUR_MAX_CANDIDATES];
+    double probe_throughput[CONCUR_MAX_CANDIDATES];
+    int num_probes;
+    int calibrations;
+
+    // Drift detection
+    int stale;
+    int observations;         // since the last calibration
+    double baseline;          // second observation after a calibration
+    int off_runs;             // observations in a row outside the drift band
+} ConcurPhase;
+
+typedef struct {
+    int candidates[CONCUR_MAX_CANDIDATES];   // ascending
+    int num_candidates;
+    ConcurPhase phases[CONCUR_MAX_PHASES];
+    int num_phases;
+    TopoPolicy policy;        // placement at init ($TOPO_POLICY), tried first
+    FILE *log;                // calibration rows (CSV), NULL for none
+} ConcurController;
+
+static int concur_compare_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Candidate thread counts come from the benchmark's --threads list
+static void concur_init(ConcurController *c, const int *thread_counts, int count, FILE *log) {
+    memset(c, 0, sizeof(*c));
+    for (int i = 0; i < count && c->num_candidates < CONCUR_MAX_CANDIDATES; i++) {
+        if (thread_counts[i] > 0) c->candidates[c->num_candidates++] = thread_counts[i];
+    }
+    qsort(c->candidates, c->num_candidates, sizeof(int), concur_compare_int);
+    int unique = 0;
+    for (int i = 0; i < c->num_candidates; i++) {
+        if (unique == 0 || c->candidates[i] != c->candidates[unique - 1]) c->candidates[unique++] = c->candidates[i];
+    }
+    c->num_candidates = unique;
+    c->policy = topo_get()->policy;
+    c->log = log;
+    if (log) {
+        fprintf(log, "Phase,Calibration,Threads,Policy,Throughput,Unit,MaxThreads,MaxThroughput,Change(%%),"
+                     "Efficiency(%%),Reason,Probes\n");
+    }
+}
+
+// Returns the phase index
+static int concur_add_phase(ConcurController *c, const char *name, const char *unit, ConcurProbeFn probe,
+                            void *ctx) {
+    ConcurPhase *p = &c->phases[c->num_phases];
+    memset(p, 0, sizeof(*p));
+    p->name = name;
+    p->unit = unit;
+    p->probe = probe;
+    p->ctx = ctx;
+    p->stale = 1;
+    return c->num_phases++;
+}
+
+static double concur_measure(ConcurPhase *p, int threads) {
+    double best = 0.0;
+    for (int r = 0; r < CONCUR_REPS; r++) {
+        double throughput = p->probe(p->ctx, threads);
+        if (throughput > best) best = throughput;
+    }
+    return best;
+}
+
+static double concur_probed(const ConcurPhase *p, int threads) {
+    for (int i = 0; i < p->num_probes; i++) {
+        if (p->probe_threads[i] == threads) return p->probe_throughput[i];
+    }
+    return 0.0;
+}
+
+static void concur_calibrate(ConcurController *c, int phase) {
+    ConcurPhase *p = &c->phases[phase];
+    TopoPolicy policy = c->policy;
+    topo_set_policy(policy);
+    p->num_probes = 0;
+    p->calibrations++;
+
+    double best = 0.0;
+    int misses = 0;
+    for (int i = 0; i < c->num_candidates && misses < CONCUR_PATIENCE; i++) {
+        double throughput = concur_measure(p, c->candidates[i]);
+        p->probe_threads[p->num_probes] = c->candidates[i];
+        p->probe_throughput[p->num_probes++] = throughput;
+        misses = throughput > best * (1.0 + CONCUR_GAIN) ? 0 : misses + 1;
+        if (throughput > best) best = throughput;
+    }
+    p->max_threads = c->candidates[c->num_candidates - 1];
+    p->max_throughput = concur_probed(p, p->max_threads);
+    if (p->max_throughput == 0.0) {
+        p->max_throughput = concur_measure(p, p->max_threads);
+        p->probe_threads[p->num_probes] = p->max_threads;
+        p->probe_throughput[p->num_probes++] = p->max_throughput;
+        if (p->max_throughput > best) best = p->max_throughput;
+    }
+
+    // Smallest count close enough to the best (probes are in ascending order)
+    p->threads = p->max_threads;
+    p->throughput = p->max_throughput;
+    for (int i = 0; i < p->num_probes; i++) {
+        if (p->probe_throughput[i] >= best * (1.0 - CONCUR_TOLERANCE)) {
+            p->threads = p->probe_threads[i];
+            p->throughput = p->probe_throughput[i];
+            break;
+        }
+    }
+    p->reason = p->threads == p->max_threads ? "scaling"
+              : p->max_throughput < best * (1.0 - CONCUR_TOLERANCE) ? "declined" : "saturated";
+
+    // Placement: the other of compact / scatter at the chosen count
+    p->policy = policy;
+    if (p->threads > 1 && (policy == TOPO_COMPACT || policy == TOPO_SCATTER)) {
+        TopoPolicy other = policy == TOPO_COMPACT ? TOPO_SCATTER : TOPO_COMPACT;
+        topo_set_policy(other);
+        double throughput = concur_measure(p, p->threads);
+        if (throughput > p->throughput * (1.0 + CONCUR_GAIN)) {
+            p->policy = other;
+            p->throughput = throughput;
+        }
+        topo_set_policy(policy);
+    }
+
+    p->stale = 0;
+    p->observations = 0;
+    p->baseline = 0.0;
+    p->off_runs = 0;
+
+    double single = concur_probed(p, 1);
+    double efficiency = single > 0 ? p->throughput / (single * p->threads) * 100.0 : 0.0;
+    double change = p->max_throughput > 0 ? (p->throughput / p->max_throughput - 1.0) * 100.0 : 0.0;
+    printf("Calibrated %s (#%d): %d thread(s), %s placement, %.3f %s (%s; %d threads: %.3f %s, %+.1f%%)\n",
+           p->name, p->calibrations, p->threads, topo_policy_names[p->policy], p->throughput, p->unit,
+           p->reason, p->max_threads, p->max_throughput, p->unit, change);
+    if (c->log) {
+        fprintf(c->log, "%s,%d,%d,%s,%.4f,%s,%d,%.4f,%.2f,%.1f,%s,", p->name, p->calibrations, p->threads,
+                topo_policy_names[p->policy], p->throughput, p->unit, p->max_threads, p->max_throughput, change,
+                efficiency, p->reason);
+        for (int i = 0; i < p->num_probes; i++) {
+            fprintf(c->log, "%s%d:%.4f", i ? ";" : "", p->probe_threads[i], p->probe_throughput[i]);
+        }
+        fprintf(c->log, "\n");
+        fflush(c->log);
+    }
+}
+
+// Thread count of the phase's last calibration; also switches to its
+// placement policy. Never calibrates, even when the phase is stale.
+static int concur_use(ConcurController *c, int phase) {
+    const ConcurPhase *p = &c->phases[phase];
+    topo_set_policy(p->policy);
+    return p->threads;
+}
+
+// Thread count for the next measurement of the phase, calibrating it first
+// if it is new or stale; also switches to the phase's placement policy
+static int concur_apply(ConcurController *c, int phase) {
+    if (c->phases[phase].stale) concur_calibrate(c, phase);
+    return concur_use(c, phase);
+}
+
+// Throughput of a real run of the phase (same unit as its probe, though
+// usually not the same value). Returns 1 if the phase became stale.
+static inline int concur_observe(ConcurController *c, int phase, double throughput) {
+    ConcurPhase *p = &c->phases[phase];
+    if (++p->observations <= 2) {
+        if (p->observations == 2) p->baseline = throughput;
+        return 0;
+    }
+    double ratio = throughput / p->baseline;
+    p->off_runs = (ratio < 1.0 - CONCUR_DRIFT || ratio > 1.0 + CONCUR_DRIFT) ? p->off_runs + 1 : 0;
+    if (p->off_runs >= CONCUR_PATIENCE) {
+        printf("Throughput of %s moved to %.0f%% of its baseline; re-probing\n", p->name, ratio * 100.0);
+        p->stale = 1;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
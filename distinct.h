@@ -0,0 +1,323 @@
+#ifndef DISTINCT_H
+#define DISTINCT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "rng.h"
+#include "chunk.h"
+#include "freq.h"
+
+// Distinct counts (cardinality) of 64-bit keys: exact and HyperLogLog.
+//
+// Exact (distinct_exact_chunks): the keys are radix-partitioned by hash
+// with freq.h's partition pass, so all copies of a key share a partition.
+// Threads take whole partitions and insert them into a private
+// open-addressing set (0 marks an empty slot; key 0 is tracked with a
+// flag), then add up the set sizes. Nothing is shared while counting. It
+// needs a scratch copy of the keys, so it is for data held in memory.
+//
+// Approximate (HllSketch): HyperLogLog with HLL++'s 64-bit hash, so there
+// are no hash collisions to correct for at any cardinality seen here. Of
+// the hash h, the top `precision` bits pick one of m = 2^precision
+// registers, and the register keeps the largest rank (leading zeros + 1)
+// of the remaining bits. The estimate is Ertl's improved estimator ("New
+// cardinality estimation algorithms for HyperLogLog sketches", 2017): it
+// works from the histogram of register values and is unbiased from empty
+// through linear-counting range to saturation, which replaces HLL++'s
+// empirical bias tables and the switch to linear counting. Relative
+// standard error is about 1.04 / sqrt(m): 0.81% at the default precision
+// of 14 (16 KB). Sketches are dense from the start; the sparse form of
+// HLL++ only pays below a few thousand keys.
+//
+// Sketches of the same precision merge by register-wise max, so threads
+// each fill their own and combine them (AVX-512BW / AVX2 byte max,
+// 64 / 32 registers per instruction). With AVX-512 the batch update hashes
+// and ranks 8 keys per step (64-bit multiply and lzcnt) before the
+// register updates. Kernels are selected with rng_isa(), so RNG_ISA caps
+// them too; every kernel produces the same registers.
+
+#define HLL_MIN_PRECISION 6    // 64 registers: one AVX-512 step
+#define HLL_MAX_PRECISION 18
+#define HLL_DEFAULT_PRECISION 14
+
+// ---- exact ----
+
+// Number of distinct keys of the reader in *count. scratch must hold n keys
+// or be NULL to allocate one; *bytes receives the memory used (scratch and
+// sets). Returns 0, or -1 on allocation failure.
+static int distinct_exact_chunks(const ChunkReader *in, unsigned long long *scratch, long long *count,
+                                 double *bytes, int num_threads) {
+    *count = 0;
+    *bytes = 0;
+    if (in->n <= 0) return 0;
+
+    FreqPartitions part;
+    if (freq_partition(in, scratch, num_threads, &part) != 0) return -1;
+    const unsigned long long *partitioned = part.keys;
+    const long long *part_begin = part.begin;
+    int parts = part.parts;
+
+    long long capacity = 16;
+    while (capacity < 2 * part.max_part) capacity *= 2;
+    long long total = 0;
+    int status = 0;
+    int threads_used = 0;
+
+    #pragma omp parallel num_threads(num_threads) reduction(+:total)
+    {
+        unsigned long long *slots = malloc(capacity * sizeof(unsigned long long));
+        #pragma omp single
+        threads_used = omp_get_num_threads();
+
+        // Every thread must reach the worksharing loop, even without a set
+        #pragma omp for schedule(dynamic, 1)
+        for (int p = 0; p < parts; p++) {
+            if (!slots) {
+                #pragma omp atomic write
+                status = -1;
+                continue;
+            }
+            long long size = part_begin[p + 1] - part_begin[p];
+            long long cap = 16;
+            while (cap < 2 * size) cap *= 2;
+            long long mask = cap - 1;
+            memset(slots, 0, cap * sizeof(unsigned long long));
+
+            long long distinct = 0;
+            int zero = 0;
+            for (long long i = part_begin[p]; i < part_begin[p + 1]; i++) {
+                unsigned long long key = partitioned[i];
+                if (key == 0) {
+                    zero = 1;
+                    continue;
+                }
+                long long slot = freq_hash(key) & mask;
+                while (slots[slot] != 0 && slots[slot] != key) slot = (slot + 1) & mask;
+                if (slots[slot] == 0) {
+                    slots[slot] = key;
+                    distinct++;
+                }
+            }
+            total += distinct + zero;
+        }
+        free(slots);
+    }
+
+    if (status == 0) {
+        *count = total;
+        *bytes = (double)in->n * sizeof(unsigned long long) +
+                 (double)threads_used * capacity * sizeof(unsigned long long) +
+                 (double)(parts + 1) * sizeof(long long);
+    }
+    freq_partitions_free(&part);
+    return status;
+}
+
+// ---- HyperLogLog ----
+
+typedef struct {
+    int precision;
+    long long m;                 // registers
+    unsigned char *registers;    // m bytes, 64-byte aligned
+} HllSketch;
+
+// Returns 0, or -1 on a bad precision or allocation failure
+static int hll_init(HllSketch *s, int precision) {
+    s->precision = precision;
+    s->m = 0;
+    s->registers = NULL;
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) return -1;
+    s->m = 1LL << precision;
+    s->registers = aligned_alloc(64, s->m);
+    if (!s->registers) return -1;
+    memset(s->registers, 0, s->m);
+    return 0;
+}
+
+static void hll_free(HllSketch *s) {
+    free(s->registers);
+    s->registers = NULL;
+}
+
+static inline size_t hll_memory_bytes(const HllSketch *s) {
+    return (size_t)s->m;
+}
+
+// Expected relative standard error of the estimate
+static inline double hll_std_error(int precision) {
+    return 1.04 / sqrt((double)(1LL << precision));
+}
+
+static inline void hll_add(HllSketch *s, unsigned long long key) {
+    int p = s->precision;
+    unsigned long long h = freq_hash(key);
+    // The guard bit caps the rank at 64 - p + 1 when the low bits are all 0
+    unsigned long long w = (h << p) | (1ULL << (p - 1));
+    unsigned char rank = (unsigned char)(__builtin_clzll(w) + 1);
+    unsigned char *r = &s->registers[h >> (64 - p)];
+    if (rank > *r) *r = rank;
+}
+
+static void hll_add_batch_scalar(HllSketch *s, const unsigned long long *keys, long long n) {
+    for (long long i = 0; i < n; i++) hll_add(s, keys[i]);
+}
+
+static void hll_merge_scalar(unsigned char *dst, const unsigned char *src, long long m) {
+    for (long long i = 0; i < m; i++) {
+        if (src[i] > dst[i]) dst[i] = src[i];
+    }
+}
+
+#ifdef RNG_X86
+// AVX-512 needs BW for the byte max and CD for lzcnt on top of rng_isa()'s F + DQ
+static inline int hll_avx512(void) {
+    return rng_isa() == RNG_ISA_AVX512 && __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512cd");
+}
+
+__attribute__((target("avx512f,avx512dq,avx512cd")))
+static void hll_add_batch_avx512(HllSketch *s, const unsigned long long *keys, long long n) {
+    int p = s->precision;
+    unsigned char *registers = s->registers;
+    const __m512i c1 = _mm512_set1_epi64((long long)0xff51afd7ed558ccdULL);
+    const __m512i c2 = _mm512_set1_epi64((long long)0xc4ceb9fe1a85ec53ULL);
+    const __m512i guard = _mm512_set1_epi64((long long)(1ULL << (p - 1)));
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m128i index_shift = _mm_cvtsi32_si128(64 - p);
+    const __m128i rank_shift = _mm_cvtsi32_si128(p);
+    unsigned long long index[8], rank[8];
+
+    long long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void *)&keys[i]);
+        x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+        x = _mm512_mullo_epi64(x, c1);
+        x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+        x = _mm512_mullo_epi64(x, c2);
+        x = _mm512_xor_si512(x, _mm512_srli_epi64(x, 33));
+        __m512i w = _mm512_or_si512(_mm512_sll_epi64(x, rank_shift), guard);
+        _mm512_storeu_si512((void *)index, _mm512_srl_epi64(x, index_shift));
+        _mm512_storeu_si512((void *)rank, _mm512_add_epi64(_mm512_lzcnt_epi64(w), one));
+        for (int j = 0; j < 8; j++) {
+            if (rank[j] > registers[index[j]]) registers[index[j]] = (unsigned char)rank[j];
+        }
+    }
+    hll_add_batch_scalar(s, &keys[i], n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void hll_merge_avx512(unsigned char *dst, const unsigned char *src, long long m) {
+    for (long long i = 0; i < m; i += 64) {
+        __m512i a = _mm512_load_si512((const void *)&dst[i]);
+        __m512i b = _mm512_load_si512((const void *)&src[i]);
+        _mm512_store_si512((void *)&dst[i], _mm512_max_epu8(a, b));
+    }
+}
+
+__attribute__((target("avx2")))
+static void hll_merge_avx2(unsigned char *dst, const unsigned char *src, long long m) {
+    for (long long i = 0; i < m; i += 32) {
+        __m256i a = _mm256_load_si256((const __m256i *)&dst[i]);
+        __m256i b = _mm256_load_si256((const __m256i *)&src[i]);
+        _mm256_store_si256((__m256i *)&dst[i], _mm256_max_epu8(a, b));
+    }
+}
+#endif
+
+static void hll_add_batch(HllSketch *s, const unsigned long long *keys, long long n) {
+#ifdef RNG_X86
+    if (hll_avx512()) {
+        hll_add_batch_avx512(s, keys, n);
+        return;
+    }
+#endif
+    hll_add_batch_scalar(s, keys, n);
+}
+
+// dst = max(dst, src) register by register. Returns -1 if the precisions differ.
+static int hll_merge(HllSketch *dst, const HllSketch *src) {
+    if (dst->precision != src->precision) return -1;
+#ifdef RNG_X86
+    if (hll_avx512()) {
+        hll_merge_avx512(dst->registers, src->registers, dst->m);
+        return 0;
+    }
+    if (rng_isa() >= RNG_ISA_AVX2) {
+        hll_merge_avx2(dst->registers, src->registers, dst->m);
+        return 0;
+    }
+#endif
+    hll_merge_scalar(dst->registers, src->registers, dst->m);
+    return 0;
+}
+
+// Ertl's sigma and tau series (both converge in a few dozen steps)
+static double hll_sigma(double x) {
+    if (x == 1.0) return INFINITY;
+    double y = 1.0, z = x, previous;
+    do {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (z != previous);
+    return z;
+}
+
+static double hll_tau(double x) {
+    if (x == 0.0 || x == 1.0) return 0.0;
+    double y = 1.0, z = 1.0 - x, previous;
+    do {
+        x = sqrt(x);
+        previous = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != previous);
+    return z / 3.0;
+}
+
+// Estimated number of distinct keys added to the sketch
+static double hll_estimate(const HllSketch *s) {
+    int q = 64 - s->precision;
+    long long histogram[66] = {0};
+    for (long long i = 0; i < s->m; i++) histogram[s->registers[i]]++;
+    if (histogram[0] == s->m) return 0.0;
+
+    double m = (double)s->m;
+    double z = m * hll_tau(1.0 - histogram[q + 1] / m);
+    for (int k = q; k >= 1; k--) z = 0.5 * (z + histogram[k]);
+    z += m * hll_sigma(histogram[0] / m);
+    return m * m / (2.0 * log(2.0) * z);
+}
+
+// Sketch of the reader's keys: one per thread over static chunk ranges,
+// merged into out (initialized here). Returns 0, or -1 on allocation failure.
+static int hll_count_chunks(const ChunkReader *in, int precision, HllSketch *out, int num_threads) {
+    if (hll_init(out, precision) != 0) return -1;
+    long long chunks = chunk_count(in);
+    int status = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        HllSketch local;
+        unsigned long long buffer[CHUNK_MAX];
+        int ok = (hll_init(&local, precision) == 0);
+
+        #pragma omp for schedule(static)
+        for (long long c = 0; c < chunks; c++) {
+            if (ok) hll_add_batch(&local, in->read(in->ctx, c, buffer), chunk_len(in, c));
+        }
+
+        #pragma omp critical
+        {
+            if (ok) hll_merge(out, &local);
+            else status = -1;
+        }
+        hll_free(&local);
+    }
+    return status;
+}
+
+#endif
@@ -0,0 +1,518 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // O_DIRECT
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#include "radix_sort.h"
+#include "freq.h"
+
+// External-memory exact order statistics and top-k for 64-bit keys.
+//
+// Spill (ext_spill): the stream is produced in chunks of half the memory
+// budget (the other half is the radix sort scratch). Each chunk is filled
+// in parallel by a caller-supplied function, radix-sorted, and written to
+// its own run file in EXT_IO_BLOCK pieces, then synced and dropped from
+// the page cache so the merge really reads from disk. With direct_io the
+// files are opened O_DIRECT (buffers are page aligned; the unaligned tail
+// of a run is written after clearing the flag), falling back to buffered
+// I/O where the filesystem refuses it. Every EXT_INDEX_STRIDE-th key of a
+// run is kept in memory as a sparse index.
+//
+// Merge (ext_merge_stats): the key space is cut into one range per thread
+// at quantiles of the pooled sparse index, and each run's split positions
+// are found by reading one index stride around them. A key never spans
+// two ranges, so every thread streams its range of every run through a
+// loser tree on its own: it counts, sums, tracks the top-k by run length,
+// counts distinct keys (one per run of equal keys) and picks up the
+// requested ranks that fall in its range. The read
+// buffers (one per run per thread) share the memory budget.
+//
+// Memory is bounded by the budget plus the sparse index (8 bytes per
+// EXT_INDEX_STRIDE keys); disk use is 8 bytes per key.
+
+#define EXT_ALIGN 4096                  // O_DIRECT offset and size alignment
+#define EXT_IO_BLOCK (8 << 20)          // bytes per write call
+#define EXT_INDEX_STRIDE 4096           // keys per sparse index entry
+#define EXT_MAX_RUNS 4096
+#define EXT_MIN_BUFFER EXT_ALIGN        // smallest per-run merge buffer, in bytes
+
+typedef struct {
+    size_t memory_budget;   // bytes
+    const char *dir;        // where run files go
+    int direct_io;          // try O_DIRECT
+} ExtConfig;
+
+// Fills out[0..count) with keys first..first+count-1 of the stream. Called
+// from a parallel region: tid is the calling thread, and each thread gets
+// one contiguous slice of every chunk.
+typedef void (*ExtFillFn)(void *ctx, int tid, long long first, long long count, unsigned long long *out);
+
+typedef struct {
+    int num_runs;
+    long long total;
+    long long lens[EXT_MAX_RUNS];
+    unsigned long long *index[EXT_MAX_RUNS];   // key at every EXT_INDEX_STRIDE-th position
+    char dir[256];
+    int pid;
+    int direct;                 // 1 if O_DIRECT was used
+    double gen_time, sort_time, write_time;
+    double merge_time;          // wall time of the merge, including reads
+    double read_time;           // time threads spent in read(), averaged over threads
+    double bytes_written, bytes_read;
+} ExtRuns;
+
+typedef struct {
+    long long count;
+    long long distinct;
+    unsigned long long min, max;
+    double mean;
+    int top_k;
+    FreqEntry top[FREQ_TOP_K_MAX];
+} ExtSummary;
+
+// Keys per chunk: half the budget, a whole number of aligned pages
+static inline long long ext_chunk_values(const ExtConfig *cfg) {
+    long long values = (long long)(cfg->memory_budget / 2 / sizeof(unsigned long long));
+    values -= values % (EXT_ALIGN / sizeof(unsigned long long));
+    return values > 0 ? values : EXT_ALIGN / (long long)sizeof(unsigned long long);
+}
+
+static inline void ext_run_path(const ExtRuns *runs, int run, char *path, size_t size) {
+    snprintf(path, size, "%s/ext_run_%d_%d.bin", runs->dir, runs->pid, run);
+}
+
+// Deletes the run files and frees the index
+static void ext_runs_free(ExtRuns *runs) {
+    char path[320];
+    for (int r = 0; r < runs->num_runs; r++) {
+        ext_run_path(runs, r, path, sizeof(path));
+        unlink(path);
+        free(runs->index[r]);
+        runs->index[r] = NULL;
+    }
+    runs->num_runs = 0;
+}
+
+static void *ext_alloc(size_t bytes) {
+    void *p = NULL;
+    if (posix_memalign(&p, EXT_ALIGN, bytes ? bytes : EXT_ALIGN) != 0) return NULL;
+    return p;
+}
+
+static int ext_write_all(int fd, const char *buf, size_t bytes) {
+    while (bytes > 0) {
+        size_t piece = bytes < EXT_IO_BLOCK ? bytes : EXT_IO_BLOCK;
+        ssize_t written = write(fd, buf, piece);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        buf += written;
+        bytes -= (size_t)written;
+    }
+    return 0;
+}
+
+// Writes one sorted run; returns 0 or -1
+static int ext_write_run(ExtRuns *runs, int run, const unsigned long long *data, long long n, int direct) {
+    char path[320];
+    ext_run_path(runs, run, path, sizeof(path));
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = direct ? open(path, flags | O_DIRECT, 0600) : -1;
+    if (fd < 0) {
+        fd = open(path, flags, 0600);
+        direct = 0;
+    }
+    if (fd < 0) return -1;
+    runs->direct = direct;
+
+    size_t bytes = (size_t)n * sizeof(unsigned long long);
+    size_t aligned = direct ? bytes - bytes % EXT_ALIGN : bytes;
+    int status = ext_write_all(fd, (const char *)data, aligned);
+    if (status == 0 && aligned < bytes) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        status = ext_write_all(fd, (const char *)data + aligned, bytes - aligned);
+    }
+    if (status == 0 && fdatasync(fd) != 0) status = -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (close(fd) != 0) status = -1;
+    return status;
+}
+
+// Produces `total` keys through fill and spills them as sorted runs.
+// Returns 0, or -1 (with the runs removed) if memory, the run count or
+// the disk gives out.
+static int ext_spill(const ExtConfig *cfg, long long total, ExtFillFn fill, void *ctx, int num_threads,
+                     ExtRuns *runs) {
+    memset(runs, 0, sizeof(*runs));
+    snprintf(runs->dir, sizeof(runs->dir), "%s", cfg->dir && *cfg->dir ? cfg->dir : ".");
+    runs->pid = (int)getpid();
+    runs->total = total;
+
+    long long chunk = ext_chunk_values(cfg);
+    if ((total + chunk - 1) / chunk > EXT_MAX_RUNS) {
+        errno = E2BIG;
+        return -1;
+    }
+    unsigned long long *data = ext_alloc(chunk * sizeof(unsigned long long));
+    unsigned long long *scratch = ext_alloc(chunk * sizeof(unsigned long long));
+    if (!data || !scratch) {
+        free(data);
+        free(scratch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int status = 0;
+    for (long long first = 0; first < total && status == 0; first += chunk) {
+        long long n = (total - first < chunk) ? total - first : chunk;
+        int run = runs->num_runs;
+
+        double t0 = omp_get_wtime();
+        #pragma omp parallel num_threads(num_threads)
+        {
+            int tid = omp_get_thread_num();
+            long long begin = n * tid / omp_get_num_threads();
+            long long end = n * (tid + 1) / omp_get_num_threads();
+            if (end > begin) fill(ctx, tid, first + begin, end - begin, &data[begin]);
+        }
+        double t1 = omp_get_wtime();
+        if (radix_sort_u64(data, scratch, n, num_threads) != 0) {
+            qsort(data, n, sizeof(unsigned long long), radix_compare_u64);
+        }
+
+        long long entries = (n + EXT_INDEX_STRIDE - 1) / EXT_INDEX_STRIDE;
+        runs->index[run] = malloc(entries * sizeof(unsigned long long));
+        if (!runs->index[run]) {
+            status = -1;
+            break;
+        }
+        for (long long e = 0; e < entries; e++) runs->index[run][e] = data[e * EXT_INDEX_STRIDE];
+        runs->lens[run] = n;
+        runs->num_runs++;
+        double t2 = omp_get_wtime();
+
+        if (ext_write_run(runs, run, data, n, cfg->direct_io) != 0) status = -1;
+        double t3 = omp_get_wtime();
+        runs->gen_time += t1 - t0;
+        runs->sort_time += t2 - t1;
+        runs->write_time += t3 - t2;
+        runs->bytes_written += (double)n * sizeof(unsigned long long);
+    }
+
+    free(data);
+    free(scratch);
+    if (status != 0) ext_runs_free(runs);
+    return status;
+}
+
+// Number of keys of run r below v, read around the sparse index
+static long long ext_lower_bound(const ExtRuns *runs, int r, unsigned long long v, int fd,
+                                 unsigned long long *block) {
+    const unsigned long long *index = runs->index[r];
+    long long entries = (runs->lens[r] + EXT_INDEX_STRIDE - 1) / EXT_INDEX_STRIDE;
+    long long lo = 0, hi = entries;   // first index entry >= v
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (index[mid] < v) lo = mid + 1; else hi = mid;
+    }
+    if (lo == 0) return 0;
+
+    // The answer lies in the stride that starts at entry lo - 1
+    long long base = (lo - 1) * EXT_INDEX_STRIDE;
+    long long n = runs->lens[r] - base < EXT_INDEX_STRIDE ? runs->lens[r] - base : EXT_INDEX_STRIDE;
+    ssize_t got = pread(fd, block, n * sizeof(unsigned long long), base * (off_t)sizeof(unsigned long long));
+    if (got != (ssize_t)(n * sizeof(unsigned long long))) return -1;
+    long long a = 0, b = n;
+    while (a < b) {
+        long long mid = a + (b - a) / 2;
+        if (block[mid] < v) a = mid + 1; else b = mid;
+    }
+    return base + a;
+}
+
+typedef struct {
+    int fd;
+    unsigned long long *buf;
+    long long cap;            // keys per buffer
+    long long pos, len;       // unread part of buf
+    off_t next, end;          // byte range of the file still to read
+    int direct;
+} ExtCursor;
+
+// Refills c->buf; returns the number of keys now available (0 at the end)
+static long long ext_cursor_fill(ExtCursor *c, double *read_time, double *bytes_read) {
+    c->pos = c->len = 0;
+    if (c->next >= c->end) return 0;
+    // Direct reads start at an aligned offset and skip the leading bytes
+    off_t start = c->direct ? c->next - c->next % EXT_ALIGN : c->next;
+    size_t want = (size_t)c->cap * sizeof(unsigned long long);
+    if (!c->direct && (off_t)want > c->end - start) want = (size_t)(c->end - start);
+
+    double t0 = omp_get_wtime();
+    size_t got = 0;
+    while (got < want) {
+        ssize_t r = pread(c->fd, (char *)c->buf + got, want - got, start + (off_t)got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += (size_t)r;
+        if (c->direct && start + (off_t)got >= c->end) break;
+    }
+    *read_time += omp_get_wtime() - t0;
+    *bytes_read += (double)got;
+
+    off_t valid_end = start + (off_t)got < c->end ? start + (off_t)got : c->end;
+    if (valid_end <= c->next) {
+        c->next = c->end;   // short read: treat as the end of the run
+        return 0;
+    }
+    c->pos = (c->next - start) / (off_t)sizeof(unsigned long long);
+    c->len = (valid_end - start) / (off_t)sizeof(unsigned long long);
+    c->next = valid_end;
+    return c->len - c->pos;
+}
+
+// Source a beats source b: smaller key, then live before exhausted, then
+// lower run (exhausted runs hold ULLONG_MAX). Written without branches:
+// on random keys every tree level would otherwise be a coin flip.
+static inline int ext_beats(const int *alive, unsigned long long key_a, int a, unsigned long long key_b, int b) {
+    int tie = (alive[a] > alive[b]) | ((alive[a] == alive[b]) & (a < b));
+    return (key_a < key_b) | ((key_a == key_b) & tie);
+}
+
+static int ext_tree_init(int *tree, int k, const int *alive, const unsigned long long *head, int node) {
+    if (node >= k) return node - k;
+    int a = ext_tree_init(tree, k, alive, head, 2 * node);
+    int b = ext_tree_init(tree, k, alive, head, 2 * node + 1);
+    if (ext_beats(alive, head[b], b, head[a], a)) {
+        tree[node] = a;
+        return b;
+    }
+    tree[node] = b;
+    return a;
+}
+
+typedef struct {
+    long long count;
+    long long distinct;
+    unsigned __int128 sum;
+    unsigned long long min, max;
+    FreqTopK top;
+    int failed;
+} ExtPartial;
+
+// Merges keys [starts[r], ends[r]) of every run; global rank of the first
+// key is `base`. Ranks in [base, base + count) are written to values[].
+static void ext_merge_range(const ExtRuns *runs, const int *fds, const long long *starts, const long long *ends,
+                            long long cap, int direct, long long base, const long long *ranks,
+                            unsigned long long *values, int num_ranks, int k_top, ExtPartial *part,
+                            double *read_time, double *bytes_read) {
+    int k = runs->num_runs;
+    memset(part, 0, sizeof(*part));
+    freq_topk_init(&part->top, k_top);
+    ExtCursor *cur = calloc(k, sizeof(ExtCursor));
+    int *alive = calloc(k, sizeof(int));
+    unsigned long long *head = calloc(k, sizeof(unsigned long long));
+    int *tree = calloc(k + 1, sizeof(int));
+    unsigned long long *tree_key = calloc(k + 1, sizeof(unsigned long long));   // key of each node's loser
+    unsigned long long *buffers = ext_alloc((size_t)k * cap * sizeof(unsigned long long));
+    if (!cur || !alive || !head || !tree || !tree_key || !buffers) {
+        part->failed = 1;
+        free(cur); free(alive); free(head); free(tree); free(tree_key); free(buffers);
+        return;
+    }
+
+    for (int r = 0; r < k; r++) {
+        cur[r].fd = fds[r];
+        cur[r].buf = &buffers[(size_t)r * cap];
+        cur[r].cap = cap;
+        cur[r].direct = direct;
+        cur[r].next = starts[r] * (off_t)sizeof(unsigned long long);
+        cur[r].end = ends[r] * (off_t)sizeof(unsigned long long);
+        alive[r] = ext_cursor_fill(&cur[r], read_time, bytes_read) > 0;
+        head[r] = alive[r] ? cur[r].buf[cur[r].pos] : ULLONG_MAX;
+    }
+    int winner = (k == 1) ? 0 : ext_tree_init(tree, k, alive, head, 1);
+    for (int node = 1; node < k; node++) tree_key[node] = head[tree[node]];
+    unsigned long long key = head[winner];
+
+    // Accumulate in locals: stores through part could alias the buffers
+    long long count = 0, distinct = 0;
+    unsigned __int128 sum = 0;
+    unsigned long long min = 0, max = 0;
+    unsigned long long run_value = 0;
+    long long run_count = 0;
+    long long rank = base;
+    while (alive[winner]) {
+        unsigned long long v = key;
+        if (count == 0) min = v;
+        max = v;
+        count++;
+        sum += v;
+        for (int i = 0; i < num_ranks; i++) if (ranks[i] == rank) values[i] = v;
+        rank++;
+        if (run_count > 0 && v == run_value) {
+            run_count++;
+        } else {
+            if (run_count > 0) freq_topk_offer(&part->top, run_value, run_count);
+            run_value = v;
+            run_count = 1;
+            distinct++;
+        }
+
+        ExtCursor *c = &cur[winner];
+        if (++c->pos < c->len || ext_cursor_fill(c, read_time, bytes_read) > 0) {
+            key = c->buf[c->pos];
+        } else {
+            alive[winner] = 0;
+            key = ULLONG_MAX;
+        }
+        for (int node = (winner + k) / 2; node >= 1; node /= 2) {
+            int other = tree[node];
+            unsigned long long other_key = tree_key[node];
+            int swap = ext_beats(alive, other_key, other, key, winner);
+            tree[node] = swap ? winner : other;
+            tree_key[node] = swap ? key : other_key;
+            winner = swap ? other : winner;
+            key = swap ? other_key : key;
+        }
+    }
+    if (run_count > 0) freq_topk_offer(&part->top, run_value, run_count);
+    part->count = count;
+    part->distinct = distinct;
+    part->sum = sum;
+    part->min = min;
+    part->max = max;
+
+    free(cur); free(alive); free(head); free(tree); free(tree_key); free(buffers);
+}
+
+// Exact count, distinct count, min, max, mean, top-k and the keys at the
+// given ranks (0-based, any order) over all runs. Returns 0, or -1 if a
+// file cannot be read or memory runs out.
+static int ext_merge_stats(const ExtConfig *cfg, ExtRuns *runs, const long long *ranks, unsigned long long *values,
+                           int num_ranks, int k_top, ExtSummary *out, int num_threads) {
+    int k = runs->num_runs;
+    memset(out, 0, sizeof(*out));
+    if (k == 0) return 0;
+    double start = omp_get_wtime();
+
+    int *fds = malloc(k * sizeof(int));
+    int *probe_fds = malloc(k * sizeof(int));
+    long long *splits = malloc((size_t)(num_threads + 1) * k * sizeof(long long));
+    ExtPartial *parts = calloc(num_threads, sizeof(ExtPartial));
+    double *read_times = calloc(num_threads, sizeof(double));
+    double *bytes_read = calloc(num_threads, sizeof(double));
+    unsigned long long *splitters = malloc((num_threads + 1) * sizeof(unsigned long long));
+    if (!fds || !probe_fds || !splits || !parts || !read_times || !bytes_read || !splitters) {
+        free(fds); free(probe_fds); free(splits); free(parts); free(read_times); free(bytes_read); free(splitters);
+        return -1;
+    }
+
+    int status = 0;
+    char path[320];
+    for (int r = 0; r < k; r++) {
+        ext_run_path(runs, r, path, sizeof(path));
+        fds[r] = runs->direct ? open(path, O_RDONLY | O_CLOEXEC | O_DIRECT) : -1;
+        if (fds[r] < 0) fds[r] = open(path, O_RDONLY | O_CLOEXEC);
+        probe_fds[r] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fds[r] < 0 || probe_fds[r] < 0) status = -1;
+    }
+    int direct = runs->direct;
+
+    // Splitters: quantiles of the pooled sparse index
+    long long pooled = 0;
+    for (int r = 0; r < k; r++) pooled += (runs->lens[r] + EXT_INDEX_STRIDE - 1) / EXT_INDEX_STRIDE;
+    unsigned long long *pool = malloc(pooled * sizeof(unsigned long long));
+    if (!pool) status = -1;
+    if (status == 0) {
+        long long p = 0;
+        for (int r = 0; r < k; r++) {
+            long long entries = (runs->lens[r] + EXT_INDEX_STRIDE - 1) / EXT_INDEX_STRIDE;
+            memcpy(&pool[p], runs->index[r], entries * sizeof(unsigned long long));
+            p += entries;
+        }
+        qsort(pool, pooled, sizeof(unsigned long long), radix_compare_u64);
+        for (int t = 1; t < num_threads; t++) splitters[t] = pool[pooled * t / num_threads];
+    }
+    free(pool);
+
+    // splits[t * k + r]: first key of run r that belongs to thread t
+    if (status == 0) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            unsigned long long *block = malloc(EXT_INDEX_STRIDE * sizeof(unsigned long long));
+            #pragma omp for collapse(2) schedule(dynamic)
+            for (int t = 0; t <= num_threads; t++) {
+                for (int r = 0; r < k; r++) {
+                    long long pos;
+                    if (t == 0) pos = 0;
+                    else if (t == num_threads) pos = runs->lens[r];
+                    else pos = block ? ext_lower_bound(runs, r, splitters[t], probe_fds[r], block) : -1;
+                    if (pos < 0) {
+                        #pragma omp atomic write
+                        status = -1;
+                    }
+                    splits[(size_t)t * k + r] = pos;
+                }
+            }
+            free(block);
+        }
+    }
+
+    if (status == 0) {
+        // Per-run buffers of every thread share the budget
+        long long cap = (long long)(cfg->memory_budget / ((size_t)num_threads * k) / sizeof(unsigned long long));
+        cap -= cap % (EXT_ALIGN / sizeof(unsigned long long));
+        if (cap < (long long)(EXT_MIN_BUFFER / sizeof(unsigned long long))) {
+            cap = EXT_MIN_BUFFER / sizeof(unsigned long long);
+        }
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            int t = omp_get_thread_num();
+            long long base = 0;
+            for (int r = 0; r < k; r++) base += splits[(size_t)t * k + r];
+            ext_merge_range(runs, fds, &splits[(size_t)t * k], &splits[(size_t)(t + 1) * k], cap, direct, base,
+                            ranks, values, num_ranks, k_top, &parts[t], &read_times[t], &bytes_read[t]);
+        }
+
+        FreqTopK best;
+        freq_topk_init(&best, k_top);
+        unsigned __int128 sum = 0;
+        for (int t = 0; t < num_threads; t++) {
+            const ExtPartial *p = &parts[t];
+            if (p->failed) status = -1;
+            if (p->count == 0) continue;
+            if (out->count == 0) out->min = p->min;
+            out->max = p->max;
+            out->count += p->count;
+            out->distinct += p->distinct;
+            sum += p->sum;
+            for (int i = 0; i < p->top.size; i++) freq_topk_offer(&best, p->top.entries[i].value, p->top.entries[i].count);
+            runs->read_time += read_times[t] / num_threads;
+            runs->bytes_read += bytes_read[t];
+        }
+        out->mean = out->count ? (double)sum / out->count : 0.0;
+        out->top_k = best.size;
+        memcpy(out->top, best.entries, best.size * sizeof(FreqEntry));
+        if (out->count != runs->total) status = -1;
+    }
+
+    for (int r = 0; r < k; r++) {
+        if (fds[r] >= 0) close(fds[r]);
+        if (probe_fds[r] >= 0) close(probe_fds[r]);
+    }
+    free(fds); free(probe_fds); free(splits); free(parts); free(read_times); free(bytes_read); free(splitters);
+    runs->merge_time += omp_get_wtime() - start;
+    return status;
+}
+
+#endif
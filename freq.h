@@ -0,0 +1,479 @@
+#ifndef FREQ_H
+#define FREQ_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "chunk.h"
+
+// Frequency engine for 64-bit keys: exact mode / top-k and approximate
+// heavy hitters.
+//
+// Exact (freq_exact_topk): keys are radix-partitioned by the high bits of
+// their hash (per-thread histograms, prefix-summed scatter offsets), so
+// every distinct key lands in exactly one partition. Threads then take
+// whole partitions and count them in a private open-addressing table, keep
+// a local top-k, and the local top-k lists are merged at the end. No table
+// is ever shared, so there are no locks or atomics on the counting path.
+// The two passes over the input go through a ChunkReader (chunk.h), so an
+// encoded column is counted without decoding it in full. The partition
+// pass (freq_partition) is shared with the distinct counter in distinct.h.
+//
+// Sorted input (freq_sorted_topk): a parallel run-length scan.
+//
+// Approximate (HeavyHitters): a Count-Min sketch (conservative update)
+// plus a fixed-size candidate table in SpaceSaving style: a key that is not
+// tracked replaces the smallest candidate once its Count-Min estimate
+// exceeds it. Both parts merge, so per-thread summaries can be combined.
+// Estimates never undercount and overcount by at most e * n / width with
+// probability 1 - e^-depth.
+
+#define FREQ_TOP_K_MAX 16
+#define FREQ_PARTITION_TARGET 65536  // keys per partition, so tables stay cache-resident
+
+typedef struct {
+    unsigned long long value;
+    long long count;
+} FreqEntry;
+
+typedef struct {
+    FreqEntry entries[FREQ_TOP_K_MAX];
+    int size;
+    int k;
+} FreqTopK;
+
+// murmur3 fmix64: cheap, well-mixed in every bit
+static inline unsigned long long freq_hash(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Higher count wins; ties go to the smaller value so results are deterministic
+static inline int freq_better(unsigned long long value, long long count, const FreqEntry *e) {
+    return count > e->count || (count == e->count && value < e->value);
+}
+
+static void freq_topk_init(FreqTopK *t, int k) {
+    t->size = 0;
+    t->k = (k > FREQ_TOP_K_MAX) ? FREQ_TOP_K_MAX : k;
+}
+
+static void freq_topk_offer(FreqTopK *t, unsigned long long value, long long count) {
+    if (t->k <= 0) return;
+    if (t->size == t->k && !freq_better(value, count, &t->entries[t->size - 1])) return;
+
+    int i = (t->size < t->k) ? t->size++ : t->size - 1;
+    while (i > 0 && freq_better(value, count, &t->entries[i - 1])) {
+        t->entries[i] = t->entries[i - 1];
+        i--;
+    }
+    t->entries[i].value = value;
+    t->entries[i].count = count;
+}
+
+// Keys radix-partitioned by the high bits of their hash: partition p is
+// keys[begin[p] .. begin[p + 1]), and every occurrence of a key is in the
+// same partition
+typedef struct {
+    unsigned long long *keys;
+    long long *begin;        // parts + 1 offsets
+    int parts;
+    long long max_part;      // keys in the largest partition
+    int owns_keys;
+} FreqPartitions;
+
+static void freq_partitions_free(FreqPartitions *p) {
+    if (p->owns_keys) free(p->keys);
+    free(p->begin);
+    p->keys = NULL;
+    p->begin = NULL;
+}
+
+// Partitions the reader's keys into scratch (n keys, or NULL to allocate
+// it) with enough partitions for num_threads and tables of about
+// FREQ_PARTITION_TARGET keys. Returns 0, or -1 on allocation failure.
+static int freq_partition(const ChunkReader *in, unsigned long long *scratch, int num_threads, FreqPartitions *out) {
+    long long n = in->n;
+    long long chunks = chunk_count(in);
+
+    int bits = 0;
+    while ((1LL << bits) < num_threads * 4 || (n >> bits) > FREQ_PARTITION_TARGET) bits++;
+    int parts = 1 << bits;
+    int shift = 64 - bits;
+
+    out->owns_keys = (scratch == NULL);
+    if (out->owns_keys) scratch = malloc((n > 0 ? n : 1) * sizeof(unsigned long long));
+    long long *offsets = calloc((size_t)num_threads * parts, sizeof(long long));
+    long long *part_begin = malloc((parts + 1) * sizeof(long long));
+    if (!scratch || !offsets || !part_begin) {
+        if (out->owns_keys) free(scratch);
+        free(offsets);
+        free(part_begin);
+        out->keys = NULL;
+        out->begin = NULL;
+        return -1;
+    }
+
+    long long max_part = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int nthreads = omp_get_num_threads();
+        int tid = omp_get_thread_num();
+        long long c_begin = chunks * tid / nthreads;
+        long long c_end = chunks * (tid + 1) / nthreads;
+        long long *offset = &offsets[(size_t)tid * parts];
+        unsigned long long buffer[CHUNK_MAX];
+
+        // 1. Partition histogram of this thread's slice
+        for (long long c = c_begin; c < c_end; c++) {
+            long long len = chunk_len(in, c);
+            const unsigned long long *keys = in->read(in->ctx, c, buffer);
+            for (long long i = 0; i < len; i++) {
+                offset[freq_hash(keys[i]) >> shift]++;
+            }
+        }
+
+        #pragma omp barrier
+
+        // 2. Prefix sum across (partition, thread)
+        #pragma omp single
+        {
+            long long running = 0;
+            for (int p = 0; p < parts; p++) {
+                part_begin[p] = running;
+                for (int t = 0; t < nthreads; t++) {
+                    long long c = offsets[(size_t)t * parts + p];
+                    offsets[(size_t)t * parts + p] = running;
+                    running += c;
+                }
+                if (running - part_begin[p] > max_part) max_part = running - part_begin[p];
+            }
+            part_begin[parts] = running;
+        }
+
+        // 3. Scatter keys into their partitions
+        for (long long c = c_begin; c < c_end; c++) {
+            long long len = chunk_len(in, c);
+            const unsigned long long *keys = in->read(in->ctx, c, buffer);
+            for (long long i = 0; i < len; i++) {
+                unsigned long long key = keys[i];
+                scratch[offset[freq_hash(key) >> shift]++] = key;
+            }
+        }
+    }
+
+    free(offsets);
+    out->keys = scratch;
+    out->begin = part_begin;
+    out->parts = parts;
+    out->max_part = max_part;
+    return 0;
+}
+
+// Exact top-k (by count) of the reader's keys. out receives up to k entries
+// in descending count order; *found is how many. scratch must hold n keys
+// or be NULL to allocate one. Returns 0 on success, -1 on allocation failure.
+static int freq_exact_topk_chunks(const ChunkReader *in, unsigned long long *scratch,
+                                  int k, FreqEntry *out, int *found, int num_threads) {
+    *found = 0;
+    if (in->n <= 0) return 0;
+
+    FreqPartitions part;
+    if (freq_partition(in, scratch, num_threads, &part) != 0) return -1;
+    const unsigned long long *partitioned = part.keys;
+    const long long *part_begin = part.begin;
+    int parts = part.parts;
+
+    FreqTopK best;
+    freq_topk_init(&best, k);
+    int status = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        // 4. Count each partition in a private open-addressing table
+        long long capacity = 16;
+        while (capacity < 2 * part.max_part) capacity *= 2;
+        unsigned long long *keys = malloc(capacity * sizeof(unsigned long long));
+        long long *counts = malloc(capacity * sizeof(long long));
+        FreqTopK local;
+        freq_topk_init(&local, k);
+
+        // Every thread must reach the worksharing loop, even without a table
+        #pragma omp for schedule(dynamic, 1)
+        for (int p = 0; p < parts; p++) {
+            if (!keys || !counts) {
+                #pragma omp atomic write
+                status = -1;
+                continue;
+            }
+            long long size = part_begin[p + 1] - part_begin[p];
+            long long cap = 16;
+            while (cap < 2 * size) cap *= 2;
+            long long mask = cap - 1;
+            memset(counts, 0, cap * sizeof(long long));
+
+            for (long long i = part_begin[p]; i < part_begin[p + 1]; i++) {
+                unsigned long long key = partitioned[i];
+                long long slot = freq_hash(key) & mask;
+                while (counts[slot] != 0 && keys[slot] != key) slot = (slot + 1) & mask;
+                keys[slot] = key;
+                counts[slot]++;
+            }
+            for (long long slot = 0; slot < cap; slot++) {
+                if (counts[slot]) freq_topk_offer(&local, keys[slot], counts[slot]);
+            }
+        }
+
+        #pragma omp critical
+        {
+            for (int i = 0; i < local.size; i++) {
+                freq_topk_offer(&best, local.entries[i].value, local.entries[i].count);
+            }
+        }
+        free(keys);
+        free(counts);
+    }
+
+    if (status == 0) {
+        memcpy(out, best.entries, best.size * sizeof(FreqEntry));
+        *found = best.size;
+    }
+    freq_partitions_free(&part);
+    return status;
+}
+
+static inline int freq_exact_topk(const unsigned long long *data, long long n, unsigned long long *scratch,
+                                  int k, FreqEntry *out, int *found, int num_threads) {
+    ChunkReader in = chunk_array(data, n);
+    return freq_exact_topk_chunks(&in, scratch, k, out, found, num_threads);
+}
+
+// Exact top-k of already sorted data by run-length scan. Each thread owns
+// the runs that start inside its slice.
+static void freq_sorted_topk(const unsigned long long *data, long long n, int k,
+                             FreqEntry *out, int *found, int num_threads) {
+    FreqTopK best;
+    freq_topk_init(&best, k);
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int nthreads = omp_get_num_threads();
+        int tid = omp_get_thread_num();
+        long long begin = n * tid / nthreads;
+        long long end = n * (tid + 1) / nthreads;
+        FreqTopK local;
+        freq_topk_init(&local, k);
+
+        // Skip a run that started in the previous slice
+        while (begin > 0 && begin < end && data[begin] == data[begin - 1]) begin++;
+
+        long long i = begin;
+        while (i < end) {
+            long long j = i + 1;
+            while (j < n && data[j] == data[i]) j++;  // runs may extend past end
+            freq_topk_offer(&local, data[i], j - i);
+            i = j;
+        }
+
+        #pragma omp critical
+        {
+            for (int e = 0; e < local.size; e++) {
+                freq_topk_offer(&best, local.entries[e].value, local.entries[e].count);
+            }
+        }
+    }
+
+    memcpy(out, best.entries, best.size * sizeof(FreqEntry));
+    *found = best.size;
+}
+
+#define HH_DEPTH 4
+#define HH_WIDTH_BITS 16
+#define HH_WIDTH (1 << HH_WIDTH_BITS)
+#define HH_CANDIDATES 1024
+
+typedef struct {
+    unsigned int cm[HH_DEPTH][HH_WIDTH];
+    long long n;
+    int size;
+    // Candidates: a min-heap (by count) of ids into key/count/pos, plus an
+    // open-addressing index from key to id (linear probing, -1 = empty)
+    unsigned long long key[HH_CANDIDATES];
+    long long count[HH_CANDIDATES];
+    int pos[HH_CANDIDATES];
+    int heap[HH_CANDIDATES];
+    int index[2 * HH_CANDIDATES];
+} HeavyHitters;
+
+static void hh_init(HeavyHitters *h) {
+    memset(h->cm, 0, sizeof(h->cm));
+    h->n = 0;
+    h->size = 0;
+    for (int i = 0; i < 2 * HH_CANDIDATES; i++) h->index[i] = -1;
+}
+
+static inline unsigned int hh_row_slot(unsigned long long hash, int row) {
+    unsigned int h1 = (unsigned int)hash;
+    unsigned int h2 = (unsigned int)(hash >> 32) | 1;
+    return (h1 + row * h2) & (HH_WIDTH - 1);
+}
+
+static long long hh_estimate(const HeavyHitters *h, unsigned long long key) {
+    unsigned long long hash = freq_hash(key);
+    unsigned int est = ~0U;
+    for (int r = 0; r < HH_DEPTH; r++) {
+        unsigned int c = h->cm[r][hh_row_slot(hash, r)];
+        if (c < est) est = c;
+    }
+    return est;
+}
+
+static int hh_find(const HeavyHitters *h, unsigned long long key) {
+    int slot = freq_hash(key) & (2 * HH_CANDIDATES - 1);
+    while (h->index[slot] >= 0) {
+        if (h->key[h->index[slot]] == key) return slot;
+        slot = (slot + 1) & (2 * HH_CANDIDATES - 1);
+    }
+    return -slot - 1;  // not found: encodes the free slot
+}
+
+// Backward-shift deletion keeps linear probing chains intact without tombstones
+static void hh_index_remove(HeavyHitters *h, int slot) {
+    int mask = 2 * HH_CANDIDATES - 1;
+    int next = (slot + 1) & mask;
+    while (h->index[next] >= 0) {
+        int home = freq_hash(h->key[h->index[next]]) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            h->index[slot] = h->index[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    h->index[slot] = -1;
+}
+
+static void hh_heap_swap(HeavyHitters *h, int a, int b) {
+    int t = h->heap[a];
+    h->heap[a] = h->heap[b];
+    h->heap[b] = t;
+    h->pos[h->heap[a]] = a;
+    h->pos[h->heap[b]] = b;
+}
+
+static void hh_sift_down(HeavyHitters *h, int i) {
+    for (;;) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < h->size && h->count[h->heap[l]] < h->count[h->heap[smallest]]) smallest = l;
+        if (r < h->size && h->count[h->heap[r]] < h->count[h->heap[smallest]]) smallest = r;
+        if (smallest == i) return;
+        hh_heap_swap(h, i, smallest);
+        i = smallest;
+    }
+}
+
+static void hh_sift_up(HeavyHitters *h, int i) {
+    while (i > 0 && h->count[h->heap[(i - 1) / 2]] > h->count[h->heap[i]]) {
+        hh_heap_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+// Tracks key with count est: raises it if tracked, otherwise inserts it or
+// replaces the smallest candidate when est beats it
+static void hh_offer(HeavyHitters *h, unsigned long long key, long long est) {
+    int slot = hh_find(h, key);
+    if (slot >= 0) {
+        int id = h->index[slot];
+        if (est > h->count[id]) {
+            h->count[id] = est;
+            hh_sift_down(h, h->pos[id]);
+        }
+        return;
+    }
+
+    int id;
+    if (h->size < HH_CANDIDATES) {
+        id = h->size;
+        h->heap[h->size] = id;
+        h->pos[id] = h->size++;
+    } else {
+        id = h->heap[0];
+        if (est <= h->count[id]) return;
+        hh_index_remove(h, hh_find(h, h->key[id]));
+        slot = hh_find(h, key);  // the free slot may have moved
+    }
+    h->index[-slot - 1] = id;
+    h->key[id] = key;
+    h->count[id] = est;
+    hh_sift_down(h, h->pos[id]);
+    hh_sift_up(h, h->pos[id]);
+}
+
+static void hh_update(HeavyHitters *h, unsigned long long key) {
+    unsigned long long hash = freq_hash(key);
+    unsigned int slots[HH_DEPTH];
+    unsigned int est = ~0U;
+    for (int r = 0; r < HH_DEPTH; r++) {
+        slots[r] = hh_row_slot(hash, r);
+        if (h->cm[r][slots[r]] < est) est = h->cm[r][slots[r]];
+    }
+    // Conservative update: only raise the counters that hold the minimum
+    est++;
+    for (int r = 0; r < HH_DEPTH; r++) {
+        if (h->cm[r][slots[r]] < est) h->cm[r][slots[r]] = est;
+    }
+    h->n++;
+
+    if (h->size < HH_CANDIDATES || est > h->count[h->heap[0]]) hh_offer(h, key, est);
+}
+
+static void hh_update_batch(HeavyHitters *h, const unsigned long long *values, long long n) {
+    for (long long i = 0; i < n; i++) hh_update(h, values[i]);
+}
+
+// dst += src. Count-Min rows add; candidates are re-estimated against the
+// merged sketch and the best HH_CANDIDATES are kept.
+static void hh_merge(HeavyHitters *dst, const HeavyHitters *src) {
+    for (int r = 0; r < HH_DEPTH; r++) {
+        for (int c = 0; c < HH_WIDTH; c++) dst->cm[r][c] += src->cm[r][c];
+    }
+    dst->n += src->n;
+
+    // Re-estimate current candidates, then offer src's
+    for (int id = 0; id < dst->size; id++) dst->count[id] = hh_estimate(dst, dst->key[id]);
+    for (int i = dst->size / 2 - 1; i >= 0; i--) hh_sift_down(dst, i);
+    for (int id = 0; id < src->size; id++) {
+        hh_offer(dst, src->key[id], hh_estimate(dst, src->key[id]));
+    }
+}
+
+static int hh_compare_desc(const void *a, const void *b) {
+    const FreqEntry *x = a, *y = b;
+    if (x->count != y->count) return (x->count < y->count) - (x->count > y->count);
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+// Top-k candidates by estimated count, descending
+static int hh_topk(const HeavyHitters *h, int k, FreqEntry *out) {
+    FreqEntry all[HH_CANDIDATES];
+    for (int id = 0; id < h->size; id++) {
+        all[id].value = h->key[id];
+        all[id].count = hh_estimate(h, h->key[id]);
+    }
+    qsort(all, h->size, sizeof(FreqEntry), hh_compare_desc);
+    int found = (k < h->size) ? k : h->size;
+    memcpy(out, all, found * sizeof(FreqEntry));
+    return found;
+}
+
+// Additive error bound of the estimates (holds with probability 1 - e^-depth)
+static double hh_error_bound(const HeavyHitters *h) {
+    return 2.718281828 * h->n / HH_WIDTH;
+}
+
+#endif
@@ -0,0 +1,360 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86 1
+#endif
+
+// Packed-panel double GEMM, C += A * B on contiguous row-major matrices.
+//
+// Goto/BLIS structure: the jc loop cuts B into nc-wide column panels (L3),
+// the pc loop cuts the k dimension into kc-deep slices, and the B slice is
+// packed once into NR-wide micro-panels laid out k-major. The ic loop then
+// hands mc-row blocks of A to the threads; each packs its block into
+// MR-tall micro-panels (L2) and runs the micro-kernel over every (ir, jr)
+// micro-tile. The micro-kernel keeps an MR x NR tile of C in registers and
+// does one broadcast-FMA per A element per k step, so its loads are
+// unit-stride streams from L1 and L2.
+//
+// Micro-kernels (double precision) are generated per register tile by the
+// GEMM_*_KERNEL macros, so every tile shape is a separate function with
+// constant trip counts and fully unrolled inner loops:
+//   AVX-512: 14x16 (default), 8x24, 28x8   (up to 28 zmm accumulators)
+//   AVX2+FMA: 6x8 (default), 4x12, 8x4     (up to 12 ymm accumulators)
+//   generic:  4x8                          (plain C)
+// The cache blocking (mc, kc, nc) is a runtime GemmConfig; gemm_tune.h
+// searches both. Partial tiles at the matrix edges are computed into a
+// zero-padded buffer and added to C.
+
+#define GEMM_ALIGN 64
+#define GEMM_MAX_TILE (28 * 8)
+
+typedef void (*GemmKernelFn)(int kc, const double *a, const double *b, double *c, long ldc);
+
+typedef enum { GEMM_ISA_GENERIC, GEMM_ISA_AVX2, GEMM_ISA_AVX512 } GemmIsa;
+
+typedef struct {
+    const char *name;
+    GemmIsa isa;
+    int mr, nr;           // register tile
+    GemmKernelFn kernel;
+} GemmKernel;
+
+typedef struct {
+    const GemmKernel *kernel;
+    int mc, kc, nc;       // cache blocking: L2 block of A, depth, L3 panel of B
+} GemmConfig;
+
+// Allocates a rows x cols matrix as one 64-byte aligned block
+static inline double *gemm_alloc_matrix(int rows, int cols) {
+    size_t bytes = (size_t)rows * cols * sizeof(double);
+    bytes = (bytes + GEMM_ALIGN - 1) / GEMM_ALIGN * GEMM_ALIGN;
+    return aligned_alloc(GEMM_ALIGN, bytes ? bytes : GEMM_ALIGN);
+}
+
+#define GEMM_GENERIC_KERNEL(MR, NR)                                                      \
+    static void gemm_kernel_generic_##MR##x##NR(int kc, const double *a, const double *b, \
+                                                double *c, long ldc) {                   \
+        double acc[MR][NR] = {{0}};                                                      \
+        for (int p = 0; p < kc; p++) {                                                   \
+            for (int i = 0; i < MR; i++) {                                               \
+                for (int j = 0; j < NR; j++) acc[i][j] += a[i] * b[j];                   \
+            }                                                                            \
+            a += MR;                                                                     \
+            b += NR;                                                                     \
+        }                                                                                \
+        for (int i = 0; i < MR; i++) {                                                   \
+            for (int j = 0; j < NR; j++) c[i * ldc + j] += acc[i][j];                    \
+        }                                                                                \
+    }
+
+GEMM_GENERIC_KERNEL(4, 8)
+
+#ifdef GEMM_X86
+
+// MR rows x NR columns, NR / 4 ymm registers per row of C
+#define GEMM_AVX2_KERNEL(MR, NR)                                                         \
+    __attribute__((target("avx2,fma")))                                                 \
+    static void gemm_kernel_avx2_##MR##x##NR(int kc, const double *a, const double *b,    \
+                                             double *c, long ldc) {                      \
+        enum { NV = (NR) / 4 };                                                          \
+        __m256d acc[MR][NV];                                                             \
+        _Pragma("GCC unroll 32")                                                         \
+        for (int i = 0; i < MR; i++) {                                                   \
+            for (int v = 0; v < NV; v++) acc[i][v] = _mm256_setzero_pd();                \
+        }                                                                                \
+        for (int p = 0; p < kc; p++) {                                                   \
+            __m256d bv[NV];                                                              \
+            _Pragma("GCC unroll 8")                                                      \
+            for (int v = 0; v < NV; v++) bv[v] = _mm256_load_pd(b + 4 * v);              \
+            _Pragma("GCC unroll 32")                                                     \
+            for (int i = 0; i < MR; i++) {                                               \
+                __m256d ai = _mm256_broadcast_sd(&a[i]);                                 \
+                _Pragma("GCC unroll 8")                                                  \
+                for (int v = 0; v < NV; v++) acc[i][v] = _mm256_fmadd_pd(ai, bv[v], acc[i][v]); \
+            }                                                                            \
+            a += MR;                                                                     \
+            b += NR;                                                                     \
+        }                                                                                \
+        _Pragma("GCC unroll 32")                                                         \
+        for (int i = 0; i < MR; i++) {                                                   \
+            for (int v = 0; v < NV; v++) {                                               \
+                double *cp = &c[i * ldc + 4 * v];                                        \
+                _mm256_storeu_pd(cp, _mm256_add_pd(_mm256_loadu_pd(cp), acc[i][v]));     \
+            }                                                                            \
+        }                                                                                \
+    }
+
+// MR rows x NR columns, NR / 8 zmm registers per row of C
+#define GEMM_AVX512_KERNEL(MR, NR)                                                       \
+    __attribute__((target("avx512f")))                                                  \
+    static void gemm_kernel_avx512_##MR##x##NR(int kc, const double *a, const double *b,  \
+                                               double *c, long ldc) {                    \
+        enum { NV = (NR) / 8 };                                                          \
+        __m512d acc[MR][NV];                                                             \
+        _Pragma("GCC unroll 32")                                                         \
+        for (int i = 0; i < MR; i++) {                                                   \
+            for (int v = 0; v < NV; v++) acc[i][v] = _mm512_setzero_pd();                \
+        }                                                                                \
+        for (int p = 0; p < kc; p++) {                                                   \
+            __m512d bv[NV];                                                              \
+            _Pragma("GCC unroll 8")                                                      \
+            for (int v = 0; v < NV; v++) bv[v] = _mm512_load_pd(b + 8 * v);              \
+            _Pragma("GCC unroll 32")                                                     \
+            for (int i = 0; i < MR; i++) {                                               \
+                __m512d ai = _mm512_set1_pd(a[i]);                                       \
+                _Pragma("GCC unroll 8")                                                  \
+                for (int v = 0; v < NV; v++) acc[i][v] = _mm512_fmadd_pd(ai, bv[v], acc[i][v]); \
+            }                                                                            \
+            a += MR;                                                                     \
+            b += NR;                                                                     \
+        }                                                                                \
+        _Pragma("GCC unroll 32")                                                         \
+        for (int i = 0; i < MR; i++) {                                                   \
+            for (int v = 0; v < NV; v++) {                                               \
+                double *cp = &c[i * ldc + 8 * v];                                        \
+                _mm512_storeu_pd(cp, _mm512_add_pd(_mm512_loadu_pd(cp), acc[i][v]));     \
+            }                                                                            \
+        }                                                                                \
+    }
+
+GEMM_AVX2_KERNEL(6, 8)
+GEMM_AVX2_KERNEL(4, 12)
+GEMM_AVX2_KERNEL(8, 4)
+GEMM_AVX512_KERNEL(14, 16)
+GEMM_AVX512_KERNEL(8, 24)
+GEMM_AVX512_KERNEL(28, 8)
+
+#endif
+
+// The first kernel of each ISA is its default
+static const GemmKernel gemm_kernels[] = {
+    {"generic 4x8", GEMM_ISA_GENERIC, 4, 8, gemm_kernel_generic_4x8},
+#ifdef GEMM_X86
+    {"avx2 6x8", GEMM_ISA_AVX2, 6, 8, gemm_kernel_avx2_6x8},
+    {"avx2 4x12", GEMM_ISA_AVX2, 4, 12, gemm_kernel_avx2_4x12},
+    {"avx2 8x4", GEMM_ISA_AVX2, 8, 4, gemm_kernel_avx2_8x4},
+    {"avx512 14x16", GEMM_ISA_AVX512, 14, 16, gemm_kernel_avx512_14x16},
+    {"avx512 8x24", GEMM_ISA_AVX512, 8, 24, gemm_kernel_avx512_8x24},
+    {"avx512 28x8", GEMM_ISA_AVX512, 28, 8, gemm_kernel_avx512_28x8},
+#endif
+};
+
+#define GEMM_KERNEL_COUNT ((int)(sizeof(gemm_kernels) / sizeof(gemm_kernels[0])))
+
+static inline int gemm_isa_supported(GemmIsa isa) {
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (isa == GEMM_ISA_AVX512) return __builtin_cpu_supports("avx512f");
+    if (isa == GEMM_ISA_AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return isa == GEMM_ISA_GENERIC;
+}
+
+// Default micro-kernel of the widest ISA this CPU supports
+static inline const GemmKernel *gemm_best_kernel(void) {
+    const GemmKernel *best = &gemm_kernels[0];
+    for (int i = 1; i < GEMM_KERNEL_COUNT; i++) {
+        if (gemm_kernels[i].isa > best->isa && gemm_isa_supported(gemm_kernels[i].isa)) best = &gemm_kernels[i];
+    }
+    return best;
+}
+
+static inline const GemmKernel *gemm_find_kernel(const char *name) {
+    for (int i = 0; i < GEMM_KERNEL_COUNT; i++) {
+        if (strcmp(gemm_kernels[i].name, name) == 0) return &gemm_kernels[i];
+    }
+    return NULL;
+}
+
+// Blocking that keeps an mc x kc block of A in L2 and a kc x nc panel of B in L3
+static inline GemmConfig gemm_default_config(void) {
+    GemmConfig cfg;
+    cfg.kernel = gemm_best_kernel();
+    cfg.kc = 256;
+    cfg.mc = cfg.kernel->mr * (cfg.kernel->isa == GEMM_ISA_AVX512 ? 12 : 16);
+    cfg.nc = 4096 / cfg.kernel->nr * cfg.kernel->nr;
+    return cfg;
+}
+
+// A[0:mc, 0:kc] (row-major, lda) -> MR-row micro-panels, k-major, zero padded
+static void gemm_pack_a(const GemmKernel *kd, int mc, int kc, const double *A, long lda, double *packed) {
+    int mr = kd->mr;
+    for (int ir = 0; ir < mc; ir += mr) {
+        int rows = (mc - ir < mr) ? mc - ir : mr;
+        for (int p = 0; p < kc; p++) {
+            for (int i = 0; i < rows; i++) packed[i] = A[(long)(ir + i) * lda + p];
+            for (int i = rows; i < mr; i++) packed[i] = 0.0;
+            packed += mr;
+        }
+    }
+}
+
+// B[0:kc, jr:jr+NR] (row-major, ldb) -> one NR-column micro-panel, zero padded
+static void gemm_pack_b_panel(const GemmKernel *kd, int kc, int cols, const double *B, long ldb,
+                              double *packed) {
+    int nr = kd->nr;
+    for (int p = 0; p < kc; p++) {
+        memcpy(packed, &B[(long)p * ldb], cols * sizeof(double));
+        for (int j = cols; j < nr; j++) packed[j] = 0.0;
+        packed += nr;
+    }
+}
+
+// One mc x kc block of A against a packed kc x nc slice of B: packs the
+// block into apack and runs the micro-kernel over every micro-tile of C
+static void gemm_macro_kernel(const GemmKernel *kd, int mcur, int ncur, int kcur,
+                              const double *A, long lda, const double *bpack, double *apack,
+                              double *C, long ldc) {
+    int mr = kd->mr, nr = kd->nr;
+    gemm_pack_a(kd, mcur, kcur, A, lda, apack);
+
+    for (int jr = 0; jr < ncur; jr += nr) {
+        int cols = (ncur - jr < nr) ? ncur - jr : nr;
+        for (int ir = 0; ir < mcur; ir += mr) {
+            int rows = (mcur - ir < mr) ? mcur - ir : mr;
+            const double *ap = &apack[(long)ir * kcur];
+            const double *bp = &bpack[(long)jr * kcur];
+            double *cp = &C[(long)ir * ldc + jr];
+            if (rows == mr && cols == nr) {
+                kd->kernel(kcur, ap, bp, cp, ldc);
+            } else {
+                double tile[GEMM_MAX_TILE];
+                memset(tile, 0, sizeof(tile));
+                kd->kernel(kcur, ap, bp, tile, nr);
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) cp[(long)i * ldc + j] += tile[i * nr + j];
+                }
+            }
+        }
+    }
+}
+
+// Blocking of cfg clipped to an m x n x k problem (whole micro-tiles)
+static inline void gemm_clip_blocking(const GemmConfig *cfg, int m, int n, int k, int *mc, int *nc, int *kc) {
+    int mr = cfg->kernel->mr, nr = cfg->kernel->nr;
+    *mc = (((cfg->mc < m) ? cfg->mc : m) + mr - 1) / mr * mr;
+    *nc = (((cfg->nc < n) ? cfg->nc : n) + nr - 1) / nr * nr;
+    *kc = (cfg->kc < k) ? cfg->kc : k;
+}
+
+// Doubles of workspace gemm_dgemm_serial needs for an m x n x k problem
+static inline size_t gemm_serial_workspace(const GemmConfig *cfg, int m, int n, int k) {
+    int mc, nc, kc;
+    gemm_clip_blocking(cfg, m, n, k, &mc, &nc, &kc);
+    return (size_t)kc * nc + (size_t)mc * kc;
+}
+
+// Single-threaded C += A * B for small blocks (e.g. the leaves of a
+// recursive multiply). work must be 64-byte aligned and hold
+// gemm_serial_workspace(cfg, m, n, k) doubles.
+static void gemm_dgemm_serial(const GemmConfig *cfg, int m, int n, int k,
+                              const double *A, long lda, const double *B, long ldb,
+                              double *C, long ldc, double *work) {
+    if (m <= 0 || n <= 0 || k <= 0) return;
+    const GemmKernel *kd = cfg->kernel;
+    int mc, nc, kc;
+    gemm_clip_blocking(cfg, m, n, k, &mc, &nc, &kc);
+    double *bpack = work;                   // first, so the B micro-panels stay aligned
+    double *apack = work + (size_t)kc * nc;
+
+    for (int jc = 0; jc < n; jc += nc) {
+        int ncur = (n - jc < nc) ? n - jc : nc;
+        for (int pc = 0; pc < k; pc += kc) {
+            int kcur = (k - pc < kc) ? k - pc : kc;
+            for (int jr = 0; jr < ncur; jr += kd->nr) {
+                int cols = (ncur - jr < kd->nr) ? ncur - jr : kd->nr;
+                gemm_pack_b_panel(kd, kcur, cols, &B[(long)pc * ldb + jc + jr], ldb, &bpack[(long)jr * kcur]);
+            }
+            for (int ic = 0; ic < m; ic += mc) {
+                int mcur = (m - ic < mc) ? m - ic : mc;
+                gemm_macro_kernel(kd, mcur, ncur, kcur, &A[(long)ic * lda + pc], lda, bpack, apack,
+                                  &C[(long)ic * ldc + jc], ldc);
+            }
+        }
+    }
+}
+
+// C[0:m, 0:n] += A[0:m, 0:k] * B[0:k, 0:n], all row-major with the given
+// leading dimensions, with the micro-kernel and blocking of cfg.
+// Returns 0 on success, -1 if the packing buffers cannot be allocated.
+static int gemm_dgemm_with(const GemmConfig *cfg, int m, int n, int k,
+                           const double *A, long lda, const double *B, long ldb,
+                           double *C, long ldc, int num_threads) {
+    if (m <= 0 || n <= 0 || k <= 0) return 0;
+    const GemmKernel *kd = cfg->kernel;
+    int nr = kd->nr;
+    int mc, nc, kc;
+    gemm_clip_blocking(cfg, m, n, k, &mc, &nc, &kc);
+
+    double *bpack = aligned_alloc(GEMM_ALIGN, (size_t)kc * nc * sizeof(double));
+    if (!bpack) return -1;
+    int status = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        double *apack = aligned_alloc(GEMM_ALIGN, (size_t)mc * kc * sizeof(double));
+        if (!apack) {
+            #pragma omp atomic write
+            status = -1;
+        }
+
+        for (int jc = 0; jc < n; jc += nc) {
+            int ncur = (n - jc < nc) ? n - jc : nc;
+            for (int pc = 0; pc < k; pc += kc) {
+                int kcur = (k - pc < kc) ? k - pc : kc;
+
+                #pragma omp for schedule(static)
+                for (int jr = 0; jr < ncur; jr += nr) {
+                    int cols = (ncur - jr < nr) ? ncur - jr : nr;
+                    gemm_pack_b_panel(kd, kcur, cols, &B[(long)pc * ldb + jc + jr], ldb,
+                                      &bpack[(long)jr * kcur]);
+                }
+
+                #pragma omp for schedule(dynamic)
+                for (int ic = 0; ic < m; ic += mc) {
+                    if (!apack) continue;
+                    int mcur = (m - ic < mc) ? m - ic : mc;
+                    gemm_macro_kernel(kd, mcur, ncur, kcur, &A[(long)ic * lda + pc], lda, bpack, apack,
+                                      &C[(long)ic * ldc + jc], ldc);
+                }
+            }
+        }
+        free(apack);
+    }
+
+    free(bpack);
+    return status;
+}
+
+static inline int gemm_dgemm(int m, int n, int k, const double *A, long lda, const double *B, long ldb,
+                             double *C, long ldc, int num_threads) {
+    GemmConfig cfg = gemm_default_config();
+    return gemm_dgemm_with(&cfg, m, n, k, A, lda, B, ldb, C, ldc, num_threads);
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef GEMM_TUNE_H
+#define GEMM_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include "gemm.h"
+#include "topology.h"
+
+// Autotuner for the packed GEMM engine.
+//
+// The search is a coordinate descent per micro-kernel: starting from the
+// default blocking it sweeps kc, then mc (in multiples of the kernel's MR),
+// then nc (multiples of NR), keeping the best value of each axis before
+// moving on. The best kernel and blocking are then timed at every thread
+// count. Each point is the best of GEMM_TUNE_REPS multiplies of an n x n
+// problem, so the sweep takes seconds rather than the minutes of the
+// full-size benchmark.
+//
+// The winner is written as key=value lines to a per-machine file
+// (gemm_tuning_<hostname>.txt, or $GEMM_TUNING_FILE) together with the CPU
+// model. gemm_tuning_load() rejects a file from another CPU model or one
+// that names a kernel this build or CPU does not have.
+
+#define GEMM_TUNE_REPS 2
+#define GEMM_TUNE_FILE_ENV "GEMM_TUNING_FILE"
+
+typedef struct {
+    GemmConfig config;
+    int threads;
+    int n;            // size of the tuning problem
+    double gflops;    // measured on it
+} GemmTuning;
+
+static inline void gemm_tuning_path(char *path, size_t size) {
+    const char *env = getenv(GEMM_TUNE_FILE_ENV);
+    if (env && *env) {
+        snprintf(path, size, "%s", env);
+        return;
+    }
+    char host[256] = "unknown";
+    if (gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+    snprintf(path, size, "gemm_tuning_%s.txt", host);
+}
+
+// Returns 0 on success, -1 if the file cannot be written
+static int gemm_tuning_save(const GemmTuning *t, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    char model[256];
+    topo_cpu_model(model, sizeof(model));
+    fprintf(fp, "# Packed GEMM tuning, written by q4 tune\n");
+    fprintf(fp, "cpu=%s\n", model);
+    fprintf(fp, "kernel=%s\n", t->config.kernel->name);
+    fprintf(fp, "mc=%d\nkc=%d\nnc=%d\n", t->config.mc, t->config.kc, t->config.nc);
+    fprintf(fp, "threads=%d\n", t->threads);
+    fprintf(fp, "n=%d\n", t->n);
+    fprintf(fp, "gflops=%.2f\n", t->gflops);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+// Returns 0 if path holds a usable tuning for this machine, -1 otherwise
+static int gemm_tuning_load(GemmTuning *t, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char model[256], line[512];
+    topo_cpu_model(model, sizeof(model));
+    GemmTuning loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    int cpu_matches = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *eq = strchr(line, '=');
+        if (line[0] == '#' || !eq) continue;
+        *eq = '\0';
+        const char *key = line, *value = eq + 1;
+        if (strcmp(key, "cpu") == 0) cpu_matches = strcmp(value, model) == 0;
+        else if (strcmp(key, "kernel") == 0) loaded.config.kernel = gemm_find_kernel(value);
+        else if (strcmp(key, "mc") == 0) loaded.config.mc = atoi(value);
+        else if (strcmp(key, "kc") == 0) loaded.config.kc = atoi(value);
+        else if (strcmp(key, "nc") == 0) loaded.config.nc = atoi(value);
+        else if (strcmp(key, "threads") == 0) loaded.threads = atoi(value);
+        else if (strcmp(key, "n") == 0) loaded.n = atoi(value);
+        else if (strcmp(key, "gflops") == 0) loaded.gflops = atof(value);
+    }
+    fclose(fp);
+
+    if (!cpu_matches || !loaded.config.kernel || !gemm_isa_supported(loaded.config.kernel->isa)) return -1;
+    if (loaded.config.mc <= 0 || loaded.config.kc <= 0 || loaded.config.nc <= 0 || loaded.threads <= 0) return -1;
+    *t = loaded;
+    return 0;
+}
+
+// Best GFLOP/s of GEMM_TUNE_REPS multiplies, 0 if the engine fails
+static double gemm_tune_measure(const GemmConfig *cfg, int threads, int n,
+                                const double *A, const double *B, double *C) {
+    double best = 0.0;
+    for (int rep = 0; rep < GEMM_TUNE_REPS; rep++) {
+        double start = omp_get_wtime();
+        if (gemm_dgemm_with(cfg, n, n, n, A, n, B, n, C, n, threads) != 0) return 0.0;
+        double seconds = omp_get_wtime() - start;
+        double gflops = 2.0 * n * n * n / seconds / 1e9;
+        if (gflops > best) best = gflops;
+    }
+    return best;
+}
+
+// Sweeps one blocking axis (*field) over values and keeps the fastest
+static double gemm_tune_axis(GemmConfig *cfg, int *field, const int *values, int count, double best,
+                             int threads, int n, const double *A, const double *B, double *C, int verbose) {
+    int best_value = *field;
+    for (int v = 0; v < count; v++) {
+        if (values[v] == best_value) continue;
+        *field = values[v];
+        double gflops = gemm_tune_measure(cfg, threads, n, A, B, C);
+        if (verbose) {
+            printf("  %-13s mc=%-4d kc=%-4d nc=%-5d threads=%-2d %7.2f GFLOP/s\n",
+                   cfg->kernel->name, cfg->mc, cfg->kc, cfg->nc, threads, gflops);
+        }
+        if (gflops > best) {
+            best = gflops;
+            best_value = values[v];
+        }
+    }
+    *field = best_value;
+    return best;
+}
+
+// Tunes kernel, blocking and thread count on an n x n multiply. Thread
+// counts come from thread_counts; the blocking is searched at the largest
+// of them that does not exceed the processor count. Returns 0 on success,
+// -1 if the matrices cannot be allocated.
+static int gemm_tune(int n, const int *thread_counts, int num_thread_configs, int verbose, GemmTuning *result) {
+    double *A = gemm_alloc_matrix(n, n);
+    double *B = gemm_alloc_matrix(n, n);
+    double *C = gemm_alloc_matrix(n, n);
+    if (!A || !B || !C) {
+        free(A);
+        free(B);
+        free(C);
+        return -1;
+    }
+    for (long i = 0; i < (long)n * n; i++) {
+        A[i] = (double)(i % 97) / 97.0;
+        B[i] = (double)(i % 89) / 89.0;
+        C[i] = 0.0;
+    }
+
+    int search_threads = thread_counts[0];
+    for (int tc = 0; tc < num_thread_configs; tc++) {
+        if (thread_counts[tc] <= omp_get_num_procs() && thread_counts[tc] > search_threads) {
+            search_threads = thread_counts[tc];
+        }
+    }
+
+    GemmConfig best = gemm_default_config();
+    double best_gflops = 0.0;
+
+    for (int k = 0; k < GEMM_KERNEL_COUNT; k++) {
+        const GemmKernel *kd = &gemm_kernels[k];
+        if (!gemm_isa_supported(kd->isa)) continue;
+
+        GemmConfig cfg;
+        cfg.kernel = kd;
+        cfg.kc = 256;
+        cfg.mc = kd->mr * (256 / kd->mr / 2);
+        cfg.nc = 4096 / kd->nr * kd->nr;
+        double gflops = gemm_tune_measure(&cfg, search_threads, n, A, B, C);
+
+        int kcs[] = {64, 128, 192, 256, 384, 512};
+        int mcs[] = {kd->mr * 2, kd->mr * 4, kd->mr * 8, kd->mr * 12, kd->mr * 16, kd->mr * 24, kd->mr * 32};
+        int ncs[] = {kd->nr * 32, kd->nr * 64, kd->nr * 128, 2048 / kd->nr * kd->nr, 4096 / kd->nr * kd->nr,
+                     8192 / kd->nr * kd->nr};
+        gflops = gemm_tune_axis(&cfg, &cfg.kc, kcs, 6, gflops, search_threads, n, A, B, C, verbose);
+        gflops = gemm_tune_axis(&cfg, &cfg.mc, mcs, 7, gflops, search_threads, n, A, B, C, verbose);
+        gflops = gemm_tune_axis(&cfg, &cfg.nc, ncs, 6, gflops, search_threads, n, A, B, C, verbose);
+
+        if (verbose) {
+            printf("%s: best mc=%d kc=%d nc=%d at %.2f GFLOP/s\n", kd->name, cfg.mc, cfg.kc, cfg.nc, gflops);
+        }
+        if (gflops > best_gflops) {
+            best_gflops = gflops;
+            best = cfg;
+        }
+    }
+
+    int best_threads = search_threads;
+    for (int tc = 0; tc < num_thread_configs; tc++) {
+        if (thread_counts[tc] == search_threads) continue;
+        double gflops = gemm_tune_measure(&best, thread_counts[tc], n, A, B, C);
+        if (verbose) printf("  %-13s threads=%-2d %7.2f GFLOP/s\n", best.kernel->name, thread_counts[tc], gflops);
+        if (gflops > best_gflops) {
+            best_gflops = gflops;
+            best_threads = thread_counts[tc];
+        }
+    }
+
+    free(A);
+    free(B);
+    free(C);
+
+    result->config = best;
+    result->threads = best_threads;
+    result->n = n;
+    result->gflops = best_gflops;
+    return 0;
+}
+
+#endif
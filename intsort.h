@@ -0,0 +1,259 @@
+#ifndef INTSORT_H
+#define INTSORT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INTSORT_X86 1
+#endif
+
+// Sort engine for runs of int keys, specialized by key range and run size
+// instead of going through a comparator callback:
+//
+//   - tiny runs (<= 16) and small runs (<= INTSORT_SMALL_MAX): AVX2
+//     bitonic networks sort blocks of 16 keys in two registers, and the
+//     blocks are merged bottom-up
+//   - narrow key ranges (max - min < INTSORT_COUNTING_MAX_RANGE and not
+//     much wider than the run): counting sort, two passes and no
+//     comparisons. This is the Problem 3 case: 10^6 keys in a range of 1000
+//   - everything else: LSD radix sort on key - min with 8-bit digits,
+//     skipping the digits above the range
+//
+// Each strategy can also be forced, for comparisons against qsort.
+
+#define INTSORT_NETWORK 16                 // keys per sorting network block
+#define INTSORT_SMALL_MAX 256
+#define INTSORT_COUNTING_MAX_RANGE (1 << 16)
+#define INTSORT_RADIX_BITS 8
+
+typedef enum {
+    INTSORT_QSORT,      // libc qsort with a comparator (baseline)
+    INTSORT_AUTO,       // pick by key range and run size
+    INTSORT_COUNTING,   // counting sort (falls back to radix for wide ranges)
+    INTSORT_RADIX,      // LSD radix sort
+    INTSORT_NETWORKS,   // sorting networks + bottom-up merge at any size
+    INTSORT_METHOD_COUNT
+} IntSortMethod;
+
+static const char *const intsort_method_names[INTSORT_METHOD_COUNT] = {
+    "qsort", "auto", "counting", "radix", "network"
+};
+
+static inline int intsort_parse(const char *name) {
+    for (int m = 0; m < INTSORT_METHOD_COUNT; m++) {
+        if (strcmp(name, intsort_method_names[m]) == 0) return m;
+    }
+    return -1;
+}
+
+static int intsort_compare(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// ---- sorting networks ----
+
+static inline void intsort_block_scalar(int *block) {
+    for (int i = 1; i < INTSORT_NETWORK; i++) {
+        int v = block[i];
+        int j = i - 1;
+        while (j >= 0 && block[j] > v) { block[j + 1] = block[j]; j--; }
+        block[j + 1] = v;
+    }
+}
+
+#ifdef INTSORT_X86
+
+// Compare-exchange of every lane i with lane i ^ j; lane i keeps the
+// minimum when bit j and bit k of i agree (bitonic direction rule)
+#define INTSORT_TAKE_MIN(i, j, k) (((((i) & (j)) == 0) == (((i) & (k)) == 0)) ? -1 : 0)
+#define INTSORT_STAGE(v, j, k)                                                              \
+    intsort_cmpx_avx2(v, _mm256_setr_epi32(0 ^ (j), 1 ^ (j), 2 ^ (j), 3 ^ (j),              \
+                                           4 ^ (j), 5 ^ (j), 6 ^ (j), 7 ^ (j)),             \
+                      _mm256_setr_epi32(INTSORT_TAKE_MIN(0, j, k), INTSORT_TAKE_MIN(1, j, k), \
+                                        INTSORT_TAKE_MIN(2, j, k), INTSORT_TAKE_MIN(3, j, k), \
+                                        INTSORT_TAKE_MIN(4, j, k), INTSORT_TAKE_MIN(5, j, k), \
+                                        INTSORT_TAKE_MIN(6, j, k), INTSORT_TAKE_MIN(7, j, k)))
+
+__attribute__((target("avx2")))
+static inline __m256i intsort_cmpx_avx2(__m256i v, __m256i perm, __m256i take_min) {
+    __m256i other = _mm256_permutevar8x32_epi32(v, perm);
+    return _mm256_blendv_epi8(_mm256_max_epi32(v, other), _mm256_min_epi32(v, other), take_min);
+}
+
+// Bitonic merge of a bitonic register into ascending order
+__attribute__((target("avx2")))
+static inline __m256i intsort_merge8_avx2(__m256i v) {
+    v = INTSORT_STAGE(v, 4, 8);
+    v = INTSORT_STAGE(v, 2, 8);
+    return INTSORT_STAGE(v, 1, 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i intsort_sort8_avx2(__m256i v) {
+    v = INTSORT_STAGE(v, 1, 2);
+    v = INTSORT_STAGE(v, 2, 4);
+    v = INTSORT_STAGE(v, 1, 4);
+    return intsort_merge8_avx2(v);
+}
+
+// Sorts 16 keys: each register is sorted, the second is reversed so the
+// pair is bitonic, and one min/max step plus a merge per register finishes
+__attribute__((target("avx2")))
+static inline void intsort_block_avx2(int *block) {
+    __m256i a = intsort_sort8_avx2(_mm256_loadu_si256((const __m256i *)block));
+    __m256i b = intsort_sort8_avx2(_mm256_loadu_si256((const __m256i *)(block + 8)));
+    b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    __m256i lo = _mm256_min_epi32(a, b);
+    __m256i hi = _mm256_max_epi32(a, b);
+    _mm256_storeu_si256((__m256i *)block, intsort_merge8_avx2(lo));
+    _mm256_storeu_si256((__m256i *)(block + 8), intsort_merge8_avx2(hi));
+}
+
+#endif
+
+static inline int intsort_have_avx2(void) {
+#ifdef INTSORT_X86
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+// Sorts blocks of 16 with the network (padding the last one with INT_MAX),
+// then merges them bottom-up through scratch (n keys).
+static void intsort_networks(int *data, long long n, int *scratch) {
+    int use_avx2 = intsort_have_avx2();
+    for (long long b = 0; b < n; b += INTSORT_NETWORK) {
+        int block[INTSORT_NETWORK];
+        int count = (n - b < INTSORT_NETWORK) ? (int)(n - b) : INTSORT_NETWORK;
+        memcpy(block, &data[b], count * sizeof(int));
+        for (int i = count; i < INTSORT_NETWORK; i++) block[i] = INT_MAX;
+#ifdef INTSORT_X86
+        if (use_avx2) intsort_block_avx2(block); else intsort_block_scalar(block);
+#else
+        (void)use_avx2;
+        intsort_block_scalar(block);
+#endif
+        memcpy(&data[b], block, count * sizeof(int));
+    }
+
+    int *src = data, *dst = scratch;
+    for (long long width = INTSORT_NETWORK; width < n; width *= 2) {
+        for (long long lo = 0; lo < n; lo += 2 * width) {
+            long long mid = (lo + width < n) ? lo + width : n;
+            long long hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+            long long i = lo, j = mid, o = lo;
+            while (i < mid && j < hi) dst[o++] = (src[j] < src[i]) ? src[j++] : src[i++];
+            while (i < mid) dst[o++] = src[i++];
+            while (j < hi) dst[o++] = src[j++];
+        }
+        int *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != data) memcpy(data, src, n * sizeof(int));
+}
+
+// ---- counting and radix sort ----
+
+static void intsort_min_max(const int *data, long long n, int *min, int *max) {
+    int lo = data[0], hi = data[0];
+    for (long long i = 1; i < n; i++) {
+        lo = (data[i] < lo) ? data[i] : lo;
+        hi = (data[i] > hi) ? data[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+// Returns -1 if the histogram cannot be allocated
+static int intsort_counting(int *data, long long n, int min, unsigned range) {
+    long long *count = calloc((size_t)range + 1, sizeof(long long));
+    if (!count) return -1;
+    for (long long i = 0; i < n; i++) count[(unsigned)data[i] - (unsigned)min]++;
+    long long o = 0;
+    for (unsigned v = 0; v <= range; v++) {
+        int key = (int)((unsigned)min + v);
+        for (long long c = count[v]; c > 0; c--) data[o++] = key;
+    }
+    free(count);
+    return 0;
+}
+
+static void intsort_radix(int *data, long long n, int *scratch, int min, unsigned range) {
+    int *src = data, *dst = scratch;
+    for (int shift = 0; shift < 32 && (range >> shift) != 0; shift += INTSORT_RADIX_BITS) {
+        long long count[1 << INTSORT_RADIX_BITS] = {0};
+        for (long long i = 0; i < n; i++) {
+            count[(((unsigned)src[i] - (unsigned)min) >> shift) & ((1 << INTSORT_RADIX_BITS) - 1)]++;
+        }
+        long long sum = 0;
+        for (int b = 0; b < (1 << INTSORT_RADIX_BITS); b++) {
+            long long c = count[b];
+            count[b] = sum;
+            sum += c;
+        }
+        for (long long i = 0; i < n; i++) {
+            dst[count[(((unsigned)src[i] - (unsigned)min) >> shift) & ((1 << INTSORT_RADIX_BITS) - 1)]++] = src[i];
+        }
+        int *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != data) memcpy(data, src, n * sizeof(int));
+}
+
+// Sorts data[0..n) ascending with the given method. scratch must hold n
+// keys, or be NULL to allocate one when needed. Returns 0 on success, -1
+// on allocation failure (data is unchanged then).
+static int intsort_sort(int *data, long long n, int *scratch, IntSortMethod method) {
+    if (n < 2) return 0;
+    if (method == INTSORT_QSORT) {
+        qsort(data, n, sizeof(int), intsort_compare);
+        return 0;
+    }
+
+    int small[INTSORT_SMALL_MAX];
+    int owns_scratch = 0;
+    int min = 0, max = 0;
+    unsigned range = 0;
+    if (method == INTSORT_AUTO && n <= INTSORT_SMALL_MAX) {
+        method = INTSORT_NETWORKS;
+        if (!scratch) scratch = small;
+    } else if (method != INTSORT_NETWORKS) {
+        intsort_min_max(data, n, &min, &max);
+        range = (unsigned)max - (unsigned)min;
+        if (range == 0) return 0;
+        int narrow = range < INTSORT_COUNTING_MAX_RANGE;
+        if (method == INTSORT_AUTO) {
+            method = (narrow && range <= 2 * (unsigned long long)n) ? INTSORT_COUNTING : INTSORT_RADIX;
+        } else if (method == INTSORT_COUNTING && !narrow) {
+            method = INTSORT_RADIX;
+        }
+    }
+
+    if (method == INTSORT_COUNTING) return intsort_counting(data, n, min, range);
+
+    if (!scratch) {
+        scratch = malloc(n * sizeof(int));
+        if (!scratch) return -1;
+        owns_scratch = 1;
+    }
+    if (method == INTSORT_RADIX) {
+        intsort_radix(data, n, scratch, min, range);
+    } else {
+        intsort_networks(data, n, scratch);
+    }
+    if (owns_scratch) free(scratch);
+    return 0;
+}
+
+#endif
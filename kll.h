@@ -0,0 +1,283 @@
+#ifndef KLL_H
+#define KLL_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// KLL quantile sketch (Karnin, Lang, Liberty 2016) for 64-bit unsigned keys.
+//
+// The sketch is a stack of compactors. Level h holds items of weight 2^h.
+// When a level reaches its capacity it is sorted and every other item
+// (random odd/even offset) is promoted to the level above, halving its
+// size. Capacities shrink by 2/3 per level below the top, so memory is
+// O(k) regardless of how many values are summarized.
+//
+// Sketches are mergeable: per-thread sketches can be combined at the end
+// of a stream or at any checkpoint, and the result has the same error
+// guarantee as a single sketch fed every value.
+
+#define KLL_MAX_LEVELS 61
+#define KLL_MIN_WIDTH 8
+
+typedef struct {
+    int k;
+    int num_levels;
+    long long n;                             // number of values summarized
+    unsigned long long *items[KLL_MAX_LEVELS];
+    int size[KLL_MAX_LEVELS];
+    int alloc[KLL_MAX_LEVELS];
+    int capacity[KLL_MAX_LEVELS];            // recomputed when a level is added
+    unsigned long long *scratch;             // radix sort buffer for level 0
+    int scratch_alloc;
+    unsigned long long rng;                  // coin flips for compaction
+} KllSketch;
+
+typedef struct {
+    unsigned long long item;
+    long long weight;
+} KllWeightedItem;
+
+// k for a target normalized rank error. The observed KLL error is about
+// 1.7 / k at 99% confidence, so 2 / epsilon leaves some headroom.
+static int kll_k_for_epsilon(double epsilon) {
+    double k = 2.0 / epsilon;
+    if (k < KLL_MIN_WIDTH) return KLL_MIN_WIDTH;
+    if (k > (1 << 24)) return 1 << 24;
+    return (int)k + 1;
+}
+
+// Level capacities depend on the depth below the top level, so they are
+// refreshed whenever the sketch grows a level. Level 0 keeps at least
+// k / 4 slots: it holds weight-1 items, so the extra room costs no accuracy
+// and makes compactions (a sort each) rarer on the hot update path.
+static void kll_refresh_capacities(KllSketch *s) {
+    for (int level = 0; level < s->num_levels; level++) {
+        long long cap = s->k;
+        for (int depth = s->num_levels - 1 - level; depth > 0 && cap > KLL_MIN_WIDTH; depth--) {
+            cap = cap * 2 / 3;
+        }
+        s->capacity[level] = (cap < KLL_MIN_WIDTH) ? KLL_MIN_WIDTH : (int)cap;
+    }
+    if (s->capacity[0] < s->k / 4) s->capacity[0] = s->k / 4;
+}
+
+static void kll_init(KllSketch *s, int k, unsigned long long seed) {
+    memset(s, 0, sizeof(*s));
+    s->k = (k < KLL_MIN_WIDTH) ? KLL_MIN_WIDTH : k;
+    s->num_levels = 1;
+    s->rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    kll_refresh_capacities(s);
+}
+
+static void kll_free(KllSketch *s) {
+    for (int h = 0; h < KLL_MAX_LEVELS; h++) free(s->items[h]);
+    free(s->scratch);
+    memset(s, 0, sizeof(*s));
+}
+
+static int kll_reserve(KllSketch *s, int level, int needed) {
+    if (needed <= s->alloc[level]) return 0;
+    int alloc = s->alloc[level] ? s->alloc[level] : KLL_MIN_WIDTH;
+    while (alloc < needed) alloc *= 2;
+    unsigned long long *items = realloc(s->items[level], alloc * sizeof(unsigned long long));
+    if (!items) return -1;
+    s->items[level] = items;
+    s->alloc[level] = alloc;
+    return 0;
+}
+
+// Level 0 is sorted with a small LSD radix sort (8-bit digits, constant
+// digits skipped); tiny levels use insertion sort.
+static int kll_sort_level0(KllSketch *s) {
+    unsigned long long *a = s->items[0];
+    int n = s->size[0];
+    if (n <= 32) {
+        for (int i = 1; i < n; i++) {
+            unsigned long long v = a[i];
+            int j = i - 1;
+            while (j >= 0 && a[j] > v) { a[j + 1] = a[j]; j--; }
+            a[j + 1] = v;
+        }
+        return 0;
+    }
+
+    if (n > s->scratch_alloc) {
+        unsigned long long *scratch = realloc(s->scratch, s->alloc[0] * sizeof(unsigned long long));
+        if (!scratch) return -1;
+        s->scratch = scratch;
+        s->scratch_alloc = s->alloc[0];
+    }
+
+    unsigned long long diff = 0;
+    for (int i = 1; i < n; i++) diff |= a[i] ^ a[0];
+
+    unsigned long long *src = a, *dst = s->scratch;
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (((diff >> shift) & 0xff) == 0) continue;
+        int count[256] = {0};
+        for (int i = 0; i < n; i++) count[(src[i] >> shift) & 0xff]++;
+        int sum = 0;
+        for (int b = 0; b < 256; b++) {
+            int c = count[b];
+            count[b] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < n; i++) dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+        unsigned long long *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != a) memcpy(a, src, n * sizeof(unsigned long long));
+    return 0;
+}
+
+static int kll_compact_level(KllSketch *s, int h) {
+    if (h == s->num_levels - 1) {
+        if (s->num_levels == KLL_MAX_LEVELS) return -1;
+        s->num_levels++;
+        kll_refresh_capacities(s);
+    }
+
+    // Levels above 0 are kept sorted (promotions are merged in), so only
+    // level 0 ever needs a sort
+    unsigned long long *items = s->items[h];
+    int n = s->size[h];
+    if (h == 0 && kll_sort_level0(s) != 0) return -1;
+
+    // An odd item stays behind at this level
+    int pairs = n / 2;
+    if (kll_reserve(s, h + 1, s->size[h + 1] + pairs) != 0) return -1;
+
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 7;
+    s->rng ^= s->rng << 17;
+    int offset = (int)(s->rng & 1);
+
+    // Merge the promoted items into the (sorted) level above, back to front
+    unsigned long long *up = s->items[h + 1];
+    int i = s->size[h + 1] - 1;
+    int j = pairs - 1;
+    for (int out = s->size[h + 1] + pairs - 1; j >= 0; out--) {
+        unsigned long long promoted = items[2 * j + offset];
+        if (i >= 0 && up[i] > promoted) {
+            up[out] = up[i--];
+        } else {
+            up[out] = promoted;
+            j--;
+        }
+    }
+    s->size[h + 1] += pairs;
+
+    // The leftover odd item is the largest, so the level stays sorted
+    if (n & 1) items[0] = items[n - 1];
+    s->size[h] = n & 1;
+    return 0;
+}
+
+// Compacts the lowest over-capacity level until every level fits
+static int kll_compress(KllSketch *s) {
+    int h = 0;
+    while (h < s->num_levels) {
+        if (s->size[h] >= s->capacity[h]) {
+            if (kll_compact_level(s, h) != 0) return -1;
+            h = 0;  // capacities change when a level is added
+        } else {
+            h++;
+        }
+    }
+    return 0;
+}
+
+static int kll_update(KllSketch *s, unsigned long long value) {
+    if (s->size[0] >= s->alloc[0] && kll_reserve(s, 0, s->size[0] + 1) != 0) return -1;
+    s->items[0][s->size[0]++] = value;
+    s->n++;
+    if (s->size[0] >= s->capacity[0]) return kll_compress(s);
+    return 0;
+}
+
+static int kll_update_batch(KllSketch *s, const unsigned long long *values, long long count) {
+    for (long long i = 0; i < count; i++) {
+        if (kll_update(s, values[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// Adds everything summarized by src into dst. src is not modified.
+static int kll_merge(KllSketch *dst, const KllSketch *src) {
+    if (src->num_levels > dst->num_levels) {
+        dst->num_levels = src->num_levels;
+        kll_refresh_capacities(dst);
+    }
+    for (int h = 0; h < src->num_levels; h++) {
+        if (src->size[h] == 0) continue;
+        if (kll_reserve(dst, h, dst->size[h] + src->size[h]) != 0) return -1;
+        unsigned long long *d = dst->items[h];
+        const unsigned long long *from = src->items[h];
+        if (h == 0) {
+            memcpy(d + dst->size[h], from, src->size[h] * sizeof(unsigned long long));
+        } else {
+            // Both levels are sorted: merge back to front
+            int i = dst->size[h] - 1;
+            int j = src->size[h] - 1;
+            for (int out = dst->size[h] + src->size[h] - 1; j >= 0; out--) {
+                if (i >= 0 && d[i] > from[j]) {
+                    d[out] = d[i--];
+                } else {
+                    d[out] = from[j--];
+                }
+            }
+        }
+        dst->size[h] += src->size[h];
+    }
+    dst->n += src->n;
+    return kll_compress(dst);
+}
+
+static int kll_compare_weighted(const void *a, const void *b) {
+    unsigned long long x = ((const KllWeightedItem *)a)->item;
+    unsigned long long y = ((const KllWeightedItem *)b)->item;
+    return (x > y) - (x < y);
+}
+
+// Estimates the values at fractional ranks phis[0..m) (0 <= phi < 1), with
+// the same convention as data[(long long)(n * phi)] on sorted data.
+static int kll_quantiles(const KllSketch *s, const double *phis, unsigned long long *out, int m) {
+    long long total = 0;
+    for (int h = 0; h < s->num_levels; h++) total += s->size[h];
+    if (total == 0) return -1;
+
+    KllWeightedItem *all = malloc(total * sizeof(KllWeightedItem));
+    if (!all) return -1;
+    long long pos = 0;
+    for (int h = 0; h < s->num_levels; h++) {
+        for (int i = 0; i < s->size[h]; i++) {
+            all[pos].item = s->items[h][i];
+            all[pos].weight = 1LL << h;
+            pos++;
+        }
+    }
+    qsort(all, total, sizeof(KllWeightedItem), kll_compare_weighted);
+
+    for (int q = 0; q < m; q++) {
+        long long target = (long long)(s->n * phis[q]);
+        long long cumulative = 0;
+        long long i = 0;
+        for (; i < total - 1; i++) {
+            cumulative += all[i].weight;
+            if (cumulative > target) break;
+        }
+        out[q] = all[i].item;
+    }
+    free(all);
+    return 0;
+}
+
+static size_t kll_memory_bytes(const KllSketch *s) {
+    size_t bytes = sizeof(*s);
+    for (int h = 0; h < KLL_MAX_LEVELS; h++) bytes += s->alloc[h] * sizeof(unsigned long long);
+    bytes += s->scratch_alloc * sizeof(unsigned long long);
+    return bytes;
+}
+
+#endif
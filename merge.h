@@ -0,0 +1,159 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdlib.h>
+#include <limits.h>
+#include <omp.h>
+
+// Parallel k-way merge of sorted int runs.
+//
+// The output is cut into num_threads equal slices. The start of each slice
+// is a global rank r, and its co-rank (how many elements of every run come
+// before output position r) is found by bisecting the key space: the
+// smallest key v with count(<= v) >= r fixes every run's split except among
+// keys equal to v, which are handed out in run order so the merge is
+// stable. Each thread then merges its k sub-runs with a loser tree, so the
+// threads write disjoint, equal-sized parts of the output and no serial
+// pass is left at the end.
+
+typedef struct {
+    int k;
+    int *tree;            // tree[0]: current winner; tree[1..k-1]: losers of each match
+    long long *head;      // current key of each source, MERGE_EXHAUSTED when empty
+    const int **cur;      // next element of each source
+    const int **end;
+} LoserTree;
+
+#define MERGE_EXHAUSTED LLONG_MAX  // above every int key
+
+static inline long long merge_lower_bound(const int *run, long long n, long long v) {
+    long long lo = 0, hi = n;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (run[mid] < v) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// pos[j] = number of elements of run j among the first `rank` outputs
+static void merge_corank(const int *const *runs, const long long *lens, int k, long long rank,
+                         long long *pos) {
+    long long lo = INT_MIN, hi = INT_MAX;
+    // Smallest v with count(<= v) >= rank, i.e. count(< v + 1) >= rank
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        long long count = 0;
+        for (int j = 0; j < k && count < rank; j++) count += merge_lower_bound(runs[j], lens[j], mid + 1);
+        if (count >= rank) hi = mid; else lo = mid + 1;
+    }
+
+    long long remaining = rank;
+    for (int j = 0; j < k; j++) {
+        pos[j] = merge_lower_bound(runs[j], lens[j], lo);
+        remaining -= pos[j];
+    }
+    // Keys equal to lo, earlier runs first
+    for (int j = 0; j < k && remaining > 0; j++) {
+        long long equal = merge_lower_bound(runs[j], lens[j], lo + 1) - pos[j];
+        long long take = (equal < remaining) ? equal : remaining;
+        pos[j] += take;
+        remaining -= take;
+    }
+}
+
+// Source a beats source b: smaller head key, ties to the lower run
+static inline int merge_beats(const LoserTree *t, int a, int b) {
+    return t->head[a] < t->head[b] || (t->head[a] == t->head[b] && a < b);
+}
+
+static inline void merge_load_head(LoserTree *t, int j) {
+    t->head[j] = (t->cur[j] < t->end[j]) ? *t->cur[j] : MERGE_EXHAUSTED;
+}
+
+// Plays the matches below node (leaves are nodes k..2k-1) and returns the winner
+static int merge_tree_init(LoserTree *t, int node) {
+    if (node >= t->k) return node - t->k;
+    int a = merge_tree_init(t, 2 * node);
+    int b = merge_tree_init(t, 2 * node + 1);
+    if (merge_beats(t, b, a)) {
+        t->tree[node] = a;
+        return b;
+    }
+    t->tree[node] = b;
+    return a;
+}
+
+static void merge_tree_run(LoserTree *t, int *out, long long count) {
+    int k = t->k;
+    for (int j = 0; j < k; j++) merge_load_head(t, j);
+    t->tree[0] = (k == 1) ? 0 : merge_tree_init(t, 1);
+    for (long long i = 0; i < count; i++) {
+        int winner = t->tree[0];
+        out[i] = (int)t->head[winner];
+        t->cur[winner]++;
+        merge_load_head(t, winner);
+        // Replay the winner's path to the root
+        for (int node = (winner + k) / 2; node >= 1; node /= 2) {
+            if (merge_beats(t, t->tree[node], winner)) {
+                int loser = winner;
+                winner = t->tree[node];
+                t->tree[node] = loser;
+            }
+        }
+        t->tree[0] = winner;
+    }
+}
+
+// Merges the k sorted runs into out (which must hold the sum of lens) using
+// num_threads equal output slices. Returns 0 on success, -1 if the
+// per-thread state cannot be allocated.
+static int merge_runs_int(const int *const *runs, const long long *lens, int k, int *out,
+                          int num_threads) {
+    long long total = 0;
+    for (int j = 0; j < k; j++) total += lens[j];
+    if (k <= 0 || total == 0) return 0;
+
+    long long *splits = malloc((size_t)(num_threads + 1) * k * sizeof(long long));
+    if (!splits) return -1;
+    int status = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int tid = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+        long long begin = total * tid / nthreads;
+        long long end = total * (tid + 1) / nthreads;
+
+        merge_corank(runs, lens, k, begin, &splits[(size_t)tid * k]);
+        if (tid == nthreads - 1) {
+            for (int j = 0; j < k; j++) splits[(size_t)nthreads * k + j] = lens[j];
+        }
+        #pragma omp barrier
+
+        LoserTree t;
+        t.k = k;
+        t.tree = malloc(k * sizeof(int));
+        t.head = malloc(k * sizeof(long long));
+        t.cur = malloc(k * sizeof(const int *));
+        t.end = malloc(k * sizeof(const int *));
+        if (t.tree && t.head && t.cur && t.end) {
+            for (int j = 0; j < k; j++) {
+                t.cur[j] = runs[j] + splits[(size_t)tid * k + j];
+                t.end[j] = runs[j] + splits[(size_t)(tid + 1) * k + j];
+            }
+            merge_tree_run(&t, out + begin, end - begin);
+        } else {
+            #pragma omp atomic write
+            status = -1;
+        }
+        free(t.tree);
+        free(t.head);
+        free((void *)t.cur);
+        free((void *)t.end);
+    }
+
+    free(splits);
+    return status;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef MOMENTS_H
+#define MOMENTS_H
+
+#include <math.h>
+
+// Single-pass, mergeable central moments (count, mean, M2, M3, M4).
+//
+// Values are folded in blocks of MOMENTS_BLOCK: a block's own mean and
+// centered power sums are computed with two short passes over data that is
+// still in L1, both written as `omp simd` reductions so they vectorize, and
+// the block is then merged into the accumulator with the pairwise update
+// of Chan et al. extended to the third and fourth moments by Pebay. The
+// same merge combines per-thread accumulators, so the result does not
+// depend on how the data was split beyond rounding, and there is no
+// catastrophic cancellation as with raw power sums (values up to 10^12
+// have fourth powers near 10^48).
+//
+// moments_variance() is the population variance (divide by n), matching
+// NumPy's default; moments_kurtosis() is the excess kurtosis (0 for a
+// normal distribution, -1.2 for a uniform one).
+
+#define MOMENTS_BLOCK 1024
+
+typedef struct {
+    long long n;
+    double mean;
+    double m2, m3, m4;   // sums of centered squares, cubes, fourth powers
+} Moments;
+
+static inline void moments_init(Moments *m) {
+    m->n = 0;
+    m->mean = m->m2 = m->m3 = m->m4 = 0.0;
+}
+
+// Folds b into a (Chan / Pebay pairwise update)
+static inline void moments_merge(Moments *a, const Moments *b) {
+    if (b->n == 0) return;
+    if (a->n == 0) {
+        *a = *b;
+        return;
+    }
+    double na = (double)a->n, nb = (double)b->n, n = na + nb;
+    double delta = b->mean - a->mean;
+    double delta_n = delta / n;
+    double delta_n2 = delta_n * delta_n;
+    double term = delta * delta_n * na * nb;   // delta^2 na nb / n
+
+    double m4 = a->m4 + b->m4 + term * delta_n2 * (na * na - na * nb + nb * nb)
+              + 6.0 * delta_n2 * (na * na * b->m2 + nb * nb * a->m2)
+              + 4.0 * delta_n * (na * b->m3 - nb * a->m3);
+    double m3 = a->m3 + b->m3 + term * delta_n * (na - nb)
+              + 3.0 * delta_n * (na * b->m2 - nb * a->m2);
+    a->m2 += b->m2 + term;
+    a->m3 = m3;
+    a->m4 = m4;
+    a->mean += delta_n * nb;
+    a->n += b->n;
+}
+
+// Moments of one block of at most MOMENTS_BLOCK values, two-pass
+static inline void moments_block(const unsigned long long *values, int n, Moments *out) {
+    double sum = 0.0;
+    #pragma omp simd reduction(+:sum)
+    for (int i = 0; i < n; i++) sum += (double)values[i];
+    double mean = sum / n;
+
+    double s2 = 0.0, s3 = 0.0, s4 = 0.0;
+    #pragma omp simd reduction(+:s2, s3, s4)
+    for (int i = 0; i < n; i++) {
+        double d = (double)values[i] - mean;
+        double d2 = d * d;
+        s2 += d2;
+        s3 += d2 * d;
+        s4 += d2 * d2;
+    }
+    out->n = n;
+    out->mean = mean;
+    out->m2 = s2;
+    out->m3 = s3;
+    out->m4 = s4;
+}
+
+static inline void moments_add(Moments *m, const unsigned long long *values, long long n) {
+    for (long long first = 0; first < n; first += MOMENTS_BLOCK) {
+        Moments block;
+        moments_block(&values[first], (int)(n - first < MOMENTS_BLOCK ? n - first : MOMENTS_BLOCK), &block);
+        moments_merge(m, &block);
+    }
+}
+
+static inline double moments_variance(const Moments *m) {
+    return m->n > 0 ? m->m2 / m->n : 0.0;
+}
+
+static inline double moments_skewness(const Moments *m) {
+    if (m->n == 0 || m->m2 <= 0.0) return 0.0;
+    return sqrt((double)m->n) * m->m3 / pow(m->m2, 1.5);
+}
+
+static inline double moments_kurtosis(const Moments *m) {
+    if (m->n == 0 || m->m2 <= 0.0) return 0.0;
+    return (double)m->n * m->m4 / (m->m2 * m->m2) - 3.0;
+}
+
+#endif
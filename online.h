@@ -0,0 +1,231 @@
+#ifndef ONLINE_H
+#define ONLINE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <omp.h>
+#include "rng.h"
+
+// Online aggregation: progressive mean / min / max over an index space
+// [0, n) that stops as soon as the answer is good enough.
+//
+// The space is cut into ONLINE_BLOCK-value blocks that are visited in a
+// random order: position i of the order is block perm(i), a keyed
+// bijection on [0, blocks) (a 4-round Feistel network on the next even
+// power of two, cycle-walking past the last block). Threads claim positions
+// from a shared counter, so the finished blocks are always the first ones
+// in the order, short of the few still in flight: a simple random sample of
+// blocks, drawn without replacement.
+//
+// The mean is the ratio estimator r = sum / count over the sampled blocks.
+// Its standard error comes from the variation between blocks (cluster
+// sampling), with the finite population correction:
+//   se^2 = (1 - k / K) / (k * cbar^2) * sum_i (s_i - r * c_i)^2 / (k - 1)
+// for k of K blocks with sums s_i and counts c_i. The correction brings it to
+// 0 once every block has been seen, when the answer is the exact one.
+// The interval is r +/- 1.96 se (95%). Min and max are the extremes seen so
+// far: bounds that can only widen towards the true ones, not estimates.
+//
+// A run stops when the relative half-width reaches target_error (after at
+// least ONLINE_MIN_BLOCKS blocks, so the normal approximation is
+// reasonable), when time_limit seconds have passed, or when every block is
+// done. Every `interval` seconds a progress line goes to `progress`.
+// Threads finish the block they hold when a run stops, and those blocks are
+// counted, so the sample is exactly a prefix of the order.
+
+#define ONLINE_BLOCK (1LL << 18)   // values per block: ~0.3 ms of work, so the shared update stays cheap
+#define ONLINE_MIN_BLOCKS 30
+#define ONLINE_Z95 1.96
+
+typedef struct {
+    long long blocks;
+    unsigned long long half_mask;
+    int half_bits;
+    unsigned long long keys[4];
+} OnlinePerm;
+
+static void online_perm_init(OnlinePerm *p, long long blocks, unsigned long long seed) {
+    int bits = 2;
+    while (bits < 62 && (1LL << bits) < blocks) bits += 2;
+    p->blocks = blocks;
+    p->half_bits = bits / 2;
+    p->half_mask = (1ULL << p->half_bits) - 1;
+    for (int r = 0; r < 4; r++) p->keys[r] = rng_key(seed, r);
+}
+
+// Block at position i of the visit order
+static long long online_perm_at(const OnlinePerm *p, long long i) {
+    unsigned long long x = (unsigned long long)i;
+    do {
+        unsigned long long left = x >> p->half_bits, right = x & p->half_mask;
+        for (int r = 0; r < 4; r++) {
+            unsigned long long next = left ^ (rng_mix(p->keys[r] ^ right) & p->half_mask);
+            left = right;
+            right = next;
+        }
+        x = left << p->half_bits | right;
+    } while (x >= (unsigned long long)p->blocks);
+    return (long long)x;
+}
+
+// Aggregate of one block, filled by the caller's OnlineBlockFn
+typedef struct {
+    long long count;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+} OnlineBlock;
+
+typedef void (*OnlineBlockFn)(void *ctx, long long first, long long count, OnlineBlock *out);
+
+// Running totals over the blocks processed so far
+typedef struct {
+    long long blocks;
+    long long values;
+    unsigned __int128 sum;
+    long double sum_sq;      // sum of s_i^2
+    long double sum_cross;   // sum of s_i * c_i
+    long double count_sq;    // sum of c_i^2
+    unsigned long long min;
+    unsigned long long max;
+} OnlineState;
+
+typedef struct {
+    double mean;
+    double half_width;       // of the 95% interval; INFINITY before two blocks
+    double rel_error;        // half_width / mean
+    unsigned long long min;
+    unsigned long long max;
+    long long blocks;
+    long long values;
+    double scanned;          // fraction of the values processed
+    double elapsed;
+} OnlineEstimate;
+
+typedef enum { ONLINE_STOP_COMPLETE, ONLINE_STOP_TARGET, ONLINE_STOP_TIME } OnlineStop;
+
+static const char *const online_stop_names[] = {"complete", "target", "time"};
+
+typedef struct {
+    double target_error;     // relative half-width to stop at; 0 for none
+    double time_limit;       // seconds; 0 for none
+    double interval;         // seconds between progress lines
+    FILE *progress;          // NULL for none
+    unsigned long long seed; // block order
+} OnlineConfig;
+
+typedef struct {
+    OnlineEstimate estimate;
+    OnlineStop stop;
+    long long total_blocks;
+} OnlineResult;
+
+static void online_state_init(OnlineState *s) {
+    memset(s, 0, sizeof(*s));
+    s->min = ULLONG_MAX;
+}
+
+static void online_state_add(OnlineState *s, const OnlineBlock *b) {
+    long double sum = (long double)b->sum, count = (long double)b->count;
+    s->blocks++;
+    s->values += b->count;
+    s->sum += b->sum;
+    s->sum_sq += sum * sum;
+    s->sum_cross += sum * count;
+    s->count_sq += count * count;
+    if (b->min < s->min) s->min = b->min;
+    if (b->max > s->max) s->max = b->max;
+}
+
+static void online_estimate(const OnlineState *s, long long total_blocks, long long n, OnlineEstimate *e) {
+    e->blocks = s->blocks;
+    e->values = s->values;
+    e->min = s->min;
+    e->max = s->max;
+    e->scanned = n > 0 ? (double)s->values / n : 1.0;
+    e->mean = s->values > 0 ? (double)((long double)s->sum / s->values) : 0.0;
+    e->half_width = INFINITY;
+    if (s->blocks == total_blocks) {
+        e->half_width = 0.0;
+    } else if (s->blocks >= 2) {
+        long double k = s->blocks;
+        long double r = (long double)s->sum / s->values;
+        long double cbar = (long double)s->values / k;
+        long double residual = s->sum_sq - 2 * r * s->sum_cross + r * r * s->count_sq;
+        if (residual < 0) residual = 0;   // rounding
+        long double fpc = 1.0L - k / total_blocks;
+        e->half_width = ONLINE_Z95 * (double)sqrtl(fpc * residual / (k - 1) / (k * cbar * cbar));
+    }
+    e->rel_error = e->mean > 0 ? e->half_width / e->mean : INFINITY;
+}
+
+static void online_print(FILE *fp, const OnlineEstimate *e) {
+    fprintf(fp, "  [%7.2f s] %6.2f%% scanned | Mean: %.2f +/- %.2f (%.4f%%) | Min: %llu | Max: %llu\n",
+            e->elapsed, e->scanned * 100.0, e->mean, e->half_width, e->rel_error * 100.0, e->min, e->max);
+}
+
+// Runs fn over random blocks of [0, n) with num_threads threads until a
+// stop condition of cfg holds
+static void online_aggregate(long long n, int num_threads, const OnlineConfig *cfg, OnlineBlockFn fn, void *ctx,
+                             OnlineResult *result) {
+    long long total_blocks = (n + ONLINE_BLOCK - 1) / ONLINE_BLOCK;
+    OnlinePerm perm;
+    online_perm_init(&perm, total_blocks, cfg->seed);
+
+    OnlineState state;
+    online_state_init(&state);
+    OnlineEstimate estimate;
+    memset(&estimate, 0, sizeof(estimate));
+    atomic_llong next = 0;
+    atomic_int stop = 0;                 // OnlineStop + 1 once set
+    double start = omp_get_wtime();
+    double next_report = start + cfg->interval;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+            long long pos = atomic_fetch_add_explicit(&next, 1, memory_order_relaxed);
+            if (pos >= total_blocks) break;
+            long long first = online_perm_at(&perm, pos) * ONLINE_BLOCK;
+            OnlineBlock block;
+            fn(ctx, first, n - first < ONLINE_BLOCK ? n - first : ONLINE_BLOCK, &block);
+
+            #pragma omp critical(online_state)
+            {
+                online_state_add(&state, &block);
+                double now = omp_get_wtime();
+                online_estimate(&state, total_blocks, n, &estimate);
+                estimate.elapsed = now - start;
+                int reason = 0;
+                if (state.blocks == total_blocks) {
+                    reason = ONLINE_STOP_COMPLETE + 1;
+                } else if (cfg->target_error > 0 && state.blocks >= ONLINE_MIN_BLOCKS &&
+                           estimate.rel_error <= cfg->target_error) {
+                    reason = ONLINE_STOP_TARGET + 1;
+                } else if (cfg->time_limit > 0 && estimate.elapsed >= cfg->time_limit) {
+                    reason = ONLINE_STOP_TIME + 1;
+                }
+                if (reason && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+                    atomic_store_explicit(&stop, reason, memory_order_relaxed);
+                }
+                if (cfg->progress && now >= next_report) {
+                    online_print(cfg->progress, &estimate);
+                    next_report = now + cfg->interval;
+                }
+            }
+        }
+    }
+
+    // Blocks finished after the stop are in the state; re-time the estimate
+    online_estimate(&state, total_blocks, n, &estimate);
+    estimate.elapsed = omp_get_wtime() - start;
+    result->estimate = estimate;
+    result->total_blocks = total_blocks;
+    int reason = atomic_load(&stop);
+    result->stop = reason ? (OnlineStop)(reason - 1) : ONLINE_STOP_COMPLETE;
+}
+
+#endif
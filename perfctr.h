@@ -0,0 +1,369 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+#include "topology.h"
+
+// Per-phase hardware counters from perf_event_open(2).
+//
+// A program keeps one PerfSession and brackets each kernel phase with
+// perfctr_begin(session, "sort", threads) / perfctr_end(session). Both run
+// a parallel region of that many threads, the same team the phase itself
+// uses (the OpenMP runtime keeps its threads, and topo_set_num_threads()
+// pins them), in which every thread enables or reads its own counters:
+// cycles, instructions, LLC misses, dTLB load misses and task-clock, all
+// user-space only. Each thread opens its counters on first use and keeps
+// them for the life of the process.
+//
+// Derived per phase: IPC, memory traffic estimated as LLC misses x 64 B,
+// its bandwidth, and the intensity in instructions per byte. The roofline
+// class compares that intensity with the machine's ridge point: the peak
+// instruction rate (PERFCTR_PEAK_IPC at the measured cycle rate) over the
+// peak read bandwidth, which a streaming probe measures once per process.
+// Phases above the ridge are compute-bound, below it bandwidth-bound.
+//
+// Counters that cannot be opened (no PMU in a VM, perf_event_paranoid,
+// seccomp) are reported as NA and the roofline as n/a; task-clock, a
+// software event, usually survives and still shows per-thread CPU time.
+// PERF_COUNTERS=0 turns counting off.
+
+typedef enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_TASK_CLOCK,   // nanoseconds
+    PERFCTR_COUNT
+} PerfCounter;
+
+static const char *const perfctr_names[PERFCTR_COUNT] = {
+    "cycles", "instructions", "LLC-misses", "dTLB-misses", "task-clock"
+};
+
+#define PERFCTR_MAX_THREADS 64   // threads beyond this count in the totals only
+#define PERFCTR_MAX_PHASES 8
+#define PERFCTR_LINE_BYTES 64
+#define PERFCTR_PEAK_IPC 4.0
+#define PERFCTR_ENV "PERF_COUNTERS"
+
+typedef struct {
+    char name[24];
+    int threads;
+    double seconds;
+    double total[PERFCTR_COUNT];   // summed over threads, -1 if not counted
+    double per_thread[PERFCTR_MAX_THREADS][PERFCTR_COUNT];
+} PerfPhase;
+
+typedef struct {
+    int num_phases;
+    double start;
+    PerfPhase phases[PERFCTR_MAX_PHASES];
+} PerfSession;
+
+typedef struct {
+    double ipc;         // -1 when unknown
+    double gbs;         // estimated memory bandwidth
+    double intensity;   // instructions per byte of memory traffic
+    const char *roofline;
+} PerfDerived;
+
+static int perfctr_state = -1;   // -1 not probed, 0 off, 1 on
+static int perfctr_available[PERFCTR_COUNT];
+static __thread int perfctr_fds[PERFCTR_COUNT];
+static __thread int perfctr_thread_ready;
+
+static inline int perfctr_open(PerfCounter counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (counter) {
+    case PERFCTR_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERFCTR_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERFCTR_LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case PERFCTR_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    default:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        break;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Probes which counters this process may open; returns 1 if any can be
+static int perfctr_init(void) {
+    if (perfctr_state >= 0) return perfctr_state;
+    const char *env = getenv(PERFCTR_ENV);
+    perfctr_state = 0;
+    if (env && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0)) return 0;
+    for (int c = 0; c < PERFCTR_COUNT; c++) {
+        int fd = perfctr_open((PerfCounter)c);
+        perfctr_available[c] = fd >= 0;
+        if (fd >= 0) {
+            close(fd);
+            perfctr_state = 1;
+        }
+    }
+    return perfctr_state;
+}
+
+static inline void perfctr_thread_open(void) {
+    if (perfctr_thread_ready) return;
+    for (int c = 0; c < PERFCTR_COUNT; c++) {
+        perfctr_fds[c] = perfctr_available[c] ? perfctr_open((PerfCounter)c) : -1;
+    }
+    perfctr_thread_ready = 1;
+}
+
+// Counter value scaled for multiplexing, 0 if it never ran
+static inline double perfctr_read(int fd) {
+    unsigned long long buf[3];
+    if (read(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[2] == 0) return 0.0;
+    return (double)buf[0] * ((double)buf[1] / (double)buf[2]);
+}
+
+static inline void perfctr_reset(PerfSession *s) {
+    s->num_phases = 0;
+}
+
+static void perfctr_begin(PerfSession *s, const char *name, int num_threads) {
+    if (s->num_phases == PERFCTR_MAX_PHASES) return;
+    PerfPhase *p = &s->phases[s->num_phases];
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->threads = num_threads;
+    if (perfctr_init()) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            perfctr_thread_open();
+            for (int c = 0; c < PERFCTR_COUNT; c++) {
+                if (perfctr_fds[c] < 0) continue;
+                ioctl(perfctr_fds[c], PERF_EVENT_IOC_RESET, 0);
+                ioctl(perfctr_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+    s->start = omp_get_wtime();
+}
+
+static void perfctr_end(PerfSession *s) {
+    double seconds = omp_get_wtime() - s->start;
+    if (s->num_phases == PERFCTR_MAX_PHASES) return;
+    PerfPhase *p = &s->phases[s->num_phases++];
+    p->seconds = seconds;
+    memset(p->per_thread, 0, sizeof(p->per_thread));
+    for (int c = 0; c < PERFCTR_COUNT; c++) p->total[c] = perfctr_available[c] && perfctr_state == 1 ? 0.0 : -1.0;
+    if (perfctr_state != 1) return;
+
+    #pragma omp parallel num_threads(p->threads)
+    {
+        int tid = omp_get_thread_num();
+        for (int c = 0; c < PERFCTR_COUNT; c++) {
+            if (!perfctr_thread_ready || perfctr_fds[c] < 0) continue;
+            ioctl(perfctr_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+            double value = perfctr_read(perfctr_fds[c]);
+            if (tid < PERFCTR_MAX_THREADS) p->per_thread[tid][c] = value;
+            #pragma omp atomic
+            p->total[c] += value;
+        }
+    }
+}
+
+// All phases of a session as one
+static void perfctr_sum(const PerfSession *s, PerfPhase *out) {
+    memset(out, 0, sizeof(*out));
+    snprintf(out->name, sizeof(out->name), "all");
+    for (int c = 0; c < PERFCTR_COUNT; c++) out->total[c] = s->num_phases ? s->phases[0].total[c] : -1.0;
+    for (int i = 0; i < s->num_phases; i++) {
+        const PerfPhase *p = &s->phases[i];
+        if (p->threads > out->threads) out->threads = p->threads;
+        out->seconds += p->seconds;
+        for (int c = 0; c < PERFCTR_COUNT; c++) {
+            if (i > 0 && out->total[c] >= 0) out->total[c] += p->total[c];
+            for (int t = 0; t < PERFCTR_MAX_THREADS; t++) out->per_thread[t][c] += p->per_thread[t][c];
+        }
+    }
+}
+
+// Peak read bandwidth in bytes/s: best of a few parallel passes over a
+// buffer four times the L3 (at least 64 MB), measured once with a thread
+// pinned to every CPU
+static double perfctr_peak_bandwidth(void) {
+    static double peak = -1.0;
+    if (peak >= 0) return peak;
+    peak = 0.0;
+    size_t bytes = (size_t)topo_get()->l3_kb * 4096;
+    if (bytes < ((size_t)64 << 20)) bytes = (size_t)64 << 20;
+    if (bytes > ((size_t)1 << 30)) bytes = (size_t)1 << 30;
+    long long n = (long long)(bytes / sizeof(long long));
+    long long *buffer = malloc(n * sizeof(long long));
+    if (!buffer) return peak;
+    int threads = omp_get_num_procs();
+    long long sum = 0;
+    double start = 0.0;
+
+    #pragma omp parallel num_threads(threads)
+    {
+        // One thread per CPU: the caller's pinned team would otherwise leave
+        // these threads on the (single) CPU of the thread that created them
+        cpu_set_t saved;
+        int pinned = topo_pin(topo_spread_cpu(omp_get_thread_num()), &saved);
+        #pragma omp for schedule(static)
+        for (long long i = 0; i < n; i++) buffer[i] = i;
+        for (int pass = 0; pass < 3; pass++) {
+            #pragma omp single
+            {
+                sum = 0;
+                start = omp_get_wtime();
+            }
+            #pragma omp for schedule(static) reduction(+:sum)
+            for (long long i = 0; i < n; i++) sum += buffer[i];
+            #pragma omp single
+            {
+                double seconds = omp_get_wtime() - start;
+                // The check keeps the loop from being elided
+                if (sum == n * (n - 1) / 2 && bytes / seconds > peak) peak = bytes / seconds;
+            }
+        }
+        topo_unpin(pinned, &saved);
+    }
+    free(buffer);
+    return peak;
+}
+
+static void perfctr_derive(const PerfPhase *p, PerfDerived *d) {
+    double cycles = p->total[PERFCTR_CYCLES], instructions = p->total[PERFCTR_INSTRUCTIONS];
+    double misses = p->total[PERFCTR_LLC_MISSES];
+    double bytes = misses * PERFCTR_LINE_BYTES;
+
+    d->ipc = (cycles > 0 && instructions >= 0) ? instructions / cycles : -1.0;
+    d->gbs = (misses >= 0 && p->seconds > 0) ? bytes / p->seconds / 1e9 : -1.0;
+    d->intensity = (bytes > 0 && instructions >= 0) ? instructions / bytes : -1.0;
+    d->roofline = "n/a";
+    if (cycles <= 0 || instructions < 0 || misses < 0 || p->seconds <= 0) return;
+
+    double peak_bw = perfctr_peak_bandwidth();
+    if (peak_bw <= 0) return;
+    double ridge = (cycles / p->seconds * PERFCTR_PEAK_IPC) / peak_bw;
+    d->roofline = (bytes == 0 || d->intensity >= ridge) ? "compute" : "bandwidth";
+}
+
+// Roofline class of the whole session, for a results column
+static inline const char *perfctr_roofline(const PerfSession *s) {
+    PerfPhase all;
+    PerfDerived d;
+    perfctr_sum(s, &all);
+    perfctr_derive(&all, &d);
+    return d.roofline;
+}
+
+// Roofline class of the named phase, n/a if the session has none
+static inline const char *perfctr_phase_roofline(const PerfSession *s, const char *name) {
+    for (int i = 0; i < s->num_phases; i++) {
+        if (strcmp(s->phases[i].name, name) != 0) continue;
+        PerfDerived d;
+        perfctr_derive(&s->phases[i], &d);
+        return d.roofline;
+    }
+    return "n/a";
+}
+
+static inline void perfctr_print_summary(void) {
+    if (!perfctr_init()) {
+        printf("Counters: unavailable or disabled (%s=0), phases are timed only\n", PERFCTR_ENV);
+        return;
+    }
+    printf("Counters:");
+    for (int c = 0; c < PERFCTR_COUNT; c++) if (perfctr_available[c]) printf(" %s", perfctr_names[c]);
+    int missing = 0;
+    for (int c = 0; c < PERFCTR_COUNT; c++) missing += !perfctr_available[c];
+    if (missing) {
+        printf(" (unavailable:");
+        for (int c = 0; c < PERFCTR_COUNT; c++) if (!perfctr_available[c]) printf(" %s", perfctr_names[c]);
+        printf(")");
+    }
+    printf("\n");
+}
+
+// One line per phase of the last run
+static void perfctr_print(const PerfSession *s) {
+    for (int i = 0; i < s->num_phases; i++) {
+        const PerfPhase *p = &s->phases[i];
+        PerfDerived d;
+        perfctr_derive(p, &d);
+        printf("  Phase %-12s %.4f s", p->name, p->seconds);
+        if (p->total[PERFCTR_TASK_CLOCK] >= 0) printf(" | CPU %.4f s", p->total[PERFCTR_TASK_CLOCK] / 1e9);
+        if (d.ipc >= 0) printf(" | IPC %.2f", d.ipc);
+        if (d.gbs >= 0) printf(" | %.2f GB/s", d.gbs);
+        if (d.intensity >= 0) printf(" | %.2f instr/B", d.intensity);
+        printf(" | %s\n", d.roofline);
+    }
+}
+
+static inline void perfctr_write_header(FILE *fp) {
+    fprintf(fp, "Threads,Benchmark,Phase,Thread,Seconds,Cycles,Instructions,LLC_Misses,dTLB_Misses,"
+                "Task_Clock(s),IPC,GB/s,Instr/Byte,Roofline\n");
+}
+
+static void perfctr_write_value(FILE *fp, double value, double scale) {
+    if (value < 0) fprintf(fp, ",NA");
+    else fprintf(fp, ",%.6g", value * scale);
+}
+
+static void perfctr_write_phase(FILE *fp, int threads, const char *benchmark, const PerfPhase *p) {
+    PerfDerived d;
+    perfctr_derive(p, &d);
+    int stored = p->threads < PERFCTR_MAX_THREADS ? p->threads : PERFCTR_MAX_THREADS;
+    for (int t = -1; t < stored; t++) {
+        const double *v = (t < 0) ? p->total : p->per_thread[t];
+        if (t < 0) fprintf(fp, "%d,%s,%s,all,%.6f", threads, benchmark, p->name, p->seconds);
+        else fprintf(fp, "%d,%s,%s,%d,%.6f", threads, benchmark, p->name, t, p->seconds);
+        for (int c = 0; c < PERFCTR_COUNT; c++) {
+            perfctr_write_value(fp, p->total[c] < 0 ? -1.0 : v[c], c == PERFCTR_TASK_CLOCK ? 1e-9 : 1.0);
+        }
+        if (t < 0) {
+            perfctr_write_value(fp, d.ipc, 1.0);
+            perfctr_write_value(fp, d.gbs, 1.0);
+            perfctr_write_value(fp, d.intensity, 1.0);
+            fprintf(fp, ",%s\n", d.roofline);
+        } else {
+            fprintf(fp, ",,,,\n");
+        }
+    }
+}
+
+// Rows for every phase of the session (totals, then each thread) and the
+// whole run
+static void perfctr_write_rows(FILE *fp, int threads, const char *benchmark, const PerfSession *s) {
+    if (!fp) return;
+    for (int i = 0; i < s->num_phases; i++) perfctr_write_phase(fp, threads, benchmark, &s->phases[i]);
+    if (s->num_phases > 1) {
+        PerfPhase all;
+        perfctr_sum(s, &all);
+        perfctr_write_phase(fp, threads, benchmark, &all);
+    }
+}
+
+#endif
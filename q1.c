@@ -1,114 +1,428 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <omp.h>
-#include <sys/time.h>
 #include <limits.h>
+#include <string.h>
+#include "rng.h"
+#include "reduce.h"
+#include "online.h"
+#include "concur.h"
+#include "topology.h"
+#include "perfctr.h"
+#include "bench.h"
 
-#define N (1LL << 34)  // 2^34 elements
+#define N (1LL << 34)  // 2^34 elements, the default size
 #define DOMAIN_MAX 1000000000  // 10^9
+#define PROBE_SIZE (1LL << 27)  // values per calibration run of the adaptive mode
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
-}
+PerfSession perf_session;  // counters of the last run
 
-double problem1_min_max_mean(int num_threads) {  // Return execution time
-    omp_set_num_threads(num_threads);
-    
-    long long min_val = LLONG_MAX;
-    long long max_val = LLONG_MIN;
-    double sum = 0.0;
-    
-    double start_time = get_time();
+// Online aggregation settings ("online" mode)
+static OnlineConfig online_config = {.target_error = 1e-4, .time_limit = 0.0, .interval = 0.5};
+
+// Values depend only on their index, so every thread count sees the same data
+static void problem1_reduce(long long n, RngIsa isa, ReduceResult *total) {
+    unsigned long long key = rng_key(12345, 1);
+    RngRange range = rng_range(DOMAIN_MAX + 1);
+    reduce_init(total);
     
+    // Fused kernel: values are generated and reduced in registers
     #pragma omp parallel
     {
-        long long local_min = LLONG_MAX;
-        long long local_max = LLONG_MIN;
-        double local_sum = 0.0;
-        unsigned int seed = omp_get_thread_num() * 42 + 12345;
+        ReduceResult local;
+        reduce_init(&local);
+        int tid = omp_get_thread_num();
+        long long begin = n * tid / omp_get_num_threads();
+        long long end = n * (tid + 1) / omp_get_num_threads();
         
-        #pragma omp for
-        for (long long i = 0; i < N; i++) {
-            long long value = rand_r(&seed) % (DOMAIN_MAX + 1);
-            
-            if (value < local_min) local_min = value;
-            if (value > local_max) local_max = value;
-            local_sum += value;
-        }
+        reduce_bounded(key, begin, end - begin, &range, isa, &local);
         
         #pragma omp critical
-        {
-            if (local_min < min_val) min_val = local_min;
-            if (local_max > max_val) max_val = local_max;
-            sum += local_sum;
-        }
+        reduce_combine(total, &local);
     }
+}
+
+// result, when not NULL, receives the exact min/max/sum
+double problem1_min_max_mean(long long n, int num_threads, RngIsa isa, ReduceResult *result) {  // Return execution time
+    topo_set_num_threads(num_threads);
     
-    double end_time = get_time();
+    ReduceResult total;
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "reduce", num_threads);
+    double start_time = bench_now();
+    problem1_reduce(n, isa, &total);
+    double end_time = bench_now();
+    perfctr_end(&perf_session);
     double execution_time = end_time - start_time;
-    double mean = sum / N;
+    double mean = (double)((long double)total.sum / n);  // sum is exact in 128 bits for any n
     
-    printf("Threads: %2d | Min: %lld | Max: %lld | Mean: %.2f | Time: %.4f s\n", 
-           num_threads, min_val, max_val, mean, execution_time);
+    printf("Threads: %2d | Min: %llu | Max: %llu | Mean: %.2f | Time: %.4f s | %.3f Gelem/s (%.2f GB/s)\n", 
+           num_threads, total.min, total.max, mean, execution_time,
+           n / execution_time / 1e9, n * sizeof(long long) / execution_time / 1e9);
     
+    if (result) *result = total;
     return execution_time;  // FIXED: Return the time
 }
 
-int main() {
-    int thread_counts[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
-    int num_configs = 9;
-    int runs = 5;
+typedef struct {
+    unsigned long long key;
+    RngRange range;
+    RngIsa isa;
+} Problem1Stream;
+
+static void problem1_online_block(void *ctx, long long first, long long count, OnlineBlock *out) {
+    const Problem1Stream *stream = ctx;
+    ReduceResult r;
+    reduce_init(&r);
+    reduce_bounded(stream->key, first, count, &stream->range, stream->isa, &r);
+    out->count = count;
+    out->sum = (unsigned long long)r.sum;  // ONLINE_BLOCK values of at most 10^9 fit in 64 bits
+    out->min = r.min;
+    out->max = r.max;
+}
+
+// Online aggregation over the same stream: random blocks until the
+// interval of the mean is within the target (or the time limit is up)
+double problem1_online(long long n, int num_threads, RngIsa isa, unsigned long long seed, int progress,
+                       OnlineResult *result) {
+    topo_set_num_threads(num_threads);
+    
+    Problem1Stream stream = {rng_key(12345, 1), rng_range(DOMAIN_MAX + 1), isa};
+    OnlineConfig cfg = online_config;
+    cfg.seed = seed;
+    cfg.progress = progress ? stdout : NULL;
+    
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "online", num_threads);
+    online_aggregate(n, num_threads, &cfg, problem1_online_block, &stream, result);
+    perfctr_end(&perf_session);
+    
+    const OnlineEstimate *e = &result->estimate;
+    printf("Threads: %2d | Mean: %.2f +/- %.2f (%.4f%%) | Min: %llu | Max: %llu | Scanned: %.3f%% "
+           "(skipped %.3f%%) | Time: %.4f s | Stop: %s\n",
+           num_threads, e->mean, e->half_width, e->rel_error * 100.0, e->min, e->max, e->scanned * 100.0,
+           (1.0 - e->scanned) * 100.0, e->elapsed, online_stop_names[result->stop]);
+    
+    return e->elapsed;
+}
+
+// Calibration run of the adaptive mode: Gelem/s on PROBE_SIZE values
+static double problem1_probe(void *ctx, int threads) {
+    const RngIsa *isa = ctx;
+    ReduceResult total;
+    topo_set_num_threads(threads);
+    double start = bench_now();
+    problem1_reduce(PROBE_SIZE, *isa, &total);
+    return PROBE_SIZE / (bench_now() - start) / 1e9;
+}
+
+typedef struct {
+    long long n;
+    int threads;
+    RngIsa isa;
+    int online;
+    unsigned long long seed;   // online: block order of the next run
+    OnlineResult result;       // online: last run
+    ConcurController *concur;  // adaptive: threads come from the controller
+    int phase;
+} Problem1Run;
+
+// Online runs return the time to the answer; extras: fraction scanned and
+// relative half-width
+static double problem1_run(void *ctx, double *extra) {
+    Problem1Run *p = ctx;
+    if (p->concur) {
+        p->threads = concur_use(p->concur, p->phase);
+        double time = problem1_min_max_mean(p->n, p->threads, p->isa, NULL);
+        concur_observe(p->concur, p->phase, p->n / time / 1e9);
+        return time;
+    }
+    if (p->online) {
+        double time = problem1_online(p->n, p->threads, p->isa, p->seed, p->seed == 0, &p->result);
+        p->seed++;   // every run draws a new sample
+        extra[0] = p->result.estimate.scanned;
+        extra[1] = p->result.estimate.rel_error;
+        return time;
+    }
+    return problem1_min_max_mean(p->n, p->threads, p->isa, NULL);
+}
+
+// Online mode: one row per kernel, size and thread count; with verify, an
+// exact scan per row checks the last interval and measures the real saving
+static int problem1_online_mode(const BenchOptions *opts, const int *use_isa, int verify, BenchReport *report) {
+    static const char *const extra_names[] = {"scanned", "rel_error"};
+    // Less scanned is the saving with a target error, more is the accuracy
+    // with a time limit: reported, but not judged against a baseline
+    static const BenchDirection extra_directions[] = {BENCH_INFORMATIONAL, BENCH_LOWER_BETTER};
+    FILE *fp = fopen("problem1_online.txt", "w");
+    if (!fp) {
+        fprintf(stderr, "Could not write problem1_online.txt\n");
+        return -1;
+    }
+    fprintf(fp, "Threads,Kernel,Elements,Time(s),Scanned(%%),Skipped(%%),Mean,HalfWidth,RelError(%%),Min,Max,"
+                "Stop,ProjectedExact(s),ExactTime(s),ExactMean,InInterval,Topology\n");
+    
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (!use_isa[isa]) continue;
+        printf("--- Kernel: %s ---\n", rng_isa_names[isa]);
+        
+        for (int s = 0; s < opts->num_sizes; s++) {
+            for (int i = 0; i < opts->num_threads; i++) {
+                Problem1Run run = {.n = opts->sizes[s], .threads = opts->threads[i], .isa = (RngIsa)isa,
+                                   .online = 1};
+                BenchStats stats;
+                char benchmark[64];
+                
+                printf("Running online with %d thread(s), %lld elements - %d to %d iterations:\n",
+                       run.threads, run.n, opts->min_runs, opts->max_runs);
+                bench_measure(opts, problem1_run, &run, 2, &stats);
+                bench_print_stats(&stats);
+                perfctr_print(&perf_session);
+                
+                // Work skipped, projected from the scan rate of the last run
+                const OnlineEstimate *e = &run.result.estimate;
+                double projected = e->scanned > 0 ? e->elapsed / e->scanned : 0.0;
+                printf("  Median time: %.4f seconds | Median scanned: %.3f%% | Exact scan: ~%.2f s projected\n",
+                       stats.time.median, stats.extra[0].median * 100.0, projected);
+                
+                double exact_time = 0.0, exact_mean = 0.0;
+                int inside = -1;
+                if (verify) {
+                    ReduceResult exact;
+                    printf("  Exact scan: ");
+                    exact_time = problem1_min_max_mean(run.n, run.threads, (RngIsa)isa, &exact);
+                    exact_mean = (double)((long double)exact.sum / run.n);
+                    inside = fabs(e->mean - exact_mean) <= e->half_width;
+                    printf("  Last estimate off by %.2f (%s the interval), %.1fx faster than the exact scan\n",
+                           e->mean - exact_mean, inside ? "inside" : "OUTSIDE", exact_time / e->elapsed);
+                }
+                printf("\n");
+                
+                // Every column describes the last run (its estimate has no
+                // median); the medians over all runs go to the bench report
+                char topology[64];
+                topo_describe(run.threads, topology, sizeof(topology));
+                fprintf(fp, "%d,%s,%lld,%.4f,%.4f,%.4f,%.4f,%.4f,%.6f,%llu,%llu,%s,%.4f,%.4f,%.4f,%d,%s\n",
+                        run.threads, rng_isa_names[isa], run.n, e->elapsed, e->scanned * 100.0,
+                        (1.0 - e->scanned) * 100.0, e->mean, e->half_width, e->rel_error * 100.0, e->min, e->max,
+                        online_stop_names[run.result.stop], projected, exact_time, exact_mean, inside, topology);
+                snprintf(benchmark, sizeof(benchmark), "online_%s", rng_isa_names[isa]);
+                bench_report_add(report, benchmark, run.threads, run.n, &stats, extra_names, extra_directions, 2);
+            }
+        }
+    }
+    fclose(fp);
+    printf("Results saved to problem1_online.txt\n");
+    return 0;
+}
+
+// Adaptive mode: the thread count and placement of each kernel's reduction
+// come from calibration runs on the --threads candidates (concur.h), and
+// every size is then timed with that choice only
+static int problem1_adaptive_mode(const BenchOptions *opts, const int *use_isa, BenchReport *report) {
+    static RngIsa isas[RNG_ISA_COUNT];
+    static char names[RNG_ISA_COUNT][32];
+    FILE *log = fopen("problem1_adaptive.txt", "w");
+    if (!log) {
+        fprintf(stderr, "Could not write problem1_adaptive.txt\n");
+        return -1;
+    }
+    ConcurController concur;
+    concur_init(&concur, opts->threads, opts->num_threads, log);
+    
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (!use_isa[isa]) continue;
+        isas[isa] = (RngIsa)isa;
+        snprintf(names[isa], sizeof(names[isa]), "reduce_%s", rng_isa_names[isa]);
+        int phase = concur_add_phase(&concur, names[isa], "Gelem/s", problem1_probe, &isas[isa]);
+        printf("--- Kernel: %s ---\n", rng_isa_names[isa]);
+        
+        for (int s = 0; s < opts->num_sizes; s++) {
+            Problem1Run run = {.n = opts->sizes[s], .isa = (RngIsa)isa, .concur = &concur, .phase = phase};
+            BenchStats stats;
+            char benchmark[64];
+            
+            run.threads = concur_apply(&concur, phase);
+            printf("Running adaptive, %lld elements - %d to %d iterations:\n", run.n, opts->min_runs,
+                   opts->max_runs);
+            bench_measure(opts, problem1_run, &run, 0, &stats);
+            bench_print_stats(&stats);
+            perfctr_print(&perf_session);
+            
+            const ConcurPhase *p = &concur.phases[phase];
+            printf("  Median time: %.4f seconds (%.3f Gelem/s) with %d thread(s), %s placement\n\n",
+                   stats.time.median, run.n / stats.time.median / 1e9, run.threads, topo_policy_names[p->policy]);
+            snprintf(benchmark, sizeof(benchmark), "minmaxmean_%s_adaptive", rng_isa_names[isa]);
+            bench_report_add(report, benchmark, run.threads, run.n, &stats, NULL, NULL, 0);
+        }
+    }
+    fclose(log);
+    printf("Calibrations saved to problem1_adaptive.txt\n");
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    bench_options_init(&opts, "problem1", 1);
+    if (bench_parse_args(&opts, &argc, argv) != 0) return 1;
+    if (opts.num_sizes == 0) {
+        opts.sizes[0] = N;
+        opts.num_sizes = 1;
+    }
+    
+    // Optional arguments: instruction set levels to compare (scalar, sse42,
+    // avx2, avx512, or "all"); default is the widest the CPU supports.
+    // "online" estimates instead of scanning everything: --target-error=<relative
+    // 95% half-width>, --time-limit=<s>, --interval=<s between progress lines>,
+    // --verify to run the exact scan as well. "adaptive" calibrates the
+    // thread count per kernel and times only that choice
+    int use_isa[RNG_ISA_COUNT] = {0};
+    int num_isas = 0;
+    int online = 0, verify = 0, adaptive = 0;
+    for (int a = 1; a < argc; a++) {
+        int isa = rng_isa_parse(argv[a]);
+        if (strcmp(argv[a], "all") == 0) {
+            for (int l = 0; l <= (int)rng_cpu_isa(); l++) use_isa[l] = 1;
+        } else if (isa >= 0 && isa <= (int)rng_cpu_isa()) {
+            use_isa[isa] = 1;
+        } else if (strcmp(argv[a], "online") == 0) {
+            online = 1;
+        } else if (strncmp(argv[a], "--target-error=", 15) == 0 && atof(argv[a] + 15) >= 0) {
+            online_config.target_error = atof(argv[a] + 15);
+        } else if (strncmp(argv[a], "--time-limit=", 13) == 0 && atof(argv[a] + 13) >= 0) {
+            online_config.time_limit = atof(argv[a] + 13);
+        } else if (strncmp(argv[a], "--interval=", 11) == 0 && atof(argv[a] + 11) > 0) {
+            online_config.interval = atof(argv[a] + 11);
+        } else if (strcmp(argv[a], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[a], "adaptive") == 0) {
+            adaptive = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [scalar|sse42|avx2|avx512|all]... (this CPU supports up to %s)\n"
+                            "       %s online [--target-error=<fraction>] [--time-limit=<s>] [--interval=<s>] "
+                            "[--verify]\n"
+                            "       %s adaptive\n",
+                    argv[0], rng_isa_names[rng_cpu_isa()], argv[0], argv[0]);
+            bench_usage(&opts);
+            return 1;
+        }
+    }
+    for (int l = 0; l < RNG_ISA_COUNT; l++) num_isas += use_isa[l];
+    if (num_isas == 0) use_isa[rng_isa()] = 1;
+    
+    const int *thread_counts = opts.threads;
+    int num_configs = opts.num_threads;
     
     printf("=================================================================\n");
     printf("PROBLEM 1: Minimum, Maximum, and Mean (2^34 elements)\n");
+    printf("Fused generate-and-reduce kernel, CPU supports up to %s\n", rng_isa_names[rng_cpu_isa()]);
+    if (online) {
+        char limit[32] = "none";
+        if (online_config.time_limit > 0) snprintf(limit, sizeof(limit), "%g s", online_config.time_limit);
+        printf("Online aggregation: %lld-value blocks in random order | Target error: %.4f%% | Time limit: %s\n",
+               ONLINE_BLOCK, online_config.target_error * 100.0, limit);
+    }
+    topo_print_summary();
+    perfctr_print_summary();
     printf("=================================================================\n\n");
     
-    double results[9];
+    if (online || adaptive) {
+        BenchReport report;
+        bench_report_init(&report);
+        int status = online ? problem1_online_mode(&opts, use_isa, verify, &report)
+                            : problem1_adaptive_mode(&opts, use_isa, &report);
+        if (status != 0) {
+            bench_report_free(&report);
+            return 1;
+        }
+        int regressions = bench_finish(&report, &opts);
+        bench_report_free(&report);
+        return regressions > 0 ? 2 : 0;
+    }
     
-    for (int i = 0; i < num_configs; i++) {
-        int threads = thread_counts[i];
-        double total_time = 0.0;
-        
-        printf("Running with %d thread(s) - %d iterations:\n", threads, runs);
+    // Median times and roofline class per kernel, size and thread count
+    static double results[RNG_ISA_COUNT][BENCH_MAX_CONFIGS][BENCH_MAX_CONFIGS];
+    static const char *roofline[RNG_ISA_COUNT][BENCH_MAX_CONFIGS][BENCH_MAX_CONFIGS];
+    FILE *counters = fopen("problem1_counters.txt", "w");
+    if (counters) perfctr_write_header(counters);
+    BenchReport report;
+    bench_report_init(&report);
+    
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (!use_isa[isa]) continue;
+        printf("--- Kernel: %s ---\n", rng_isa_names[isa]);
         
-        for (int run = 0; run < runs; run++) {
-            printf("  Run %d: ", run + 1);
-            double exec_time = problem1_min_max_mean(threads);  // FIXED: Capture return value
-            total_time += exec_time;  // FIXED: Accumulate time
+        for (int s = 0; s < opts.num_sizes; s++) {
+            for (int i = 0; i < num_configs; i++) {
+                Problem1Run run = {.n = opts.sizes[s], .threads = thread_counts[i], .isa = (RngIsa)isa};
+                BenchStats stats;
+                char benchmark[64];
+                
+                printf("Running with %d thread(s), %lld elements - %d to %d iterations:\n",
+                       run.threads, run.n, opts.min_runs, opts.max_runs);
+                bench_measure(&opts, problem1_run, &run, 0, &stats);
+                bench_print_stats(&stats);
+                perfctr_print(&perf_session);
+                
+                results[isa][s][i] = stats.time.median;
+                roofline[isa][s][i] = perfctr_roofline(&perf_session);
+                printf("  Median time: %.4f seconds (%.3f Gelem/s)\n\n", results[isa][s][i],
+                       run.n / results[isa][s][i] / 1e9);
+                snprintf(benchmark, sizeof(benchmark), "minmaxmean_%s", rng_isa_names[isa]);
+                bench_report_add(&report, benchmark, run.threads, run.n, &stats, NULL, NULL, 0);
+                perfctr_write_rows(counters, run.threads, benchmark, &perf_session);
+            }
         }
-        
-        results[i] = total_time / runs;  // FIXED: Calculate average
-        printf("  Average time: %.4f seconds\n\n", results[i]);
     }
     
     // Print speedup table
     printf("\n=================================================================\n");
     printf("SPEEDUP ANALYSIS\n");
     printf("=================================================================\n");
-    printf("Threads | Time (s)  | Speedup | Efficiency\n");
-    printf("--------|-----------|---------|------------\n");
-    
-    double baseline = results[0];
-    for (int i = 0; i < num_configs; i++) {
-        double speedup = baseline / results[i];
-        double efficiency = (speedup / thread_counts[i]) * 100.0;
-        printf("  %2d    | %9.4f | %7.2f | %7.2f%%\n", 
-               thread_counts[i], results[i], speedup, efficiency);
+    printf("Kernel | Elements    | Threads | Time (s)  | Speedup | Efficiency | Gelem/s | GB/s\n");
+    printf("-------|-------------|---------|-----------|---------|------------|---------|-------\n");
+    
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (!use_isa[isa]) continue;
+        for (int s = 0; s < opts.num_sizes; s++) {
+            long long n = opts.sizes[s];
+            double baseline = results[isa][s][0];
+            for (int i = 0; i < num_configs; i++) {
+                double speedup = baseline / results[isa][s][i];
+                double efficiency = (speedup / thread_counts[i]) * 100.0;
+                printf("%-6s | %11lld |   %2d    | %9.4f | %7.2f | %7.2f%%   | %7.3f | %6.2f\n", 
+                       rng_isa_names[isa], n, thread_counts[i], results[isa][s][i], speedup, efficiency,
+                       n / results[isa][s][i] / 1e9, n * sizeof(long long) / results[isa][s][i] / 1e9);
+            }
+        }
     }
     
     // Save results to file
     FILE *fp = fopen("problem1_results.txt", "w");
-    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%)\n");
-    for (int i = 0; i < num_configs; i++) {
-        double speedup = baseline / results[i];
-        double efficiency = (speedup / thread_counts[i]) * 100.0;
-        fprintf(fp, "%d,%.4f,%.2f,%.2f\n", 
-                thread_counts[i], results[i], speedup, efficiency);
+    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%),Kernel,Elements/s,GB/s,Topology,Elements,Roofline\n");
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (!use_isa[isa]) continue;
+        for (int s = 0; s < opts.num_sizes; s++) {
+            long long n = opts.sizes[s];
+            double baseline = results[isa][s][0];
+            for (int i = 0; i < num_configs; i++) {
+                double speedup = baseline / results[isa][s][i];
+                double efficiency = (speedup / thread_counts[i]) * 100.0;
+                char topology[64];
+                topo_describe(thread_counts[i], topology, sizeof(topology));
+                fprintf(fp, "%d,%.4f,%.2f,%.2f,%s,%.4e,%.3f,%s,%lld,%s\n", 
+                        thread_counts[i], results[isa][s][i], speedup, efficiency, rng_isa_names[isa],
+                        n / results[isa][s][i], n * sizeof(long long) / results[isa][s][i] / 1e9, topology, n,
+                        roofline[isa][s][i]);
+            }
+        }
     }
     fclose(fp);
-    printf("\nResults saved to problem1_results.txt\n");
+    if (counters) fclose(counters);
+    printf("\nResults saved to problem1_results.txt (counters per phase in problem1_counters.txt)\n");
     
-    return 0;
-}
\ No newline at end of file
+    int regressions = bench_finish(&report, &opts);
+    bench_report_free(&report);
+    return regressions > 0 ? 2 : 0;
+}
@@ -1,97 +1,291 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <omp.h>
-#include <sys/time.h>
+#include <string.h>
+#include "rng.h"
+#include "ternary.h"
+#include "topology.h"
+#include "perfctr.h"
+#include "bench.h"
 
 #define N 1000000000LL  // 10^9 elements
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
-}
+PerfSession perf_session;  // counters of the last run
 
-double problem2_dot_product_reduction(int num_threads) {  // Return time
-    omp_set_num_threads(num_threads);
+double problem2_dot_product_reduction(int num_threads, long long *result) {  // Return time
+    topo_set_num_threads(num_threads);
     
     long long dot_product = 0;
     
-    double start_time = get_time();
+    // One stream per vector; element i of a and b depends only on i
+    unsigned long long key_a = rng_key(12345, 1);
+    unsigned long long key_b = rng_key(12345, 2);
+    RngRange range = rng_range(3);
+    
+    perfctr_begin(&perf_session, "regenerated", num_threads);
+    double start_time = bench_now();
     
     #pragma omp parallel reduction(+:dot_product)
     {
-        unsigned int seed = omp_get_thread_num() * 42 + 12345;
+        unsigned long long a[RNG_BLOCK], b[RNG_BLOCK];
+        int tid = omp_get_thread_num();
+        long long begin = N * tid / omp_get_num_threads();
+        long long end = N * (tid + 1) / omp_get_num_threads();
         
-        #pragma omp for
-        for (long long i = 0; i < N; i++) {
-            int a = (rand_r(&seed) % 3) - 1;
-            int b = (rand_r(&seed) % 3) - 1;
-            dot_product += (long long)a * b;
+        for (long long first = begin; first < end; first += RNG_BLOCK) {
+            long long count = (end - first < RNG_BLOCK) ? end - first : RNG_BLOCK;
+            rng_fill_bounded(key_a, first, count, &range, a);
+            rng_fill_bounded(key_b, first, count, &range, b);
+            
+            for (long long i = 0; i < count; i++) {
+                dot_product += ((long long)a[i] - 1) * ((long long)b[i] - 1);
+            }
         }
     }
     
-    double end_time = get_time();
+    double end_time = bench_now();
+    perfctr_end(&perf_session);
     double execution_time = end_time - start_time;
     
-    printf("Threads: %2d | Dot Product: %lld | Time: %.4f s\n", 
+    printf("Threads: %2d | Dot Product: %lld | Time: %.4f s (regenerated)\n", 
            num_threads, dot_product, execution_time);
     
+    *result = dot_product;
+    return execution_time;
+}
+
+// Stored copies of the two vectors: one byte per element (unpacked) and
+// 2 bits per element (packed). Both hold exactly the regenerated values.
+typedef struct {
+    signed char *a, *b;
+    TernaryVector packed_a, packed_b;
+} DotVectors;
+
+static void fill_vector(unsigned long long key, const RngRange *range, signed char *unpacked,
+                        TernaryVector *packed, int num_threads) {
+    #pragma omp parallel num_threads(num_threads)
+    {
+        unsigned long long digits[TERNARY_GROUP];
+        signed char values[TERNARY_GROUP];
+        
+        // Static schedule: each thread first-touches the pages it later reads
+        #pragma omp for schedule(static)
+        for (long long g = 0; g < packed->groups; g++) {
+            long long first = g * TERNARY_GROUP;
+            int count = (N - first < TERNARY_GROUP) ? (int)(N - first) : TERNARY_GROUP;
+            rng_fill_bounded(key, first, count, range, digits);
+            for (int i = 0; i < count; i++) values[i] = (signed char)digits[i] - 1;
+            if (unpacked) memcpy(&unpacked[first], values, count);
+            ternary_pack_group(packed, g, values, count);
+        }
+    }
+}
+
+// Returns 0 on success. The unpacked copies are optional (2 GB): if they
+// cannot be allocated, only the packed comparison runs.
+int generate_vectors(DotVectors *v, int num_threads) {
+    memset(v, 0, sizeof(*v));
+    if (ternary_alloc(&v->packed_a, N) != 0 || ternary_alloc(&v->packed_b, N) != 0) {
+        ternary_free(&v->packed_a);
+        return -1;
+    }
+    v->a = malloc(N);
+    v->b = v->a ? malloc(N) : NULL;
+    if (!v->b) {
+        free(v->a);
+        v->a = NULL;
+        fprintf(stderr, "Unpacked vectors (%.1f GB) could not be allocated, skipping them\n", 2.0 * N / 1e9);
+    }
+    
+    RngRange range = rng_range(3);
+    fill_vector(rng_key(12345, 1), &range, v->a, &v->packed_a, num_threads);
+    fill_vector(rng_key(12345, 2), &range, v->b, &v->packed_b, num_threads);
+    return 0;
+}
+
+void free_vectors(DotVectors *v) {
+    free(v->a);
+    free(v->b);
+    ternary_free(&v->packed_a);
+    ternary_free(&v->packed_b);
+}
+
+double problem2_dot_unpacked(const DotVectors *v, int num_threads, long long *result) {
+    topo_set_num_threads(num_threads);
+    long long dot_product = 0;
+    const signed char *a = v->a, *b = v->b;
+    
+    perfctr_begin(&perf_session, "unpacked", num_threads);
+    double start_time = bench_now();
+    #pragma omp parallel for schedule(static) reduction(+:dot_product)
+    for (long long i = 0; i < N; i++) {
+        dot_product += a[i] * b[i];
+    }
+    double execution_time = bench_now() - start_time;
+    perfctr_end(&perf_session);
+    
+    printf("Threads: %2d | Dot Product: %lld | Time: %.4f s (unpacked, %.2f GB/s)\n", 
+           num_threads, dot_product, execution_time, 2.0 * N / execution_time / 1e9);
+    
+    *result = dot_product;
     return execution_time;
 }
 
-int main() {
-    int thread_counts[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
-    int num_configs = 9;
-    int runs = 5;
+double problem2_dot_packed(const DotVectors *v, TernaryKernel kernel, int num_threads, long long *result) {
+    topo_set_num_threads(num_threads);
+    
+    perfctr_begin(&perf_session, "packed", num_threads);
+    double start_time = bench_now();
+    long long dot_product = ternary_dot(&v->packed_a, &v->packed_b, kernel, num_threads);
+    double execution_time = bench_now() - start_time;
+    perfctr_end(&perf_session);
+    
+    printf("Threads: %2d | Dot Product: %lld | Time: %.4f s (packed, %.2f GB/s)\n", 
+           num_threads, dot_product, execution_time,
+           2.0 * ternary_bytes(N) / execution_time / 1e9);
+    
+    *result = dot_product;
+    return execution_time;
+}
+
+typedef struct {
+    const DotVectors *vectors;
+    TernaryKernel kernel;
+    int threads;
+    int have_unpacked;
+    int mismatch;
+} Problem2Run;
+
+// Timed value: the regenerated dot product; extras: unpacked, packed
+static double problem2_run(void *ctx, double *extra) {
+    Problem2Run *p = ctx;
+    long long regen_dot, unpacked_dot, packed_dot;
+    perfctr_reset(&perf_session);
+    double time = problem2_dot_product_reduction(p->threads, &regen_dot);
+    if (p->have_unpacked) {
+        printf("         ");
+        extra[0] = problem2_dot_unpacked(p->vectors, p->threads, &unpacked_dot);
+        if (unpacked_dot != regen_dot) p->mismatch = 1;
+    }
+    printf("         ");
+    extra[1] = problem2_dot_packed(p->vectors, p->kernel, p->threads, &packed_dot);
+    if (packed_dot != regen_dot) p->mismatch = 1;
+    return time;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    bench_options_init(&opts, "problem2", 0);
+    if (bench_parse_args(&opts, &argc, argv) != 0) return 1;
+    if (argc > 1) {
+        fprintf(stderr, "Usage: %s [benchmark options]\n", argv[0]);
+        bench_usage(&opts);
+        return 1;
+    }
+    
+    const int *thread_counts = opts.threads;
+    int num_configs = opts.num_threads;
+    int max_threads = 1;
+    for (int i = 0; i < num_configs; i++) {
+        if (thread_counts[i] > max_threads) max_threads = thread_counts[i];
+    }
+    TernaryKernel kernel = ternary_best_kernel();
     
     printf("=================================================================\n");
     printf("PROBLEM 2: Dot Product (10^9 elements from {-1, 0, 1})\n");
+    printf("Generator: counter-based (%s kernel) | Packed kernel: %s\n",
+           rng_isa_name(), ternary_kernel_names[kernel]);
+    topo_print_summary();
+    perfctr_print_summary();
     printf("=================================================================\n\n");
     
-    double results[9];
+    DotVectors vectors;
+    double gen_start = bench_now();
+    topo_set_num_threads(max_threads);
+    if (generate_vectors(&vectors, max_threads) != 0) {
+        fprintf(stderr, "Memory allocation failed for the packed vectors\n");
+        return 1;
+    }
+    int have_unpacked = (vectors.a != NULL);
+    printf("Stored vectors generated in %.4f s | Packed: %.1f MB per vector", bench_now() - gen_start,
+           ternary_bytes(N) / 1e6);
+    if (have_unpacked) printf(" | Unpacked: %.1f MB per vector", N / 1e6);
+    printf("\n\n");
+    
+    static const char *const extra_names[] = {"unpacked", "packed"};
+    double results[BENCH_MAX_CONFIGS], unpacked[BENCH_MAX_CONFIGS], packed[BENCH_MAX_CONFIGS];
+    const char *roofline[BENCH_MAX_CONFIGS][3];   // regenerated, unpacked, packed
+    FILE *counters = fopen("problem2_counters.txt", "w");
+    if (counters) perfctr_write_header(counters);
+    int mismatch = 0;
+    BenchReport report;
+    bench_report_init(&report);
     
     for (int i = 0; i < num_configs; i++) {
-        int threads = thread_counts[i];
-        double total_time = 0.0;
+        Problem2Run run = {&vectors, kernel, thread_counts[i], have_unpacked, 0};
+        BenchStats stats;
         
-        printf("Running with %d thread(s) - %d iterations:\n", threads, runs);
+        printf("Running with %d thread(s) - %d to %d iterations:\n", run.threads, opts.min_runs, opts.max_runs);
+        bench_measure(&opts, problem2_run, &run, 2, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, run.threads, "dot", &perf_session);
+        mismatch |= run.mismatch;
+        roofline[i][0] = perfctr_phase_roofline(&perf_session, "regenerated");
+        roofline[i][1] = perfctr_phase_roofline(&perf_session, "unpacked");
+        roofline[i][2] = perfctr_phase_roofline(&perf_session, "packed");
         
-        for (int run = 0; run < runs; run++) {
-            printf("  Run %d: ", run + 1);
-            double exec_time = problem2_dot_product_reduction(threads);
-            total_time += exec_time;
+        results[i] = stats.time.median;
+        unpacked[i] = have_unpacked ? stats.extra[0].median : 0.0;
+        packed[i] = stats.extra[1].median;
+        printf("  Median time: %.4f seconds (unpacked %.4f s, packed %.4f s)\n\n",
+               results[i], unpacked[i], packed[i]);
+        bench_report_add(&report, "dot", run.threads, N, &stats, extra_names, NULL,
+                         have_unpacked ? 2 : 0);
+        if (!have_unpacked) {
+            bench_report_add_summary(&report, "dot", "packed", run.threads, N, stats.outliers,
+                                     BENCH_LOWER_BETTER, &stats.extra[1]);
         }
-        
-        results[i] = total_time / runs;
-        printf("  Average time: %.4f seconds\n\n", results[i]);
     }
+    if (mismatch) fprintf(stderr, "WARNING: stored-vector dot products differ from the regenerated one\n");
     
     // Print speedup table
     printf("\n=================================================================\n");
     printf("SPEEDUP ANALYSIS\n");
     printf("=================================================================\n");
-    printf("Threads | Time (s)  | Speedup | Efficiency\n");
-    printf("--------|-----------|---------|------------\n");
+    printf("Threads | Time (s)  | Speedup | Efficiency | Unpacked (s) | Packed (s) | Packed GB/s\n");
+    printf("--------|-----------|---------|------------|--------------|------------|------------\n");
     
     double baseline = results[0];
     for (int i = 0; i < num_configs; i++) {
         double speedup = baseline / results[i];
         double efficiency = (speedup / thread_counts[i]) * 100.0;
-        printf("  %2d    | %9.4f | %7.2f | %7.2f%%\n", 
-               thread_counts[i], results[i], speedup, efficiency);
+        printf("  %2d    | %9.4f | %7.2f | %7.2f%%   | %12.4f | %10.4f | %10.2f\n", 
+               thread_counts[i], results[i], speedup, efficiency, unpacked[i], packed[i],
+               2.0 * ternary_bytes(N) / packed[i] / 1e9);
     }
     
     // Save results
     FILE *fp = fopen("problem2_results.txt", "w");
-    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%)\n");
+    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%),Unpacked_Time(s),Packed_Time(s),Packed_GB/s,Topology,"
+                "Roofline,Unpacked_Roofline,Packed_Roofline\n");
     for (int i = 0; i < num_configs; i++) {
         double speedup = baseline / results[i];
         double efficiency = (speedup / thread_counts[i]) * 100.0;
-        fprintf(fp, "%d,%.4f,%.2f,%.2f\n", 
-                thread_counts[i], results[i], speedup, efficiency);
+        char topology[64];
+        topo_describe(thread_counts[i], topology, sizeof(topology));
+        fprintf(fp, "%d,%.4f,%.2f,%.2f,%.4f,%.4f,%.2f,%s,%s,%s,%s\n", 
+                thread_counts[i], results[i], speedup, efficiency, unpacked[i], packed[i],
+                2.0 * ternary_bytes(N) / packed[i] / 1e9, topology,
+                roofline[i][0], roofline[i][1], roofline[i][2]);
     }
     fclose(fp);
-    printf("\nResults saved to problem2_results.txt\n");
+    if (counters) fclose(counters);
+    printf("\nResults saved to problem2_results.txt (counters per phase in problem2_counters.txt)\n");
     
-    return 0;
-}
\ No newline at end of file
+    free_vectors(&vectors);
+    int regressions = bench_finish(&report, &opts);
+    bench_report_free(&report);
+    return regressions > 0 ? 2 : 0;
+}
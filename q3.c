@@ -1,115 +1,258 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <omp.h>
-#include <sys/time.h>
+#include "rng.h"
+#include "merge.h"
+#include "intsort.h"
+#include "topology.h"
+#include "arena.h"
+#include "perfctr.h"
+#include "bench.h"
+#include <string.h>
 
 #define NUM_SUBSEQUENCES 1000
 #define ELEMENTS_PER_SEQ 1000000
 #define TOTAL_ELEMENTS (NUM_SUBSEQUENCES * ELEMENTS_PER_SEQ)
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
-}
+IntSortMethod sort_method = INTSORT_AUTO;
+int first_touch = 0;       // --first-touch: place the merge output with each run's team
+PerfSession perf_session;  // counters of the last run
+Arena arena;               // working set, reused by every run
 
-int compare_ints(const void *a, const void *b) {
-    int arg1 = *(const int*)a;
-    int arg2 = *(const int*)b;
-    return (arg1 > arg2) - (arg1 < arg2);
-}
+typedef struct {
+    double total;
+    double generate;
+    double sort;
+    double merge;         // 0 if the merge buffer could not be allocated
+} RunMetrics;
 
-double problem3_sorting_merging(int num_threads) {  // Return time
-    omp_set_num_threads(num_threads);
+double problem3_sorting_merging(int num_threads, RunMetrics *times) {  // Return time
+    topo_set_num_threads(num_threads);
+    arena_reset(&arena);
     
-    int *data = malloc(TOTAL_ELEMENTS * sizeof(int));
+    int *data = arena_alloc(&arena, (size_t)TOTAL_ELEMENTS * sizeof(int), ARENA_ALIGN);
     if (!data) {
         fprintf(stderr, "Memory allocation failed!\n");
         exit(1);
     }
     
-    double start_time = get_time();
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "generate", num_threads);
+    double start_time = bench_now();
     
-    // Generate data
-    #pragma omp parallel for
-    for (int seq = 0; seq < NUM_SUBSEQUENCES; seq++) {
-        unsigned int seed = seq * 42 + 12345;
-        int base_value = seq * 1000;
+    // Generate data: element i of the whole array is value i of one stream
+    unsigned long long key = rng_key(12345, 3);
+    RngRange range = rng_range(1000);
+    
+    #pragma omp parallel
+    {
+        unsigned long long block[RNG_BLOCK];
         
-        for (int i = 0; i < ELEMENTS_PER_SEQ; i++) {
-            data[seq * ELEMENTS_PER_SEQ + i] = base_value + (rand_r(&seed) % 1000);
+        #pragma omp for
+        for (int seq = 0; seq < NUM_SUBSEQUENCES; seq++) {
+            int base_value = seq * 1000;
+            int *out = &data[(long long)seq * ELEMENTS_PER_SEQ];
+            
+            for (int first = 0; first < ELEMENTS_PER_SEQ; first += RNG_BLOCK) {
+                int count = (ELEMENTS_PER_SEQ - first < RNG_BLOCK) ? ELEMENTS_PER_SEQ - first : RNG_BLOCK;
+                rng_fill_bounded(key, (long long)seq * ELEMENTS_PER_SEQ + first, count, &range, block);
+                for (int i = 0; i < count; i++) {
+                    out[first + i] = base_value + (int)block[i];
+                }
+            }
         }
     }
     
-    // Parallel sort
-    #pragma omp parallel for
+    perfctr_end(&perf_session);
+    perfctr_begin(&perf_session, "sort", num_threads);
+    double sort_start = bench_now();
+    
+    // Parallel sort, one run per iteration with a per-thread scratch buffer
+    int *scratch_all = (sort_method == INTSORT_QSORT) ? NULL :
+        arena_alloc(&arena, (size_t)num_threads * ELEMENTS_PER_SEQ * sizeof(int), ARENA_ALIGN);
+    #pragma omp parallel
+    {
+        int *scratch = scratch_all ? &scratch_all[(size_t)omp_get_thread_num() * ELEMENTS_PER_SEQ] : NULL;
+        IntSortMethod method = (sort_method != INTSORT_QSORT && !scratch) ? INTSORT_QSORT : sort_method;
+        
+        #pragma omp for
+        for (int seq = 0; seq < NUM_SUBSEQUENCES; seq++) {
+            int *run = &data[(long long)seq * ELEMENTS_PER_SEQ];
+            if (intsort_sort(run, ELEMENTS_PER_SEQ, scratch, method) != 0) {
+                // No scratch for this run (counting / radix allocate their own): qsort it instead
+                qsort(run, ELEMENTS_PER_SEQ, sizeof(int), intsort_compare);
+            }
+        }
+    }
+    
+    perfctr_end(&perf_session);
+    perfctr_begin(&perf_session, "merge", num_threads);
+    double merge_start = bench_now();
+    
+    // Parallel k-way merge of the sorted runs into one sorted array
+    // The arena pre-faulted the output with the largest team's slices, so
+    // by default there is no first touch in the timed merge; --first-touch
+    // re-faults it with this run's slices first, as merge_runs_int() splits it
+    int *merged = arena_alloc(&arena, (size_t)TOTAL_ELEMENTS * sizeof(int), ARENA_ALIGN);
+    if (merged && first_touch) arena_place(&arena, merged, (size_t)TOTAL_ELEMENTS * sizeof(int), num_threads);
+    const int *runs[NUM_SUBSEQUENCES];
+    long long lens[NUM_SUBSEQUENCES];
     for (int seq = 0; seq < NUM_SUBSEQUENCES; seq++) {
-        qsort(&data[seq * ELEMENTS_PER_SEQ], ELEMENTS_PER_SEQ, sizeof(int), compare_ints);
+        runs[seq] = &data[(long long)seq * ELEMENTS_PER_SEQ];
+        lens[seq] = ELEMENTS_PER_SEQ;
     }
+    int merge_ok = merged && merge_runs_int(runs, lens, NUM_SUBSEQUENCES, merged, num_threads) == 0;
     
-    double end_time = get_time();
+    double end_time = bench_now();
+    perfctr_end(&perf_session);
     double execution_time = end_time - start_time;
     
-    printf("Threads: %2d | Elements: %d | Time: %.4f s\n", 
-           num_threads, TOTAL_ELEMENTS, execution_time);
+    times->total = execution_time;
+    times->generate = sort_start - start_time;
+    times->sort = merge_start - sort_start;
+    times->merge = merge_ok ? end_time - merge_start : 0.0;
+    
+    printf("Threads: %2d | Elements: %d | Time: %.4f s (Gen: %.4f s, Sort: %.4f s, Merge: %.4f s)\n", 
+           num_threads, TOTAL_ELEMENTS, execution_time, times->generate, times->sort, times->merge);
+    
+    if (merge_ok) {
+        long long unsorted = 0;
+        #pragma omp parallel for reduction(+:unsorted)
+        for (long long i = 1; i < TOTAL_ELEMENTS; i++) {
+            unsorted += merged[i - 1] > merged[i];
+        }
+        if (unsorted) fprintf(stderr, "Merge check failed: %lld adjacent pairs out of order\n", unsorted);
+    } else {
+        fprintf(stderr, "Merge skipped: could not allocate the %.1f GB output\n",
+                (double)TOTAL_ELEMENTS * sizeof(int) / 1e9);
+    }
     
-    free(data);
     return execution_time;
 }
 
-int main() {
-    int thread_counts[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
-    int num_configs = 9;
-    int runs = 5;
+// Timed value: the whole run; extras: generate, sort, merge
+static double problem3_run(void *ctx, double *extra) {
+    RunMetrics times;
+    double time = problem3_sorting_merging(*(const int *)ctx, &times);
+    extra[0] = times.generate;
+    extra[1] = times.sort;
+    extra[2] = times.merge;
+    return time;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    bench_options_init(&opts, "problem3", 0);
+    if (bench_parse_args(&opts, &argc, argv) != 0) return 1;
+    
+    // Optional arguments: run sort method (qsort, auto, counting, radix,
+    // network) and --first-touch to place the merge output per run
+    int have_method = 0;
+    for (int a = 1; a < argc; a++) {
+        int method = intsort_parse(argv[a]);
+        if (strcmp(argv[a], "--first-touch") == 0) {
+            first_touch = 1;
+        } else if (method >= 0 && !have_method) {
+            sort_method = (IntSortMethod)method;
+            have_method = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [qsort|auto|counting|radix|network] [--first-touch]\n", argv[0]);
+            bench_usage(&opts);
+            return 1;
+        }
+    }
+    
+    const int *thread_counts = opts.threads;
+    int num_configs = opts.num_threads;
+    int max_threads = 1;
+    for (int i = 0; i < num_configs; i++) {
+        if (thread_counts[i] > max_threads) max_threads = thread_counts[i];
+    }
+    arena_init(&arena, max_threads);
     
     printf("=================================================================\n");
     printf("PROBLEM 3: Sorting and Merging Subsequences\n");
+    printf("Generator: counter-based (%s kernel) | Run sort: %s\n",
+           rng_isa_name(), intsort_method_names[sort_method]);
+    topo_print_summary();
+    perfctr_print_summary();
     printf("=================================================================\n\n");
     
-    double results[9];
+    static const char *const extra_names[] = {"generate", "sort", "merge"};
+    double results[BENCH_MAX_CONFIGS], sort_time[BENCH_MAX_CONFIGS], merge_time[BENCH_MAX_CONFIGS];
+    const char *roofline[BENCH_MAX_CONFIGS][4];   // whole run, generate, sort, merge
+    FILE *counters = fopen("problem3_counters.txt", "w");
+    if (counters) perfctr_write_header(counters);
+    BenchReport report;
+    bench_report_init(&report);
+    char benchmark[64];
+    snprintf(benchmark, sizeof(benchmark), "sortmerge_%s", intsort_method_names[sort_method]);
     
     for (int i = 0; i < num_configs; i++) {
         int threads = thread_counts[i];
-        double total_time = 0.0;
+        BenchStats stats;
         
-        printf("Running with %d thread(s) - %d iterations:\n", threads, runs);
+        printf("Running with %d thread(s) - %d to %d iterations:\n", threads, opts.min_runs, opts.max_runs);
+        bench_measure(&opts, problem3_run, &threads, 3, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, threads, benchmark, &perf_session);
+        roofline[i][0] = perfctr_roofline(&perf_session);
+        roofline[i][1] = perfctr_phase_roofline(&perf_session, "generate");
+        roofline[i][2] = perfctr_phase_roofline(&perf_session, "sort");
+        roofline[i][3] = perfctr_phase_roofline(&perf_session, "merge");
         
-        for (int run = 0; run < runs; run++) {
-            printf("  Run %d: ", run + 1);
-            double exec_time = problem3_sorting_merging(threads);
-            total_time += exec_time;
-        }
-        
-        results[i] = total_time / runs;
-        printf("  Average time: %.4f seconds\n\n", results[i]);
+        results[i] = stats.time.median;
+        sort_time[i] = stats.extra[1].median;
+        merge_time[i] = stats.extra[2].median;
+        printf("  Median time: %.4f seconds (Sort: %.4f s, Merge: %.4f s)\n\n",
+               results[i], sort_time[i], merge_time[i]);
+        bench_report_add(&report, benchmark, threads, TOTAL_ELEMENTS, &stats, extra_names, NULL, 3);
     }
     
     // Print speedup table
     printf("\n=================================================================\n");
     printf("SPEEDUP ANALYSIS\n");
     printf("=================================================================\n");
-    printf("Threads | Time (s)  | Speedup | Efficiency\n");
-    printf("--------|-----------|---------|------------\n");
+    printf("Threads | Time (s)  | Speedup | Efficiency | Sort Melem/s | Merge Melem/s\n");
+    printf("--------|-----------|---------|------------|--------------|--------------\n");
     
     double baseline = results[0];
     for (int i = 0; i < num_configs; i++) {
         double speedup = baseline / results[i];
         double efficiency = (speedup / thread_counts[i]) * 100.0;
-        printf("  %2d    | %9.4f | %7.2f | %7.2f%%\n", 
-               thread_counts[i], results[i], speedup, efficiency);
+        printf("  %2d    | %9.4f | %7.2f | %7.2f%%   | %12.1f | %12.1f\n", 
+               thread_counts[i], results[i], speedup, efficiency,
+               TOTAL_ELEMENTS / sort_time[i] / 1e6,
+               merge_time[i] > 0 ? TOTAL_ELEMENTS / merge_time[i] / 1e6 : 0.0);
     }
     
     // Save results
     FILE *fp = fopen("problem3_results.txt", "w");
-    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%)\n");
+    fprintf(fp, "Threads,Time(s),Speedup,Efficiency(%%),Sort_Time(s),Sort_Throughput(Melem/s),"
+                "Merge_Time(s),Merge_Throughput(Melem/s),Topology,Roofline,Generate_Roofline,Sort_Roofline,"
+                "Merge_Roofline\n");
     for (int i = 0; i < num_configs; i++) {
         double speedup = baseline / results[i];
         double efficiency = (speedup / thread_counts[i]) * 100.0;
-        fprintf(fp, "%d,%.4f,%.2f,%.2f\n", 
-                thread_counts[i], results[i], speedup, efficiency);
+        char topology[64];
+        topo_describe(thread_counts[i], topology, sizeof(topology));
+        fprintf(fp, "%d,%.4f,%.2f,%.2f,%.4f,%.1f,%.4f,%.1f,%s,%s,%s,%s,%s\n", 
+                thread_counts[i], results[i], speedup, efficiency,
+                sort_time[i], TOTAL_ELEMENTS / sort_time[i] / 1e6,
+                merge_time[i], merge_time[i] > 0 ? TOTAL_ELEMENTS / merge_time[i] / 1e6 : 0.0, topology,
+                roofline[i][0], roofline[i][1], roofline[i][2], roofline[i][3]);
     }
     fclose(fp);
-    printf("\nResults saved to problem3_results.txt\n");
+    if (counters) fclose(counters);
+    printf("\nResults saved to problem3_results.txt (counters per phase in problem3_counters.txt)\n");
+    char arena_info[128];
+    arena_describe(&arena, arena_info, sizeof(arena_info));
+    printf("Arena: %s\n", arena_info);
+    arena_release(&arena);
     
-    return 0;
-}
\ No newline at end of file
+    int regressions = bench_finish(&report, &opts);
+    bench_report_free(&report);
+    return regressions > 0 ? 2 : 0;
+}
@@ -1,42 +1,72 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <omp.h>
-#include <sys/time.h>
 #include <string.h>
+#include <math.h>
+#include "rng.h"
+#include "gemm.h"
+#include "gemm_tune.h"
+#include "recmm.h"
+#include "summa.h"
+#include "concur.h"
+#include "topology.h"
+#include "arena.h"
+#include "perfctr.h"
+#include "bench.h"
 
-#define MATRIX_SIZE 4096
+#define MATRIX_SIZE 4096   // default size; --sizes= sweeps others
+#define VERIFY_SIZE 257   // odd, so every edge-tile path of the packed engine runs
+#define TUNE_SIZE 1024
+#define STRASSEN_LEVELS 2
+#define VERIFY_LEAF 32   // small, so the verification product really recurses
+#define SUMMA_PANEL 256
+#define SUMMA_BLOCK 32   // largest tile of the blocked sweep
+#define VERIFY_SUMMA_PANEL 16   // narrow, so the verification product takes many steps
 
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
+// Packed engine configuration: the tuning file if there is one, else defaults
+GemmConfig gemm_config;
+PerfSession perf_session;  // counters of the last run
+Arena arena;               // matrices, reused by every run
+
+double gflops(int n, double seconds) {
+    return 2.0 * n * n * n / seconds / 1e9;
 }
 
-double matrix_multiply_block(int n, int block_size, int num_threads) {
-    omp_set_num_threads(num_threads);
-    
-    // Allocate matrices
-    double **A = malloc(n * sizeof(double*));
-    double **B = malloc(n * sizeof(double*));
-    double **C = malloc(n * sizeof(double*));
-    
-    for (int i = 0; i < n; i++) {
-        A[i] = malloc(n * sizeof(double));
-        B[i] = malloc(n * sizeof(double));
-        C[i] = malloc(n * sizeof(double));
+// Resets the arena and carves A, B and C out of it, one aligned block each.
+// Entry (i, j) of A and B is value i * n + j of its stream, so rows can be
+// filled in parallel and the matrices never change; C is zeroed.
+void init_matrices(int n, double **A, double **B, double **C) {
+    size_t bytes = (size_t)n * n * sizeof(double);
+    arena_reset(&arena);
+    *A = arena_alloc(&arena, bytes, GEMM_ALIGN);
+    *B = arena_alloc(&arena, bytes, GEMM_ALIGN);
+    *C = arena_alloc(&arena, bytes, GEMM_ALIGN);
+    if (!*A || !*B || !*C) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(1);
     }
     
-    // Initialize matrices
-    unsigned int seed = 42;
+    unsigned long long key_a = rng_key(42, 1);
+    unsigned long long key_b = rng_key(42, 2);
+    double *a = *A, *b = *B, *c = *C;
+    #pragma omp parallel for schedule(static)
     for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            A[i][j] = (double)rand_r(&seed) / RAND_MAX;
-            B[i][j] = (double)rand_r(&seed) / RAND_MAX;
-            C[i][j] = 0.0;
-        }
+        rng_fill_unit(key_a, (unsigned long long)i * n, n, &a[(long)i * n]);
+        rng_fill_unit(key_b, (unsigned long long)i * n, n, &b[(long)i * n]);
+        memset(&c[(long)i * n], 0, n * sizeof(double));
     }
+}
+
+double matrix_multiply_block(int n, int block_size, int num_threads) {
+    topo_set_num_threads(num_threads);
+    
+    double *A, *B, *C;
+    init_matrices(n, &A, &B, &C);
     
-    double start_time = get_time();
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "multiply", num_threads);
+    double start_time = bench_now();
     
     // Block matrix multiplication
     #pragma omp parallel for collapse(2) schedule(dynamic)
@@ -50,9 +80,9 @@ double matrix_multiply_block(int n, int block_size, int num_threads) {
                 
                 for (int i = ii; i < i_max; i++) {
                     for (int k = kk; k < k_max; k++) {
-                        double a_ik = A[i][k];
+                        double a_ik = A[(long)i * n + k];
                         for (int j = jj; j < j_max; j++) {
-                            C[i][j] += a_ik * B[k][j];
+                            C[(long)i * n + j] += a_ik * B[(long)k * n + j];
                         }
                     }
                 }
@@ -60,60 +90,230 @@ double matrix_multiply_block(int n, int block_size, int num_threads) {
         }
     }
     
-    double end_time = get_time();
+    double end_time = bench_now();
+    perfctr_end(&perf_session);
     double execution_time = end_time - start_time;
     
-    // Free memory
-    for (int i = 0; i < n; i++) {
-        free(A[i]);
-        free(B[i]);
-        free(C[i]);
+    return execution_time;
+}
+
+// Packed-panel engine from gemm.h (register-blocked FMA micro-kernel)
+double matrix_multiply_packed(int n, int num_threads) {
+    topo_set_num_threads(num_threads);
+    
+    double *A, *B, *C;
+    init_matrices(n, &A, &B, &C);
+    
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "multiply", num_threads);
+    double start_time = bench_now();
+    if (gemm_dgemm_with(&gemm_config, n, n, n, A, n, B, n, C, n, num_threads) != 0) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(1);
     }
-    free(A);
-    free(B);
-    free(C);
+    double execution_time = bench_now() - start_time;
+    perfctr_end(&perf_session);
     
     return execution_time;
 }
 
-int main() {
-    int thread_counts[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
-    int block_sizes[] = {2, 4, 8, 16, 32};
-    int num_thread_configs = 9;
-    int num_block_configs = 5;
-    int runs = 5;
+// Recursive engine: quadrant recursion down to `leaf` with strassen_levels
+// Strassen-Winograd levels on top. *error is max |C - C_classical| / max
+// |C_classical|, with the packed engine as the classical product (untimed).
+double matrix_multiply_recursive(int n, int num_threads, int leaf, int strassen_levels, double *error) {
+    topo_set_num_threads(num_threads);
     
-    printf("=================================================================\n");
-    printf("PROBLEM 4: Block Matrix Multiplication (%dx%d)\n", MATRIX_SIZE, MATRIX_SIZE);
-    printf("=================================================================\n\n");
+    double *A, *B, *C;
+    init_matrices(n, &A, &B, &C);
+    
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "multiply", num_threads);
+    double start_time = bench_now();
+    if (recmm_multiply(n, n, n, A, n, B, n, C, n, leaf, strassen_levels, num_threads) != 0) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        exit(1);
+    }
+    double execution_time = bench_now() - start_time;
+    perfctr_end(&perf_session);
+    
+    double *reference = arena_alloc(&arena, (size_t)n * n * sizeof(double), GEMM_ALIGN);
+    *error = -1.0;
+    if (reference) {
+        memset(reference, 0, (size_t)n * n * sizeof(double));
+        if (gemm_dgemm_with(&gemm_config, n, n, n, A, n, B, n, reference, n, num_threads) == 0) {
+            double max_diff = 0.0, max_ref = 0.0;
+            for (long i = 0; i < (long)n * n; i++) {
+                max_diff = fmax(max_diff, fabs(C[i] - reference[i]));
+                max_ref = fmax(max_ref, fabs(reference[i]));
+            }
+            *error = max_diff / max_ref;
+        }
+    }
+    
+    return execution_time;
+}
+
+// Largest |C - C_classical| on a small product; strassen_levels < 0 checks
+// the packed engine, otherwise the recursive one
+double verify_engine(int n, int strassen_levels) {
+    double *A, *B, *C;
+    init_matrices(n, &A, &B, &C);
+    if (strassen_levels < 0) {
+        gemm_dgemm_with(&gemm_config, n, n, n, A, n, B, n, C, n, 1);
+    } else {
+        recmm_multiply(n, n, n, A, n, B, n, C, n, VERIFY_LEAF, strassen_levels, 1);
+    }
+    
+    double max_error = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double expected = 0.0;
+            for (int k = 0; k < n; k++) expected += A[(long)i * n + k] * B[(long)k * n + j];
+            double error = fabs(C[(long)i * n + j] - expected);
+            if (error > max_error) max_error = error;
+        }
+    }
+    
+    return max_error;
+}
+
+// Largest |C - C_classical| of a SUMMA product on a 2 x 2 process grid
+double verify_summa(int n, int overlap) {
+    double *A, *B, *C;
+    init_matrices(n, &A, &B, &C);
+    SummaConfig cfg = {n, 4, 1, VERIFY_SUMMA_PANEL, 8, overlap, rng_key(42, 1), rng_key(42, 2)};
+    SummaResult result;
+    if (summa_multiply(&cfg, C, &result) != 0) return -1.0;
+    
+    double max_error = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double expected = 0.0;
+            for (int k = 0; k < n; k++) expected += A[(long)i * n + k] * B[(long)k * n + j];
+            double error = fabs(C[(long)i * n + j] - expected);
+            if (error > max_error) max_error = error;
+        }
+    }
+    
+    return max_error;
+}
+
+enum { ENGINE_BLOCKED, ENGINE_PACKED, ENGINE_RECURSIVE };
+
+#define ROOFLINE_TEXT 256
+
+typedef struct {
+    int engine;
+    int n, threads;
+    int block_size;                 // blocked
+    int leaf, strassen_levels;      // recursive
+    double error;                   // recursive, from the last run
+    ConcurController *concur;       // adaptive: threads come from the controller
+    int phase;
+} Problem4Run;
+
+static double problem4_run(void *ctx, double *extra) {
+    Problem4Run *p = ctx;
+    double exec_time;
+    (void)extra;
+    if (p->concur) p->threads = concur_use(p->concur, p->phase);
+    if (p->engine == ENGINE_BLOCKED) {
+        exec_time = matrix_multiply_block(p->n, p->block_size, p->threads);
+    } else if (p->engine == ENGINE_PACKED) {
+        exec_time = matrix_multiply_packed(p->n, p->threads);
+    } else {
+        exec_time = matrix_multiply_recursive(p->n, p->threads, p->leaf, p->strassen_levels, &p->error);
+    }
+    printf("Time: %.4f s (%.2f GFLOP/s)\n", exec_time, gflops(p->n, exec_time));
+    if (p->concur) concur_observe(p->concur, p->phase, gflops(p->n, exec_time));
+    return exec_time;
+}
+
+// Times one engine configuration at every thread count; medians go to
+// times[], and "benchmark=class;" is appended to each row's roofline string
+static void measure_engine(const BenchOptions *opts, Problem4Run run, const char *benchmark,
+                           BenchReport *report, double *times, double *errors,
+                           FILE *counters, char (*roofline)[ROOFLINE_TEXT]) {
+    for (int tc = 0; tc < opts->num_threads; tc++) {
+        BenchStats stats;
+        run.threads = opts->threads[tc];
+        
+        printf("Running with %d thread(s) - %d to %d iterations:\n", run.threads, opts->min_runs, opts->max_runs);
+        bench_measure(opts, problem4_run, &run, 0, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, run.threads, benchmark, &perf_session);
+        size_t used = strlen(roofline[tc]);
+        snprintf(roofline[tc] + used, ROOFLINE_TEXT - used, "%s%s=%s", used ? ";" : "", benchmark,
+                 perfctr_roofline(&perf_session));
+        
+        times[tc] = stats.time.median;
+        if (errors) errors[tc] = run.error;
+        printf("  Median time: %.4f seconds (%.2f GFLOP/s)\n\n", times[tc], gflops(run.n, times[tc]));
+        bench_report_add(report, benchmark, run.threads, run.n, &stats, NULL, NULL, 0);
+    }
+}
+
+static const int block_sizes[] = {2, 4, 8, 16, 32};
+#define NUM_BLOCK_CONFIGS 5
+
+// Runs the selected engines on n x n matrices, prints their tables and
+// appends their rows to the results file
+static void benchmark_size(int n, const BenchOptions *opts, int run_blocked, int run_packed, int run_recursive,
+                           int leaf, BenchReport *report, FILE *fp, FILE *counters) {
+    const int *thread_counts = opts->threads;
+    int num_thread_configs = opts->num_threads;
+    int num_block_configs = NUM_BLOCK_CONFIGS;
+    char benchmark[64];
     
     // Results: [thread_config][block_size]
-    double results[9][5];
+    double results[BENCH_MAX_CONFIGS][NUM_BLOCK_CONFIGS] = {{0}};
+    double packed_results[BENCH_MAX_CONFIGS] = {0};
+    double recursive_results[BENCH_MAX_CONFIGS] = {0}, recursive_error[BENCH_MAX_CONFIGS] = {0};
+    double strassen_results[BENCH_MAX_CONFIGS] = {0}, strassen_error[BENCH_MAX_CONFIGS] = {0};
+    char roofline[BENCH_MAX_CONFIGS][ROOFLINE_TEXT] = {{0}};   // per engine, e.g. "block2=bandwidth;..."
+    
+    printf("\n#################################################################\n");
+    printf("MATRIX SIZE: %dx%d\n", n, n);
+    printf("#################################################################\n");
     
     // Test each block size
-    for (int bs = 0; bs < num_block_configs; bs++) {
+    for (int bs = 0; bs < num_block_configs && run_blocked; bs++) {
         int block_size = block_sizes[bs];
+        double times[BENCH_MAX_CONFIGS];
+        Problem4Run run = {.engine = ENGINE_BLOCKED, .n = n, .block_size = block_size};
         
         printf("\n=================================================================\n");
         printf("BLOCK SIZE: %d\n", block_size);
         printf("=================================================================\n");
         
-        for (int tc = 0; tc < num_thread_configs; tc++) {
-            int threads = thread_counts[tc];
-            double total_time = 0.0;
-            
-            printf("Running with %d thread(s) - %d iterations:\n", threads, runs);
-            
-            for (int run = 0; run < runs; run++) {
-                printf("  Run %d: ", run + 1);
-                double exec_time = matrix_multiply_block(MATRIX_SIZE, block_size, threads);
-                printf("Time: %.4f s\n", exec_time);
-                total_time += exec_time;
-            }
-            
-            results[tc][bs] = total_time / runs;
-            printf("  Average time: %.4f seconds\n\n", results[tc][bs]);
-        }
+        snprintf(benchmark, sizeof(benchmark), "block%d", block_size);
+        measure_engine(opts, run, benchmark, report, times, NULL, counters, roofline);
+        for (int tc = 0; tc < num_thread_configs; tc++) results[tc][bs] = times[tc];
+    }
+    
+    if (run_packed) {
+        Problem4Run run = {.engine = ENGINE_PACKED, .n = n};
+        printf("\n=================================================================\n");
+        printf("PACKED GEMM ENGINE\n");
+        printf("=================================================================\n\n");
+        snprintf(benchmark, sizeof(benchmark), "packed_%s", gemm_config.kernel->name);
+        measure_engine(opts, run, benchmark, report, packed_results, NULL, counters, roofline);
+    }
+    
+    if (run_recursive) {
+        int levels = recmm_strassen_levels(n, n, n, leaf, STRASSEN_LEVELS);
+        Problem4Run run = {.engine = ENGINE_RECURSIVE, .n = n, .leaf = leaf};
+        printf("\n=================================================================\n");
+        printf("RECURSIVE ENGINE (leaf %d)\n", leaf);
+        printf("=================================================================\n\n");
+        measure_engine(opts, run, "recursive", report, recursive_results, recursive_error, counters, roofline);
+        
+        printf("\n=================================================================\n");
+        printf("STRASSEN-WINOGRAD (leaf %d, %d level(s) used)\n", leaf, levels);
+        printf("=================================================================\n\n");
+        run.strassen_levels = STRASSEN_LEVELS;
+        measure_engine(opts, run, "strassen", report, strassen_results, strassen_error, counters, roofline);
     }
     
     // Print speedup analysis for each block size
@@ -121,77 +321,439 @@ int main() {
     printf("SPEEDUP ANALYSIS BY BLOCK SIZE\n");
     printf("=================================================================\n\n");
     
-    for (int bs = 0; bs < num_block_configs; bs++) {
+    for (int bs = 0; bs < num_block_configs && run_blocked; bs++) {
         int block_size = block_sizes[bs];
         double baseline = results[0][bs];
         
         printf("Block Size %d:\n", block_size);
-        printf("Threads | Time (s)  | Speedup | Efficiency\n");
-        printf("--------|-----------|---------|------------\n");
+        printf("Threads | Time (s)  | GFLOP/s | Speedup | Efficiency\n");
+        printf("--------|-----------|---------|---------|------------\n");
         
         for (int tc = 0; tc < num_thread_configs; tc++) {
             double speedup = baseline / results[tc][bs];
             double efficiency = (speedup / thread_counts[tc]) * 100.0;
-            printf("  %2d    | %9.4f | %7.2f | %7.2f%%\n", 
-                   thread_counts[tc], results[tc][bs], speedup, efficiency);
+            printf("  %2d    | %9.4f | %7.2f | %7.2f | %7.2f%%\n", 
+                   thread_counts[tc], results[tc][bs], gflops(n, results[tc][bs]),
+                   speedup, efficiency);
         }
         printf("\n");
     }
     
-    // Comparison table across block sizes
-    printf("\n=================================================================\n");
-    printf("SPEEDUP COMPARISON (All Block Sizes)\n");
-    printf("=================================================================\n");
-    printf("Threads | Block2 | Block4 | Block8 | Block16 | Block32\n");
-    printf("--------|--------|--------|--------|---------|--------\n");
-    
-    for (int tc = 0; tc < num_thread_configs; tc++) {
-        printf("  %2d    |", thread_counts[tc]);
-        for (int bs = 0; bs < num_block_configs; bs++) {
-            double speedup = results[0][bs] / results[tc][bs];
-            printf(" %6.2f |", speedup);
+    if (run_packed) {
+        printf("Packed GEMM (%s):\n", gemm_config.kernel->name);
+        printf("Threads | Time (s)  | GFLOP/s | Speedup | Efficiency\n");
+        printf("--------|-----------|---------|---------|------------\n");
+        
+        for (int tc = 0; tc < num_thread_configs; tc++) {
+            double speedup = packed_results[0] / packed_results[tc];
+            double efficiency = (speedup / thread_counts[tc]) * 100.0;
+            printf("  %2d    | %9.4f | %7.2f | %7.2f | %7.2f%%\n", 
+                   thread_counts[tc], packed_results[tc], gflops(n, packed_results[tc]),
+                   speedup, efficiency);
         }
         printf("\n");
     }
     
-    // Save detailed results to CSV
-    FILE *fp = fopen("problem4_results.txt", "w");
-    fprintf(fp, "Threads");
-    for (int bs = 0; bs < num_block_configs; bs++) {
-        fprintf(fp, ",Block%d_Time,Block%d_Speedup", block_sizes[bs], block_sizes[bs]);
+    if (run_recursive) {
+        printf("Recursive (leaf %d) and Strassen-Winograd (%d levels):\n", leaf, STRASSEN_LEVELS);
+        printf("Threads | Rec. Time | GFLOP/s | Speedup | Str. Time | GFLOP/s* | Speedup | Rel. Error\n");
+        printf("--------|-----------|---------|---------|-----------|----------|---------|-----------\n");
+        
+        for (int tc = 0; tc < num_thread_configs; tc++) {
+            printf("  %2d    | %9.4f | %7.2f | %7.2f | %9.4f | %8.2f | %7.2f | %9.2e\n", thread_counts[tc],
+                   recursive_results[tc], gflops(n, recursive_results[tc]),
+                   recursive_results[0] / recursive_results[tc],
+                   strassen_results[tc], gflops(n, strassen_results[tc]),
+                   strassen_results[0] / strassen_results[tc], strassen_error[tc]);
+        }
+        printf("* Strassen GFLOP/s counts the classical 2n^3 operations\n\n");
     }
-    fprintf(fp, "\n");
     
+    // Comparison table across block sizes
+    if (run_blocked) {
+        printf("\n=================================================================\n");
+        printf("SPEEDUP COMPARISON (All Block Sizes)\n");
+        printf("=================================================================\n");
+        printf("Threads | Block2 | Block4 | Block8 | Block16 | Block32\n");
+        printf("--------|--------|--------|--------|---------|--------\n");
+        
+        for (int tc = 0; tc < num_thread_configs; tc++) {
+            printf("  %2d    |", thread_counts[tc]);
+            for (int bs = 0; bs < num_block_configs; bs++) {
+                double speedup = results[0][bs] / results[tc][bs];
+                printf(" %6.2f |", speedup);
+            }
+            printf("\n");
+        }
+    }
+    
+    // Detailed results (columns of engines that did not run are 0)
     for (int tc = 0; tc < num_thread_configs; tc++) {
         fprintf(fp, "%d", thread_counts[tc]);
         for (int bs = 0; bs < num_block_configs; bs++) {
-            double speedup = results[0][bs] / results[tc][bs];
+            double speedup = run_blocked ? results[0][bs] / results[tc][bs] : 0.0;
             fprintf(fp, ",%.4f,%.2f", results[tc][bs], speedup);
         }
-        fprintf(fp, "\n");
+        if (run_packed) {
+            fprintf(fp, ",%.4f,%.2f,%.2f", packed_results[tc], packed_results[0] / packed_results[tc],
+                    gflops(n, packed_results[tc]));
+        } else {
+            fprintf(fp, ",0.0000,0.00,0.00");
+        }
+        if (run_recursive) {
+            fprintf(fp, ",%.4f,%.2f,%.2e,%.4f,%.2f,%.2e", recursive_results[tc],
+                    gflops(n, recursive_results[tc]), recursive_error[tc], strassen_results[tc],
+                    gflops(n, strassen_results[tc]), strassen_error[tc]);
+        } else {
+            fprintf(fp, ",0.0000,0.00,0.00e+00,0.0000,0.00,0.00e+00");
+        }
+        char topology[64];
+        topo_describe(thread_counts[tc], topology, sizeof(topology));
+        fprintf(fp, ",%s,%d,%s\n", topology, n, roofline[tc]);
     }
-    fclose(fp);
-    printf("\nResults saved to problem4_results.txt\n");
     
     // Find optimal configuration
     printf("\n=================================================================\n");
-    printf("OPTIMAL CONFIGURATIONS\n");
+    printf("OPTIMAL CONFIGURATIONS (%dx%d)\n", n, n);
     printf("=================================================================\n");
     
     for (int tc = 0; tc < num_thread_configs; tc++) {
-        double min_time = results[tc][0];
-        int best_block = block_sizes[0];
+        double min_time = 0.0;
+        const char *best = "none";
+        char label[32];
         
-        for (int bs = 1; bs < num_block_configs; bs++) {
-            if (results[tc][bs] < min_time) {
+        for (int bs = 0; bs < num_block_configs && run_blocked; bs++) {
+            if (min_time == 0.0 || results[tc][bs] < min_time) {
                 min_time = results[tc][bs];
-                best_block = block_sizes[bs];
+                snprintf(label, sizeof(label), "block %d", block_sizes[bs]);
+                best = label;
             }
         }
+        if (run_packed && (min_time == 0.0 || packed_results[tc] < min_time)) {
+            min_time = packed_results[tc];
+            best = "packed";
+        }
+        if (run_recursive && (min_time == 0.0 || recursive_results[tc] < min_time)) {
+            min_time = recursive_results[tc];
+            best = "recursive";
+        }
+        if (run_recursive && (min_time == 0.0 || strassen_results[tc] < min_time)) {
+            min_time = strassen_results[tc];
+            best = "strassen";
+        }
+        
+        printf("Threads %2d: Best = %-9s (Time: %.4f s, %.2f GFLOP/s)\n", 
+               thread_counts[tc], best, min_time, gflops(n, min_time));
+    }
+}
+
+typedef struct {
+    SummaConfig cfg;
+    SummaResult result;   // from the last run
+} SummaRun;
+
+// Slowest rank's compute and exchange time of a SUMMA result
+static void summa_slowest(const SummaRun *s, double *compute, double *exchange) {
+    *compute = *exchange = 0.0;
+    for (int r = 0; r < s->cfg.ranks; r++) {
+        *compute = fmax(*compute, s->result.rank[r].compute);
+        *exchange = fmax(*exchange, s->result.rank[r].exchange);
+    }
+}
+
+static double problem4_summa_run(void *ctx, double *extra) {
+    SummaRun *s = ctx;
+    if (summa_multiply(&s->cfg, NULL, &s->result) != 0) {
+        fprintf(stderr, "SUMMA run failed (shared memory or a rank process)!\n");
+        exit(1);
+    }
+    summa_slowest(s, &extra[0], &extra[1]);
+    printf("Time: %.4f s (%.2f GFLOP/s, compute %.4f s, exchange %.4f s)\n", s->result.time,
+           gflops(s->cfg.n, s->result.time), extra[0], extra[1]);
+    return s->result.time;
+}
+
+// SUMMA over rank processes at every size and thread count (threads /
+// rank_threads ranks), without and with communication overlap. Per-rank
+// times of each configuration's last run go to problem4_summa.txt.
+static int problem4_summa(const BenchOptions *opts, int rank_threads, BenchReport *report) {
+    static const char *const extra_names[] = {"compute", "exchange"};
+    FILE *fp = fopen("problem4_summa.txt", "w");
+    if (!fp) {
+        fprintf(stderr, "Could not open problem4_summa.txt\n");
+        return -1;
+    }
+    fprintf(fp, "Threads,Ranks,Grid,Rank_Threads,Overlap,Size,Rank,Compute(s),Exchange(s),Comm(s),Total(s),"
+                "Time(s),GFLOPs\n");
+    
+    for (int s = 0; s < opts->num_sizes; s++) {
+        int n = (int)opts->sizes[s];
+        printf("\n#################################################################\n");
+        printf("SUMMA: %dx%d, panel %d, tile %d, %d thread(s) per rank\n", n, n, SUMMA_PANEL, SUMMA_BLOCK,
+               rank_threads);
+        printf("#################################################################\n");
         
-        printf("Threads %2d: Best block size = %2d (Time: %.4f s)\n", 
-               thread_counts[tc], best_block, min_time);
+        for (int tc = 0; tc < opts->num_threads; tc++) {
+            int threads = opts->threads[tc];
+            int ranks = threads / rank_threads > 0 ? threads / rank_threads : 1;
+            if (ranks > SUMMA_MAX_RANKS) ranks = SUMMA_MAX_RANKS;
+            
+            for (int overlap = 0; overlap <= 1; overlap++) {
+                SummaRun run = {.cfg = {n, ranks, rank_threads, SUMMA_PANEL, SUMMA_BLOCK, overlap,
+                                        rng_key(42, 1), rng_key(42, 2)}};
+                BenchStats stats;
+                summa_grid(ranks, &run.result.grid_rows, &run.result.grid_cols);
+                printf("\nRunning %d rank(s) (%dx%d grid), overlap %s - %d to %d iterations:\n", ranks,
+                       run.result.grid_rows, run.result.grid_cols, overlap ? "on" : "off", opts->min_runs,
+                       opts->max_runs);
+                if (summa_overlap_nominal(&run.cfg)) {
+                    printf("  (no spare CPU for the communication threads: they share the ranks' CPUs, "
+                           "so overlap is nominal)\n");
+                }
+                bench_measure(opts, problem4_summa_run, &run, 2, &stats);
+                bench_print_stats(&stats);
+                bench_report_add(report, overlap ? "summa_overlap" : "summa", threads, n, &stats, extra_names,
+                                 NULL, 2);
+                
+                printf("  Rank | Compute (s) | Exchange (s) | Comm (s) | Total (s)\n");
+                for (int r = 0; r < ranks; r++) {
+                    const SummaRankTimes *t = &run.result.rank[r];
+                    printf("  %4d | %11.4f | %12.4f | %8.4f | %9.4f\n", r, t->compute, t->exchange, t->comm,
+                           t->total);
+                    fprintf(fp, "%d,%d,%dx%d,%d,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f\n", threads, ranks,
+                            run.result.grid_rows, run.result.grid_cols, rank_threads, overlap, n, r, t->compute,
+                            t->exchange, t->comm, t->total, stats.time.median, gflops(n, stats.time.median));
+                }
+                printf("  Median time: %.4f seconds (%.2f GFLOP/s)\n", stats.time.median,
+                       gflops(n, stats.time.median));
+            }
+        }
     }
+    fclose(fp);
+    printf("\nSUMMA results saved to problem4_summa.txt\n");
+    return 0;
+}
+
+// Calibration run of the adaptive mode: GFLOP/s of one TUNE_SIZE multiply
+// with the engine of the Problem4Run in ctx
+static double problem4_probe(void *ctx, int threads) {
+    const Problem4Run *run = ctx;
+    double seconds = run->engine == ENGINE_BLOCKED ? matrix_multiply_block(TUNE_SIZE, run->block_size, threads)
+                                                   : matrix_multiply_packed(TUNE_SIZE, threads);
+    return gflops(TUNE_SIZE, seconds);
+}
+
+// Adaptive mode: the packed engine and the blocked engine (SUMMA_BLOCK
+// tiles) each get the thread count and placement their calibration picks
+// from the --threads candidates (concur.h); every size is then timed with
+// that choice only
+static int problem4_adaptive(const BenchOptions *opts, BenchReport *report) {
+    static Problem4Run engines[] = {{.engine = ENGINE_PACKED}, {.engine = ENGINE_BLOCKED, .block_size = SUMMA_BLOCK}};
+    static const char *const names[] = {"multiply_packed", "multiply_block32"};
+    FILE *log = fopen("problem4_adaptive.txt", "w");
+    if (!log) {
+        fprintf(stderr, "Could not open problem4_adaptive.txt\n");
+        return -1;
+    }
+    ConcurController concur;
+    concur_init(&concur, opts->threads, opts->num_threads, log);
     
+    for (int e = 0; e < 2; e++) {
+        int phase = concur_add_phase(&concur, names[e], "GFLOP/s", problem4_probe, &engines[e]);
+        for (int s = 0; s < opts->num_sizes; s++) {
+            Problem4Run run = engines[e];
+            BenchStats stats;
+            char benchmark[64];
+            run.n = (int)opts->sizes[s];
+            run.concur = &concur;
+            run.phase = phase;
+            
+            run.threads = concur_apply(&concur, phase);
+            printf("\nRunning %s adaptive, %dx%d - %d to %d iterations:\n", names[e], run.n, run.n,
+                   opts->min_runs, opts->max_runs);
+            bench_measure(opts, problem4_run, &run, 0, &stats);
+            bench_print_stats(&stats);
+            perfctr_print(&perf_session);
+            printf("  Median time: %.4f seconds (%.2f GFLOP/s) with %d thread(s), %s placement\n",
+                   stats.time.median, gflops(run.n, stats.time.median), run.threads,
+                   topo_policy_names[concur.phases[phase].policy]);
+            snprintf(benchmark, sizeof(benchmark), "%s_adaptive", names[e]);
+            bench_report_add(report, benchmark, run.threads, run.n, &stats, NULL, NULL, 0);
+        }
+    }
+    fclose(log);
+    printf("\nCalibrations saved to problem4_adaptive.txt\n");
     return 0;
-}
\ No newline at end of file
+}
+
+
+int main(int argc, char **argv) {
+    // Rank processes of the SUMMA engine re-execute this program
+    if (summa_is_rank(argc, argv)) return summa_rank_main(argc, argv);
+    
+    BenchOptions opts;
+    bench_options_init(&opts, "problem4", 1);
+    if (bench_parse_args(&opts, &argc, argv) != 0) return 1;
+    if (opts.num_sizes == 0) {
+        opts.sizes[0] = MATRIX_SIZE;
+        opts.num_sizes = 1;
+    }
+    
+    // Packed engine setup from this machine's tuning file, if present
+    char tuning_path[512];
+    GemmTuning tuning = {0};
+    gemm_tuning_path(tuning_path, sizeof(tuning_path));
+    int tuned = gemm_tuning_load(&tuning, tuning_path) == 0;
+    gemm_config = tuned ? tuning.config : gemm_default_config();
+    
+    // Engines to run: "blocked" (the block-size sweep), "packed", "recursive"
+    // (classical recursion and Strassen-Winograd), "tune" (search and save the
+    // packed engine's configuration), or by default the packed engine plus the
+    // sweep, which a tuned machine skips. "summa" runs the tiled kernel
+    // across rank processes instead (--rank-threads=<n> threads per rank).
+    // "adaptive" calibrates the thread count per engine and times only that.
+    int run_blocked = !tuned, run_packed = 1, run_recursive = 0, run_tune = 0, run_summa = 0, run_adaptive = 0;
+    int rank_threads = 1;
+    if (argc > 1) {
+        run_blocked = strcmp(argv[1], "blocked") == 0;
+        run_packed = strcmp(argv[1], "packed") == 0;
+        run_recursive = strcmp(argv[1], "recursive") == 0;
+        run_tune = strcmp(argv[1], "tune") == 0;
+        run_summa = strcmp(argv[1], "summa") == 0;
+        run_adaptive = strcmp(argv[1], "adaptive") == 0;
+        int extra_args = argc - 2;
+        if (run_summa && argc == 3 && strncmp(argv[2], "--rank-threads=", 15) == 0 && atoi(argv[2] + 15) > 0) {
+            rank_threads = atoi(argv[2] + 15);
+            extra_args = 0;
+        }
+        if ((!run_blocked && !run_packed && !run_recursive && !run_tune && !run_summa && !run_adaptive) ||
+            extra_args > 0) {
+            fprintf(stderr, "Usage: %s [blocked|packed|recursive|tune|adaptive]\n"
+                            "       %s summa [--rank-threads=<n>]\n", argv[0], argv[0]);
+            bench_usage(&opts);
+            return 1;
+        }
+    }
+    
+    if (run_tune) {
+        printf("=================================================================\n");
+        printf("PROBLEM 4: Packed GEMM autotuning (%dx%d)\n", TUNE_SIZE, TUNE_SIZE);
+        printf("=================================================================\n");
+        if (gemm_tune(TUNE_SIZE, opts.threads, opts.num_threads, 1, &tuning) != 0) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            return 1;
+        }
+        printf("\nBest: %s mc=%d kc=%d nc=%d threads=%d (%.2f GFLOP/s)\n", tuning.config.kernel->name,
+               tuning.config.mc, tuning.config.kc, tuning.config.nc, tuning.threads, tuning.gflops);
+        if (gemm_tuning_save(&tuning, tuning_path) != 0) {
+            fprintf(stderr, "Cannot write %s\n", tuning_path);
+            return 1;
+        }
+        printf("Saved to %s\n", tuning_path);
+        return 0;
+    }
+    
+    // A tuned machine runs the packed engine at the tuned thread count only,
+    // unless --threads asks for a sweep
+    int tuned_threads = tuned && run_packed && !opts.threads_given;
+    if (tuned_threads) {
+        opts.threads[0] = tuning.threads;
+        opts.num_threads = 1;
+    }
+    
+    int max_threads = 1;
+    for (int i = 0; i < opts.num_threads; i++) {
+        if (opts.threads[i] > max_threads) max_threads = opts.threads[i];
+    }
+    arena_init(&arena, max_threads);
+    
+    printf("=================================================================\n");
+    printf("PROBLEM 4: Block Matrix Multiplication (");
+    for (int s = 0; s < opts.num_sizes; s++) printf("%s%lldx%lld", s ? ", " : "", opts.sizes[s], opts.sizes[s]);
+    printf(")\n");
+    printf("Generator: counter-based (%s kernel)\n", rng_isa_name());
+    topo_print_summary();
+    perfctr_print_summary();
+    printf("GEMM micro-kernel: %s (mc=%d, kc=%d, nc=%d)\n", gemm_config.kernel->name,
+           gemm_config.mc, gemm_config.kc, gemm_config.nc);
+    if (tuned) {
+        printf("Tuning: %s (best at %d threads, %.2f GFLOP/s on %dx%d)\n",
+               tuning_path, tuning.threads, tuning.gflops, tuning.n, tuning.n);
+        if (tuned_threads) {
+            printf("Threads: %d from the tuning file (pass --threads= to sweep thread counts)\n", tuning.threads);
+        }
+    } else {
+        printf("Tuning: defaults (run '%s tune' to write %s)\n", argv[0], tuning_path);
+    }
+    printf("=================================================================\n\n");
+    
+    if (run_summa) {
+        printf("SUMMA verification (%dx%d, 2x2 grid, panel %d): max |summa - classical| = %.3e, "
+               "with overlap %.3e\n", VERIFY_SIZE, VERIFY_SIZE, VERIFY_SUMMA_PANEL, verify_summa(VERIFY_SIZE, 0),
+               verify_summa(VERIFY_SIZE, 1));
+        BenchReport report;
+        bench_report_init(&report);
+        int status = problem4_summa(&opts, rank_threads, &report);
+        arena_release(&arena);
+        int regressions = status == 0 ? bench_finish(&report, &opts) : 0;
+        bench_report_free(&report);
+        return status != 0 ? 1 : regressions > 0 ? 2 : 0;
+    }
+    
+    if (run_adaptive) {
+        BenchReport report;
+        bench_report_init(&report);
+        int status = problem4_adaptive(&opts, &report);
+        arena_release(&arena);
+        int regressions = status == 0 ? bench_finish(&report, &opts) : 0;
+        bench_report_free(&report);
+        return status != 0 ? 1 : regressions > 0 ? 2 : 0;
+    }
+    
+    if (run_packed) {
+        printf("Packed engine verification (%dx%d): max |packed - classical| = %.3e\n",
+               VERIFY_SIZE, VERIFY_SIZE, verify_engine(VERIFY_SIZE, -1));
+    }
+    int leaf = 0;
+    if (run_recursive) {
+        printf("Recursive engine verification (%dx%d, leaf %d): max |recursive - classical| = %.3e, "
+               "max |strassen - classical| = %.3e\n", VERIFY_SIZE, VERIFY_SIZE, VERIFY_LEAF,
+               verify_engine(VERIFY_SIZE, 0), verify_engine(VERIFY_SIZE, STRASSEN_LEVELS));
+        leaf = recmm_tune_leaf(TUNE_SIZE, omp_get_num_procs());
+        if (leaf < 0) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            return 1;
+        }
+        printf("Leaf size: %d (fastest on %dx%d), Strassen-Winograd levels: up to %d\n",
+               leaf, TUNE_SIZE, TUNE_SIZE, STRASSEN_LEVELS);
+    }
+    
+    FILE *fp = fopen("problem4_results.txt", "w");
+    fprintf(fp, "Threads");
+    for (int bs = 0; bs < NUM_BLOCK_CONFIGS; bs++) {
+        fprintf(fp, ",Block%d_Time,Block%d_Speedup", block_sizes[bs], block_sizes[bs]);
+    }
+    fprintf(fp, ",Packed_Time,Packed_Speedup,Packed_GFLOPs");
+    fprintf(fp, ",Recursive_Time,Recursive_GFLOPs,Recursive_Error,Strassen_Time,Strassen_GFLOPs,Strassen_Error");
+    fprintf(fp, ",Topology,Size,Roofline\n");
+    FILE *counters = fopen("problem4_counters.txt", "w");
+    if (counters) perfctr_write_header(counters);
+    
+    BenchReport report;
+    bench_report_init(&report);
+    for (int s = 0; s < opts.num_sizes; s++) {
+        benchmark_size((int)opts.sizes[s], &opts, run_blocked, run_packed, run_recursive, leaf, &report, fp,
+                       counters);
+    }
+    fclose(fp);
+    if (counters) fclose(counters);
+    printf("\nResults saved to problem4_results.txt (counters per phase in problem4_counters.txt)\n");
+    char arena_info[128];
+    arena_describe(&arena, arena_info, sizeof(arena_info));
+    printf("Arena: %s\n", arena_info);
+    arena_release(&arena);
+    
+    int regressions = bench_finish(&report, &opts);
+    bench_report_free(&report);
+    return regressions > 0 ? 2 : 0;
+}
@@ -1,14 +1,25 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <omp.h>
-#include <sys/time.h>
 #include <limits.h>
-
-double get_time() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
-}
+#include <string.h>
+#include "radix_sort.h"
+#include "select.h"
+#include "column.h"
+#include "concur.h"
+#include "extsort.h"
+#include "ring.h"
+#include "kll.h"
+#include "moments.h"
+#include "freq.h"
+#include "distinct.h"
+#include "sample.h"
+#include "rng.h"
+#include "topology.h"
+#include "arena.h"
+#include "perfctr.h"
+#include "bench.h"
 
 int compare_ulonglong(const void *a, const void *b) {
     unsigned long long arg1 = *(const unsigned long long*)a;
@@ -18,6 +29,21 @@ int compare_ulonglong(const void *a, const void *b) {
     return 0;
 }
 
+#define STATS_TOP_K 10
+#define VALUE_RANGE 1000000000000ULL  // values are uniform on [0, 10^12)
+#define SAMPLE_SIZE 1000000          // values kept by the per-run sample export
+
+// Distinct values (--distinct): exact count and HyperLogLog estimate
+typedef struct {
+    long long exact;          // -1 when not counted
+    double exact_time;
+    double exact_bytes;
+    double estimate;          // -1 when not sketched
+    double hll_time;          // sketch updates and merges
+    double hll_bytes;         // every sketch, per-thread ones included
+    double reference;         // what the estimate is checked against (exact or expected count)
+} DistinctResult;
+
 typedef struct {
     double mean;
     unsigned long long median;
@@ -26,210 +52,1861 @@ typedef struct {
     unsigned long long max;
     unsigned long long p25;
     unsigned long long p75;
+    double order_time;  // time spent on median/percentiles (sort or selection), -1 if they failed
+    
+    // Higher moments over the full stream (moments.h)
+    double variance;    // population variance
+    double std;
+    double skewness;
+    double kurtosis;    // excess kurtosis
+    double iqr;         // p75 - p25
+    
+    // Mode and most frequent values, descending by count
+    long long mode_count;
+    int mode_exact;     // 0 when counts are Count-Min estimates
+    double count_error; // additive error bound on estimated counts
+    int top_k;
+    FreqEntry top[STATS_TOP_K];
+    double freq_time;
+    
+    DistinctResult distinct;
 } Statistics;
 
-Statistics calculate_statistics(unsigned long long *data, long long size, int num_threads) {
+// How calculate_statistics() finds the median and percentiles
+typedef enum {
+    ORDER_SELECT,  // histogram-refine selection, data left in generation order
+    ORDER_SORT,    // parallel radix sort, data sorted in place
+    ORDER_EXTERNAL // sorted runs spilled to disk and merged (both scenarios exact)
+} OrderMethod;
+
+static OrderMethod order_method = ORDER_SELECT;
+static ExtConfig ext_config = {.memory_budget = 1024UL << 20, .dir = ".", .direct_io = 0};
+
+static double sketch_epsilon = 0.001;  // target rank error of the streaming sketches
+static PerfSession perf_session;       // counters of the last run
+static Arena arena;                    // working sets, reused by every run
+static int compress_column = 0;        // Scenario A held as a compressed column (column.h)
+static ConcurController *concur;       // adaptive mode: thread counts per phase
+static int phase_generate, phase_order;
+static int distinct_precision = 0;     // --distinct: HyperLogLog precision (distinct.h), 0 for off
+
+typedef struct {
+    double total;
+    double generate;
+    double order;         // order statistics (Scenario A) or sketch updates (Scenario B)
+    double frequency;     // mode / top-k (Scenario A; part of the sketch updates in B)
+    double throughput;    // values per second
+    double memory_bytes;  // working set holding the values / their summary
+    double sort;          // external mode: chunk sorts (order = sort + merge)
+    double write, read;   // external mode: time in run writes / merge reads
+    double bytes_written, bytes_read;
+    DistinctResult distinct;
+} RunMetrics;
+
+// Fills variance, std, skewness, kurtosis and the IQR (p25/p75 must be set)
+void set_moments(Statistics *stats, const Moments *m) {
+    stats->variance = moments_variance(m);
+    stats->std = sqrt(stats->variance);
+    stats->skewness = moments_skewness(m);
+    stats->kurtosis = moments_kurtosis(m);
+    stats->iqr = (double)stats->p75 - (double)stats->p25;
+}
+
+// No counts, as reported without --distinct
+void distinct_none(DistinctResult *d) {
+    memset(d, 0, sizeof(*d));
+    d->exact = -1;
+    d->estimate = -1;
+    d->reference = -1;
+}
+
+// Expected number of distinct values among n uniform draws from
+// VALUE_RANGE: what Scenario B's sketch is checked against, since no exact
+// count of 3.6B values fits in memory (outside external mode)
+double distinct_expected(long long n) {
+    return -(double)VALUE_RANGE * expm1(n * log1p(-1.0 / VALUE_RANGE));
+}
+
+// Approximate top-k through per-thread heavy-hitter summaries; used when
+// the exact frequency engine cannot get its scratch memory
+int approximate_top_k(const ChunkReader *in, FreqEntry *top, double *count_error, int num_threads) {
+    HeavyHitters *merged = malloc(sizeof(HeavyHitters));
+    if (!merged) return 0;
+    hh_init(merged);
+    
+    #pragma omp parallel num_threads(num_threads)
+    {
+        HeavyHitters *local = malloc(sizeof(HeavyHitters));
+        unsigned long long buffer[CHUNK_MAX];
+        if (local) hh_init(local);
+        
+        #pragma omp for schedule(static)
+        for (long long c = 0; c < chunk_count(in); c++) {
+            if (local) hh_update_batch(local, in->read(in->ctx, c, buffer), chunk_len(in, c));
+        }
+        
+        #pragma omp critical
+        {
+            if (local) hh_merge(merged, local);
+        }
+        free(local);
+    }
+    
+    int found = hh_topk(merged, STATS_TOP_K, top);
+    *count_error = hh_error_bound(merged);
+    free(merged);
+    return found;
+}
+
+// Percentiles of a column whose selection could not get its buffers:
+// selection (or, failing that too, qsort) over a decoded copy in scratch,
+// or in memory of its own without scratch. Returns 0, or -1 without memory
+// for the copy.
+static int column_select_decoded(const Column *column, unsigned long long *scratch, const long long *ranks,
+                                 unsigned long long *values, int k, int num_threads) {
+    unsigned long long *copy = scratch ? scratch : malloc(column->n * sizeof(unsigned long long));
+    if (!copy) return -1;
+    
+    #pragma omp parallel for schedule(static) num_threads(num_threads)
+    for (long long b = 0; b < column->num_blocks; b++) column_decode_block(column, b, &copy[b * COLUMN_BLOCK]);
+    if (select_ranks_u64(copy, column->n, column_min(column), column_max(column), ranks, values, k,
+                         num_threads) != 0) {
+        qsort(copy, column->n, sizeof(unsigned long long), compare_ulonglong);
+        for (int r = 0; r < k; r++) values[r] = copy[ranks[r]];
+    }
+    if (copy != scratch) free(copy);
+    return 0;
+}
+
+// scratch holds size keys for the radix sort and the counting pass, or is
+// NULL to have them allocate their own. With a column (FOR-encoded, see
+// column.h) data is unused: the passes decode one block at a time, min/max
+// come from the zone maps and the data is never sorted. Without memory for
+// any way to the percentiles, the result has order_time -1 and nothing else.
+Statistics calculate_statistics(unsigned long long *data, const Column *column, unsigned long long *scratch,
+                                long long size, int num_threads) {
     Statistics stats;
-    omp_set_num_threads(num_threads);
+    distinct_none(&stats.distinct);
+    topo_set_num_threads(num_threads);
     
     unsigned long long min_val = ULLONG_MAX;
     unsigned long long max_val = 0;
-    double sum = 0.0;
+    Moments moments;
+    moments_init(&moments);
     
+    // One pass: min/max and per-thread moment accumulators, block by block
+    perfctr_begin(&perf_session, "moments", num_threads);
     #pragma omp parallel
     {
         unsigned long long local_min = ULLONG_MAX;
         unsigned long long local_max = 0;
-        double local_sum = 0.0;
+        Moments local_moments;
+        moments_init(&local_moments);
+        unsigned long long decoded[COLUMN_BLOCK];
         
-        #pragma omp for
-        for (long long i = 0; i < size; i++) {
-            if (data[i] < local_min) local_min = data[i];
-            if (data[i] > local_max) local_max = data[i];
-            local_sum += data[i];
+        #pragma omp for schedule(static)
+        for (long long first = 0; first < size; first += MOMENTS_BLOCK) {
+            int n = (int)(size - first < MOMENTS_BLOCK ? size - first : MOMENTS_BLOCK);
+            if (column) {
+                // MOMENTS_BLOCK == COLUMN_BLOCK: one column block per moments block
+                const ColumnBlock *zone = &column->blocks[first / COLUMN_BLOCK];
+                if (zone->min < local_min) local_min = zone->min;
+                if (zone->max > local_max) local_max = zone->max;
+                column_decode_block(column, first / COLUMN_BLOCK, decoded);
+                Moments block_moments;
+                moments_block(decoded, n, &block_moments);
+                moments_merge(&local_moments, &block_moments);
+                continue;
+            }
+            const unsigned long long *block = &data[first];
+            for (int i = 0; i < n; i++) {
+                if (block[i] < local_min) local_min = block[i];
+                if (block[i] > local_max) local_max = block[i];
+            }
+            Moments block_moments;
+            moments_block(block, n, &block_moments);
+            moments_merge(&local_moments, &block_moments);
         }
         
         #pragma omp critical
         {
             if (local_min < min_val) min_val = local_min;
             if (local_max > max_val) max_val = local_max;
-            sum += local_sum;
+            moments_merge(&moments, &local_moments);
         }
     }
     
     stats.min = min_val;
     stats.max = max_val;
-    stats.mean = sum / size;
+    stats.mean = moments.mean;
+    perfctr_end(&perf_session);
+    
+    perfctr_begin(&perf_session, "order", num_threads);
+    double order_start = bench_now();
+    long long ranks[4] = {
+        (size - 1) / 2,                // lower median
+        size / 2,                      // upper median
+        (long long)(size * 0.25),
+        (long long)(size * 0.75)
+    };
+    unsigned long long values[4];
+    int sorted = 0;
     
-    qsort(data, size, sizeof(unsigned long long), compare_ulonglong);
+    if (column) {
+        if (column_select_ranks(column, ranks, values, 4, num_threads) != 0 &&
+            column_select_decoded(column, scratch, ranks, values, 4, num_threads) != 0) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            perfctr_end(&perf_session);
+            stats.order_time = -1;
+            return stats;
+        }
+    } else if (order_method == ORDER_SELECT &&
+               select_ranks_u64(data, size, min_val, max_val, ranks, values, 4, num_threads) == 0) {
+        // data is untouched
+    } else {
+        if (radix_sort_u64(data, scratch, size, num_threads) != 0) {
+            // Not enough memory for the radix scratch buffer: fall back to qsort
+            qsort(data, size, sizeof(unsigned long long), compare_ulonglong);
+        }
+        for (int r = 0; r < 4; r++) values[r] = data[ranks[r]];
+        sorted = 1;
+    }
+    stats.order_time = bench_now() - order_start;
+    perfctr_end(&perf_session);
     
     if (size % 2 == 0) {
-        stats.median = (data[size/2 - 1] + data[size/2]) / 2;
+        stats.median = (values[0] + values[1]) / 2;
     } else {
-        stats.median = data[size/2];
+        stats.median = values[1];
     }
     
-    stats.p25 = data[(long long)(size * 0.25)];
-    stats.p75 = data[(long long)(size * 0.75)];
-    stats.mode = data[size/2];
+    stats.p25 = values[2];
+    stats.p75 = values[3];
+    set_moments(&stats, &moments);
+    
+    // Mode / top-k: run-length scan when the data is sorted, otherwise the
+    // partitioned hash-table engine, with heavy hitters as a last resort
+    perfctr_begin(&perf_session, "frequency", num_threads);
+    double freq_start = bench_now();
+    stats.mode_exact = 1;
+    stats.count_error = 0.0;
+    ChunkReader reader = column ? column_reader(column) : chunk_array(data, size);
+    if (sorted) {
+        freq_sorted_topk(data, size, STATS_TOP_K, stats.top, &stats.top_k, num_threads);
+    } else if (freq_exact_topk_chunks(&reader, scratch, STATS_TOP_K, stats.top, &stats.top_k, num_threads) != 0) {
+        stats.top_k = approximate_top_k(&reader, stats.top, &stats.count_error, num_threads);
+        stats.mode_exact = 0;
+    }
+    stats.mode = stats.top_k > 0 ? stats.top[0].value : 0;
+    stats.mode_count = stats.top_k > 0 ? stats.top[0].count : 0;
+    stats.freq_time = bench_now() - freq_start;
+    perfctr_end(&perf_session);
     
     return stats;
 }
 
-void save_sample_data(unsigned long long *data, long long size, const char *filename, long long sample_size) {
+// --distinct: exact distinct count (partitioned hash sets) and a
+// HyperLogLog estimate of the reader's keys (distinct.h). scratch holds n
+// keys for the partitioning, or is NULL to have it allocate its own.
+void calculate_distinct(const ChunkReader *in, unsigned long long *scratch, int num_threads, DistinctResult *out) {
+    distinct_none(out);
+    
+    perfctr_begin(&perf_session, "distinct", num_threads);
+    double start = bench_now();
+    if (distinct_exact_chunks(in, scratch, &out->exact, &out->exact_bytes, num_threads) != 0) {
+        fprintf(stderr, "Memory allocation failed for the exact distinct count\n");
+        out->exact = -1;
+    }
+    out->exact_time = bench_now() - start;
+    perfctr_end(&perf_session);
+    
+    perfctr_begin(&perf_session, "hll", num_threads);
+    start = bench_now();
+    HllSketch hll;
+    if (hll_count_chunks(in, distinct_precision, &hll, num_threads) == 0) {
+        out->estimate = hll_estimate(&hll);
+        out->hll_bytes = (double)(num_threads + 1) * hll_memory_bytes(&hll);
+    }
+    hll_free(&hll);
+    out->hll_time = bench_now() - start;
+    perfctr_end(&perf_session);
+    out->reference = (double)out->exact;
+}
+
+// Native statistics for q5c.py, one "key: value" per line
+void save_statistics(const Statistics *stats, long long count, const char *filename) {
     FILE *fp = fopen(filename, "w");
     if (!fp) return;
     
-    long long to_save = (sample_size < size) ? sample_size : size;
-    for (long long i = 0; i < to_save; i++) {
-        fprintf(fp, "%llu\n", data[i]);
+    fprintf(fp, "count: %lld\n", count);
+    fprintf(fp, "mean: %.6f\n", stats->mean);
+    fprintf(fp, "median: %llu\n", stats->median);
+    fprintf(fp, "min: %llu\n", stats->min);
+    fprintf(fp, "max: %llu\n", stats->max);
+    fprintf(fp, "p25: %llu\n", stats->p25);
+    fprintf(fp, "p75: %llu\n", stats->p75);
+    fprintf(fp, "variance: %.6e\n", stats->variance);
+    fprintf(fp, "std: %.6e\n", stats->std);
+    fprintf(fp, "skewness: %.6f\n", stats->skewness);
+    fprintf(fp, "kurtosis: %.6f\n", stats->kurtosis);
+    fprintf(fp, "iqr: %.1f\n", stats->iqr);
+    fprintf(fp, "mode: %llu\n", stats->mode);
+    fprintf(fp, "mode_count: %lld\n", stats->mode_count);
+    fprintf(fp, "mode_exact: %d\n", stats->mode_exact);
+    fprintf(fp, "count_error: %.1f\n", stats->count_error);
+    for (int i = 0; i < stats->top_k; i++) {
+        fprintf(fp, "top%d: %llu %lld\n", i + 1, stats->top[i].value, stats->top[i].count);
+    }
+    const DistinctResult *d = &stats->distinct;
+    if (d->exact >= 0) fprintf(fp, "distinct: %lld\n", d->exact);
+    if (d->estimate >= 0) {
+        fprintf(fp, "distinct_estimate: %.1f\n", d->estimate);
+        fprintf(fp, "distinct_error: %.6f\n", d->reference > 0 ? d->estimate / d->reference - 1.0 : 0.0);
+        fprintf(fp, "hll_precision: %d\n", distinct_precision);
     }
     fclose(fp);
 }
 
+// Binary sample for q5c.py (see sample.h for the layout)
+void save_sample(const char *filename, const StratifiedSampler *sampler, int num_threads) {
+    if (!sampler) {
+        fprintf(stderr, "Sample allocation failed, %s not written\n", filename);
+        return;
+    }
+    double t0 = bench_now();
+    if (sampler_write(sampler, filename, num_threads) != 0) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return;
+    }
+    printf("           | Saved %lld-value sample of %lld to %s in %.4f s\n",
+           sampler->sample_size, sampler->population, filename, bench_now() - t0);
+}
+
+void print_moments(const Statistics *stats) {
+    printf("           | Std: %.4e | Skewness: %.4f | Excess kurtosis: %.4f | IQR: %.4e\n",
+           stats->std, stats->skewness, stats->kurtosis, stats->iqr);
+}
+
+// Exact count and sketch estimate with their time, throughput and memory;
+// nothing without --distinct
+void print_distinct(const DistinctResult *d, long long count) {
+    if (d->exact >= 0) {
+        if (d->exact_time > 0) {
+            printf("           | Distinct: %lld exact | %.4f s, %.1f M values/s, %.1f MB\n", d->exact,
+                   d->exact_time, count / d->exact_time / 1e6, d->exact_bytes / 1048576.0);
+        } else {
+            printf("           | Distinct: %lld exact (counted during the merge)\n", d->exact);
+        }
+    }
+    if (d->estimate >= 0) {
+        printf("           | HyperLogLog (p = %d): %.0f, %+.3f%% vs %s (std error %.2f%%) | %.4f s, %.1f M values/s, "
+               "%.1f KB\n", distinct_precision, d->estimate,
+               d->reference > 0 ? (d->estimate / d->reference - 1.0) * 100.0 : 0.0,
+               d->exact >= 0 ? "exact" : "expected", hll_std_error(distinct_precision) * 100.0, d->hll_time,
+               d->hll_time > 0 ? count / d->hll_time / 1e6 : 0.0, d->hll_bytes / 1024.0);
+    }
+}
+
+// problem5_distinct.txt: one row per method of a run's distinct counts
+void distinct_write_rows(FILE *fp, const char *scenario, int threads, long long count, const DistinctResult *d) {
+    if (!fp) return;
+    if (d->exact >= 0) {
+        fprintf(fp, "%s,%d,exact,%lld,%lld,0.0000,%.4f,%.1f,%.1f\n", scenario, threads, d->exact, d->exact,
+                d->exact_time, d->exact_time > 0 ? count / d->exact_time / 1e6 : 0.0, d->exact_bytes / 1024.0);
+    }
+    if (d->estimate >= 0) {
+        fprintf(fp, "%s,%d,hll,%.0f,%.0f,%.4f,%.4f,%.1f,%.1f\n", scenario, threads, d->estimate, d->reference,
+                d->reference > 0 ? (d->estimate / d->reference - 1.0) * 100.0 : 0.0, d->hll_time,
+                d->hll_time > 0 ? count / d->hll_time / 1e6 : 0.0, d->hll_bytes / 1024.0);
+    }
+}
+
+void print_mode(const Statistics *stats) {
+    if (stats->mode_exact) {
+        printf("           | Mode: %llu (count %lld) | Freq time: %.4f s\n",
+               stats->mode, stats->mode_count, stats->freq_time);
+    } else {
+        printf("           | Mode: %llu (count ~%lld, +/- %.0f)\n",
+               stats->mode, stats->mode_count, stats->count_error);
+    }
+}
+
+typedef struct {
+    unsigned long long key;
+    RngRange range;
+    StratifiedSampler *sampler;   // NULL when not sampling
+    Moments *moments;             // one accumulator per thread
+    HllSketch *hll;               // one per thread with --distinct, else NULL
+    double *hll_time;
+} ExternalFill;
+
+// Generates one thread's slice of a chunk (see ext_spill)
+static void external_fill(void *ctx, int tid, long long first, long long count, unsigned long long *out) {
+    ExternalFill *f = ctx;
+    rng_fill_bounded(f->key, first, count, &f->range, out);
+    moments_add(&f->moments[tid], out, count);
+    if (f->hll) {
+        double t0 = bench_now();
+        hll_add_batch(&f->hll[tid], out, count);
+        f->hll_time[tid] += bench_now() - t0;
+    }
+    if (f->sampler) {
+        for (long long i = 0; i < count; i++) reservoir_offer(&f->sampler->strata[tid], out[i]);
+    }
+}
+
+static void problem5_external_free_hll(HllSketch *hll, double *hll_time, int num_threads) {
+    for (int t = 0; hll && t < num_threads; t++) hll_free(&hll[t]);
+    free(hll);
+    free(hll_time);
+}
+
+// Exact statistics out of core: the stream is generated and sorted in
+// chunks that fit the memory budget, spilled as runs to ext_config.dir and
+// merged back (extsort.h). Used by both scenarios in "external" mode.
+double problem5_external(const char *scenario, long long total_values, unsigned long long key,
+                         unsigned long long sample_seed, int num_threads, int save_data, RunMetrics *times) {
+    topo_set_num_threads(num_threads);
+
+    // Every chunk is split into the same static thread slices, so each
+    // thread's stratum is the sum of its slices
+    StratifiedSampler sampler;
+    int sampling = 0;
+    if (save_data) {
+        long long chunk = ext_chunk_values(&ext_config);
+        long long *stratum = calloc(num_threads, sizeof(long long));
+        if (stratum) {
+            for (long long first = 0; first < total_values; first += chunk) {
+                long long n = (total_values - first < chunk) ? total_values - first : chunk;
+                for (int t = 0; t < num_threads; t++) {
+                    stratum[t] += n * (t + 1) / num_threads - n * t / num_threads;
+                }
+            }
+            sampling = (sampler_init(&sampler, SAMPLE_SIZE, stratum, num_threads, sample_seed) == 0);
+            if (!sampling) sampler_free(&sampler);
+        }
+        free(stratum);
+    }
+
+    Moments *moments = malloc(num_threads * sizeof(Moments));
+    for (int t = 0; moments && t < num_threads; t++) moments_init(&moments[t]);
+    // --distinct: the merge counts distinct values exactly; a sketch per
+    // thread is filled alongside, to check its estimate against that count
+    HllSketch *hll = NULL;
+    double *hll_time = NULL;
+    int hll_ok = 1;
+    if (distinct_precision) {
+        hll = calloc(num_threads, sizeof(HllSketch));
+        hll_time = calloc(num_threads, sizeof(double));
+        hll_ok = hll && hll_time;
+        for (int t = 0; hll_ok && t < num_threads; t++) {
+            if (hll_init(&hll[t], distinct_precision) != 0) hll_ok = 0;
+        }
+    }
+    ExternalFill fill = {.key = key, .range = rng_range(VALUE_RANGE), .sampler = sampling ? &sampler : NULL,
+                         .moments = moments, .hll = hll, .hll_time = hll_time};
+    long long ranks[4] = {
+        (total_values - 1) / 2,
+        total_values / 2,
+        (long long)(total_values * 0.25),
+        (long long)(total_values * 0.75)
+    };
+    unsigned long long values[4];
+    ExtRuns *runs = malloc(sizeof(ExtRuns));
+    ExtSummary summary;
+
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "spill", num_threads);
+    double start_time = bench_now();
+    int status = (runs && moments && hll_ok) ? ext_spill(&ext_config, total_values, external_fill, &fill, num_threads, runs) : -1;
+    perfctr_end(&perf_session);
+    if (status == 0) {
+        perfctr_begin(&perf_session, "merge", num_threads);
+        status = ext_merge_stats(&ext_config, runs, ranks, values, 4, STATS_TOP_K, &summary, num_threads);
+        perfctr_end(&perf_session);
+    }
+    double execution_time = bench_now() - start_time;
+
+    if (status != 0) {
+        fprintf(stderr, "External statistics failed for %s in %s: %s\n", scenario, ext_config.dir, strerror(errno));
+        if (runs) ext_runs_free(runs);
+        free(runs);
+        free(moments);
+        problem5_external_free_hll(hll, hll_time, num_threads);
+        if (sampling) sampler_free(&sampler);
+        times->total = times->generate = times->order = -1;
+        times->frequency = times->throughput = times->memory_bytes = 0;
+        distinct_none(&times->distinct);
+        return -1;
+    }
+
+    Statistics stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.mean = summary.mean;
+    stats.min = summary.min;
+    stats.max = summary.max;
+    stats.median = (total_values % 2 == 0) ? (values[0] + values[1]) / 2 : values[1];
+    stats.p25 = values[2];
+    stats.p75 = values[3];
+    for (int t = 1; t < num_threads; t++) moments_merge(&moments[0], &moments[t]);
+    set_moments(&stats, &moments[0]);
+    free(moments);
+    stats.mode_exact = 1;
+    stats.top_k = summary.top_k;
+    memcpy(stats.top, summary.top, summary.top_k * sizeof(FreqEntry));
+    stats.mode = stats.top_k > 0 ? stats.top[0].value : 0;
+    stats.mode_count = stats.top_k > 0 ? stats.top[0].count : 0;
+    stats.order_time = runs->sort_time + runs->merge_time;
+    stats.freq_time = 0.0;   // counted during the merge
+    distinct_none(&stats.distinct);
+    if (hll) {
+        double t0 = bench_now();
+        for (int t = 1; t < num_threads; t++) hll_merge(&hll[0], &hll[t]);
+        double merge_time = bench_now() - t0;
+        stats.distinct.exact = summary.distinct;
+        stats.distinct.reference = (double)summary.distinct;
+        stats.distinct.estimate = hll_estimate(&hll[0]);
+        stats.distinct.hll_bytes = (double)num_threads * hll_memory_bytes(&hll[0]);
+        for (int t = 0; t < num_threads; t++) stats.distinct.hll_time += hll_time[t] / num_threads;
+        stats.distinct.hll_time += merge_time;
+    }
+    problem5_external_free_hll(hll, hll_time, num_threads);
+
+    long long index_entries = 0;
+    for (int r = 0; r < runs->num_runs; r++) {
+        index_entries += (runs->lens[r] + EXT_INDEX_STRIDE - 1) / EXT_INDEX_STRIDE;
+    }
+    double write_gbs = runs->write_time > 0 ? runs->bytes_written / runs->write_time / 1e9 : 0.0;
+    double read_gbs = runs->read_time > 0 ? runs->bytes_read / runs->read_time / 1e9 : 0.0;
+
+    printf("Threads: %2d | Mean: %.2e | Median: %llu | Min: %llu | Max: %llu | Time: %.4f s "
+           "(Gen: %.4f s, Sort: %.4f s, Merge: %.4f s)\n",
+           num_threads, stats.mean, stats.median, stats.min, stats.max, execution_time,
+           runs->gen_time, runs->sort_time, runs->merge_time);
+    printf("           | %d runs%s | Write: %.4f s (%.2f GB/s) | Read: %.4f s (%.2f GB/s) | Budget: %.0f MB\n",
+           runs->num_runs, runs->direct ? " (O_DIRECT)" : "", runs->write_time, write_gbs,
+           runs->read_time, read_gbs, ext_config.memory_budget / 1048576.0);
+
+    times->total = execution_time;
+    times->generate = runs->gen_time;
+    times->order = stats.order_time;
+    times->frequency = 0.0;
+    times->throughput = total_values / execution_time;
+    times->memory_bytes = (double)ext_config.memory_budget + index_entries * sizeof(unsigned long long);
+    times->sort = runs->sort_time;
+    times->write = runs->write_time;
+    times->read = runs->read_time;
+    times->bytes_written = runs->bytes_written;
+    times->bytes_read = runs->bytes_read;
+
+    print_moments(&stats);
+    print_mode(&stats);
+    print_distinct(&stats.distinct, total_values);
+    times->distinct = stats.distinct;
+
+    if (save_data) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "%s_stats.txt", scenario);
+        save_statistics(&stats, total_values, filename);
+        printf("           | Saved statistics to %s\n", filename);
+        snprintf(filename, sizeof(filename), "%s_sample.bin", scenario);
+        save_sample(filename, sampling ? &sampler : NULL, num_threads);
+    }
+    if (sampling) sampler_free(&sampler);
+
+    ext_runs_free(runs);
+    free(runs);
+    return execution_time;
+}
+
+// Encodes a small stream as FOR and, sorted, as DELTA and checks every
+// block, min/max, sum and a few ranks against the raw values. The stream
+// has a constant block (0 bits), a block with a 2^63 outlier (unpacked),
+// packed 55- and 56-bit blocks whose sums pass 2^64, and a partial last
+// block. Returns 0 when everything matches.
+static int column_self_check(int num_threads) {
+    long long n = 50 * COLUMN_BLOCK + 333;
+    unsigned long long *raw = malloc(n * sizeof(unsigned long long));
+    unsigned long long *sorted = malloc(n * sizeof(unsigned long long));
+    void *memory = malloc(column_size(n, 64));
+    unsigned long long decoded[COLUMN_BLOCK];
+    int status = (raw && sorted && memory) ? 0 : -1;
+
+    RngRange range = rng_range(VALUE_RANGE);
+    if (status == 0) rng_fill_bounded(rng_key(777, 5), 0, n, &range, raw);
+    for (long long i = 0; status == 0 && i < COLUMN_BLOCK; i++) raw[3 * COLUMN_BLOCK + i] = 42;
+    if (status == 0) raw[7 * COLUMN_BLOCK + 5] = 1ULL << 63;
+    for (long long i = 0; status == 0 && i < COLUMN_BLOCK; i++) {
+        raw[11 * COLUMN_BLOCK + i] = i ? (1ULL << 56) - i : 0;
+        raw[12 * COLUMN_BLOCK + i] = i ? (1ULL << 55) - i : 0;
+    }
+
+    for (int encoding = COLUMN_FOR; status == 0 && encoding <= COLUMN_DELTA; encoding++) {
+        Column col;
+        const unsigned long long *values = raw;
+        if (encoding == COLUMN_FOR) {
+            column_init(&col, n, COLUMN_FOR, 64, memory);
+            for (long long b = 0; b < col.num_blocks; b++) column_put_block(&col, b, &raw[b * COLUMN_BLOCK]);
+        } else {
+            memcpy(sorted, raw, n * sizeof(unsigned long long));
+            qsort(sorted, n, sizeof(unsigned long long), compare_ulonglong);
+            column_encode_sorted(&col, sorted, n, 64, memory, num_threads);
+            values = sorted;
+        }
+
+        unsigned __int128 sum = 0;
+        unsigned long long min = ULLONG_MAX, max = 0;
+        for (long long i = 0; i < n; i++) {
+            sum += values[i];
+            if (values[i] < min) min = values[i];
+            if (values[i] > max) max = values[i];
+        }
+        for (long long b = 0; b < col.num_blocks; b++) {
+            int len = column_decode_block(&col, b, decoded);
+            if (memcmp(decoded, &values[b * COLUMN_BLOCK], len * sizeof(unsigned long long)) != 0) status = -1;
+        }
+        long long ranks[4] = {0, n / 4, n / 2, n - 1};
+        unsigned long long expected[4], found[4];
+        if (select_ranks_u64(raw, n, min, max, ranks, expected, 4, num_threads) != 0 ||
+            column_select_ranks(&col, ranks, found, 4, num_threads) != 0 ||
+            memcmp(expected, found, sizeof(found)) != 0) {
+            status = -1;
+        }
+        if (column_min(&col) != min || column_max(&col) != max || column_sum(&col, num_threads) != sum) {
+            status = -1;
+        }
+    }
+
+    free(raw);
+    free(sorted);
+    free(memory);
+    return status;
+}
+
+// Thread tid's slice [begin, end) of a stream; whole column blocks when the
+// values go into a column, so every block has a single writer
+static void problem5a_slice(long long total, int tid, int threads, int blocks, long long *begin, long long *end) {
+    long long unit = blocks ? COLUMN_BLOCK : 1;
+    long long units = (total + unit - 1) / unit;
+    *begin = units * tid / threads * unit;
+    *end = units * (tid + 1) / threads * unit;
+    if (*end > total) *end = total;
+}
+
 // Scenario A: 100,000 values/second × 3,600 seconds = 360,000,000 values
-double problem5a_streaming_data(int num_threads, int save_data) {
-    omp_set_num_threads(num_threads);
+double problem5a_streaming_data(int num_threads, int save_data, RunMetrics *times) {
+    if (concur) num_threads = concur_use(concur, phase_generate);
+    topo_set_num_threads(num_threads);
     
     long long total_values = 360000000LL;  // 100K/sec × 3600 sec
-    
-    unsigned long long *data = malloc(total_values * sizeof(unsigned long long));
-    if (!data) {
+    if (order_method == ORDER_EXTERNAL) {
+        return problem5_external("problem5a", total_values, rng_key(12345, 5), 0x5A,
+                                 num_threads, save_data, times);
+    }
+
+    // With --compress, selection runs on a FOR column generated block by
+    // block (no raw copy), and sorting delta-encodes its output afterwards
+    int for_column = compress_column && order_method == ORDER_SELECT;
+    int slot_bits = column_lane_bits(VALUE_RANGE - 1);
+    Column column;
+    void *column_memory = NULL;
+    unsigned long long *data = NULL;
+    arena_reset(&arena);
+    if (for_column) {
+        column_memory = arena_alloc(&arena, column_size(total_values, slot_bits), ARENA_ALIGN);
+        if (column_memory) column_init(&column, total_values, COLUMN_FOR, slot_bits, column_memory);
+    } else {
+        data = arena_alloc(&arena, total_values * sizeof(unsigned long long), ARENA_ALIGN);
+    }
+    if (!data && !column_memory) {
         fprintf(stderr, "Memory allocation failed for Problem 5a\n");
+        times->total = times->generate = times->order = -1;
+        times->frequency = times->throughput = times->memory_bytes = 0;
+        distinct_none(&times->distinct);
         return -1;
     }
+    // Radix / counting scratch; without room for it the passes allocate their own
+    unsigned long long *scratch = arena_alloc(&arena, total_values * sizeof(unsigned long long), ARENA_ALIGN);
+    
+    // Value i of the stream depends only on i, not on the thread count
+    unsigned long long key = rng_key(12345, 5);
+    RngRange range = rng_range(VALUE_RANGE);
+    
+    // Each thread samples its own slice of the stream while generating it
+    StratifiedSampler sampler;
+    int sampling = 0;
+    if (save_data) {
+        long long *slice = malloc(num_threads * sizeof(long long));
+        if (slice) {
+            for (int t = 0; t < num_threads; t++) {
+                long long begin, end;
+                problem5a_slice(total_values, t, num_threads, for_column, &begin, &end);
+                slice[t] = end - begin;
+            }
+            sampling = (sampler_init(&sampler, SAMPLE_SIZE, slice, num_threads, 0x5A) == 0);
+            if (!sampling) sampler_free(&sampler);
+        }
+        free(slice);
+    }
     
-    double start_time = get_time();
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "generate", num_threads);
+    double start_time = bench_now();
     
     #pragma omp parallel
     {
-        unsigned int seed = omp_get_thread_num() * 42 + 12345;
+        int tid = omp_get_thread_num();
+        long long begin, end;
+        problem5a_slice(total_values, tid, omp_get_num_threads(), for_column, &begin, &end);
+        Reservoir *reservoir = sampling ? &sampler.strata[tid] : NULL;
+        unsigned long long block[COLUMN_BLOCK];
         
-        #pragma omp for
-        for (long long i = 0; i < total_values; i++) {
-            unsigned long long val1 = rand_r(&seed);
-            unsigned long long val2 = rand_r(&seed);
-            data[i] = (val1 << 32) | val2;
-            data[i] %= 1000000000000ULL;
+        if (for_column) {
+            // Generate each block into a buffer and pack it; VALUE_RANGE
+            // fits slot_bits, so column_put_block() cannot fail
+            for (long long first = begin; first < end; first += COLUMN_BLOCK) {
+                long long count = (end - first < COLUMN_BLOCK) ? end - first : COLUMN_BLOCK;
+                rng_fill_bounded(key, first, count, &range, block);
+                if (reservoir) {
+                    for (long long i = 0; i < count; i++) reservoir_offer(reservoir, block[i]);
+                }
+                column_put_block(&column, first / COLUMN_BLOCK, block);
+            }
+        } else {
+            for (long long first = begin; first < end; first += RNG_BLOCK) {
+                long long count = (end - first < RNG_BLOCK) ? end - first : RNG_BLOCK;
+                rng_fill_bounded(key, first, count, &range, &data[first]);
+                if (reservoir) {
+                    for (long long i = first; i < first + count; i++) reservoir_offer(reservoir, data[i]);
+                }
+            }
         }
     }
     
-    Statistics stats = calculate_statistics(data, total_values, num_threads);
+    double gen_time = bench_now() - start_time;
+    perfctr_end(&perf_session);
+    int order_threads = concur ? concur_use(concur, phase_order) : num_threads;
+    Statistics stats = calculate_statistics(data, for_column ? &column : NULL, scratch, total_values,
+                                            order_threads);
+    if (stats.order_time < 0) {
+        times->total = times->generate = times->order = -1;
+        times->frequency = times->throughput = times->memory_bytes = 0;
+        distinct_none(&times->distinct);
+        if (sampling) sampler_free(&sampler);
+        return -1;
+    }
+    if (distinct_precision) {
+        // Before the delta encoding below takes over the scratch buffer
+        ChunkReader reader = for_column ? column_reader(&column) : chunk_array(data, total_values);
+        calculate_distinct(&reader, scratch, order_threads, &stats.distinct);
+    }
+    
+    // Sorted data delta-encodes into the scratch buffer, which the sort no
+    // longer needs; the order statistics are read back from the column
+    int delta_column = 0;
+    if (compress_column && !for_column && scratch) {
+        perfctr_begin(&perf_session, "encode", order_threads);
+        double encode_start = bench_now();
+        column_encode_sorted(&column, data, total_values, column_lane_bits(stats.max - stats.min), scratch,
+                             order_threads);
+        long long ranks[2] = {(long long)(total_values * 0.25), (long long)(total_values * 0.75)};
+        unsigned long long values[2];
+        if (column_select_ranks(&column, ranks, values, 2, order_threads) != 0 ||
+            values[0] != stats.p25 || values[1] != stats.p75 ||
+            column_min(&column) != stats.min || column_max(&column) != stats.max) {
+            fprintf(stderr, "Delta column does not match the sorted data\n");
+        }
+        stats.order_time += bench_now() - encode_start;
+        perfctr_end(&perf_session);
+        delta_column = 1;
+    }
     
-    double end_time = get_time();
+    double end_time = bench_now();
     double execution_time = end_time - start_time;
     
-    printf("Threads: %2d | Mean: %.2e | Median: %llu | Min: %llu | Max: %llu | Time: %.4f s\n", 
-           num_threads, stats.mean, stats.median, stats.min, stats.max, execution_time);
+    printf("Threads: %2d | Mean: %.2e | Median: %llu | Min: %llu | Max: %llu | Time: %.4f s "
+           "(Gen: %.4f s, Order: %.4f s)\n", 
+           num_threads, stats.mean, stats.median, stats.min, stats.max, execution_time,
+           gen_time, stats.order_time);
+    if (concur) {
+        printf("           | Adaptive: generate %d thread(s) (%s), order %d thread(s) (%s)\n", num_threads,
+               topo_policy_names[concur->phases[phase_generate].policy], order_threads,
+               topo_policy_names[concur->phases[phase_order].policy]);
+    }
+    
+    times->total = execution_time;
+    times->generate = gen_time;
+    times->order = stats.order_time;
+    times->frequency = stats.freq_time;
+    times->throughput = total_values / execution_time;
+    times->memory_bytes = (double)total_values * sizeof(unsigned long long);
+    times->distinct = stats.distinct;
+    if (for_column || delta_column) {
+        times->memory_bytes = (double)column_bytes(&column);
+        printf("           | Column: %s, %.1f bits/value, %.2f GB (raw %.2f GB)\n",
+               for_column ? "frame of reference" : "delta", column_bits_per_value(&column),
+               column_bytes(&column) / 1e9, total_values * 8 / 1e9);
+    }
+    
+    print_moments(&stats);
+    print_mode(&stats);
+    print_distinct(&stats.distinct, total_values);
     
     if (save_data) {
-        save_sample_data(data, total_values, "problem5a_data.txt", 100000);
-        printf("           | Saved sample to problem5a_data.txt\n");
+        save_statistics(&stats, total_values, "problem5a_stats.txt");
+        save_sample("problem5a_sample.bin", sampling ? &sampler : NULL, num_threads);
+        printf("           | Saved statistics to problem5a_stats.txt\n");
     }
+    if (sampling) sampler_free(&sampler);
     
-    free(data);
     return execution_time;
 }
 
+// Streaming summary: exact count/min/max/sum, a KLL sketch for quantiles,
+// heavy hitters for the mode / top-k and, with --distinct, a HyperLogLog
+// sketch for the distinct count. Each thread owns one; they merge at
+// checkpoints and at the end.
+typedef struct {
+    KllSketch sketch;
+    HeavyHitters *hh;
+    long long count;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned __int128 sum;  // 3.6B values < 10^12 overflow 64 bits
+    Moments moments;
+    HllSketch hll;          // registers are NULL without --distinct
+    double hll_time;        // in hll updates, summed over merged summaries
+} StreamStats;
+
+int stream_stats_init(StreamStats *s, int k, unsigned long long seed) {
+    kll_init(&s->sketch, k, seed);
+    s->count = 0;
+    s->min = ULLONG_MAX;
+    s->max = 0;
+    s->sum = 0;
+    moments_init(&s->moments);
+    s->hll.registers = NULL;
+    s->hll_time = 0.0;
+    s->hh = malloc(sizeof(HeavyHitters));
+    if (!s->hh) return -1;
+    hh_init(s->hh);
+    if (distinct_precision && hll_init(&s->hll, distinct_precision) != 0) return -1;
+    return 0;
+}
+
+void stream_stats_free(StreamStats *s) {
+    kll_free(&s->sketch);
+    hll_free(&s->hll);
+    free(s->hh);
+    s->hh = NULL;
+}
+
+size_t stream_stats_memory(const StreamStats *s) {
+    size_t hll_bytes = s->hll.registers ? hll_memory_bytes(&s->hll) : 0;
+    return kll_memory_bytes(&s->sketch) + sizeof(HeavyHitters) + hll_bytes;
+}
+
+int stream_stats_update(StreamStats *s, const unsigned long long *values, long long n) {
+    unsigned long long local_min = s->min, local_max = s->max;
+    unsigned long long chunk_sum = 0;  // n * 10^12 fits in 64 bits for chunk-sized n
+    for (long long i = 0; i < n; i++) {
+        if (values[i] < local_min) local_min = values[i];
+        if (values[i] > local_max) local_max = values[i];
+        chunk_sum += values[i];
+    }
+    s->min = local_min;
+    s->max = local_max;
+    s->sum += chunk_sum;
+    s->count += n;
+    moments_add(&s->moments, values, n);
+    if (s->hh) hh_update_batch(s->hh, values, n);
+    if (s->hll.registers) {
+        double t0 = bench_now();
+        hll_add_batch(&s->hll, values, n);
+        s->hll_time += bench_now() - t0;
+    }
+    return kll_update_batch(&s->sketch, values, n);
+}
+
+int stream_stats_merge(StreamStats *dst, const StreamStats *src) {
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->sum += src->sum;
+    dst->count += src->count;
+    moments_merge(&dst->moments, &src->moments);
+    if (dst->hh && src->hh) hh_merge(dst->hh, src->hh);
+    if (dst->hll.registers && src->hll.registers) hll_merge(&dst->hll, &src->hll);
+    dst->hll_time += src->hll_time;
+    return kll_merge(&dst->sketch, &src->sketch);
+}
+
+Statistics stream_stats_result(const StreamStats *s) {
+    Statistics stats;
+    double phis[3] = {0.5, 0.25, 0.75};
+    unsigned long long q[3] = {0, 0, 0};
+    kll_quantiles(&s->sketch, phis, q, 3);
+    
+    stats.mean = (double)s->sum / s->count;
+    stats.min = s->min;
+    stats.max = s->max;
+    stats.median = q[0];
+    stats.p25 = q[1];
+    stats.p75 = q[2];
+    set_moments(&stats, &s->moments);
+    stats.order_time = 0.0;
+    
+    stats.top_k = s->hh ? hh_topk(s->hh, STATS_TOP_K, stats.top) : 0;
+    stats.mode = stats.top_k > 0 ? stats.top[0].value : 0;
+    stats.mode_count = stats.top_k > 0 ? stats.top[0].count : 0;
+    stats.mode_exact = 0;
+    stats.count_error = s->hh ? hh_error_bound(s->hh) : 0.0;
+    stats.freq_time = 0.0;
+    
+    distinct_none(&stats.distinct);
+    if (s->hll.registers) {
+        stats.distinct.estimate = hll_estimate(&s->hll);
+        stats.distinct.reference = distinct_expected(s->count);
+        stats.distinct.hll_time = s->hll_time;
+    }
+    return stats;
+}
+
+#define STREAM_CHUNK 65536                 // values generated and summarized at a time
+#define STREAM_CHECKPOINT 60000000LL      // Scenario B: one minute of data
+
 // Scenario B: 60,000,000 values/minute × 60 minutes = 3,600,000,000 values
-// Using 100M sample for memory constraints
-double problem5b_streaming_data(int num_threads, int save_data) {
-    omp_set_num_threads(num_threads);
+// Streamed in chunks through per-thread sketches, so memory stays at a few
+// MB instead of 28.8 GB. The sketches are merged once per stream minute
+// (checkpoint) and at the end.
+double problem5b_streaming_data(int num_threads, int save_data, RunMetrics *times) {
+    topo_set_num_threads(num_threads);
     
-    // Note: Full size would be 3.6B, using 100M sample
-    long long sample_size = 100000000LL;
+    long long total_values = 3600000000LL;  // 60M/min × 60 min
+    if (order_method == ORDER_EXTERNAL) {
+        return problem5_external("problem5b", total_values, rng_key(54321, 5), 0x5B,
+                                 num_threads, save_data, times);
+    }
+    long long checkpoints = total_values / STREAM_CHECKPOINT;
+    long long chunks_per_checkpoint = (STREAM_CHECKPOINT + STREAM_CHUNK - 1) / STREAM_CHUNK;
+    int k = kll_k_for_epsilon(sketch_epsilon);
     
-    unsigned long long *data = malloc(sample_size * sizeof(unsigned long long));
-    if (!data) {
+    arena_reset(&arena);
+    StreamStats *local = malloc(num_threads * sizeof(StreamStats));
+    unsigned long long *chunks = arena_alloc(&arena, (size_t)num_threads * STREAM_CHUNK * sizeof(unsigned long long),
+                                             ARENA_ALIGN);
+    if (!local || !chunks) {
         fprintf(stderr, "Memory allocation failed for Problem 5b\n");
+        free(local);
+        times->total = times->generate = times->order = -1;
+        times->frequency = times->throughput = times->memory_bytes = 0;
+        distinct_none(&times->distinct);
         return -1;
     }
     
-    double start_time = get_time();
+    // Every checkpoint splits its chunks into the same static thread ranges,
+    // so each thread's stratum is its range repeated once per checkpoint
+    StratifiedSampler sampler;
+    int sampling = 0;
+    if (save_data) {
+        long long *stratum = calloc(num_threads, sizeof(long long));
+        if (stratum) {
+            for (int t = 0; t < num_threads; t++) {
+                long long c_begin = chunks_per_checkpoint * t / num_threads;
+                long long c_end = chunks_per_checkpoint * (t + 1) / num_threads;
+                long long first = c_begin * STREAM_CHUNK;
+                long long last = c_end * STREAM_CHUNK;
+                if (last > STREAM_CHECKPOINT) last = STREAM_CHECKPOINT;
+                stratum[t] = (last > first ? last - first : 0) * checkpoints;
+            }
+            sampling = (sampler_init(&sampler, SAMPLE_SIZE, stratum, num_threads, 0x5B) == 0);
+            if (!sampling) sampler_free(&sampler);
+        }
+        free(stratum);
+    }
+    
+    unsigned long long key = rng_key(54321, 5);
+    RngRange range = rng_range(VALUE_RANGE);
+    
+    StreamStats snapshot;
+    double checkpoint_time = 0.0;
+    double gen_time = 0.0, update_time = 0.0;
+    size_t sketch_bytes = 0;
+    
+    perfctr_reset(&perf_session);
+    perfctr_begin(&perf_session, "stream", num_threads);
+    double start_time = bench_now();
     
     #pragma omp parallel
     {
-        unsigned int seed = omp_get_thread_num() * 43 + 54321;
+        int tid = omp_get_thread_num();
+        unsigned long long *chunk = &chunks[(size_t)tid * STREAM_CHUNK];
+        double local_gen = 0.0, local_update = 0.0;
+        long long c_begin = chunks_per_checkpoint * tid / omp_get_num_threads();
+        long long c_end = chunks_per_checkpoint * (tid + 1) / omp_get_num_threads();
+        Reservoir *reservoir = sampling ? &sampler.strata[tid] : NULL;
+        stream_stats_init(&local[tid], k, tid + 1);
+        
+        for (long long cp = 0; cp < checkpoints; cp++) {
+            long long cp_begin = cp * STREAM_CHECKPOINT;
+            
+            for (long long c = c_begin; c < c_end; c++) {
+                long long first = cp_begin + c * STREAM_CHUNK;
+                long long count = STREAM_CHUNK;
+                if (first + count > cp_begin + STREAM_CHECKPOINT) {
+                    count = cp_begin + STREAM_CHECKPOINT - first;
+                }
+                
+                double t0 = bench_now();
+                rng_fill_bounded(key, first, count, &range, chunk);
+                double t1 = bench_now();
+                stream_stats_update(&local[tid], chunk, count);
+                local_update += bench_now() - t1;
+                local_gen += t1 - t0;
+                
+                if (reservoir) {
+                    for (long long i = 0; i < count; i++) reservoir_offer(reservoir, chunk[i]);
+                }
+            }
+            
+            // Checkpoint: merge a snapshot of all per-thread summaries
+            #pragma omp barrier
+            #pragma omp single
+            {
+                double t0 = bench_now();
+                stream_stats_init(&snapshot, k, 0);
+                for (int t = 0; t < omp_get_num_threads(); t++) {
+                    stream_stats_merge(&snapshot, &local[t]);
+                }
+                if (cp + 1 < checkpoints) stream_stats_free(&snapshot);
+                checkpoint_time += bench_now() - t0;
+            }
+        }
         
-        #pragma omp for
-        for (long long i = 0; i < sample_size; i++) {
-            unsigned long long val1 = rand_r(&seed);
-            unsigned long long val2 = rand_r(&seed);
-            data[i] = (val1 << 32) | val2;
-            data[i] %= 1000000000000ULL;
+        #pragma omp critical
+        {
+            gen_time += local_gen;
+            update_time += local_update;
+            sketch_bytes += stream_stats_memory(&local[tid]);
         }
+        stream_stats_free(&local[tid]);
     }
     
-    Statistics stats = calculate_statistics(data, sample_size, num_threads);
+    // The last checkpoint snapshot is the end-of-stream summary
+    Statistics stats = stream_stats_result(&snapshot);
+    stats.distinct.hll_time /= num_threads;
+    if (snapshot.hll.registers) {
+        stats.distinct.hll_bytes = (double)(num_threads + 1) * hll_memory_bytes(&snapshot.hll);
+    }
+    sketch_bytes += stream_stats_memory(&snapshot);
+    stream_stats_free(&snapshot);
     
-    double end_time = get_time();
+    double end_time = bench_now();
+    perfctr_end(&perf_session);
     double execution_time = end_time - start_time;
+    double state_bytes = sketch_bytes + (double)num_threads * STREAM_CHUNK * sizeof(unsigned long long);
+    
+    // Per-thread phase times are averaged so they compare with wall-clock time
+    gen_time /= num_threads;
+    update_time /= num_threads;
+    
+    printf("Threads: %2d | Mean: %.2e | Median: %llu | Min: %llu | Max: %llu | Time: %.4f s "
+           "(Gen: %.4f s, Sketch: %.4f s, Checkpoints: %.4f s)\n", 
+           num_threads, stats.mean, stats.median, stats.min, stats.max, execution_time,
+           gen_time, update_time, checkpoint_time);
+    printf("           | Throughput: %.1f M values/s | Memory: %.1f KB (sketches + heavy hitters %.1f KB)\n",
+           total_values / execution_time / 1e6, state_bytes / 1024.0, sketch_bytes / 1024.0);
     
-    printf("Threads: %2d | Mean: %.2e | Median: %llu | Min: %llu | Max: %llu | Time: %.4f s\n", 
-           num_threads, stats.mean, stats.median, stats.min, stats.max, execution_time);
+    times->total = execution_time;
+    times->generate = gen_time;
+    times->order = update_time;
+    times->frequency = 0.0;
+    times->throughput = total_values / execution_time;
+    times->memory_bytes = state_bytes;
+    times->distinct = stats.distinct;
+    
+    print_moments(&stats);
+    print_mode(&stats);
+    print_distinct(&stats.distinct, total_values);
     
     if (save_data) {
-        save_sample_data(data, sample_size, "problem5b_data.txt", 100000);
-        printf("           | Saved sample to problem5b_data.txt\n");
+        save_statistics(&stats, total_values, "problem5b_stats.txt");
+        save_sample("problem5b_sample.bin", sampling ? &sampler : NULL, num_threads);
+        printf("           | Saved statistics to problem5b_stats.txt\n");
     }
+    if (sampling) sampler_free(&sampler);
     
-    free(data);
+    free(local);
     return execution_time;
 }
 
-int main() {
-    int thread_counts[] = {1, 2, 4, 6, 8, 10, 12, 14, 16};
-    int num_configs = 9;
-    int runs = 5;
+// Rank error of the streaming sketches against the exact (selection) path,
+// measured on a Scenario A sized dataset.
+void problem5_sketch_accuracy(int num_threads) {
+    topo_set_num_threads(num_threads);
+    
+    long long n = 360000000LL;
+    double phis[7] = {0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99};
+    long long ranks[7];
+    unsigned long long exact[7], estimate[7];
+    long long below[7] = {0};
+    
+    arena_reset(&arena);
+    unsigned long long *data = arena_alloc(&arena, n * sizeof(unsigned long long), ARENA_ALIGN);
+    StreamStats *local = malloc(num_threads * sizeof(StreamStats));
+    if (!data || !local) {
+        fprintf(stderr, "Memory allocation failed for sketch accuracy check\n");
+        free(local);
+        return;
+    }
+    
+    int k = kll_k_for_epsilon(sketch_epsilon);
+    unsigned long long min_val = ULLONG_MAX, max_val = 0;
+    unsigned long long key = rng_key(12345, 5);
+    RngRange range = rng_range(VALUE_RANGE);
+    
+    #pragma omp parallel reduction(min:min_val) reduction(max:max_val)
+    {
+        int tid = omp_get_thread_num();
+        long long begin = n * tid / omp_get_num_threads();
+        long long end = n * (tid + 1) / omp_get_num_threads();
+        stream_stats_init(&local[tid], k, tid + 1);
+        
+        // Same stream as Scenario A
+        rng_fill_bounded(key, begin, end - begin, &range, &data[begin]);
+        for (long long i = begin; i < end; i++) {
+            if (data[i] < min_val) min_val = data[i];
+            if (data[i] > max_val) max_val = data[i];
+        }
+        stream_stats_update(&local[tid], &data[begin], end - begin);
+    }
+    
+    StreamStats merged;
+    stream_stats_init(&merged, k, 0);
+    for (int t = 0; t < num_threads; t++) {
+        stream_stats_merge(&merged, &local[t]);
+        stream_stats_free(&local[t]);
+    }
+    kll_quantiles(&merged.sketch, phis, estimate, 7);
+    
+    for (int q = 0; q < 7; q++) ranks[q] = (long long)(n * phis[q]);
+    select_ranks_u64(data, n, min_val, max_val, ranks, exact, 7, num_threads);
+    
+    #pragma omp parallel for reduction(+:below[:7])
+    for (long long i = 0; i < n; i++) {
+        for (int q = 0; q < 7; q++) below[q] += (data[i] < estimate[q]);
+    }
+    
+    printf("\nSketch accuracy (k = %d, target epsilon = %.4f, %lld values)\n", k, sketch_epsilon, n);
+    printf("Phi   | Exact          | Estimate       | Rank error\n");
+    printf("------|----------------|----------------|-----------\n");
+    
+    FILE *fp = fopen("problem5_sketch_accuracy.txt", "w");
+    if (fp) fprintf(fp, "Phi,Exact,Estimate,RankError\n");
+    double max_error = 0.0;
+    for (int q = 0; q < 7; q++) {
+        double error = (double)below[q] / n - phis[q];
+        if (error < 0) error = -error;
+        if (error > max_error) max_error = error;
+        printf("%.2f  | %14llu | %14llu | %.6f\n", phis[q], exact[q], estimate[q], error);
+        if (fp) fprintf(fp, "%.2f,%llu,%llu,%.6f\n", phis[q], exact[q], estimate[q], error);
+    }
+    printf("Max rank error: %.6f | Sketch memory: %.1f KB\n",
+           max_error, kll_memory_bytes(&merged.sketch) / 1024.0);
+    if (fp) {
+        fprintf(fp, "# max_rank_error=%.6f sketch_bytes=%zu\n", max_error, kll_memory_bytes(&merged.sketch));
+        fclose(fp);
+    }
+    
+    stream_stats_free(&merged);
+    free(local);
+}
+
+// Ingestion pipeline: producer threads generate the Scenario A stream in
+// batches and hand them to consumer threads through lock-free rings
+// (ring.h); consumers fold them into per-thread StreamStats. Batches come
+// from a fixed pool that circulates through a free ring, so a slow consumer
+// stalls its producers (backpressure) instead of growing a queue. With SPSC
+// rings producer i and consumer i form a lane with their own ring pair;
+// with MPMC all threads share one pair. Latency is measured from the time a
+// batch was due (its pacing slot, or the moment the producer asked for a
+// free batch when unpaced) to the end of its processing, so time spent
+// blocked on a full pipeline counts.
+
+#define PIPE_BATCH 4096            // values per batch
+#define PIPE_POOL 64               // batches per lane
+#define SCENARIO_A_RATE 100000.0   // values per second
+#define SCENARIO_B_RATE 1000000.0  // 60M per minute
+
+typedef struct {
+    double due;                    // bench_now() time the batch was due
+    int count;
+    unsigned long long values[PIPE_BATCH];
+} PipeBatch;
+
+typedef struct {
+    double *values;
+    long long count, capacity;
+} PipeLatencies;
+
+typedef struct {
+    double elapsed;                // first batch due to last batch processed
+    double throughput;             // values per second
+    double p50, p99, p999, max;    // latency in seconds
+    double stall;                  // producer time waiting for free batches, averaged
+    Statistics stats;
+} PipeResult;
+
+static RingKind pipe_ring_kind = RING_MPMC;
+static int pipe_producers = 0;           // 0: half the threads
+static double pipe_duration = 10.0;      // seconds per paced run
+
+static int pipe_latency_add(PipeLatencies *l, double value) {
+    if (l->count == l->capacity) {
+        long long capacity = l->capacity ? 2 * l->capacity : 4096;
+        double *grown = realloc(l->values, capacity * sizeof(double));
+        if (!grown) return -1;
+        l->values = grown;
+        l->capacity = capacity;
+    }
+    l->values[l->count++] = value;
+    return 0;
+}
+
+static double pipe_percentile(const double *sorted, long long n, double phi) {
+    if (n == 0) return 0.0;
+    long long i = (long long)(phi * n + 0.999999) - 1;
+    if (i < 0) i = 0;
+    if (i >= n) i = n - 1;
+    return sorted[i];
+}
+
+static void pipe_split(int num_threads, int *producers, int *consumers) {
+    *producers = pipe_producers > 0 ? pipe_producers : num_threads / 2;
+    if (*producers < 1) *producers = 1;
+    *consumers = num_threads - *producers;
+    if (*consumers < 1) *consumers = 1;
+    if (pipe_ring_kind == RING_SPSC) {
+        // One lane per producer/consumer pair
+        int lanes = *producers < *consumers ? *producers : *consumers;
+        *producers = *consumers = lanes;
+    }
+}
+
+// Streams total_values of Scenario A through the pipeline, paced to `rate`
+// values per second (0: as fast as possible). Returns 0 or -1.
+int problem5_pipeline_run(int num_threads, long long total_values, double rate, PipeResult *result) {
+    int producers, consumers;
+    pipe_split(num_threads, &producers, &consumers);
+    int lanes = pipe_ring_kind == RING_SPSC ? producers : 1;
+    int team = producers + consumers;
+    topo_set_num_threads(team);
+    memset(result, 0, sizeof(*result));
+
+    Ring *work = calloc(lanes, sizeof(Ring));
+    Ring *free_batches = calloc(lanes, sizeof(Ring));
+    PipeBatch *pool = malloc((size_t)lanes * PIPE_POOL * sizeof(PipeBatch));
+    StreamStats *local = calloc(consumers, sizeof(StreamStats));
+    PipeLatencies *latencies = calloc(consumers, sizeof(PipeLatencies));
+    atomic_int *producers_left = calloc(lanes, sizeof(atomic_int));
+    double *stall = calloc(producers, sizeof(double));
+    int status = (work && free_batches && pool && local && latencies && producers_left && stall) ? 0 : -1;
+    for (int l = 0; l < lanes && status == 0; l++) {
+        if (ring_init(&work[l], pipe_ring_kind, PIPE_POOL) != 0 ||
+            ring_init(&free_batches[l], pipe_ring_kind, PIPE_POOL) != 0) {
+            status = -1;
+            break;
+        }
+        for (int b = 0; b < PIPE_POOL; b++) ring_push(&free_batches[l], &pool[(size_t)l * PIPE_POOL + b]);
+        atomic_init(&producers_left[l], lanes == 1 ? producers : 1);
+    }
+    int k = kll_k_for_epsilon(sketch_epsilon);
+    for (int c = 0; c < consumers && status == 0; c++) {
+        if (stream_stats_init(&local[c], k, c + 1) != 0) status = -1;
+    }
+    if (status != 0) {
+        fprintf(stderr, "Memory allocation failed for the ingestion pipeline\n");
+    }
+
+    unsigned long long key = rng_key(12345, 5);
+    RngRange range = rng_range(VALUE_RANGE);
+    double start = 0.0, finish = 0.0;
+
+    if (status == 0) {
+        perfctr_reset(&perf_session);
+        perfctr_begin(&perf_session, "pipeline", team);
+        start = bench_now();
+        #pragma omp parallel num_threads(team) reduction(max:finish)
+        {
+            int tid = omp_get_thread_num();
+            unsigned spins = 0;
+            if (tid < producers) {
+                // Producer: a static slice of the stream, paced at rate / producers
+                int lane = tid % lanes;
+                long long begin = total_values * tid / producers;
+                long long end = total_values * (tid + 1) / producers;
+                double interval = rate > 0 ? PIPE_BATCH / (rate / producers) : 0.0;
+                double waited = 0.0;
+                long long batch_index = 0;
+
+                for (long long first = begin; first < end; first += PIPE_BATCH, batch_index++) {
+                    double due = start + batch_index * interval;
+                    if (rate > 0) {
+                        double now;
+                        while ((now = bench_now()) < due) {
+                            if (due - now > 200e-6) {
+                                struct timespec ts = {0, (long)((due - now - 100e-6) * 1e9)};
+                                nanosleep(&ts, NULL);
+                            } else {
+                                sched_yield();
+                            }
+                        }
+                    } else {
+                        due = bench_now();
+                    }
+
+                    void *item;
+                    double t0 = bench_now();
+                    spins = 0;
+                    while (ring_pop(&free_batches[lane], &item) != 0) ring_backoff(&spins);
+                    waited += bench_now() - t0;
+
+                    PipeBatch *batch = item;
+                    batch->due = due;
+                    batch->count = (int)(end - first < PIPE_BATCH ? end - first : PIPE_BATCH);
+                    rng_fill_bounded(key, first, batch->count, &range, batch->values);
+                    spins = 0;
+                    while (ring_push(&work[lane], batch) != 0) ring_backoff(&spins);
+                }
+                stall[tid] = waited;
+                atomic_fetch_sub_explicit(&producers_left[lane], 1, memory_order_release);
+            } else {
+                // Consumer: drain the lane until its producers are done and it is empty
+                int c = tid - producers;
+                int lane = c % lanes;
+                for (;;) {
+                    void *item = NULL;
+                    if (ring_pop(&work[lane], &item) != 0) {
+                        // Empty: finished once the lane's producers are done and a retry finds nothing
+                        if (atomic_load_explicit(&producers_left[lane], memory_order_acquire) == 0 &&
+                            ring_pop(&work[lane], &item) != 0) break;
+                        if (!item) {
+                            ring_backoff(&spins);
+                            continue;
+                        }
+                    }
+                    spins = 0;
+                    PipeBatch *batch = item;
+                    stream_stats_update(&local[c], batch->values, batch->count);
+                    double done = bench_now();
+                    pipe_latency_add(&latencies[c], done - batch->due);
+                    if (done > finish) finish = done;
+                    while (ring_push(&free_batches[lane], batch) != 0) ring_backoff(&spins);
+                }
+            }
+        }
+        perfctr_end(&perf_session);
+    }
+
+    if (status == 0) {
+        long long samples = 0;
+        for (int c = 0; c < consumers; c++) samples += latencies[c].count;
+        double *all = malloc((samples ? samples : 1) * sizeof(double));
+        StreamStats merged;
+        if (!all || stream_stats_init(&merged, k, 0) != 0) {
+            status = -1;
+        } else {
+            long long n = 0;
+            for (int c = 0; c < consumers; c++) {
+                memcpy(&all[n], latencies[c].values, latencies[c].count * sizeof(double));
+                n += latencies[c].count;
+                stream_stats_merge(&merged, &local[c]);
+            }
+            qsort(all, n, sizeof(double), bench_compare_double);
+            result->p50 = pipe_percentile(all, n, 0.50);
+            result->p99 = pipe_percentile(all, n, 0.99);
+            result->p999 = pipe_percentile(all, n, 0.999);
+            result->max = n ? all[n - 1] : 0.0;
+            result->elapsed = finish - start;
+            result->throughput = merged.count / result->elapsed;
+            for (int p = 0; p < producers; p++) result->stall += stall[p] / producers;
+            result->stats = stream_stats_result(&merged);
+            if (merged.count != total_values) status = -1;
+            stream_stats_free(&merged);
+        }
+        free(all);
+    }
+
+    for (int c = 0; c < consumers && local; c++) {
+        stream_stats_free(&local[c]);
+        if (latencies) free(latencies[c].values);
+    }
+    for (int l = 0; l < lanes && work && free_batches; l++) {
+        ring_free(&work[l]);
+        ring_free(&free_batches[l]);
+    }
+    free(work); free(free_batches); free(pool); free(local); free(latencies); free(producers_left); free(stall);
+    return status;
+}
+
+typedef struct {
+    int threads;
+    PipeResult result;    // of the last run
+} PipelineRun;
+
+// Timed value: ingesting one Scenario A hour (360M values) unpaced;
+// extras: p50, p99 and p99.9 latency in microseconds
+static double problem5_pipeline_max(void *ctx, double *extra) {
+    PipelineRun *p = ctx;
+    if (problem5_pipeline_run(p->threads, 360000000LL, 0.0, &p->result) != 0) return -1;
+    printf("Threads: %2d | %.1f M values/s | Latency p50 %.0f us, p99 %.0f us, p99.9 %.0f us | "
+           "Producer stall: %.4f s\n", p->threads, p->result.throughput / 1e6, p->result.p50 * 1e6,
+           p->result.p99 * 1e6, p->result.p999 * 1e6, p->result.stall);
+    extra[0] = p->result.p50 * 1e6;
+    extra[1] = p->result.p99 * 1e6;
+    extra[2] = p->result.p999 * 1e6;
+    return p->result.elapsed;
+}
+
+static void pipeline_write_row(FILE *fp, int threads, const char *mode, double target, const PipeResult *r,
+                               double max_throughput) {
+    int producers, consumers;
+    char topology[64];
+    pipe_split(threads, &producers, &consumers);
+    topo_describe(producers + consumers, topology, sizeof(topology));
+    // Paced rows: headroom is the unpaced rate over the target, and the
+    // target counts as sustained when at least 99% of it got through
+    char headroom[32] = "NA", sustained[8] = "NA";
+    if (target > 0) {
+        snprintf(headroom, sizeof(headroom), "%.2f", max_throughput / target);
+        snprintf(sustained, sizeof(sustained), "%s", r->throughput >= 0.99 * target ? "yes" : "no");
+    }
+    fprintf(fp, "%d,%s,%d,%d,%s,%.0f,%.3f,%.1f,%.1f,%.1f,%.1f,%.4f,%s,%s,%s\n",
+            threads, pipe_ring_kind == RING_SPSC ? "spsc" : "mpmc", producers, consumers, mode, target,
+            r->throughput / 1e6, r->p50 * 1e6, r->p99 * 1e6, r->p999 * 1e6, r->max * 1e6, r->stall,
+            headroom, sustained, topology);
+}
+
+// Maximum sustainable ingest rate per thread count, then each scenario's
+// rate replayed for pipe_duration seconds to see its latency and headroom
+int problem5_pipeline(const BenchOptions *opts, BenchReport *report) {
+    static const char *const extra_names[] = {"latency_p50_us", "latency_p99_us", "latency_p999_us"};
+    static const char *const scenario_names[] = {"scenarioA", "scenarioB"};
+    static const double scenario_rates[] = {SCENARIO_A_RATE, SCENARIO_B_RATE};
+    FILE *fp = fopen("problem5_pipeline.txt", "w");
+    FILE *counters = fopen("problem5_counters.txt", "w");
+    if (!fp) {
+        fprintf(stderr, "Could not open problem5_pipeline.txt\n");
+        if (counters) fclose(counters);
+        return -1;
+    }
+    if (counters) perfctr_write_header(counters);
+    fprintf(fp, "Threads,Queue,Producers,Consumers,Mode,Target(val/s),Throughput(Mval/s),Latency_p50(us),"
+                "Latency_p99(us),Latency_p999(us),Latency_max(us),Producer_Stall(s),Headroom,Sustained,Topology\n");
+
+    printf("INGESTION PIPELINE: %s rings, %d-value batches, %d batches per lane\n",
+           pipe_ring_kind == RING_SPSC ? "SPSC" : "MPMC", PIPE_BATCH, PIPE_POOL);
+    printf("------------------------------------------------------------\n");
+    char benchmark[64];
+    snprintf(benchmark, sizeof(benchmark), "pipeline_%s", pipe_ring_kind == RING_SPSC ? "spsc" : "mpmc");
+    for (int i = 0; i < opts->num_threads; i++) {
+        PipelineRun run = {.threads = opts->threads[i]};
+        BenchStats stats;
+        int producers, consumers;
+        pipe_split(run.threads, &producers, &consumers);
+
+        printf("\nRunning with %d thread(s) (%d producers, %d consumers) - %d to %d iterations:\n",
+               run.threads, producers, consumers, opts->min_runs, opts->max_runs);
+        bench_measure(opts, problem5_pipeline_max, &run, 3, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, run.threads, benchmark, &perf_session);
+        bench_report_add(report, benchmark, run.threads, 360000000LL, &stats, extra_names, NULL, 3);
+
+        double max_throughput = 360000000.0 / stats.time.median;
+        pipeline_write_row(fp, run.threads, "max", 0.0, &run.result, max_throughput);
+        printf("  Max sustainable: %.1f M values/s (median of %d runs) | Headroom: A %.0fx, B %.1fx\n",
+               max_throughput / 1e6, stats.runs, max_throughput / SCENARIO_A_RATE,
+               max_throughput / SCENARIO_B_RATE);
+
+        for (int s = 0; s < 2; s++) {
+            PipeResult paced;
+            long long values = (long long)(scenario_rates[s] * pipe_duration);
+            if (problem5_pipeline_run(run.threads, values, scenario_rates[s], &paced) != 0) continue;
+            printf("  %s at %.0f values/s for %g s: %.3f M values/s | Latency p50 %.0f us, p99 %.0f us, "
+                   "p99.9 %.0f us, max %.0f us\n", scenario_names[s], scenario_rates[s], pipe_duration,
+                   paced.throughput / 1e6, paced.p50 * 1e6, paced.p99 * 1e6, paced.p999 * 1e6, paced.max * 1e6);
+            pipeline_write_row(fp, run.threads, scenario_names[s], scenario_rates[s], &paced, max_throughput);
+        }
+    }
+    fclose(fp);
+    if (counters) fclose(counters);
+    printf("\nPipeline results saved to problem5_pipeline.txt\n");
+    return 0;
+}
+
+typedef struct {
+    int threads;
+    int save_data;        // the first run of the program writes the samples
+    RunMetrics times;     // of the last run
+} Problem5Run;
+
+#define EXTERNAL_EXTRAS 5
+
+// External mode extras: generate, sort, merge, write, read
+static void problem5_external_extras(const RunMetrics *times, double *extra) {
+    extra[0] = times->generate;
+    extra[1] = times->sort;
+    extra[2] = times->order - times->sort;
+    extra[3] = times->write;
+    extra[4] = times->read;
+}
+
+// Timed value: the whole run; extras: generate, order (or sketch), frequency
+static double problem5a_run(void *ctx, double *extra) {
+    Problem5Run *p = ctx;
+    problem5a_streaming_data(p->threads, p->save_data, &p->times);
+    p->save_data = 0;
+    if (order_method == ORDER_EXTERNAL) {
+        problem5_external_extras(&p->times, extra);
+        return p->times.total;
+    }
+    extra[0] = p->times.generate;
+    extra[1] = p->times.order;
+    extra[2] = p->times.frequency;
+    return p->times.total;
+}
+
+static double problem5b_run(void *ctx, double *extra) {
+    Problem5Run *p = ctx;
+    problem5b_streaming_data(p->threads, p->save_data, &p->times);
+    p->save_data = 0;
+    if (order_method == ORDER_EXTERNAL) {
+        problem5_external_extras(&p->times, extra);
+        return p->times.total;
+    }
+    extra[0] = p->times.generate;
+    extra[1] = p->times.order;
+    return p->times.total;
+}
+
+#define PROBE_VALUES (1LL << 24)   // values per calibration run of the adaptive mode
+
+typedef struct {
+    unsigned long long *data;
+    unsigned long long *scratch;
+} Problem5Probe;
+
+// Scenario A's first PROBE_VALUES values, generated with the run's slices
+static void problem5_probe_fill(unsigned long long *data, int threads) {
+    unsigned long long key = rng_key(12345, 5);
+    RngRange range = rng_range(VALUE_RANGE);
+    topo_set_num_threads(threads);
+    
+    #pragma omp parallel
+    {
+        long long begin, end;
+        problem5a_slice(PROBE_VALUES, omp_get_thread_num(), omp_get_num_threads(), 0, &begin, &end);
+        for (long long first = begin; first < end; first += RNG_BLOCK) {
+            long long count = (end - first < RNG_BLOCK) ? end - first : RNG_BLOCK;
+            rng_fill_bounded(key, first, count, &range, &data[first]);
+        }
+    }
+}
+
+// Calibration run of the generate phase, in M values/s
+static double problem5_probe_generate(void *ctx, int threads) {
+    Problem5Probe *p = ctx;
+    double start = bench_now();
+    problem5_probe_fill(p->data, threads);
+    return PROBE_VALUES / (bench_now() - start) / 1e6;
+}
+
+// Calibration run of the order phase (quartile selection or radix sort of
+// fresh values), in M values/s; 0 when the sort or selection fails
+static double problem5_probe_order(void *ctx, int threads) {
+    Problem5Probe *p = ctx;
+    long long ranks[4] = {PROBE_VALUES / 4, PROBE_VALUES / 2 - 1, PROBE_VALUES / 2, PROBE_VALUES * 3 / 4};
+    unsigned long long values[4];
+    problem5_probe_fill(p->data, threads);
+    double start = bench_now();
+    int status = order_method == ORDER_SORT
+               ? radix_sort_u64(p->data, p->scratch, PROBE_VALUES, threads)
+               : select_ranks_u64(p->data, PROBE_VALUES, 0, VALUE_RANGE - 1, ranks, values, 4, threads);
+    if (status != 0) return 0.0;
+    return PROBE_VALUES / (bench_now() - start) / 1e6;
+}
+
+// Adaptive mode: Scenario A with the generate and order phases each at the
+// thread count and placement their calibration picks from the --threads
+// candidates (concur.h). Calibrations go to problem5_adaptive.txt.
+static int problem5_adaptive(const BenchOptions *opts, BenchReport *report) {
+    static const char *const extra_names[] = {"generate", "order", "frequency"};
+    Problem5Probe probe = {malloc(PROBE_VALUES * sizeof(unsigned long long)),
+                           malloc(PROBE_VALUES * sizeof(unsigned long long))};
+    FILE *log = fopen("problem5_adaptive.txt", "w");
+    if (!probe.data || !probe.scratch || !log) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        free(probe.data);
+        free(probe.scratch);
+        if (log) fclose(log);
+        return -1;
+    }
+    
+    ConcurController controller;
+    concur_init(&controller, opts->threads, opts->num_threads, log);
+    phase_generate = concur_add_phase(&controller, "generate", "Mval/s", problem5_probe_generate, &probe);
+    phase_order = concur_add_phase(&controller, order_method == ORDER_SORT ? "sort" : "select", "Mval/s",
+                                   problem5_probe_order, &probe);
+    concur = &controller;
+    
+    printf("SCENARIO A (adaptive): 100,000 values/second for 1 hour (360M values)\n");
+    printf("------------------------------------------------------------\n");
+    Problem5Run run = {.save_data = 1};
+    BenchStats stats;
+    char benchmark[64];
+    // A single measurement, so there is no later one to re-probe before:
+    // the runs do not report their throughput to the controller
+    int gen_threads = concur_apply(concur, phase_generate);
+    int order_threads = concur_apply(concur, phase_order);
+    printf("\nRunning adaptive - %d to %d iterations:\n", opts->min_runs, opts->max_runs);
+    bench_measure(opts, problem5a_run, &run, 3, &stats);
+    bench_print_stats(&stats);
+    perfctr_print(&perf_session);
+    
+    printf("  Median time: %.4f seconds (Gen: %.4f s with %d thread(s), Order: %.4f s with %d thread(s), "
+           "Freq: %.4f s)\n", stats.time.median, stats.extra[0].median, gen_threads, stats.extra[1].median,
+           order_threads, stats.extra[2].median);
+    snprintf(benchmark, sizeof(benchmark), "scenarioA_%s_adaptive", order_method == ORDER_SORT ? "sort" : "select");
+    bench_report_add(report, benchmark, gen_threads, 360000000LL, &stats, extra_names, NULL, 3);
+    
+    concur = NULL;
+    fclose(log);
+    free(probe.data);
+    free(probe.scratch);
+    printf("\nCalibrations saved to problem5_adaptive.txt\n");
+    return 0;
+}
+
+// I/O bandwidth of a run in GB/s, 0 when nothing was transferred
+static double problem5_io_gbs(double bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / 1e9 : 0.0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    bench_options_init(&opts, "problem5", 0);
+    if (bench_parse_args(&opts, &argc, argv) != 0) return 1;
+    
+    // Optional arguments: "select" (default) or "sort" for the Scenario A
+    // order statistics, "external" for exact out-of-core statistics in both
+    // scenarios (--memory=<MB>, --spill-dir=<dir>, --direct),
+    // --compress to hold Scenario A as a compressed column (column.h),
+    // --epsilon=<rank error> for the Scenario B sketches, and "pipeline" to
+    // benchmark the ingestion pipeline instead (--queue=spsc|mpmc,
+    // --producers=<n>, --duration=<seconds per paced run>). "adaptive" runs
+    // Scenario A once per configuration with calibrated thread counts per
+    // phase instead of every --threads count. --distinct[=<precision>] adds
+    // distinct counts: exact and HyperLogLog in Scenario A and in external
+    // mode, HyperLogLog in Scenario B's sketches (distinct.h).
+    int pipeline = 0, adaptive = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "sort") == 0) {
+            order_method = ORDER_SORT;
+        } else if (strcmp(argv[a], "select") == 0) {
+            order_method = ORDER_SELECT;
+        } else if (strcmp(argv[a], "external") == 0) {
+            order_method = ORDER_EXTERNAL;
+        } else if (strncmp(argv[a], "--epsilon=", 10) == 0 && atof(argv[a] + 10) > 0) {
+            sketch_epsilon = atof(argv[a] + 10);
+        } else if (strncmp(argv[a], "--memory=", 9) == 0 && atof(argv[a] + 9) >= 1) {
+            ext_config.memory_budget = (size_t)(atof(argv[a] + 9) * 1048576.0);
+        } else if (strncmp(argv[a], "--spill-dir=", 12) == 0 && argv[a][12]) {
+            ext_config.dir = argv[a] + 12;
+        } else if (strcmp(argv[a], "--direct") == 0) {
+            ext_config.direct_io = 1;
+        } else if (strcmp(argv[a], "--compress") == 0) {
+            compress_column = 1;
+        } else if (strcmp(argv[a], "--distinct") == 0) {
+            distinct_precision = HLL_DEFAULT_PRECISION;
+        } else if (strncmp(argv[a], "--distinct=", 11) == 0 && atoi(argv[a] + 11) >= HLL_MIN_PRECISION &&
+                   atoi(argv[a] + 11) <= HLL_MAX_PRECISION) {
+            distinct_precision = atoi(argv[a] + 11);
+        } else if (strcmp(argv[a], "pipeline") == 0) {
+            pipeline = 1;
+        } else if (strcmp(argv[a], "adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[a], "--queue=spsc") == 0 || strcmp(argv[a], "--queue=mpmc") == 0) {
+            pipe_ring_kind = strcmp(argv[a] + 8, "spsc") == 0 ? RING_SPSC : RING_MPMC;
+        } else if (strncmp(argv[a], "--producers=", 12) == 0 && atoi(argv[a] + 12) > 0) {
+            pipe_producers = atoi(argv[a] + 12);
+        } else if (strncmp(argv[a], "--duration=", 11) == 0 && atof(argv[a] + 11) > 0) {
+            pipe_duration = atof(argv[a] + 11);
+        } else {
+            fprintf(stderr, "Usage: %s [select|sort|external] [--compress] [--epsilon=<rank error>] "
+                            "[--memory=<MB>] [--spill-dir=<dir>] [--direct] [--distinct[=<precision>]]\n"
+                            "       %s pipeline [--queue=spsc|mpmc] [--producers=<n>] [--duration=<s>]\n"
+                            "       %s adaptive [select|sort] [--compress]\n",
+                    argv[0], argv[0], argv[0]);
+            bench_usage(&opts);
+            return 1;
+        }
+    }
+    if (adaptive && order_method == ORDER_EXTERNAL) {
+        fprintf(stderr, "The adaptive mode supports select and sort, not external\n");
+        return 1;
+    }
+    
+    const int *thread_counts = opts.threads;
+    int num_configs = opts.num_threads;
+    int max_threads = 1;
+    for (int i = 0; i < num_configs; i++) {
+        if (thread_counts[i] > max_threads) max_threads = thread_counts[i];
+    }
+    arena_init(&arena, max_threads);
     
     printf("=================================================================\n");
     printf("PROBLEM 5: Streaming Data Analysis\n");
+    printf("Order statistics: %s | Sketch epsilon: %.4f | Generator: counter-based (%s kernel)\n",
+           order_method == ORDER_SELECT ? "selection" : order_method == ORDER_SORT ? "radix sort" : "external merge",
+           sketch_epsilon, rng_isa_name());
+    if (order_method == ORDER_EXTERNAL) {
+        printf("External: %.0f MB budget (%lld values per run) | Spill dir: %s | I/O: %s\n",
+               ext_config.memory_budget / 1048576.0, ext_chunk_values(&ext_config), ext_config.dir,
+               ext_config.direct_io ? "O_DIRECT" : "buffered");
+    }
+    if (compress_column && order_method != ORDER_EXTERNAL) {
+        if (column_self_check(max_threads) != 0) {
+            fprintf(stderr, "Column self-check failed (%s unpack kernel)\n", rng_isa_name());
+            return 1;
+        }
+        printf("Scenario A column: %s, self-check passed (%s unpack kernel)\n",
+               order_method == ORDER_SELECT ? "frame of reference" : "delta after the sort", rng_isa_name());
+    }
+    if (distinct_precision) {
+        printf("Distinct counts: exact %s | HyperLogLog p = %d (%lld registers, std error %.2f%%)\n",
+               order_method == ORDER_EXTERNAL ? "in the merge" : "in Scenario A", distinct_precision,
+               1LL << distinct_precision, hll_std_error(distinct_precision) * 100.0);
+    }
+    topo_print_summary();
+    perfctr_print_summary();
     printf("=================================================================\n\n");
-    
-    double results_a[9];
-    double results_b[9];
+
+    if (pipeline || adaptive) {
+        BenchReport report;
+        bench_report_init(&report);
+        int status = pipeline ? problem5_pipeline(&opts, &report) : problem5_adaptive(&opts, &report);
+        if (status != 0) {
+            bench_report_free(&report);
+            return 1;
+        }
+        int regressions = bench_finish(&report, &opts);
+        bench_report_free(&report);
+        return regressions > 0 ? 2 : 0;
+    }
+
+    static const char *const extra_names_a[] = {"generate", "order", "frequency"};
+    static const char *const extra_names_b[] = {"generate", "sketch"};
+    static const char *const extra_names_ext[] = {"generate", "sort", "merge", "write", "read"};
+    int external = (order_method == ORDER_EXTERNAL);
+    int num_extra_a = external ? EXTERNAL_EXTRAS : 3;
+    int num_extra_b = external ? EXTERNAL_EXTRAS : 2;
+    const char *benchmark_b = external ? "scenarioB_external" : "scenarioB_sketch";
+    double results_a[BENCH_MAX_CONFIGS], gen_a[BENCH_MAX_CONFIGS], order_a[BENCH_MAX_CONFIGS];
+    double freq_a[BENCH_MAX_CONFIGS];
+    double results_b[BENCH_MAX_CONFIGS], gen_b[BENCH_MAX_CONFIGS], order_b[BENCH_MAX_CONFIGS];
+    double throughput_b[BENCH_MAX_CONFIGS], memory_b[BENCH_MAX_CONFIGS];
+    double write_gbs_a[BENCH_MAX_CONFIGS], read_gbs_a[BENCH_MAX_CONFIGS];
+    double write_gbs_b[BENCH_MAX_CONFIGS], read_gbs_b[BENCH_MAX_CONFIGS];
+    const char *roofline_a[BENCH_MAX_CONFIGS], *roofline_b[BENCH_MAX_CONFIGS];
+    FILE *counters = fopen("problem5_counters.txt", "w");
+    if (counters) perfctr_write_header(counters);
+    FILE *distinct_log = distinct_precision ? fopen("problem5_distinct.txt", "w") : NULL;
+    if (distinct_log) {
+        fprintf(distinct_log, "Scenario,Threads,Method,Distinct,Reference,Error(%%),Time(s),Throughput(Mval/s),"
+                              "Memory(KB)\n");
+    }
+    BenchReport report;
+    bench_report_init(&report);
+    char benchmark[64];
     
     // Scenario A
     printf("SCENARIO A: 100,000 values/second for 1 hour (360M values)\n");
     printf("------------------------------------------------------------\n");
+    snprintf(benchmark, sizeof(benchmark), "scenarioA_%s",
+             order_method == ORDER_SELECT ? "select" : order_method == ORDER_SORT ? "sort" : "external");
     for (int i = 0; i < num_configs; i++) {
-        int threads = thread_counts[i];
-        double total_time = 0.0;
+        Problem5Run run = {.threads = thread_counts[i], .save_data = (i == 0)};
+        BenchStats stats;
         
-        printf("\nRunning with %d thread(s) - %d iterations:\n", threads, runs);
+        printf("\nRunning with %d thread(s) - %d to %d iterations:\n", run.threads, opts.min_runs, opts.max_runs);
+        bench_measure(&opts, problem5a_run, &run, num_extra_a, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, run.threads, benchmark, &perf_session);
+        roofline_a[i] = perfctr_roofline(&perf_session);
         
-        for (int run = 0; run < runs; run++) {
-            printf("  Run %d: ", run + 1);
-            int save_data = (i == 0 && run == 0) ? 1 : 0;
-            double exec_time = problem5a_streaming_data(threads, save_data);
-            total_time += exec_time;
+        results_a[i] = stats.time.median;
+        gen_a[i] = stats.extra[0].median;
+        order_a[i] = stats.extra[1].median;
+        freq_a[i] = stats.extra[2].median;
+        write_gbs_a[i] = problem5_io_gbs(run.times.bytes_written, run.times.write);
+        read_gbs_a[i] = problem5_io_gbs(run.times.bytes_read, run.times.read);
+        if (external) {
+            // Order column: sort + merge; frequency is counted in the merge
+            order_a[i] = stats.extra[1].median + stats.extra[2].median;
+            freq_a[i] = 0.0;
+            printf("  Median time: %.4f seconds (Gen: %.4f s, Sort: %.4f s, Merge: %.4f s, "
+                   "Write: %.2f GB/s, Read: %.2f GB/s)\n", results_a[i], gen_a[i], stats.extra[1].median,
+                   stats.extra[2].median, write_gbs_a[i], read_gbs_a[i]);
+        } else {
+            printf("  Median time: %.4f seconds (Gen: %.4f s, Order: %.4f s, Freq: %.4f s)\n", 
+                   results_a[i], gen_a[i], order_a[i], freq_a[i]);
         }
-        
-        results_a[i] = total_time / runs;
-        printf("  Average time: %.4f seconds\n", results_a[i]);
+        bench_report_add(&report, benchmark, run.threads, 360000000LL, &stats,
+                         external ? extra_names_ext : extra_names_a, NULL, num_extra_a);
+        distinct_write_rows(distinct_log, "A", run.threads, 360000000LL, &run.times.distinct);
     }
     
     // Scenario B
     printf("\n\n=================================================================\n");
-    printf("SCENARIO B: 60M values/minute for 1 hour (3.6B values, using 100M sample)\n");
+    printf("SCENARIO B: 60M values/minute for 1 hour (3.6B values, %s)\n",
+           external ? "exact, spilled to disk" : "streamed through sketches");
     printf("------------------------------------------------------------\n");
     for (int i = 0; i < num_configs; i++) {
-        int threads = thread_counts[i];
-        double total_time = 0.0;
+        Problem5Run run = {.threads = thread_counts[i], .save_data = (i == 0)};
+        BenchStats stats;
         
-        printf("\nRunning with %d thread(s) - %d iterations:\n", threads, runs);
+        printf("\nRunning with %d thread(s) - %d to %d iterations:\n", run.threads, opts.min_runs, opts.max_runs);
+        bench_measure(&opts, problem5b_run, &run, num_extra_b, &stats);
+        bench_print_stats(&stats);
+        perfctr_print(&perf_session);
+        perfctr_write_rows(counters, run.threads, benchmark_b, &perf_session);
+        roofline_b[i] = perfctr_roofline(&perf_session);
         
-        for (int run = 0; run < runs; run++) {
-            printf("  Run %d: ", run + 1);
-            int save_data = (i == 0 && run == 0) ? 1 : 0;
-            double exec_time = problem5b_streaming_data(threads, save_data);
-            total_time += exec_time;
+        results_b[i] = stats.time.median;
+        gen_b[i] = stats.extra[0].median;
+        order_b[i] = stats.extra[1].median;
+        memory_b[i] = run.times.memory_bytes;
+        throughput_b[i] = 3600000000.0 / results_b[i];
+        write_gbs_b[i] = problem5_io_gbs(run.times.bytes_written, run.times.write);
+        read_gbs_b[i] = problem5_io_gbs(run.times.bytes_read, run.times.read);
+        if (external) {
+            // Sketch column: sort + merge
+            order_b[i] = stats.extra[1].median + stats.extra[2].median;
+            printf("  Median time: %.4f seconds (Gen: %.4f s, Sort: %.4f s, Merge: %.4f s, "
+                   "Write: %.2f GB/s, Read: %.2f GB/s)\n", results_b[i], gen_b[i], stats.extra[1].median,
+                   stats.extra[2].median, write_gbs_b[i], read_gbs_b[i]);
+        } else {
+            printf("  Median time: %.4f seconds (Gen: %.4f s, Sketch: %.4f s, %.1f M values/s)\n", 
+                   results_b[i], gen_b[i], order_b[i], throughput_b[i] / 1e6);
         }
-        
-        results_b[i] = total_time / runs;
-        printf("  Average time: %.4f seconds\n", results_b[i]);
+        bench_report_add(&report, benchmark_b, run.threads, 3600000000LL, &stats,
+                         external ? extra_names_ext : extra_names_b, NULL, num_extra_b);
+        distinct_write_rows(distinct_log, "B", run.threads, 3600000000LL, &run.times.distinct);
     }
     
+    if (!external) problem5_sketch_accuracy(max_threads);   // no sketches in external mode
+    
     // Speedup Analysis
     printf("\n\n=================================================================\n");
     printf("SPEEDUP ANALYSIS - Scenario A\n");
@@ -261,20 +1938,37 @@ int main() {
     
     // Save results
     FILE *fp = fopen("problem5_results.txt", "w");
-    fprintf(fp, "Threads,ScenarioA_Time(s),ScenarioA_Speedup,ScenarioB_Time(s),ScenarioB_Speedup\n");
+    fprintf(fp, "Threads,ScenarioA_Time(s),ScenarioA_Speedup,ScenarioA_Gen(s),ScenarioA_Order(s),ScenarioA_Freq(s),"
+                "ScenarioB_Time(s),ScenarioB_Speedup,ScenarioB_Gen(s),ScenarioB_Sketch(s),"
+                "ScenarioB_Throughput(Mval/s),ScenarioB_Memory(KB),Topology,ScenarioA_Roofline,ScenarioB_Roofline,"
+                "ScenarioA_Write(GB/s),ScenarioA_Read(GB/s),ScenarioB_Write(GB/s),ScenarioB_Read(GB/s)\n");
     for (int i = 0; i < num_configs; i++) {
-        fprintf(fp, "%d,%.4f,%.2f,%.4f,%.2f\n", 
+        char topology[64];
+        topo_describe(thread_counts[i], topology, sizeof(topology));
+        fprintf(fp, "%d,%.4f,%.2f,%.4f,%.4f,%.4f,%.4f,%.2f,%.4f,%.4f,%.1f,%.1f,%s,%s,%s,%.3f,%.3f,%.3f,%.3f\n", 
                 thread_counts[i], 
-                results_a[i], baseline_a / results_a[i],
-                results_b[i], baseline_b / results_b[i]);
+                results_a[i], baseline_a / results_a[i], gen_a[i], order_a[i], freq_a[i],
+                results_b[i], baseline_b / results_b[i], gen_b[i], order_b[i],
+                throughput_b[i] / 1e6, memory_b[i] / 1024.0, topology, roofline_a[i], roofline_b[i],
+                write_gbs_a[i], read_gbs_a[i], write_gbs_b[i], read_gbs_b[i]);
     }
     fclose(fp);
+    if (counters) fclose(counters);
+    if (distinct_log) fclose(distinct_log);
     
     printf("\n=================================================================\n");
-    printf("Results saved to problem5_results.txt\n");
-    printf("Data samples: problem5a_data.txt, problem5b_data.txt\n");
+    printf("Results saved to problem5_results.txt (counters per phase in problem5_counters.txt)\n");
+    if (!external) printf("Sketch accuracy: problem5_sketch_accuracy.txt\n");
+    if (distinct_log) printf("Distinct counts: problem5_distinct.txt\n");
+    char arena_info[128];
+    arena_describe(&arena, arena_info, sizeof(arena_info));
+    printf("Arena: %s\n", arena_info);
+    arena_release(&arena);
+    printf("Data samples: problem5a_sample.bin, problem5b_sample.bin\n");
     printf("\nNext step: Run 'python3 problem5_visualize.py' for box plots\n");
     printf("=================================================================\n");
     
-    return 0;
+    int regressions = bench_finish(&report, &opts);
+    bench_report_free(&report);
+    return regressions > 0 ? 2 : 0;
 }
\ No newline at end of file
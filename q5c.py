@@ -8,6 +8,7 @@ import numpy as np
 import matplotlib.pyplot as plt
 import seaborn as sns
 from scipy import stats
+import struct
 import sys
 
 # Set style
@@ -15,30 +16,95 @@ sns.set_style("whitegrid")
 plt.rcParams['figure.figsize'] = (16, 10)
 plt.rcParams['font.size'] = 10
 
+SAMPLE_MAGIC = b'P5SAMPLE'
+
+def load_sample(filename):
+    """Map a binary sample written by q5ab (see sample.h) without copying it"""
+    try:
+        with open(filename, 'rb') as f:
+            header = f.read(64)
+    except FileNotFoundError:
+        return None
+    if len(header) < 40:
+        print(f"⚠ {filename} is truncated, ignoring it")
+        return None
+    magic, version, header_size, dtype, count, population = struct.unpack('<8sII8sQQ', header[:40])
+    if magic != SAMPLE_MAGIC or version != 1:
+        print(f"⚠ {filename} is not a sample file, ignoring it")
+        return None
+    dtype = dtype.rstrip(b'\0').decode()
+    data = np.memmap(filename, dtype=dtype, mode='r', offset=header_size, shape=(count,))
+    print(f"✓ Mapped {count:,} sampled values (of {population:,}) from {filename}")
+    return data
+
 def load_data(filename):
-    """Load data from file"""
+    """Load data from the binary sample, falling back to the old text export"""
+    data = load_sample(filename + '_sample.bin')
+    if data is not None:
+        return data
     try:
-        data = np.loadtxt(filename, dtype=np.uint64)
-        print(f"✓ Loaded {len(data):,} values from {filename}")
+        data = np.loadtxt(filename + '_data.txt', dtype=np.uint64)
+        print(f"✓ Loaded {len(data):,} values from {filename}_data.txt")
         return data
+    except (FileNotFoundError, OSError):
+        print(f"⚠ No sample for {filename}. Generating synthetic data.")
+        return None
+
+def load_native_stats(filename):
+    """Load statistics computed by q5ab over the full stream ("key: value" lines)"""
+    try:
+        native = {'top': []}
+        with open(filename) as f:
+            for line in f:
+                key, _, value = line.partition(':')
+                value = value.split()
+                if key.startswith('top'):
+                    native['top'].append((int(value[0]), int(value[1])))
+                elif value:
+                    native[key] = int(value[0]) if value[0].isdigit() else float(value[0])
+        print(f"✓ Loaded native statistics from {filename}")
+        return native
     except FileNotFoundError:
-        print(f"⚠ {filename} not found. Generating synthetic data.")
         return None
 
-def calculate_statistics(data):
-    """Calculate comprehensive statistics"""
+NATIVE_KEYS = ('mean', 'median', 'mode', 'min', 'max', 'std', 'p25', 'p75', 'iqr', 'skewness', 'kurtosis')
+
+def calculate_statistics(data, native=None):
+    """Calculate comprehensive statistics.
+
+    q5ab computes these over the full stream, higher moments included,
+    and exports them to problem5X_stats.txt; NumPy/scipy on the sample are
+    only the fallback for older exports.
+    """
+    if native is not None and all(key in native for key in NATIVE_KEYS):
+        return {key: native[key] for key in NATIVE_KEYS}
+    if native is not None and 'mode' in native:
+        mode = native['mode']
+    else:
+        mode = stats.mode(data, keepdims=True)[0][0] if len(data) > 0 else 0
     return {
         'mean': np.mean(data),
         'median': np.median(data),
-        'mode': stats.mode(data, keepdims=True)[0][0] if len(data) > 0 else 0,
+        'mode': mode,
         'min': np.min(data),
         'max': np.max(data),
         'std': np.std(data),
         'p25': np.percentile(data, 25),
         'p75': np.percentile(data, 75),
-        'iqr': np.percentile(data, 75) - np.percentile(data, 25)
+        'iqr': np.percentile(data, 75) - np.percentile(data, 25),
+        'skewness': stats.skew(data),
+        'kurtosis': stats.kurtosis(data)
     }
 
+def print_top_k(native):
+    """Print the native top-k most frequent values"""
+    if native is None or not native['top']:
+        return
+    approx = '~' if native.get('mode_exact', 1) == 0 else ''
+    print(f"Top {len(native['top'])} values by frequency (full stream):")
+    for value, count in native['top']:
+        print(f"  {value:>15} x {approx}{count}")
+
 def generate_synthetic_data(scenario='A'):
     """Generate synthetic data if files don't exist"""
     if scenario == 'A':
@@ -55,17 +121,21 @@ def create_comprehensive_visualization():
     """Create comprehensive box plots and analysis"""
     
     # Load or generate data
-    data_a = load_data('problem5a_data.txt')
+    data_a = load_data('problem5a')
     if data_a is None:
         data_a = generate_synthetic_data('A')
     
-    data_b = load_data('problem5b_data.txt')
+    data_b = load_data('problem5b')
     if data_b is None:
         data_b = generate_synthetic_data('B')
     
+    # Native statistics (mode / top-k over the full stream) if q5ab exported them
+    native_a = load_native_stats('problem5a_stats.txt')
+    native_b = load_native_stats('problem5b_stats.txt')
+    
     # Calculate statistics
-    stats_a = calculate_statistics(data_a)
-    stats_b = calculate_statistics(data_b)
+    stats_a = calculate_statistics(data_a, native_a)
+    stats_b = calculate_statistics(data_b, native_b)
     
     # Print statistics
     print("\n" + "="*70)
@@ -81,6 +151,9 @@ def create_comprehensive_visualization():
     print(f"25th %ile:   {stats_a['p25']:.2e}")
     print(f"75th %ile:   {stats_a['p75']:.2e}")
     print(f"IQR:         {stats_a['iqr']:.2e}")
+    print(f"Skewness:    {stats_a['skewness']:.4f}")
+    print(f"Kurtosis:    {stats_a['kurtosis']:.4f} (excess)")
+    print_top_k(native_a)
     
     print("\n" + "="*70)
     print("SCENARIO B: 60,000,000 values/minute for 1 hour")
@@ -95,6 +168,9 @@ def create_comprehensive_visualization():
     print(f"25th %ile:   {stats_b['p25']:.2e}")
     print(f"75th %ile:   {stats_b['p75']:.2e}")
     print(f"IQR:         {stats_b['iqr']:.2e}")
+    print(f"Skewness:    {stats_b['skewness']:.4f}")
+    print(f"Kurtosis:    {stats_b['kurtosis']:.4f} (excess)")
+    print_top_k(native_b)
     
     # Create figure
     fig = plt.figure(figsize=(18, 12))
@@ -0,0 +1,161 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+// Parallel LSD radix sort for 64-bit unsigned keys.
+//
+// Each pass handles one 8-bit digit:
+//   1. every thread builds a histogram of its static slice of the input
+//   2. histograms are prefix-summed (bucket-major, thread-minor) into
+//      per-thread scatter offsets, so the sort is stable
+//   3. every thread scatters its slice through per-bucket write-combining
+//      buffers that hold one cache line of keys, so each store to the
+//      destination array is a full 64-byte line instead of a single key
+//
+// Digits that are identical across all keys are detected up front and
+// skipped. For the Problem 5 data (values < 10^12 < 2^40) only 5 of the
+// 8 passes run.
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_WC_KEYS 8  // 8 x 8 bytes = one cache line per bucket buffer
+
+typedef struct {
+    unsigned long long keys[RADIX_BUCKETS][RADIX_WC_KEYS];
+} RadixWriteBuffer;
+
+// qsort() comparator, for callers' fallback when radix_sort_u64() fails
+static int radix_compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// OR of (key ^ data[0]) over all keys: a set bit means that bit varies
+static unsigned long long radix_varying_bits(const unsigned long long *data, long long n,
+                                             int num_threads) {
+    if (n == 0) return 0;
+    unsigned long long first = data[0];
+    unsigned long long diff = 0;
+
+    #pragma omp parallel for num_threads(num_threads) reduction(|:diff)
+    for (long long i = 0; i < n; i++) {
+        diff |= data[i] ^ first;
+    }
+    return diff;
+}
+
+static void radix_scatter_pass(const unsigned long long *src, unsigned long long *dst,
+                               long long n, int shift, int num_threads,
+                               long long (*offsets)[RADIX_BUCKETS], RadixWriteBuffer *buffers) {
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int tid = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+        long long begin = n * tid / nthreads;
+        long long end = n * (tid + 1) / nthreads;
+        long long *offset = offsets[tid];
+
+        // 1. Local histogram
+        long long count[RADIX_BUCKETS];
+        memset(count, 0, sizeof(count));
+        for (long long i = begin; i < end; i++) {
+            count[(src[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+        memcpy(offset, count, sizeof(count));
+
+        #pragma omp barrier
+
+        // 2. Prefix sum across (bucket, thread)
+        #pragma omp single
+        {
+            long long running = 0;
+            for (int b = 0; b < RADIX_BUCKETS; b++) {
+                for (int t = 0; t < nthreads; t++) {
+                    long long c = offsets[t][b];
+                    offsets[t][b] = running;
+                    running += c;
+                }
+            }
+        }
+
+        // 3. Scatter through write-combining buffers
+        RadixWriteBuffer *wc = &buffers[tid];
+        unsigned char fill[RADIX_BUCKETS];
+        memset(fill, 0, sizeof(fill));
+
+        for (long long i = begin; i < end; i++) {
+            unsigned long long key = src[i];
+            int b = (key >> shift) & (RADIX_BUCKETS - 1);
+            wc->keys[b][fill[b]++] = key;
+            if (fill[b] == RADIX_WC_KEYS) {
+                memcpy(&dst[offset[b]], wc->keys[b], sizeof(wc->keys[b]));
+                offset[b] += RADIX_WC_KEYS;
+                fill[b] = 0;
+            }
+        }
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            if (fill[b]) {
+                memcpy(&dst[offset[b]], wc->keys[b], fill[b] * sizeof(unsigned long long));
+                offset[b] += fill[b];
+            }
+        }
+    }
+}
+
+// Sorts data[0..n) ascending. scratch must hold n keys; pass NULL to have
+// one allocated for the duration of the call. Returns 0 on success, -1 if
+// the scratch or per-thread buffers cannot be allocated (data is left
+// untouched in that case).
+static int radix_sort_u64(unsigned long long *data, unsigned long long *scratch,
+                          long long n, int num_threads) {
+    if (n < 2) return 0;
+
+    unsigned long long varying = radix_varying_bits(data, n, num_threads);
+    if (varying == 0) return 0;
+
+    int owns_scratch = (scratch == NULL);
+    if (owns_scratch) {
+        scratch = malloc(n * sizeof(unsigned long long));
+        if (!scratch) return -1;
+    }
+
+    // Write-combining buffers, one per thread, allocated here so a failure
+    // reaches the caller instead of a thread of the parallel region
+    long long (*offsets)[RADIX_BUCKETS] = malloc(num_threads * sizeof(*offsets));
+    RadixWriteBuffer *buffers = aligned_alloc(64, num_threads * sizeof(RadixWriteBuffer));
+    if (!offsets || !buffers) {
+        free(offsets);
+        free(buffers);
+        if (owns_scratch) free(scratch);
+        return -1;
+    }
+
+    unsigned long long *src = data;
+    unsigned long long *dst = scratch;
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+        if (((varying >> shift) & (RADIX_BUCKETS - 1)) == 0) continue;
+
+        radix_scatter_pass(src, dst, n, shift, num_threads, offsets, buffers);
+        unsigned long long *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    // Odd number of passes: the sorted keys ended up in scratch
+    if (src != data) {
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (long long i = 0; i < n; i++) {
+            data[i] = src[i];
+        }
+    }
+
+    free(offsets);
+    free(buffers);
+    if (owns_scratch) free(scratch);
+    return 0;
+}
+
+#endif
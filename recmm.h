@@ -0,0 +1,266 @@
+#ifndef RECMM_H
+#define RECMM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "gemm.h"
+
+// Recursive (cache-oblivious) matrix multiply with OpenMP tasks, and an
+// optional Strassen-Winograd layer on top.
+//
+// The classical recursion splits C into quadrants (a dimension is only split
+// while it exceeds the leaf size, at a multiple of 8 near its middle, so odd
+// sizes are peeled into uneven halves). The four quadrants of C are
+// independent tasks; each does its two k-halves in turn. Once every
+// dimension fits the leaf size the block is multiplied by the packed GEMM
+// micro-kernel on one thread. Every level halves the working set, so some
+// level fits each cache without knowing its size, and the only parameter is
+// the leaf size.
+//
+// Strassen-Winograd replaces the 8 half-size products of a level by 7 and
+// 15 additions. Its levels need even dimensions, so a problem that is not a
+// multiple of 2^levels is zero-padded once at the top. Each level allocates
+// its temporaries (4 S, 4 T and 7 product blocks); if that fails the level
+// falls back to the classical recursion. The error grows by a modest factor
+// per level, so only the top levels use it.
+
+#define RECMM_SPLIT_ALIGN 8
+
+typedef struct {
+    int leaf;                 // blocks with every dimension <= leaf go to the micro-kernel
+    GemmConfig leaf_config;
+    double **work;            // gemm_dgemm_serial workspace per thread
+} RecMMPlan;
+
+// Split point of a dimension, or the whole dimension if it fits the leaf
+static inline int recmm_split(int x, int leaf) {
+    if (x <= leaf) return x;
+    return (x / 2 + RECMM_SPLIT_ALIGN - 1) / RECMM_SPLIT_ALIGN * RECMM_SPLIT_ALIGN;
+}
+
+// C += A * B by quadrant recursion (A is m x k, B is k x n)
+static void recmm_classical(const RecMMPlan *plan, int m, int n, int k,
+                            const double *A, long lda, const double *B, long ldb, double *C, long ldc) {
+    if (m <= plan->leaf && n <= plan->leaf && k <= plan->leaf) {
+        gemm_dgemm_serial(&plan->leaf_config, m, n, k, A, lda, B, ldb, C, ldc,
+                          plan->work[omp_get_thread_num()]);
+        return;
+    }
+    int ms[2] = {recmm_split(m, plan->leaf), 0};
+    int ns[2] = {recmm_split(n, plan->leaf), 0};
+    int ks[2] = {recmm_split(k, plan->leaf), 0};
+    ms[1] = m - ms[0];
+    ns[1] = n - ns[0];
+    ks[1] = k - ks[0];
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (ms[i] == 0 || ns[j] == 0) continue;
+            const double *a = &A[(long)(i ? ms[0] : 0) * lda];
+            const double *b = &B[j ? ns[0] : 0];
+            double *c = &C[(long)(i ? ms[0] : 0) * ldc + (j ? ns[0] : 0)];
+            int mi = ms[i], nj = ns[j];
+            #pragma omp task firstprivate(a, b, c, mi, nj)
+            {
+                recmm_classical(plan, mi, nj, ks[0], a, lda, b, ldb, c, ldc);
+                if (ks[1] > 0) {
+                    recmm_classical(plan, mi, nj, ks[1], a + ks[0], lda, b + (long)ks[0] * ldb, ldb, c, ldc);
+                }
+            }
+        }
+    }
+    #pragma omp taskwait
+}
+
+// out[0:rows, 0:cols] = x + sign * y
+static void recmm_add(int rows, int cols, const double *x, long ldx, const double *y, long ldy, double sign,
+                      double *out, long ldo) {
+    for (int i = 0; i < rows; i++) {
+        const double *xi = &x[(long)i * ldx], *yi = &y[(long)i * ldy];
+        double *oi = &out[(long)i * ldo];
+        for (int j = 0; j < cols; j++) oi[j] = xi[j] + sign * yi[j];
+    }
+}
+
+// C += A * B with `levels` Strassen-Winograd levels; m, n and k must be
+// divisible by 2^levels
+static void recmm_strassen(const RecMMPlan *plan, int levels, int m, int n, int k,
+                           const double *A, long lda, const double *B, long ldb, double *C, long ldc) {
+    int mh = m / 2, nh = n / 2, kh = k / 2;
+    size_t sa = (size_t)mh * kh, sb = (size_t)kh * nh, sc = (size_t)mh * nh;
+    double *temp = (levels > 0) ? calloc(4 * sa + 4 * sb + 7 * sc, sizeof(double)) : NULL;
+    if (!temp) {
+        recmm_classical(plan, m, n, k, A, lda, B, ldb, C, ldc);
+        return;
+    }
+
+    const double *A11 = A, *A12 = A + kh, *A21 = A + (long)mh * lda, *A22 = A21 + kh;
+    const double *B11 = B, *B12 = B + nh, *B21 = B + (long)kh * ldb, *B22 = B21 + nh;
+    double *S[4], *T[4], *M[7];
+    for (int i = 0; i < 4; i++) {
+        S[i] = temp + i * sa;
+        T[i] = temp + 4 * sa + i * sb;
+    }
+    for (int i = 0; i < 7; i++) M[i] = temp + 4 * sa + 4 * sb + i * sc;
+
+    // S1 = A21 + A22, S2 = S1 - A11, S3 = A11 - A21, S4 = A12 - S2
+    #pragma omp task
+    {
+        recmm_add(mh, kh, A21, lda, A22, lda, 1.0, S[0], kh);
+        recmm_add(mh, kh, S[0], kh, A11, lda, -1.0, S[1], kh);
+        recmm_add(mh, kh, A11, lda, A21, lda, -1.0, S[2], kh);
+        recmm_add(mh, kh, A12, lda, S[1], kh, -1.0, S[3], kh);
+    }
+    // T1 = B12 - B11, T2 = B22 - T1, T3 = B22 - B12, T4 = T2 - B21
+    #pragma omp task
+    {
+        recmm_add(kh, nh, B12, ldb, B11, ldb, -1.0, T[0], nh);
+        recmm_add(kh, nh, B22, ldb, T[0], nh, -1.0, T[1], nh);
+        recmm_add(kh, nh, B22, ldb, B12, ldb, -1.0, T[2], nh);
+        recmm_add(kh, nh, T[1], nh, B21, ldb, -1.0, T[3], nh);
+    }
+    #pragma omp taskwait
+
+    // M1 = A11 B11, M2 = A12 B21, M3 = S4 B22, M4 = A22 T4,
+    // M5 = S1 T1,   M6 = S2 T2,   M7 = S3 T3
+    const double *left[7] = {A11, A12, S[3], A22, S[0], S[1], S[2]};
+    const long left_ld[7] = {lda, lda, kh, lda, kh, kh, kh};
+    const double *right[7] = {B11, B21, B22, T[3], T[0], T[1], T[2]};
+    const long right_ld[7] = {ldb, ldb, ldb, nh, nh, nh, nh};
+    for (int p = 0; p < 7; p++) {
+        #pragma omp task firstprivate(p)
+        recmm_strassen(plan, levels - 1, mh, nh, kh, left[p], left_ld[p], right[p], right_ld[p], M[p], nh);
+    }
+    #pragma omp taskwait
+
+    // C11 += M1 + M2, C12 += M1 + M6 + M5 + M3,
+    // C21 += M1 + M6 + M7 - M4, C22 += M1 + M6 + M7 + M5
+    for (int q = 0; q < 4; q++) {
+        #pragma omp task firstprivate(q)
+        {
+            double *c = C + (long)((q & 2) ? mh : 0) * ldc + ((q & 1) ? nh : 0);
+            for (int i = 0; i < mh; i++) {
+                double *ci = &c[(long)i * ldc];
+                const double *m1 = &M[0][(size_t)i * nh], *m2 = &M[1][(size_t)i * nh];
+                const double *m3 = &M[2][(size_t)i * nh], *m4 = &M[3][(size_t)i * nh];
+                const double *m5 = &M[4][(size_t)i * nh], *m6 = &M[5][(size_t)i * nh];
+                const double *m7 = &M[6][(size_t)i * nh];
+                for (int j = 0; j < nh; j++) {
+                    double u2 = m1[j] + m6[j];
+                    switch (q) {
+                    case 0: ci[j] += m1[j] + m2[j]; break;
+                    case 1: ci[j] += u2 + m5[j] + m3[j]; break;
+                    case 2: ci[j] += u2 + m7[j] - m4[j]; break;
+                    default: ci[j] += u2 + m7[j] + m5[j]; break;
+                    }
+                }
+            }
+        }
+    }
+    #pragma omp taskwait
+    free(temp);
+}
+
+// Strassen levels actually used: no level may leave halves below the leaf
+static inline int recmm_strassen_levels(int m, int n, int k, int leaf, int levels) {
+    int min_dim = (m < n) ? m : n;
+    min_dim = (k < min_dim) ? k : min_dim;
+    while (levels > 0 && (min_dim >> levels) < leaf) levels--;
+    return levels;
+}
+
+// C[0:m, 0:n] += A[0:m, 0:k] * B[0:k, 0:n] (row-major), recursing down to
+// leaf-sized blocks with Strassen-Winograd on the top strassen_levels levels
+// (fewer if the halves would drop below the leaf size). Returns 0 on
+// success, -1 if the leaf or padding buffers cannot be allocated.
+static int recmm_multiply(int m, int n, int k, const double *A, long lda, const double *B, long ldb,
+                          double *C, long ldc, int leaf, int strassen_levels, int num_threads) {
+    if (m <= 0 || n <= 0 || k <= 0) return 0;
+    strassen_levels = recmm_strassen_levels(m, n, k, leaf, strassen_levels);
+
+    RecMMPlan plan;
+    plan.leaf = leaf;
+    plan.leaf_config = gemm_default_config();
+    plan.work = calloc(num_threads, sizeof(double *));
+    int status = plan.work ? 0 : -1;
+    size_t work_doubles = gemm_serial_workspace(&plan.leaf_config, leaf, leaf, leaf);
+    for (int t = 0; t < num_threads && status == 0; t++) {
+        plan.work[t] = aligned_alloc(GEMM_ALIGN, (work_doubles * sizeof(double) + GEMM_ALIGN - 1) /
+                                                 GEMM_ALIGN * GEMM_ALIGN);
+        if (!plan.work[t]) status = -1;
+    }
+
+    // Strassen levels need dimensions divisible by 2^levels: zero-pad
+    int unit = 1 << strassen_levels;
+    int mp = (m + unit - 1) / unit * unit, np = (n + unit - 1) / unit * unit, kp = (k + unit - 1) / unit * unit;
+    int padded = (mp != m || np != n || kp != k);
+    double *Ap = NULL, *Bp = NULL, *Cp = NULL;
+    if (status == 0 && padded) {
+        Ap = calloc((size_t)mp * kp, sizeof(double));
+        Bp = calloc((size_t)kp * np, sizeof(double));
+        Cp = calloc((size_t)mp * np, sizeof(double));
+        if (!Ap || !Bp || !Cp) status = -1;
+    }
+
+    if (status == 0) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            if (padded) {
+                #pragma omp for schedule(static)
+                for (int i = 0; i < m; i++) memcpy(&Ap[(long)i * kp], &A[(long)i * lda], k * sizeof(double));
+                #pragma omp for schedule(static)
+                for (int i = 0; i < k; i++) memcpy(&Bp[(long)i * np], &B[(long)i * ldb], n * sizeof(double));
+            }
+            #pragma omp single
+            {
+                if (padded) recmm_strassen(&plan, strassen_levels, mp, np, kp, Ap, kp, Bp, np, Cp, np);
+                else recmm_strassen(&plan, strassen_levels, m, n, k, A, lda, B, ldb, C, ldc);
+            }
+            if (padded) {
+                #pragma omp for schedule(static)
+                for (int i = 0; i < m; i++) {
+                    for (int j = 0; j < n; j++) C[(long)i * ldc + j] += Cp[(long)i * np + j];
+                }
+            }
+        }
+    }
+
+    free(Ap);
+    free(Bp);
+    free(Cp);
+    for (int t = 0; plan.work && t < num_threads; t++) free(plan.work[t]);
+    free(plan.work);
+    return status;
+}
+
+// Fastest leaf size among the candidates for the classical recursion on an
+// n x n multiply, or -1 if the matrices cannot be allocated
+static int recmm_tune_leaf(int n, int num_threads) {
+    const int leaves[] = {32, 64, 128, 256, 512};
+    double *A = gemm_alloc_matrix(n, n), *B = gemm_alloc_matrix(n, n), *C = gemm_alloc_matrix(n, n);
+    int best_leaf = -1;
+    if (A && B && C) {
+        for (long i = 0; i < (long)n * n; i++) {
+            A[i] = (double)(i % 97) / 97.0;
+            B[i] = (double)(i % 89) / 89.0;
+            C[i] = 0.0;
+        }
+        double best = 0.0;
+        for (int l = 0; l < (int)(sizeof(leaves) / sizeof(leaves[0])); l++) {
+            double start = omp_get_wtime();
+            if (recmm_multiply(n, n, n, A, n, B, n, C, n, leaves[l], 0, num_threads) != 0) continue;
+            double seconds = omp_get_wtime() - start;
+            if (best_leaf < 0 || seconds < best) {
+                best = seconds;
+                best_leaf = leaves[l];
+            }
+        }
+    }
+    free(A);
+    free(B);
+    free(C);
+    return best_leaf;
+}
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <limits.h>
+#include "rng.h"
+
+// Fused generate-and-reduce for bounded counter-based streams.
+//
+// Values are produced in vector registers (the same stream rng_bounded
+// gives, bit for bit) and folded straight into min/max/sum lanes, so
+// nothing is ever stored. Each kernel keeps several independent sets of
+// counters and accumulators so consecutive vectors do not wait on each
+// other: 2 for SSE4.2 and AVX2 (16 vector registers), 4 for AVX-512 (32).
+//
+// The SIMD kernels need range < 2^32: the high product word is then
+// x_hi * range + (x_lo * range >> 32), two 32 x 32 -> 64 multiplies, and
+// every value fits in the low half of its lane, so 32-bit unsigned min/max
+// (SSE4.1/AVX2) are exact on the 64-bit lanes. Larger ranges use the scalar
+// kernel. Rejected lanes (a few per 10^9 values) are patched in place.
+//
+// The total sum is kept in 128 bits. The SIMD lanes add in 64 bits, so
+// reduce_bounded hands them at most REDUCE_BLOCK values at a time: with
+// every value below 2^32, a block cannot carry out of its lanes, nor out of
+// their 64-bit horizontal add. The scalar kernel adds in 128 bits directly.
+
+#define REDUCE_BLOCK (1LL << 32)  // values per SIMD call
+
+typedef struct {
+    unsigned long long min;
+    unsigned long long max;
+    unsigned __int128 sum;
+    long long count;
+} ReduceResult;
+
+static inline void reduce_init(ReduceResult *r) {
+    r->min = ULLONG_MAX;
+    r->max = 0;
+    r->sum = 0;
+    r->count = 0;
+}
+
+static inline void reduce_combine(ReduceResult *dst, const ReduceResult *src) {
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->sum += src->sum;
+    dst->count += src->count;
+}
+
+static inline void reduce_lanes(ReduceResult *acc, const unsigned long long *min,
+                                const unsigned long long *max, const unsigned long long *sum,
+                                int lanes) {
+    for (int l = 0; l < lanes; l++) {
+        if (min[l] < acc->min) acc->min = min[l];
+        if (max[l] > acc->max) acc->max = max[l];
+        acc->sum += sum[l];
+    }
+}
+
+static inline void reduce_bounded_scalar(unsigned long long key, unsigned long long first, long long count,
+                                         const RngRange *r, ReduceResult *acc) {
+    unsigned long long min = acc->min, max = acc->max;
+    unsigned __int128 sum = 0;  // values may reach 2^64 - 1 here
+    for (long long i = 0; i < count; i++) {
+        unsigned long long v = rng_bounded(key, first + i, r);
+        min = (v < min) ? v : min;
+        max = (v > max) ? v : max;
+        sum += v;
+    }
+    acc->min = min;
+    acc->max = max;
+    acc->sum += sum;
+    acc->count += count;
+}
+
+#ifdef RNG_X86
+
+// ---- SSE4.2: 2 lanes; 64-bit compares for rejection, 32-bit min/max ----
+
+__attribute__((target("sse4.2")))
+static inline __m128i reduce_mullo64_sse(__m128i a, __m128i b) {
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i reduce_bounded_sse(__m128i z, __m128i range, __m128i threshold, int *reject) {
+    __m128i sign = _mm_set1_epi64x((long long)0x8000000000000000ULL);
+    z = _mm_xor_si128(z, _mm_srli_epi64(z, 30));
+    z = reduce_mullo64_sse(z, _mm_set1_epi64x((long long)0xBF58476D1CE4E5B9ULL));
+    z = _mm_xor_si128(z, _mm_srli_epi64(z, 27));
+    z = reduce_mullo64_sse(z, _mm_set1_epi64x((long long)0x94D049BB133111EBULL));
+    __m128i x = _mm_xor_si128(z, _mm_srli_epi64(z, 31));
+
+    __m128i p0 = _mm_mul_epu32(x, range);
+    __m128i mid = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), range), _mm_srli_epi64(p0, 32));
+    __m128i lo = _mm_or_si128(_mm_slli_epi64(mid, 32), _mm_and_si128(p0, _mm_set1_epi64x(0xFFFFFFFFLL)));
+    *reject = _mm_movemask_pd(_mm_castsi128_pd(
+        _mm_cmpgt_epi64(_mm_xor_si128(threshold, sign), _mm_xor_si128(lo, sign))));
+    return _mm_srli_epi64(mid, 32);
+}
+
+__attribute__((target("sse4.2")))
+static inline __m128i reduce_patch_sse(__m128i v, int mask, unsigned long long key,
+                                       unsigned long long index, const RngRange *r) {
+    unsigned long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    for (; mask; mask &= mask - 1) {
+        int lane = __builtin_ctz(mask);
+        lanes[lane] = rng_bounded_retry(key, index + lane, r);
+    }
+    return _mm_loadu_si128((const __m128i *)lanes);
+}
+
+__attribute__((target("sse4.2")))
+static inline void reduce_bounded_sse42(unsigned long long key, unsigned long long first, long long count,
+                                        const RngRange *r, ReduceResult *acc) {
+    __m128i z0 = _mm_add_epi64(_mm_set1_epi64x((long long)(key + (first + 1) * RNG_GAMMA)),
+                               _mm_set_epi64x((long long)RNG_GAMMA, 0));
+    __m128i z1 = _mm_add_epi64(z0, _mm_set1_epi64x((long long)(2 * RNG_GAMMA)));
+    __m128i step = _mm_set1_epi64x((long long)(4 * RNG_GAMMA));
+    __m128i range = _mm_set1_epi64x((long long)r->range);
+    __m128i threshold = _mm_set1_epi64x((long long)r->threshold);
+    __m128i min0 = _mm_set1_epi64x(0xFFFFFFFFLL), min1 = min0;
+    __m128i max0 = _mm_setzero_si128(), max1 = max0;
+    __m128i sum0 = _mm_setzero_si128(), sum1 = sum0;
+
+    long long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int reject0, reject1;
+        __m128i v0 = reduce_bounded_sse(z0, range, threshold, &reject0);
+        __m128i v1 = reduce_bounded_sse(z1, range, threshold, &reject1);
+        if (__builtin_expect(reject0 | reject1, 0)) {
+            v0 = reduce_patch_sse(v0, reject0, key, first + i, r);
+            v1 = reduce_patch_sse(v1, reject1, key, first + i + 2, r);
+        }
+        min0 = _mm_min_epu32(min0, v0);
+        min1 = _mm_min_epu32(min1, v1);
+        max0 = _mm_max_epu32(max0, v0);
+        max1 = _mm_max_epu32(max1, v1);
+        sum0 = _mm_add_epi64(sum0, v0);
+        sum1 = _mm_add_epi64(sum1, v1);
+        z0 = _mm_add_epi64(z0, step);
+        z1 = _mm_add_epi64(z1, step);
+    }
+
+    unsigned long long min[2], max[2], sum[2];
+    _mm_storeu_si128((__m128i *)min, _mm_min_epu32(min0, min1));
+    _mm_storeu_si128((__m128i *)max, _mm_max_epu32(max0, max1));
+    _mm_storeu_si128((__m128i *)sum, _mm_add_epi64(sum0, sum1));
+    if (i > 0) {
+        reduce_lanes(acc, min, max, sum, 2);
+        acc->count += i;
+    }
+    reduce_bounded_scalar(key, first + i, count - i, r, acc);
+}
+
+// ---- AVX2: 4 lanes, same scheme as SSE4.2 ----
+
+__attribute__((target("avx2")))
+static inline __m256i reduce_bounded_avx2_vec(__m256i z, __m256i range, __m256i threshold, int *reject) {
+    __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    __m256i x = rng_mix_avx2(z);
+    __m256i p0 = _mm256_mul_epu32(x, range);
+    __m256i mid = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), range),
+                                   _mm256_srli_epi64(p0, 32));
+    __m256i lo = _mm256_or_si256(_mm256_slli_epi64(mid, 32),
+                                 _mm256_and_si256(p0, _mm256_set1_epi64x(0xFFFFFFFFLL)));
+    *reject = _mm256_movemask_pd(_mm256_castsi256_pd(
+        _mm256_cmpgt_epi64(_mm256_xor_si256(threshold, sign), _mm256_xor_si256(lo, sign))));
+    return _mm256_srli_epi64(mid, 32);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i reduce_patch_avx2(__m256i v, int mask, unsigned long long key,
+                                        unsigned long long index, const RngRange *r) {
+    unsigned long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    for (; mask; mask &= mask - 1) {
+        int lane = __builtin_ctz(mask);
+        lanes[lane] = rng_bounded_retry(key, index + lane, r);
+    }
+    return _mm256_loadu_si256((const __m256i *)lanes);
+}
+
+__attribute__((target("avx2")))
+static inline void reduce_bounded_avx2(unsigned long long key, unsigned long long first, long long count,
+                                       const RngRange *r, ReduceResult *acc) {
+    __m256i z0 = _mm256_add_epi64(
+        _mm256_set1_epi64x((long long)(key + (first + 1) * RNG_GAMMA)),
+        _mm256_setr_epi64x(0, (long long)RNG_GAMMA, (long long)(2 * RNG_GAMMA), (long long)(3 * RNG_GAMMA)));
+    __m256i z1 = _mm256_add_epi64(z0, _mm256_set1_epi64x((long long)(4 * RNG_GAMMA)));
+    __m256i step = _mm256_set1_epi64x((long long)(8 * RNG_GAMMA));
+    __m256i range = _mm256_set1_epi64x((long long)r->range);
+    __m256i threshold = _mm256_set1_epi64x((long long)r->threshold);
+    __m256i min0 = _mm256_set1_epi64x(0xFFFFFFFFLL), min1 = min0;
+    __m256i max0 = _mm256_setzero_si256(), max1 = max0;
+    __m256i sum0 = _mm256_setzero_si256(), sum1 = sum0;
+
+    long long i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int reject0, reject1;
+        __m256i v0 = reduce_bounded_avx2_vec(z0, range, threshold, &reject0);
+        __m256i v1 = reduce_bounded_avx2_vec(z1, range, threshold, &reject1);
+        if (__builtin_expect(reject0 | reject1, 0)) {
+            v0 = reduce_patch_avx2(v0, reject0, key, first + i, r);
+            v1 = reduce_patch_avx2(v1, reject1, key, first + i + 4, r);
+        }
+        min0 = _mm256_min_epu32(min0, v0);
+        min1 = _mm256_min_epu32(min1, v1);
+        max0 = _mm256_max_epu32(max0, v0);
+        max1 = _mm256_max_epu32(max1, v1);
+        sum0 = _mm256_add_epi64(sum0, v0);
+        sum1 = _mm256_add_epi64(sum1, v1);
+        z0 = _mm256_add_epi64(z0, step);
+        z1 = _mm256_add_epi64(z1, step);
+    }
+
+    unsigned long long min[4], max[4], sum[4];
+    _mm256_storeu_si256((__m256i *)min, _mm256_min_epu32(min0, min1));
+    _mm256_storeu_si256((__m256i *)max, _mm256_max_epu32(max0, max1));
+    _mm256_storeu_si256((__m256i *)sum, _mm256_add_epi64(sum0, sum1));
+    if (i > 0) {
+        reduce_lanes(acc, min, max, sum, 4);
+        acc->count += i;
+    }
+    reduce_bounded_scalar(key, first + i, count - i, r, acc);
+}
+
+// ---- AVX-512: 8 lanes, 4 accumulator sets, mask compares ----
+
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i reduce_bounded_avx512_vec(__m512i z, __m512i range, __m512i threshold,
+                                                __mmask8 *reject) {
+    __m512i x = rng_mix_avx512(z);
+    __m512i p0 = _mm512_mul_epu32(x, range);
+    __m512i mid = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(x, 32), range),
+                                   _mm512_srli_epi64(p0, 32));
+    // Low product word, compared against the threshold for rejection
+    *reject = _mm512_cmplt_epu64_mask(_mm512_mullo_epi64(x, range), threshold);
+    return _mm512_srli_epi64(mid, 32);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i reduce_patch_avx512(__m512i v, __mmask8 mask, unsigned long long key,
+                                          unsigned long long index, const RngRange *r) {
+    unsigned long long lanes[8];
+    _mm512_storeu_si512(lanes, v);
+    for (unsigned m = mask; m; m &= m - 1) {
+        int lane = __builtin_ctz(m);
+        lanes[lane] = rng_bounded_retry(key, index + lane, r);
+    }
+    return _mm512_loadu_si512(lanes);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline void reduce_bounded_avx512(unsigned long long key, unsigned long long first, long long count,
+                                         const RngRange *r, ReduceResult *acc) {
+    __m512i z[4], min[4], max[4], sum[4];
+    z[0] = _mm512_add_epi64(_mm512_set1_epi64((long long)(key + (first + 1) * RNG_GAMMA)),
+                            _mm512_mullo_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7),
+                                               _mm512_set1_epi64((long long)RNG_GAMMA)));
+    for (int u = 0; u < 4; u++) {
+        if (u > 0) z[u] = _mm512_add_epi64(z[u - 1], _mm512_set1_epi64((long long)(8 * RNG_GAMMA)));
+        min[u] = _mm512_set1_epi64(-1LL);
+        max[u] = _mm512_setzero_si512();
+        sum[u] = _mm512_setzero_si512();
+    }
+    __m512i step = _mm512_set1_epi64((long long)(32 * RNG_GAMMA));
+    __m512i range = _mm512_set1_epi64((long long)r->range);
+    __m512i threshold = _mm512_set1_epi64((long long)r->threshold);
+
+    long long i = 0;
+    for (; i + 32 <= count; i += 32) {
+        for (int u = 0; u < 4; u++) {
+            __mmask8 reject;
+            __m512i v = reduce_bounded_avx512_vec(z[u], range, threshold, &reject);
+            if (__builtin_expect(reject, 0)) v = reduce_patch_avx512(v, reject, key, first + i + 8 * u, r);
+            min[u] = _mm512_min_epu64(min[u], v);
+            max[u] = _mm512_max_epu64(max[u], v);
+            sum[u] = _mm512_add_epi64(sum[u], v);
+            z[u] = _mm512_add_epi64(z[u], step);
+        }
+    }
+
+    __m512i mn = _mm512_min_epu64(_mm512_min_epu64(min[0], min[1]), _mm512_min_epu64(min[2], min[3]));
+    __m512i mx = _mm512_max_epu64(_mm512_max_epu64(max[0], max[1]), _mm512_max_epu64(max[2], max[3]));
+    __m512i sm = _mm512_add_epi64(_mm512_add_epi64(sum[0], sum[1]), _mm512_add_epi64(sum[2], sum[3]));
+    if (i > 0) {
+        if (_mm512_reduce_min_epu64(mn) < acc->min) acc->min = _mm512_reduce_min_epu64(mn);
+        if (_mm512_reduce_max_epu64(mx) > acc->max) acc->max = _mm512_reduce_max_epu64(mx);
+        acc->sum += (unsigned long long)_mm512_reduce_add_epi64(sm);
+        acc->count += i;
+    }
+    reduce_bounded_scalar(key, first + i, count - i, r, acc);
+}
+
+#endif
+
+// Folds values [first, first + count) of the bounded stream (key, r) into
+// acc using the given instruction set level (falls back to the widest
+// supported level below it, and to scalar for ranges of 2^32 and up).
+static inline void reduce_bounded(unsigned long long key, unsigned long long first, long long count,
+                                  const RngRange *r, RngIsa isa, ReduceResult *acc) {
+    if (isa > rng_cpu_isa()) isa = rng_cpu_isa();
+    if (r->range >= (1ULL << 32)) isa = RNG_ISA_SCALAR;
+#ifdef RNG_X86
+    if (isa != RNG_ISA_SCALAR) {
+        for (long long done = 0; done < count; done += REDUCE_BLOCK) {
+            long long block = count - done < REDUCE_BLOCK ? count - done : REDUCE_BLOCK;
+            switch (isa) {
+            case RNG_ISA_AVX512: reduce_bounded_avx512(key, first + done, block, r, acc); break;
+            case RNG_ISA_AVX2: reduce_bounded_avx2(key, first + done, block, r, acc); break;
+            default: reduce_bounded_sse42(key, first + done, block, r, acc); break;
+            }
+        }
+        return;
+    }
+#endif
+    reduce_bounded_scalar(key, first, count, r, acc);
+}
+
+#endif
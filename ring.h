@@ -0,0 +1,191 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// Bounded lock-free rings of pointers.
+//
+// SpscRing: one producer, one consumer. Each side owns one index on its own
+// cache line and keeps a cached copy of the other side's index, so it only
+// touches the shared line when the ring looks full (producer) or empty
+// (consumer). Push publishes with a release store that the consumer's
+// acquire load pairs with.
+//
+// MpmcRing: any number of producers and consumers (Vyukov's bounded queue).
+// Every cell carries a sequence number: a cell at position pos is free for
+// the producer claiming pos when seq == pos, and holds data for the
+// consumer claiming pos when seq == pos + 1. Positions are claimed with a
+// CAS on the shared enqueue/dequeue counter, and the cell's sequence is
+// released after the data is written or read.
+//
+// Ring wraps either kind behind ring_push/ring_pop so callers can switch
+// with a flag. Capacities are rounded up to a power of two. Push and pop
+// never block: they return -1 when the ring is full or empty, and the
+// caller waits with ring_backoff().
+
+#define RING_CACHE_LINE 64
+#define RING_SPIN_LIMIT 64   // pause iterations before yielding the CPU
+
+typedef enum { RING_SPSC, RING_MPMC } RingKind;
+
+typedef struct {
+    _Alignas(RING_CACHE_LINE) atomic_size_t head;   // next slot to write; producer
+    size_t cached_tail;
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail;   // next slot to read; consumer
+    size_t cached_head;
+    _Alignas(RING_CACHE_LINE) size_t mask;
+    void **slots;
+} SpscRing;
+
+typedef struct {
+    atomic_size_t seq;
+    void *data;
+} MpmcCell;
+
+typedef struct {
+    _Alignas(RING_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(RING_CACHE_LINE) atomic_size_t dequeue_pos;
+    _Alignas(RING_CACHE_LINE) size_t mask;
+    MpmcCell *cells;
+} MpmcRing;
+
+typedef struct {
+    RingKind kind;
+    SpscRing spsc;
+    MpmcRing mpmc;
+} Ring;
+
+static inline size_t ring_round_capacity(size_t capacity) {
+    size_t c = 2;
+    while (c < capacity) c <<= 1;
+    return c;
+}
+
+static int spsc_init(SpscRing *r, size_t capacity) {
+    capacity = ring_round_capacity(capacity);
+    r->slots = calloc(capacity, sizeof(void *));
+    if (!r->slots) return -1;
+    r->mask = capacity - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->cached_head = r->cached_tail = 0;
+    return 0;
+}
+
+static inline int spsc_push(SpscRing *r, void *item) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - r->cached_tail > r->mask) {
+        r->cached_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - r->cached_tail > r->mask) return -1;
+    }
+    r->slots[head & r->mask] = item;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+static inline int spsc_pop(SpscRing *r, void **item) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail == r->cached_head) {
+        r->cached_head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail == r->cached_head) return -1;
+    }
+    *item = r->slots[tail & r->mask];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+static int mpmc_init(MpmcRing *r, size_t capacity) {
+    capacity = ring_round_capacity(capacity);
+    r->cells = malloc(capacity * sizeof(MpmcCell));
+    if (!r->cells) return -1;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&r->cells[i].seq, i);
+        r->cells[i].data = NULL;
+    }
+    r->mask = capacity - 1;
+    atomic_init(&r->enqueue_pos, 0);
+    atomic_init(&r->dequeue_pos, 0);
+    return 0;
+}
+
+static inline int mpmc_push(MpmcRing *r, void *item) {
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    MpmcCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return -1;   // full
+        } else {
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    cell->data = item;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static inline int mpmc_pop(MpmcRing *r, void **item) {
+    size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    MpmcCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return -1;   // empty
+        } else {
+            pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    *item = cell->data;
+    atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+    return 0;
+}
+
+static inline int ring_init(Ring *r, RingKind kind, size_t capacity) {
+    r->kind = kind;
+    r->spsc.slots = NULL;
+    r->mpmc.cells = NULL;
+    return kind == RING_SPSC ? spsc_init(&r->spsc, capacity) : mpmc_init(&r->mpmc, capacity);
+}
+
+static inline void ring_free(Ring *r) {
+    free(r->spsc.slots);
+    free(r->mpmc.cells);
+    r->spsc.slots = NULL;
+    r->mpmc.cells = NULL;
+}
+
+static inline int ring_push(Ring *r, void *item) {
+    return r->kind == RING_SPSC ? spsc_push(&r->spsc, item) : mpmc_push(&r->mpmc, item);
+}
+
+static inline int ring_pop(Ring *r, void **item) {
+    return r->kind == RING_SPSC ? spsc_pop(&r->spsc, item) : mpmc_pop(&r->mpmc, item);
+}
+
+// Waits a little longer on every call: CPU pauses first, then yields, so
+// oversubscribed producers and consumers still make progress
+static inline void ring_backoff(unsigned *spins) {
+    if (*spins < RING_SPIN_LIMIT) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        (*spins)++;
+    } else {
+        sched_yield();
+    }
+}
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RNG_X86 1
+#endif
+
+// Counter-based random numbers shared by every generator.
+//
+// Value i of a stream is a pure function of (key, i): the splitmix64
+// finalizer applied to key + (i + 1) * golden gamma, which is exactly the
+// i-th output of a splitmix64 generator seeded with key. Nothing is carried
+// from one value to the next, so any thread can produce any slice of a
+// stream and the data is identical for every thread count and schedule.
+// That also makes the fill loops trivially vectorizable: AVX2 and AVX-512
+// kernels (selected at runtime) produce 4 or 8 values per step.
+//
+// Bounded values use Lemire's multiply-shift: the high 64 bits of x * range
+// are uniform on [0, range) except for a tiny band of x, detected from the
+// low 64 bits and rejected. A rejected value i is redrawn from a derived
+// retry stream at the same index, so rejection stays deterministic as well.
+// The rejection threshold is the only division and is computed once per
+// range (RngRange). For every range used here rejection is rarer than one
+// value in 10^7.
+
+#define RNG_GAMMA 0x9E3779B97F4A7C15ULL
+#define RNG_RETRY_GAMMA 0xD1B54A32D192ED03ULL
+#define RNG_BLOCK 2048  // values per batch fill in the generators
+
+typedef struct {
+    unsigned long long range;
+    unsigned long long threshold;  // low product words below this are rejected
+} RngRange;
+
+// Instruction set levels in increasing order. The fills have no SSE4.2
+// kernel (they use scalar code there); fused kernels elsewhere do.
+typedef enum { RNG_ISA_SCALAR, RNG_ISA_SSE42, RNG_ISA_AVX2, RNG_ISA_AVX512, RNG_ISA_COUNT } RngIsa;
+
+static inline unsigned long long rng_mix(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Key of an independent stream: use one per seed and per logical sequence
+// (e.g. the two vectors of a dot product)
+static inline unsigned long long rng_key(unsigned long long seed, unsigned long long stream) {
+    return rng_mix(rng_mix(seed) ^ (stream * RNG_RETRY_GAMMA + RNG_GAMMA));
+}
+
+static inline unsigned long long rng_u64(unsigned long long key, unsigned long long index) {
+    return rng_mix(key + (index + 1) * RNG_GAMMA);
+}
+
+static inline RngRange rng_range(unsigned long long range) {
+    RngRange r;
+    r.range = range;
+    r.threshold = range ? (0 - range) % range : 0;
+    return r;
+}
+
+static __attribute__((noinline, unused)) unsigned long long
+rng_bounded_retry(unsigned long long key, unsigned long long index, const RngRange *r) {
+    for (unsigned long long attempt = 1;; attempt++) {
+        unsigned long long x = rng_u64(rng_mix(key + attempt * RNG_RETRY_GAMMA), index);
+        unsigned __int128 m = (unsigned __int128)x * r->range;
+        if ((unsigned long long)m >= r->threshold) return (unsigned long long)(m >> 64);
+    }
+}
+
+// Uniform on [0, r->range)
+static inline unsigned long long rng_bounded(unsigned long long key, unsigned long long index,
+                                             const RngRange *r) {
+    unsigned __int128 m = (unsigned __int128)rng_u64(key, index) * r->range;
+    if (__builtin_expect((unsigned long long)m < r->threshold, 0)) {
+        return rng_bounded_retry(key, index, r);
+    }
+    return (unsigned long long)(m >> 64);
+}
+
+// Uniform on [0, 1) with 52 random mantissa bits: the top 52 bits of x are
+// placed under the exponent of 1.0 and 1.0 is subtracted, which every
+// kernel can do with integer ops
+static inline double rng_unit(unsigned long long key, unsigned long long index) {
+    unsigned long long bits = 0x3FF0000000000000ULL | (rng_u64(key, index) >> 12);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d - 1.0;
+}
+
+static inline void rng_fill_bounded_scalar(unsigned long long key, unsigned long long first, long long count,
+                                           const RngRange *r, unsigned long long *out) {
+    for (long long i = 0; i < count; i++) out[i] = rng_bounded(key, first + i, r);
+}
+
+static inline void rng_fill_unit_scalar(unsigned long long key, unsigned long long first, long long count,
+                                        double *out) {
+    for (long long i = 0; i < count; i++) out[i] = rng_unit(key, first + i);
+}
+
+#ifdef RNG_X86
+
+// ---- AVX2: 4 lanes, 64-bit multiplies built from 32 x 32 -> 64 products ----
+
+__attribute__((target("avx2")))
+static inline __m256i rng_mullo64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rng_mix_avx2(__m256i z) {
+    z = _mm256_xor_si256(z, _mm256_srli_epi64(z, 30));
+    z = rng_mullo64_avx2(z, _mm256_set1_epi64x((long long)0xBF58476D1CE4E5B9ULL));
+    z = _mm256_xor_si256(z, _mm256_srli_epi64(z, 27));
+    z = rng_mullo64_avx2(z, _mm256_set1_epi64x((long long)0x94D049BB133111EBULL));
+    return _mm256_xor_si256(z, _mm256_srli_epi64(z, 31));
+}
+
+// Full 64 x 64 -> 128 product of x and a broadcast range, as (hi, lo)
+__attribute__((target("avx2")))
+static inline __m256i rng_mul128_avx2(__m256i x, __m256i rl, __m256i rh, __m256i *lo) {
+    __m256i mask32 = _mm256_set1_epi64x(0xFFFFFFFFLL);
+    __m256i xh = _mm256_srli_epi64(x, 32);
+    __m256i p0 = _mm256_mul_epu32(x, rl);
+    __m256i p1 = _mm256_mul_epu32(x, rh);
+    __m256i p2 = _mm256_mul_epu32(xh, rl);
+    __m256i p3 = _mm256_mul_epu32(xh, rh);
+    __m256i mid = _mm256_add_epi64(_mm256_add_epi64(_mm256_srli_epi64(p0, 32),
+                                                    _mm256_and_si256(p1, mask32)),
+                                   _mm256_and_si256(p2, mask32));
+    *lo = _mm256_or_si256(_mm256_slli_epi64(mid, 32), _mm256_and_si256(p0, mask32));
+    return _mm256_add_epi64(_mm256_add_epi64(p3, _mm256_srli_epi64(mid, 32)),
+                            _mm256_add_epi64(_mm256_srli_epi64(p1, 32), _mm256_srli_epi64(p2, 32)));
+}
+
+__attribute__((target("avx2")))
+static inline void rng_fill_bounded_avx2(unsigned long long key, unsigned long long first, long long count,
+                                         const RngRange *r, unsigned long long *out) {
+    __m256i z = _mm256_add_epi64(
+        _mm256_set1_epi64x((long long)(key + (first + 1) * RNG_GAMMA)),
+        _mm256_setr_epi64x(0, (long long)RNG_GAMMA, (long long)(2 * RNG_GAMMA), (long long)(3 * RNG_GAMMA)));
+    __m256i step = _mm256_set1_epi64x((long long)(4 * RNG_GAMMA));
+    __m256i rl = _mm256_set1_epi64x((long long)(r->range & 0xFFFFFFFFULL));
+    __m256i rh = _mm256_set1_epi64x((long long)(r->range >> 32));
+    __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    __m256i threshold = _mm256_xor_si256(_mm256_set1_epi64x((long long)r->threshold), sign);
+
+    long long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i lo;
+        __m256i hi = rng_mul128_avx2(rng_mix_avx2(z), rl, rh, &lo);
+        _mm256_storeu_si256((__m256i *)&out[i], hi);
+        // Unsigned lo < threshold, via signed compare with flipped sign bits
+        __m256i reject = _mm256_cmpgt_epi64(threshold, _mm256_xor_si256(lo, sign));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(reject));
+        while (__builtin_expect(mask, 0)) {
+            int lane = __builtin_ctz(mask);
+            out[i + lane] = rng_bounded_retry(key, first + i + lane, r);
+            mask &= mask - 1;
+        }
+        z = _mm256_add_epi64(z, step);
+    }
+    rng_fill_bounded_scalar(key, first + i, count - i, r, out + i);
+}
+
+__attribute__((target("avx2")))
+static inline void rng_fill_unit_avx2(unsigned long long key, unsigned long long first, long long count,
+                                      double *out) {
+    __m256i z = _mm256_add_epi64(
+        _mm256_set1_epi64x((long long)(key + (first + 1) * RNG_GAMMA)),
+        _mm256_setr_epi64x(0, (long long)RNG_GAMMA, (long long)(2 * RNG_GAMMA), (long long)(3 * RNG_GAMMA)));
+    __m256i step = _mm256_set1_epi64x((long long)(4 * RNG_GAMMA));
+    __m256i one = _mm256_set1_epi64x(0x3FF0000000000000LL);
+    __m256d one_d = _mm256_set1_pd(1.0);
+
+    long long i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i bits = _mm256_or_si256(one, _mm256_srli_epi64(rng_mix_avx2(z), 12));
+        _mm256_storeu_pd(&out[i], _mm256_sub_pd(_mm256_castsi256_pd(bits), one_d));
+        z = _mm256_add_epi64(z, step);
+    }
+    rng_fill_unit_scalar(key, first + i, count - i, out + i);
+}
+
+// ---- AVX-512: 8 lanes, native 64-bit multiply (DQ) and unsigned compares ----
+
+__attribute__((target("avx512f,avx512dq")))
+static inline __m512i rng_mix_avx512(__m512i z) {
+    z = _mm512_xor_si512(z, _mm512_srli_epi64(z, 30));
+    z = _mm512_mullo_epi64(z, _mm512_set1_epi64((long long)0xBF58476D1CE4E5B9ULL));
+    z = _mm512_xor_si512(z, _mm512_srli_epi64(z, 27));
+    z = _mm512_mullo_epi64(z, _mm512_set1_epi64((long long)0x94D049BB133111EBULL));
+    return _mm512_xor_si512(z, _mm512_srli_epi64(z, 31));
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline void rng_fill_bounded_avx512(unsigned long long key, unsigned long long first, long long count,
+                                           const RngRange *r, unsigned long long *out) {
+    __m512i z = _mm512_add_epi64(
+        _mm512_set1_epi64((long long)(key + (first + 1) * RNG_GAMMA)),
+        _mm512_mullo_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7),
+                           _mm512_set1_epi64((long long)RNG_GAMMA)));
+    __m512i step = _mm512_set1_epi64((long long)(8 * RNG_GAMMA));
+    __m512i mask32 = _mm512_set1_epi64(0xFFFFFFFFLL);
+    __m512i rl = _mm512_set1_epi64((long long)(r->range & 0xFFFFFFFFULL));
+    __m512i rh = _mm512_set1_epi64((long long)(r->range >> 32));
+    __m512i threshold = _mm512_set1_epi64((long long)r->threshold);
+
+    long long i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i x = rng_mix_avx512(z);
+        __m512i xh = _mm512_srli_epi64(x, 32);
+        __m512i p0 = _mm512_mul_epu32(x, rl);
+        __m512i p1 = _mm512_mul_epu32(x, rh);
+        __m512i p2 = _mm512_mul_epu32(xh, rl);
+        __m512i p3 = _mm512_mul_epu32(xh, rh);
+        __m512i mid = _mm512_add_epi64(_mm512_add_epi64(_mm512_srli_epi64(p0, 32),
+                                                        _mm512_and_si512(p1, mask32)),
+                                       _mm512_and_si512(p2, mask32));
+        __m512i lo = _mm512_mullo_epi64(x, _mm512_set1_epi64((long long)r->range));
+        __m512i hi = _mm512_add_epi64(_mm512_add_epi64(p3, _mm512_srli_epi64(mid, 32)),
+                                      _mm512_add_epi64(_mm512_srli_epi64(p1, 32),
+                                                       _mm512_srli_epi64(p2, 32)));
+        _mm512_storeu_si512(&out[i], hi);
+        __mmask8 mask = _mm512_cmplt_epu64_mask(lo, threshold);
+        while (__builtin_expect(mask, 0)) {
+            int lane = __builtin_ctz(mask);
+            out[i + lane] = rng_bounded_retry(key, first + i + lane, r);
+            mask &= mask - 1;
+        }
+        z = _mm512_add_epi64(z, step);
+    }
+    rng_fill_bounded_scalar(key, first + i, count - i, r, out + i);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static inline void rng_fill_unit_avx512(unsigned long long key, unsigned long long first, long long count,
+                                        double *out) {
+    __m512i z = _mm512_add_epi64(
+        _mm512_set1_epi64((long long)(key + (first + 1) * RNG_GAMMA)),
+        _mm512_mullo_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7),
+                           _mm512_set1_epi64((long long)RNG_GAMMA)));
+    __m512i step = _mm512_set1_epi64((long long)(8 * RNG_GAMMA));
+    __m512i one = _mm512_set1_epi64(0x3FF0000000000000LL);
+    __m512d one_d = _mm512_set1_pd(1.0);
+
+    long long i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m512i bits = _mm512_or_si512(one, _mm512_srli_epi64(rng_mix_avx512(z), 12));
+        _mm512_storeu_pd(&out[i], _mm512_sub_pd(_mm512_castsi512_pd(bits), one_d));
+        z = _mm512_add_epi64(z, step);
+    }
+    rng_fill_unit_scalar(key, first + i, count - i, out + i);
+}
+
+#endif
+
+static const char *const rng_isa_names[RNG_ISA_COUNT] = {"scalar", "sse42", "avx2", "avx512"};
+
+// Widest level the CPU supports
+static inline RngIsa rng_cpu_isa(void) {
+    static int cached = -1;
+    if (cached >= 0) return (RngIsa)cached;
+
+    RngIsa isa = RNG_ISA_SCALAR;
+#ifdef RNG_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        isa = RNG_ISA_AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        isa = RNG_ISA_AVX2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        isa = RNG_ISA_SSE42;
+    }
+#endif
+    cached = isa;
+    return isa;
+}
+
+// Level name to RngIsa, or -1 if unknown
+static inline int rng_isa_parse(const char *name) {
+    for (int isa = 0; isa < RNG_ISA_COUNT; isa++) {
+        if (strcmp(name, rng_isa_names[isa]) == 0) return isa;
+    }
+    return -1;
+}
+
+// Level used by the dispatching kernels: the CPU's widest, capped by
+// RNG_ISA=scalar|sse42|avx2|avx512 in the environment (for comparisons).
+// The output is the same at every level.
+static inline RngIsa rng_isa(void) {
+    static int cached = -1;
+    if (cached >= 0) return (RngIsa)cached;
+
+    RngIsa isa = rng_cpu_isa();
+    const char *cap = getenv("RNG_ISA");
+    int requested = cap ? rng_isa_parse(cap) : -1;
+    if (requested >= 0 && requested < (int)isa) isa = (RngIsa)requested;
+    cached = isa;
+    return isa;
+}
+
+static inline const char *rng_isa_name(void) {
+    return rng_isa_names[rng_isa()];
+}
+
+// out[i] = rng_bounded(key, first + i, r) for i in [0, count)
+static inline void rng_fill_bounded(unsigned long long key, unsigned long long first, long long count,
+                                    const RngRange *r, unsigned long long *out) {
+#ifdef RNG_X86
+    switch (rng_isa()) {
+    case RNG_ISA_AVX512: rng_fill_bounded_avx512(key, first, count, r, out); return;
+    case RNG_ISA_AVX2: rng_fill_bounded_avx2(key, first, count, r, out); return;
+    default: break;
+    }
+#endif
+    rng_fill_bounded_scalar(key, first, count, r, out);
+}
+
+// out[i] = rng_unit(key, first + i) for i in [0, count)
+static inline void rng_fill_unit(unsigned long long key, unsigned long long first, long long count,
+                                 double *out) {
+#ifdef RNG_X86
+    switch (rng_isa()) {
+    case RNG_ISA_AVX512: rng_fill_unit_avx512(key, first, count, out); return;
+    case RNG_ISA_AVX2: rng_fill_unit_avx2(key, first, count, out); return;
+    default: break;
+    }
+#endif
+    rng_fill_unit_scalar(key, first, count, out);
+}
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <omp.h>
+
+// Uniform sampling during generation, exported as a binary column file.
+//
+// Every generating thread feeds its own stratum (its contiguous slice of
+// the stream) into a private reservoir. Stratum quotas are proportional to
+// the stratum sizes, so the union of the reservoirs is a stratified uniform
+// sample of the whole stream, and no thread ever touches shared state.
+// Reservoirs use Li's Algorithm L: after the reservoir fills, the index of
+// the next accepted value is drawn directly (geometric skips), so the
+// per-value cost is one compare.
+//
+// File layout (little-endian), readable zero-copy with numpy.memmap:
+//   0  char[8]  magic "P5SAMPLE"
+//   8  u32      version (1)
+//   12 u32      header size in bytes (payload offset, 64)
+//   16 char[8]  numpy dtype of the payload, "<u8"
+//   24 u64      number of sampled values
+//   32 u64      population size (values seen)
+//   40 u64      sampler seed
+//   48 u32      number of strata
+//   52 u32      flags (bit 0: stratified)
+//   56 u64      reserved
+//   64 u64[n]   payload
+
+#define SAMPLE_MAGIC "P5SAMPLE"
+#define SAMPLE_VERSION 1
+#define SAMPLE_HEADER_SIZE 64
+#define SAMPLE_FLAG_STRATIFIED 1
+
+typedef struct {
+    unsigned long long *items;
+    long long capacity;
+    long long size;
+    long long seen;
+    long long next;      // index of the next value to accept once full
+    double w;
+    unsigned long long rng;
+} Reservoir;
+
+typedef struct {
+    Reservoir *strata;
+    int num_strata;
+    long long sample_size;
+    long long population;
+    unsigned long long seed;
+} StratifiedSampler;
+
+static inline double reservoir_uniform(Reservoir *r) {
+    // splitmix64 step, mapped to (0, 1)
+    unsigned long long z = (r->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static void reservoir_skip(Reservoir *r) {
+    r->next += (long long)floor(log(reservoir_uniform(r)) / log(1.0 - r->w)) + 1;
+}
+
+static int reservoir_init(Reservoir *r, long long capacity, unsigned long long seed) {
+    memset(r, 0, sizeof(*r));
+    r->capacity = capacity;
+    r->rng = seed;
+    if (capacity > 0) {
+        r->items = malloc(capacity * sizeof(unsigned long long));
+        if (!r->items) return -1;
+    }
+    return 0;
+}
+
+static void reservoir_free(Reservoir *r) {
+    free(r->items);
+    r->items = NULL;
+}
+
+static inline void reservoir_offer(Reservoir *r, unsigned long long value) {
+    long long index = r->seen++;
+    if (r->size < r->capacity) {
+        r->items[r->size++] = value;
+        if (r->size == r->capacity) {
+            r->w = exp(log(reservoir_uniform(r)) / r->capacity);
+            r->next = r->seen - 1;
+            reservoir_skip(r);
+        }
+    } else if (index == r->next && r->capacity > 0) {
+        long long slot = (long long)(reservoir_uniform(r) * r->capacity);
+        r->items[slot] = value;
+        r->w *= exp(log(reservoir_uniform(r)) / r->capacity);
+        reservoir_skip(r);
+    }
+}
+
+// Splits sample_size over the strata in proportion to their sizes
+// (largest remainder), one reservoir each. On failure the sampler can
+// still be passed to sampler_free.
+static int sampler_init(StratifiedSampler *s, long long sample_size,
+                        const long long *stratum_sizes, int num_strata, unsigned long long seed) {
+    memset(s, 0, sizeof(*s));
+    s->strata = calloc(num_strata, sizeof(Reservoir));
+    if (!s->strata) return -1;
+    s->num_strata = num_strata;
+    s->seed = seed;
+
+    for (int t = 0; t < num_strata; t++) s->population += stratum_sizes[t];
+    if (sample_size > s->population) sample_size = s->population;
+    s->sample_size = sample_size;
+
+    long long assigned = 0;
+    long long *quota = malloc(num_strata * sizeof(long long));
+    double *remainder = malloc(num_strata * sizeof(double));
+    if (!quota || !remainder) {
+        free(quota);
+        free(remainder);
+        free(s->strata);
+        memset(s, 0, sizeof(*s));
+        return -1;
+    }
+    for (int t = 0; t < num_strata; t++) {
+        double exact = s->population ? (double)sample_size * stratum_sizes[t] / s->population : 0.0;
+        quota[t] = (long long)exact;
+        remainder[t] = exact - quota[t];
+        assigned += quota[t];
+    }
+    while (assigned < sample_size) {
+        int best = 0;
+        for (int t = 1; t < num_strata; t++) {
+            if (remainder[t] > remainder[best]) best = t;
+        }
+        quota[best]++;
+        remainder[best] = -1.0;
+        assigned++;
+    }
+
+    int status = 0;
+    for (int t = 0; t < num_strata; t++) {
+        if (reservoir_init(&s->strata[t], quota[t], seed + 0x632BE59BD9B4E019ULL * (t + 1)) != 0) {
+            status = -1;
+        }
+    }
+    free(quota);
+    free(remainder);
+    return status;
+}
+
+static void sampler_free(StratifiedSampler *s) {
+    for (int t = 0; t < s->num_strata; t++) reservoir_free(&s->strata[t]);
+    free(s->strata);
+    s->strata = NULL;
+}
+
+static inline unsigned long long sample_to_le64(unsigned long long v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(v);
+#else
+    return v;
+#endif
+}
+
+static void sample_put_le(unsigned char *dst, unsigned long long value, int bytes) {
+    for (int i = 0; i < bytes; i++) dst[i] = (unsigned char)(value >> (8 * i));
+}
+
+// Writes the sample through a shared mapping of the output file; strata are
+// copied into their slots of the payload in parallel. Returns 0 on success.
+static int sampler_write(const StratifiedSampler *s, const char *filename, int num_threads) {
+    long long count = 0;
+    for (int t = 0; t < s->num_strata; t++) count += s->strata[t].size;
+    size_t bytes = SAMPLE_HEADER_SIZE + count * sizeof(unsigned long long);
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        return -1;
+    }
+    unsigned char *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    unsigned char header[SAMPLE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, SAMPLE_MAGIC, 8);
+    sample_put_le(header + 8, SAMPLE_VERSION, 4);
+    sample_put_le(header + 12, SAMPLE_HEADER_SIZE, 4);
+    memcpy(header + 16, "<u8", 3);
+    sample_put_le(header + 24, count, 8);
+    sample_put_le(header + 32, s->population, 8);
+    sample_put_le(header + 40, s->seed, 8);
+    sample_put_le(header + 48, s->num_strata, 4);
+    sample_put_le(header + 52, SAMPLE_FLAG_STRATIFIED, 4);
+    memcpy(map, header, SAMPLE_HEADER_SIZE);
+
+    unsigned long long *payload = (unsigned long long *)(map + SAMPLE_HEADER_SIZE);
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (int t = 0; t < s->num_strata; t++) {
+        long long offset = 0;
+        for (int u = 0; u < t; u++) offset += s->strata[u].size;
+        const Reservoir *r = &s->strata[t];
+        for (long long i = 0; i < r->size; i++) payload[offset + i] = sample_to_le64(r->items[i]);
+    }
+
+    int status = munmap(map, bytes);
+    if (close(fd) != 0) status = -1;
+    return status;
+}
+
+#endif
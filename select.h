@@ -0,0 +1,272 @@
+#ifndef SELECT_H
+#define SELECT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "radix_sort.h"
+#include "chunk.h"
+
+// Exact multi-quantile selection for 64-bit unsigned keys without sorting.
+//
+// Histogram-refine selection: every requested rank starts in the window
+// [min, max]. One parallel pass histograms the window into SELECT_BUCKETS
+// buckets, which pins each rank to a single bucket. If that bucket is small
+// enough its keys are gathered (second pass) and the rank is resolved in
+// the gathered buffer; otherwise the bucket becomes the window for another
+// histogram pass. Each pass narrows the window by SELECT_BITS bits, so the
+// work is a few bandwidth-bound scans, expected O(n) overall. For 360M
+// uniform keys every rank is resolved after one histogram and one gather.
+//
+// The input is only read, never permuted, so callers that need the data
+// in its original order can keep using it afterwards. It is scanned
+// through a ChunkReader (chunk.h), so encoded columns can be searched
+// without decoding them in full; select_ranks_u64() wraps a plain array.
+
+#define SELECT_BITS 12
+#define SELECT_BUCKETS (1 << SELECT_BITS)
+#define SELECT_GATHER_MAX (1LL << 22)
+
+typedef struct {
+    unsigned long long lo;   // window bounds, inclusive
+    unsigned long long hi;
+    int shift;               // bucket = (key - lo) >> shift
+} SelectWindow;
+
+typedef struct {
+    int window;              // index into the current round's window list
+    long long rank;          // rank within the window
+    int done;
+    unsigned long long value;
+} SelectTarget;
+
+static int select_shift_for(unsigned long long span) {
+    int shift = 0;
+    while (shift < 64 && (span >> shift) >= SELECT_BUCKETS) shift++;
+    return shift;
+}
+
+static int select_window_index(SelectWindow *windows, int *num_windows,
+                               unsigned long long lo, unsigned long long hi) {
+    for (int w = 0; w < *num_windows; w++) {
+        if (windows[w].lo == lo && windows[w].hi == hi) return w;
+    }
+    windows[*num_windows].lo = lo;
+    windows[*num_windows].hi = hi;
+    windows[*num_windows].shift = select_shift_for(hi - lo);
+    return (*num_windows)++;
+}
+
+// Copies every key inside each window into its own buffer. counts[p][w] is
+// how many keys of partition p (a static range of chunks) fall in window w
+// (known from the histogram pass), which gives every partition a private
+// write range.
+static void select_gather(const ChunkReader *in, int parts,
+                          const SelectWindow *windows, int num_windows,
+                          long long *counts, unsigned long long **buffers,
+                          int num_threads) {
+    long long chunks = chunk_count(in);
+
+    // Turn per-partition counts into per-partition write offsets
+    for (int w = 0; w < num_windows; w++) {
+        long long running = 0;
+        for (int p = 0; p < parts; p++) {
+            long long c = counts[p * num_windows + w];
+            counts[p * num_windows + w] = running;
+            running += c;
+        }
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        unsigned long long buffer[CHUNK_MAX];
+        for (int p = omp_get_thread_num(); p < parts; p += omp_get_num_threads()) {
+            long long *offset = &counts[p * num_windows];
+
+            for (long long c = chunks * p / parts; c < chunks * (p + 1) / parts; c++) {
+                long long len = chunk_len(in, c);
+                const unsigned long long *keys = in->read(in->ctx, c, buffer);
+                for (long long i = 0; i < len; i++) {
+                    unsigned long long key = keys[i];
+                    for (int w = 0; w < num_windows; w++) {
+                        if (key - windows[w].lo <= windows[w].hi - windows[w].lo) {
+                            buffers[w][offset[w]++] = key;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Finds the keys of rank ranks[0..k) (0-based, in ascending order of the
+// keys) and stores them in out[0..k). min/max must bound every key.
+// Returns 0 on success, -1 on bad ranks or allocation failure.
+static int select_ranks_chunks(const ChunkReader *in,
+                               unsigned long long min, unsigned long long max,
+                               const long long *ranks, unsigned long long *out, int k,
+                               int num_threads) {
+    long long n = in->n;
+    long long chunks = chunk_count(in);
+    if (k <= 0) return 0;
+    for (int t = 0; t < k; t++) {
+        if (ranks[t] < 0 || ranks[t] >= n) return -1;
+    }
+
+    int parts = num_threads;
+    SelectTarget *targets = calloc(k, sizeof(SelectTarget));
+    SelectWindow *windows = malloc(k * sizeof(SelectWindow));
+    SelectWindow *next_windows = malloc(k * sizeof(SelectWindow));
+    SelectWindow *gather_windows = malloc(k * sizeof(SelectWindow));
+    int *gather_of = malloc(k * sizeof(int));
+    long long *gather_counts = malloc((size_t)parts * k * sizeof(long long));
+    long long *hist = malloc((size_t)parts * k * SELECT_BUCKETS * sizeof(long long));
+    if (!targets || !windows || !next_windows || !gather_windows || !gather_of ||
+        !gather_counts || !hist) {
+        free(targets); free(windows); free(next_windows); free(gather_windows);
+        free(gather_of); free(gather_counts); free(hist);
+        return -1;
+    }
+
+    int num_windows = 0;
+    for (int t = 0; t < k; t++) {
+        targets[t].window = select_window_index(windows, &num_windows, min, max);
+        targets[t].rank = ranks[t];
+    }
+
+    int status = 0;
+    int pending = k;
+    while (pending > 0) {
+        // Histogram pass over every window that still has unresolved ranks
+        size_t hist_size = (size_t)num_windows * SELECT_BUCKETS;
+        memset(hist, 0, parts * hist_size * sizeof(long long));
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            unsigned long long buffer[CHUNK_MAX];
+            for (int p = omp_get_thread_num(); p < parts; p += omp_get_num_threads()) {
+                long long *h = &hist[p * hist_size];
+
+                for (long long c = chunks * p / parts; c < chunks * (p + 1) / parts; c++) {
+                    long long len = chunk_len(in, c);
+                    const unsigned long long *keys = in->read(in->ctx, c, buffer);
+                    for (long long i = 0; i < len; i++) {
+                        unsigned long long key = keys[i];
+                        for (int w = 0; w < num_windows; w++) {
+                            unsigned long long d = key - windows[w].lo;
+                            if (d <= windows[w].hi - windows[w].lo) {
+                                h[w * SELECT_BUCKETS + (d >> windows[w].shift)]++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Locate each rank's bucket and decide: resolved, gather or refine
+        int num_next = 0, num_gather = 0;
+        for (int t = 0; t < k; t++) {
+            if (targets[t].done) continue;
+            SelectWindow *win = &windows[targets[t].window];
+            long long before = 0;
+            int b;
+            long long count = 0;
+            for (b = 0; b < SELECT_BUCKETS; b++) {
+                count = 0;
+                for (int p = 0; p < parts; p++) {
+                    count += hist[p * hist_size + targets[t].window * SELECT_BUCKETS + b];
+                }
+                if (before + count > targets[t].rank) break;
+                before += count;
+            }
+
+            unsigned long long lo = win->lo + ((unsigned long long)b << win->shift);
+            unsigned long long hi = lo + ((1ULL << win->shift) - 1);
+            if (hi > win->hi || hi < lo) hi = win->hi;  // last bucket / overflow
+            targets[t].rank -= before;
+
+            if (lo == hi) {
+                targets[t].done = 1;
+                targets[t].value = lo;
+                pending--;
+            } else if (count <= SELECT_GATHER_MAX) {
+                int g = select_window_index(gather_windows, &num_gather, lo, hi);
+                gather_of[t] = g;
+                for (int p = 0; p < parts; p++) {
+                    gather_counts[p * k + g] =
+                        hist[p * hist_size + targets[t].window * SELECT_BUCKETS + b];
+                }
+                targets[t].window = -1;
+            } else {
+                targets[t].window = select_window_index(next_windows, &num_next, lo, hi);
+            }
+        }
+
+        if (num_gather > 0) {
+            // gather_counts was filled with stride k; compact it to stride num_gather
+            long long *counts = malloc((size_t)parts * num_gather * sizeof(long long));
+            unsigned long long **buffers = calloc(num_gather, sizeof(unsigned long long *));
+            long long *sizes = calloc(num_gather, sizeof(long long));
+            int ok = counts && buffers && sizes;
+            for (int p = 0; ok && p < parts; p++) {
+                for (int g = 0; g < num_gather; g++) {
+                    counts[p * num_gather + g] = gather_counts[p * k + g];
+                    sizes[g] += gather_counts[p * k + g];
+                }
+            }
+            for (int g = 0; ok && g < num_gather; g++) {
+                buffers[g] = malloc((sizes[g] > 0 ? sizes[g] : 1) * sizeof(unsigned long long));
+                if (!buffers[g]) ok = 0;
+            }
+
+            if (ok) {
+                select_gather(in, parts, gather_windows, num_gather, counts, buffers, num_threads);
+                for (int g = 0; g < num_gather; g++) {
+                    if (radix_sort_u64(buffers[g], NULL, sizes[g], num_threads) != 0) {
+                        qsort(buffers[g], sizes[g], sizeof(unsigned long long), radix_compare_u64);
+                    }
+                }
+                for (int t = 0; t < k; t++) {
+                    if (!targets[t].done && targets[t].window == -1) {
+                        targets[t].value = buffers[gather_of[t]][targets[t].rank];
+                        targets[t].done = 1;
+                        pending--;
+                    }
+                }
+            } else {
+                status = -1;
+            }
+
+            if (buffers) {
+                for (int g = 0; g < num_gather; g++) free(buffers[g]);
+            }
+            free(buffers);
+            free(counts);
+            free(sizes);
+            if (status != 0) break;
+        }
+
+        SelectWindow *tmp = windows;
+        windows = next_windows;
+        next_windows = tmp;
+        num_windows = num_next;
+    }
+
+    if (status == 0) {
+        for (int t = 0; t < k; t++) out[t] = targets[t].value;
+    }
+
+    free(targets); free(windows); free(next_windows); free(gather_windows);
+    free(gather_of); free(gather_counts); free(hist);
+    return status;
+}
+
+static int select_ranks_u64(const unsigned long long *data, long long n,
+                            unsigned long long min, unsigned long long max,
+                            const long long *ranks, unsigned long long *out, int k,
+                            int num_threads) {
+    ChunkReader in = chunk_array(data, n);
+    return select_ranks_chunks(&in, min, max, ranks, out, k, num_threads);
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef TERNARY_H
+#define TERNARY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TERNARY_X86 1
+#endif
+
+// Bit-packed vectors over {-1, 0, 1}: 2 bits per element in two bit-planes,
+// "nonzero" and "sign" (set for -1, only ever set where nonzero is).
+//
+// Elements are stored in groups of 512. A group is one cache line of 8
+// nonzero words followed by one cache line of 8 sign words, so a dot
+// product streams two lines per 512 elements of each vector and an AVX-512
+// register holds exactly one plane of a group.
+//
+// For x, y in {-1, 0, 1}, x * y is 0 unless both are nonzero, and then it
+// is -1 exactly when the signs differ. Per word:
+//     both = nz_a & nz_b
+//     neg  = (sign_a ^ sign_b) & both
+//     dot += popcount(both) - 2 * popcount(neg)
+// which is a few logic ops and two popcounts per 64 elements, so the
+// kernels run at memory bandwidth.
+
+#define TERNARY_GROUP 512                     // elements per group
+#define TERNARY_GROUP_WORDS 8                 // words per plane per group
+
+typedef struct {
+    long long n;
+    long long groups;
+    unsigned long long *planes;  // per group: 8 nonzero words, then 8 sign words
+} TernaryVector;
+
+typedef enum {
+    TERNARY_GENERIC,     // compiler popcount (no hardware instruction assumed)
+    TERNARY_POPCNT,      // scalar POPCNT
+    TERNARY_AVX2,        // nibble lookup (PSHUFB) + PSADBW
+    TERNARY_VPOPCNTDQ,   // AVX-512 VPOPCNTQ
+    TERNARY_KERNEL_COUNT
+} TernaryKernel;
+
+static const char *const ternary_kernel_names[TERNARY_KERNEL_COUNT] = {
+    "generic", "popcnt", "avx2", "avx512-vpopcntdq"
+};
+
+static inline size_t ternary_bytes(long long n) {
+    return (size_t)((n + TERNARY_GROUP - 1) / TERNARY_GROUP) * 2 * TERNARY_GROUP_WORDS *
+           sizeof(unsigned long long);
+}
+
+// Returns 0 on success, -1 if the allocation fails
+static inline int ternary_alloc(TernaryVector *v, long long n) {
+    v->n = n;
+    v->groups = (n + TERNARY_GROUP - 1) / TERNARY_GROUP;
+    v->planes = aligned_alloc(64, ternary_bytes(n) ? ternary_bytes(n) : 64);
+    return v->planes ? 0 : -1;
+}
+
+static inline void ternary_free(TernaryVector *v) {
+    free(v->planes);
+    v->planes = NULL;
+}
+
+// Packs values[0..count) (each -1, 0 or 1) into group g; count < 512 only
+// for the last group, whose unused elements are zero.
+static inline void ternary_pack_group(TernaryVector *v, long long g, const signed char *values, int count) {
+    unsigned long long *nz = &v->planes[g * 2 * TERNARY_GROUP_WORDS];
+    unsigned long long *sign = nz + TERNARY_GROUP_WORDS;
+    for (int w = 0; w < TERNARY_GROUP_WORDS; w++) {
+        unsigned long long nz_bits = 0, sign_bits = 0;
+        int base = w * 64;
+        for (int b = 0; b < 64 && base + b < count; b++) {
+            nz_bits |= (unsigned long long)(values[base + b] != 0) << b;
+            sign_bits |= (unsigned long long)(values[base + b] < 0) << b;
+        }
+        nz[w] = nz_bits;
+        sign[w] = sign_bits;
+    }
+}
+
+static inline int ternary_get(const TernaryVector *v, long long i) {
+    const unsigned long long *nz = &v->planes[(i / TERNARY_GROUP) * 2 * TERNARY_GROUP_WORDS];
+    int w = (int)(i % TERNARY_GROUP) / 64, b = (int)(i % 64);
+    if (!((nz[w] >> b) & 1)) return 0;
+    return ((nz[TERNARY_GROUP_WORDS + w] >> b) & 1) ? -1 : 1;
+}
+
+// ---- kernels over groups [g0, g1); each returns sum of x * y ----
+
+static inline long long ternary_dot_generic(const unsigned long long *a, const unsigned long long *b,
+                                            long long g0, long long g1) {
+    long long both = 0, neg = 0;
+    for (long long g = g0; g < g1; g++) {
+        const unsigned long long *pa = &a[g * 2 * TERNARY_GROUP_WORDS];
+        const unsigned long long *pb = &b[g * 2 * TERNARY_GROUP_WORDS];
+        for (int w = 0; w < TERNARY_GROUP_WORDS; w++) {
+            unsigned long long nz = pa[w] & pb[w];
+            both += __builtin_popcountll(nz);
+            neg += __builtin_popcountll((pa[TERNARY_GROUP_WORDS + w] ^ pb[TERNARY_GROUP_WORDS + w]) & nz);
+        }
+    }
+    return both - 2 * neg;
+}
+
+#ifdef TERNARY_X86
+
+__attribute__((target("popcnt")))
+static inline long long ternary_dot_popcnt(const unsigned long long *a, const unsigned long long *b,
+                                           long long g0, long long g1) {
+    long long both = 0, neg = 0;
+    for (long long g = g0; g < g1; g++) {
+        const unsigned long long *pa = &a[g * 2 * TERNARY_GROUP_WORDS];
+        const unsigned long long *pb = &b[g * 2 * TERNARY_GROUP_WORDS];
+        for (int w = 0; w < TERNARY_GROUP_WORDS; w++) {
+            unsigned long long nz = pa[w] & pb[w];
+            both += __builtin_popcountll(nz);
+            neg += __builtin_popcountll((pa[TERNARY_GROUP_WORDS + w] ^ pb[TERNARY_GROUP_WORDS + w]) & nz);
+        }
+    }
+    return both - 2 * neg;
+}
+
+// Per-byte popcount by nibble lookup, summed into 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i ternary_popcount_avx2(__m256i v) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                                     _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline long long ternary_dot_avx2(const unsigned long long *a, const unsigned long long *b,
+                                         long long g0, long long g1) {
+    __m256i both = _mm256_setzero_si256(), neg = _mm256_setzero_si256();
+    for (long long g = g0; g < g1; g++) {
+        const __m256i *pa = (const __m256i *)&a[g * 2 * TERNARY_GROUP_WORDS];
+        const __m256i *pb = (const __m256i *)&b[g * 2 * TERNARY_GROUP_WORDS];
+        for (int h = 0; h < 2; h++) {
+            __m256i nz = _mm256_and_si256(_mm256_load_si256(pa + h), _mm256_load_si256(pb + h));
+            __m256i diff = _mm256_xor_si256(_mm256_load_si256(pa + 2 + h), _mm256_load_si256(pb + 2 + h));
+            both = _mm256_add_epi64(both, ternary_popcount_avx2(nz));
+            neg = _mm256_add_epi64(neg, ternary_popcount_avx2(_mm256_and_si256(diff, nz)));
+        }
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_sub_epi64(both, _mm256_slli_epi64(neg, 1)));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static inline long long ternary_dot_vpopcntdq(const unsigned long long *a, const unsigned long long *b,
+                                              long long g0, long long g1) {
+    __m512i both = _mm512_setzero_si512(), neg = _mm512_setzero_si512();
+    for (long long g = g0; g < g1; g++) {
+        const unsigned long long *pa = &a[g * 2 * TERNARY_GROUP_WORDS];
+        const unsigned long long *pb = &b[g * 2 * TERNARY_GROUP_WORDS];
+        __m512i nz = _mm512_and_si512(_mm512_load_si512(pa), _mm512_load_si512(pb));
+        __m512i diff = _mm512_xor_si512(_mm512_load_si512(pa + TERNARY_GROUP_WORDS),
+                                        _mm512_load_si512(pb + TERNARY_GROUP_WORDS));
+        both = _mm512_add_epi64(both, _mm512_popcnt_epi64(nz));
+        neg = _mm512_add_epi64(neg, _mm512_popcnt_epi64(_mm512_and_si512(diff, nz)));
+    }
+    return _mm512_reduce_add_epi64(_mm512_sub_epi64(both, _mm512_slli_epi64(neg, 1)));
+}
+
+#endif
+
+// Fastest kernel this CPU supports
+static inline TernaryKernel ternary_best_kernel(void) {
+#ifdef TERNARY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")) return TERNARY_VPOPCNTDQ;
+    if (__builtin_cpu_supports("avx2")) return TERNARY_AVX2;
+    if (__builtin_cpu_supports("popcnt")) return TERNARY_POPCNT;
+#endif
+    return TERNARY_GENERIC;
+}
+
+static inline long long ternary_dot_range(const TernaryVector *a, const TernaryVector *b,
+                                          long long g0, long long g1, TernaryKernel kernel) {
+#ifdef TERNARY_X86
+    switch (kernel) {
+    case TERNARY_VPOPCNTDQ: return ternary_dot_vpopcntdq(a->planes, b->planes, g0, g1);
+    case TERNARY_AVX2: return ternary_dot_avx2(a->planes, b->planes, g0, g1);
+    case TERNARY_POPCNT: return ternary_dot_popcnt(a->planes, b->planes, g0, g1);
+    default: break;
+    }
+#endif
+    return ternary_dot_generic(a->planes, b->planes, g0, g1);
+}
+
+// Dot product of two vectors of the same length, split over threads by
+// static group ranges
+static inline long long ternary_dot(const TernaryVector *a, const TernaryVector *b,
+                                    TernaryKernel kernel, int num_threads) {
+    long long dot = 0;
+    #pragma omp parallel num_threads(num_threads) reduction(+:dot)
+    {
+        int tid = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+        long long g0 = a->groups * tid / nthreads;
+        long long g1 = a->groups * (tid + 1) / nthreads;
+        dot += ternary_dot_range(a, b, g0, g1, kernel);
+    }
+    return dot;
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+
+// Machine topology from sysfs and thread placement policies.
+//
+// topo_get() reads, once, every CPU this process may run on (the online
+// list intersected with the affinity mask): its package, core and SMT index
+// from cpuN/topology, and its NUMA node from node/nodeN/cpulist. It also
+// reads the cache sizes of cpu0. Without sysfs every CPU is its own core
+// on node 0.
+//
+// A policy turns that into an ordered CPU list, and thread t of a team is
+// pinned to entry t (wrapping around when the team is larger):
+//   compact   fill all SMT siblings of a core, then the next core, node by node
+//   scatter   one thread per core, alternating nodes, before any SMT sibling
+//   physical  only the first hardware thread of each core, in scatter order
+//   none      no pinning (the OpenMP runtime and OS decide)
+// The policy comes from $TOPO_POLICY and defaults to scatter.
+//
+// topo_set_num_threads() is the drop-in for omp_set_num_threads(): it also
+// pins the team, so later parallel regions of that size (the runtime keeps
+// its thread pool) run on the chosen CPUs. topo_first_touch() faults a
+// fresh buffer in with the same static slices the compute loops use
+// (n * tid / nthreads), so on NUMA machines each page lands on the node of
+// the thread that will work on it.
+
+#define TOPO_MAX_CPUS 1024
+#define TOPO_MAX_NODES 64
+#define TOPO_POLICY_ENV "TOPO_POLICY"
+
+typedef enum { TOPO_NONE, TOPO_COMPACT, TOPO_SCATTER, TOPO_PHYSICAL, TOPO_POLICY_COUNT } TopoPolicy;
+
+static const char *const topo_policy_names[TOPO_POLICY_COUNT] = {"none", "compact", "scatter", "physical"};
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;        // unique over packages
+    int smt;         // index among the core's hardware threads
+    int node;
+} TopoCpu;
+
+typedef struct {
+    int num_cpus, num_cores, num_packages, num_nodes;
+    TopoCpu cpus[TOPO_MAX_CPUS];
+    int l1d_kb, l2_kb, l3_kb;
+    TopoPolicy policy;
+    int order[TOPO_MAX_CPUS];   // policy order of indices into cpus
+    int order_len;
+} Topology;
+
+static inline int topo_policy_parse(const char *name) {
+    for (int p = 0; p < TOPO_POLICY_COUNT; p++) {
+        if (strcmp(name, topo_policy_names[p]) == 0) return p;
+    }
+    return -1;
+}
+
+// Reads a small sysfs file into buf; returns 0 on success
+static inline int topo_read(const char *path, char *buf, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    size_t len = fread(buf, 1, size - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    return len > 0 ? 0 : -1;
+}
+
+static inline int topo_read_int(const char *path, int fallback) {
+    char buf[64];
+    return topo_read(path, buf, sizeof(buf)) == 0 ? atoi(buf) : fallback;
+}
+
+// Parses a cpulist such as "0-3,8,10-11" into set
+static inline void topo_parse_list(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p) break;
+        long hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) CPU_SET(c, set);
+        while (*p == ',' || *p == '\n' || *p == ' ') p++;
+    }
+}
+
+// Cache size in KB of the given level (data or unified caches only)
+static inline int topo_cache_kb(int level) {
+    for (int index = 0; index < 8; index++) {
+        char path[128], type[32], size[32];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if (topo_read_int(path, -1) != level) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if (topo_read(path, type, sizeof(type)) != 0 || strncmp(type, "Instruction", 11) == 0) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if (topo_read(path, size, sizeof(size)) != 0) continue;
+        int kb = atoi(size);
+        if (strchr(size, 'M')) kb *= 1024;
+        return kb;
+    }
+    return 0;
+}
+
+// CPU model string ("model name" in /proc/cpuinfo), "unknown" without it
+static inline void topo_cpu_model(char *model, size_t size) {
+    snprintf(model, size, "unknown");
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    if (!fp) return;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon) {
+            colon++;
+            while (*colon == ' ' || *colon == '\t') colon++;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(model, size, "%s", colon);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+static int topo_compare_compact(const void *a, const void *b) {
+    const TopoCpu *x = a, *y = b;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->core != y->core) return x->core - y->core;
+    if (x->smt != y->smt) return x->smt - y->smt;
+    return x->cpu - y->cpu;
+}
+
+// Builds the CPU order of the policy into t->order
+static void topo_build_order(Topology *t) {
+    TopoCpu sorted[TOPO_MAX_CPUS];
+    memcpy(sorted, t->cpus, t->num_cpus * sizeof(TopoCpu));
+    qsort(sorted, t->num_cpus, sizeof(TopoCpu), topo_compare_compact);
+
+    // Position of each CPU within its node in compact order, per SMT index
+    int rank[TOPO_MAX_CPUS];
+    for (int i = 0; i < t->num_cpus; i++) {
+        rank[i] = 0;
+        for (int j = 0; j < i; j++) {
+            if (sorted[j].node == sorted[i].node && sorted[j].smt == sorted[i].smt) rank[i]++;
+        }
+    }
+
+    t->order_len = 0;
+    if (t->policy == TOPO_COMPACT || t->policy == TOPO_NONE) {
+        for (int i = 0; i < t->num_cpus; i++) t->order[t->order_len++] = i;
+    } else {
+        // Scatter: by SMT index, then core rank within the node, then node
+        int max_smt = (t->policy == TOPO_PHYSICAL) ? 0 : TOPO_MAX_CPUS;
+        for (int smt = 0; smt <= max_smt; smt++) {
+            int found = 0;
+            for (int r = 0; r < t->num_cpus; r++) {
+                for (int i = 0; i < t->num_cpus; i++) {
+                    if (sorted[i].smt == smt && rank[i] == r) {
+                        t->order[t->order_len++] = i;
+                        found = 1;
+                    }
+                }
+            }
+            if (!found) break;
+        }
+    }
+    for (int i = 0; i < t->order_len; i++) {
+        t->order[i] = sorted[t->order[i]].cpu;
+    }
+}
+
+static inline const TopoCpu *topo_cpu(const Topology *t, int cpu) {
+    for (int i = 0; i < t->num_cpus; i++) {
+        if (t->cpus[i].cpu == cpu) return &t->cpus[i];
+    }
+    return NULL;
+}
+
+static void topo_discover(Topology *t) {
+    memset(t, 0, sizeof(*t));
+    cpu_set_t online, allowed;
+    char buf[4096], path[128];
+    if (topo_read("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0) {
+        topo_parse_list(buf, &online);
+    } else {
+        CPU_ZERO(&online);
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long c = 0; c < n && c < CPU_SETSIZE; c++) CPU_SET(c, &online);
+    }
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) allowed = online;
+
+    int package_ids[TOPO_MAX_CPUS], core_ids[TOPO_MAX_CPUS];
+    for (int c = 0; c < CPU_SETSIZE && t->num_cpus < TOPO_MAX_CPUS; c++) {
+        if (!CPU_ISSET(c, &online) || !CPU_ISSET(c, &allowed)) continue;
+        TopoCpu *cpu = &t->cpus[t->num_cpus];
+        cpu->cpu = c;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        cpu->package = topo_read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        int core_id = topo_read_int(path, c);
+
+        // Unique core number across packages
+        cpu->core = -1;
+        for (int i = 0; i < t->num_cores; i++) {
+            if (package_ids[i] == cpu->package && core_ids[i] == core_id) cpu->core = i;
+        }
+        if (cpu->core < 0) {
+            package_ids[t->num_cores] = cpu->package;
+            core_ids[t->num_cores] = core_id;
+            cpu->core = t->num_cores++;
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+        cpu->smt = 0;
+        if (topo_read(path, buf, sizeof(buf)) == 0) {
+            cpu_set_t siblings;
+            topo_parse_list(buf, &siblings);
+            for (int s = 0; s < c; s++) cpu->smt += CPU_ISSET(s, &siblings) ? 1 : 0;
+        }
+        if (cpu->package + 1 > t->num_packages) t->num_packages = cpu->package + 1;
+        t->num_cpus++;
+    }
+
+    for (int node = 0; node < TOPO_MAX_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (topo_read(path, buf, sizeof(buf)) != 0) continue;  // node ids may be sparse
+        cpu_set_t members;
+        topo_parse_list(buf, &members);
+        for (int i = 0; i < t->num_cpus; i++) {
+            if (CPU_ISSET(t->cpus[i].cpu, &members)) t->cpus[i].node = node;
+        }
+        t->num_nodes = node + 1;
+    }
+    if (t->num_nodes == 0) t->num_nodes = 1;
+    if (t->num_packages == 0) t->num_packages = 1;
+
+    t->l1d_kb = topo_cache_kb(1);
+    t->l2_kb = topo_cache_kb(2);
+    t->l3_kb = topo_cache_kb(3);
+
+    const char *env = getenv(TOPO_POLICY_ENV);
+    int policy = env ? topo_policy_parse(env) : -1;
+    if (env && policy < 0) {
+        fprintf(stderr, "Unknown %s '%s', using scatter\n", TOPO_POLICY_ENV, env);
+    }
+    t->policy = (policy < 0) ? TOPO_SCATTER : (TopoPolicy)policy;
+    topo_build_order(t);
+}
+
+static inline Topology *topo_get(void) {
+    static Topology topology;
+    static int ready = 0;
+    if (!ready) {
+        topo_discover(&topology);
+        ready = 1;
+    }
+    return &topology;
+}
+
+// Changes the policy for later topo_set_num_threads() calls
+static inline void topo_set_policy(TopoPolicy policy) {
+    Topology *t = topo_get();
+    t->policy = policy;
+    topo_build_order(t);
+}
+
+// CPU that thread tid of a team is pinned to, or -1 without pinning
+static inline int topo_thread_cpu(int tid) {
+    const Topology *t = topo_get();
+    if (t->policy == TOPO_NONE || t->order_len == 0) return -1;
+    return t->order[tid % t->order_len];
+}
+
+// omp_set_num_threads() plus pinning of the team to policy entries
+// first .. first + num_threads - 1, so cooperating processes can each take
+// their own share of the CPU order
+static inline void topo_set_team(int num_threads, int first) {
+    omp_set_num_threads(num_threads);
+    if (topo_get()->policy == TOPO_NONE) return;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(topo_thread_cpu(first + omp_get_thread_num()), &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+}
+
+// omp_set_num_threads() plus pinning of the team by the current policy
+static inline void topo_set_num_threads(int num_threads) {
+    topo_set_team(num_threads, 0);
+}
+
+// Pins the calling thread to cpu for a while, saving its mask; returns 1
+// if it was pinned, in which case topo_unpin() restores the mask. A cpu
+// of -1 leaves the thread alone.
+static inline int topo_pin(int cpu, cpu_set_t *saved) {
+    if (cpu < 0 || sched_getaffinity(0, sizeof(*saved), saved) != 0) return 0;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+static inline void topo_unpin(int pinned, const cpu_set_t *saved) {
+    if (pinned) sched_setaffinity(0, sizeof(*saved), saved);
+}
+
+// CPU for thread tid of a team spread over every CPU whatever the policy
+// (its order covers them all, even for "none"), or -1 if none are known
+static inline int topo_spread_cpu(int tid) {
+    const Topology *t = topo_get();
+    return t->order_len > 0 ? t->order[tid % t->order_len] : -1;
+}
+
+// Touches buffer pages from the thread that owns each static slice. Each
+// thread is pinned to its policy CPU while it touches: pool threads the
+// runtime creates for a team larger than the current one inherit the
+// creator's (possibly single-CPU) mask. Masks are restored afterwards, so
+// the caller's team keeps its placement.
+static inline void topo_first_touch(void *buffer, size_t bytes, int num_threads) {
+    const size_t page = 4096;
+    size_t pages = (bytes + page - 1) / page;
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int tid = omp_get_thread_num();
+        int nthreads = omp_get_num_threads();
+        cpu_set_t saved;
+        int pinned = topo_pin(topo_thread_cpu(tid), &saved);
+        size_t begin = pages * tid / nthreads * page;
+        size_t end = pages * (tid + 1) / nthreads * page;
+        if (end > bytes) end = bytes;
+        if (begin < end) memset((char *)buffer + begin, 0, end - begin);
+        topo_unpin(pinned, &saved);
+    }
+}
+
+// Placement of a team of num_threads, e.g. "scatter:4c/4t/1n" (cores, hardware
+// threads and NUMA nodes used), "+oversub" when threads share a CPU
+static inline void topo_describe(int num_threads, char *out, size_t size) {
+    const Topology *t = topo_get();
+    if (t->policy == TOPO_NONE) {
+        snprintf(out, size, "none:%dt", num_threads);
+        return;
+    }
+    int cores = 0, nodes = 0, cpus = 0;
+    char core_used[TOPO_MAX_CPUS] = {0}, node_used[TOPO_MAX_CPUS] = {0}, cpu_used[TOPO_MAX_CPUS] = {0};
+    for (int tid = 0; tid < num_threads; tid++) {
+        int c = topo_thread_cpu(tid);
+        const TopoCpu *cpu = topo_cpu(t, c);
+        if (!cpu) continue;
+        int index = (int)(cpu - t->cpus);
+        if (!cpu_used[index]) { cpu_used[index] = 1; cpus++; }
+        if (!core_used[cpu->core]) { core_used[cpu->core] = 1; cores++; }
+        if (!node_used[cpu->node]) { node_used[cpu->node] = 1; nodes++; }
+    }
+    snprintf(out, size, "%s:%dc/%dt/%dn%s", topo_policy_names[t->policy], cores, cpus, nodes,
+             num_threads > cpus ? "+oversub" : "");
+}
+
+// One-line machine summary for benchmark headers
+static inline void topo_print_summary(void) {
+    const Topology *t = topo_get();
+    printf("Topology: %d CPU(s), %d core(s), %d package(s), %d NUMA node(s); L1d %dK, L2 %dK, L3 %dK; "
+           "placement %s\n", t->num_cpus, t->num_cores, t->num_packages, t->num_nodes,
+           t->l1d_kb, t->l2_kb, t->l3_kb, topo_policy_names[t->policy]);
+}
+
+#endif